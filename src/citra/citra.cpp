@@ -15,6 +15,9 @@
 #include "core/core.h"
 #include "core/loader/loader.h"
 
+#include "video_core/video_core.h"
+#include "video_core/renderer_opengl/renderer_opengl.h"
+
 #include "citra/config.h"
 #include "citra/emu_window/emu_window_glfw.h"
 
@@ -39,6 +42,7 @@ int __cdecl main(int argc, char **argv) {
     std::string boot_filename = argv[1];
     EmuWindow_GLFW* emu_window = new EmuWindow_GLFW;
 
+    VideoCore::g_create_renderer = []() -> RendererBase* { return new RendererOpenGL(); };
     System::Init(emu_window);
 
     Loader::ResultStatus load_result = Loader::LoadFile(boot_filename);
@@ -59,6 +59,15 @@ void Config::ReadValues() {
     // Core
     Settings::values.gpu_refresh_rate = glfw_config->GetInteger("Core", "gpu_refresh_rate", 30);
     Settings::values.frame_skip = glfw_config->GetInteger("Core", "frame_skip", 0);
+    Settings::values.translation_cache_size = glfw_config->GetInteger("Core", "translation_cache_size", 32);
+    Settings::values.use_cpu_jit = glfw_config->GetBoolean("Core", "use_cpu_jit", false);
+    Settings::values.skip_idle_loops = glfw_config->GetBoolean("Core", "skip_idle_loops", true);
+    Settings::values.vertex_cache_size = glfw_config->GetInteger("Core", "vertex_cache_size", 32);
+    Settings::values.vertex_cache_policy = glfw_config->GetInteger("Core", "vertex_cache_policy", 0);
+    Settings::values.gpu_worker_threads = glfw_config->GetInteger("Core", "gpu_worker_threads", 0);
+    Settings::values.use_gpu_thread = glfw_config->GetBoolean("Core", "use_gpu_thread", true);
+    Settings::values.use_shader_jit = glfw_config->GetBoolean("Core", "use_shader_jit", true);
+    Settings::values.use_simd_rasterizer = glfw_config->GetBoolean("Core", "use_simd_rasterizer", true);
 
     // Data Storage
     Settings::values.use_virtual_sd = glfw_config->GetBoolean("Data Storage", "use_virtual_sd", true);
@@ -29,6 +29,15 @@ pad_sright =
 [Core]
 gpu_refresh_rate = ## 30 (default)
 frame_skip = ## 0: No frameskip (default), 1 : 2x frameskip, 2 : 4x frameskip, etc.
+translation_cache_size = ## Size of the CPU translation cache in MiB, 32 (default)
+use_cpu_jit = ## 0: Interpreter (default), 1: JIT recompiler (x86-64 hosts only)
+skip_idle_loops = ## 0: Run guest loops polling memory, 1: Skip ahead to the next event when a guest loop only polls memory (default)
+vertex_cache_size = ## Number of shaded vertices reused within indexed draws, 0: Disabled, 32 (default)
+vertex_cache_policy = ## 0: Direct mapped (default), 1: FIFO, 2: LRU
+gpu_worker_threads = ## Threads used for vertex processing and rasterization, 0: One per CPU core (default), 1: No worker threads
+use_gpu_thread = ## 0: Execute GPU commands on the emulation thread, 1: On a separate GPU thread (default)
+use_shader_jit = ## 0: Interpreter, 1: Vertex shader JIT recompiler (default, x86-64 hosts only)
+use_simd_rasterizer = ## 0: Scalar rasterizer, 1: SSE rasterizer (default, x86-64 hosts only)
 
 [Data Storage]
 use_virtual_sd =
@@ -0,0 +1,683 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Differential fuzzer and throughput benchmark for the ARM_Interface backends.
+//
+// Every backend runs the same guest code from the same ThreadContext, and the resulting contexts
+// and data memory are compared against the first backend (the interpreter). The guest code is
+// either randomly generated ARM/Thumb code or a raw dump of real game code (e.g. ExeFS:/.code),
+// which is run from random entry points. The benchmark runs generated loops on every backend
+// and reports the throughput in MIPS. The memory benchmark compares guest loads and stores through
+// the page table of Memory with the chain of range checks it replaced.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/common.h"
+#include "common/logging/backend.h"
+#include "common/logging/filter.h"
+#include "common/logging/text_formatter.h"
+#include "common/scope_exit.h"
+
+#include "core/core.h"
+#include "core/mem_map.h"
+#include "core/settings.h"
+#include "core/arm/arm_interface.h"
+#include "core/arm/dyncom/arm_dyncom.h"
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include "core/arm/jit_x64/arm_jit_x64.h"
+#endif
+
+namespace {
+
+/// Generated programs and code dumps are loaded here
+const VAddr CODE_VADDR = Memory::EXEFS_CODE_VADDR;
+
+/// All generated loads and stores are relative to SP, which starts in the middle of this window
+const VAddr DATA_VADDR = Memory::HEAP_VADDR;
+const u32 DATA_SIZE = 0x100000;
+
+const u32 CPSR_USER_FLAGS_MASK = 0xF0000000;
+const u32 CPSR_THUMB = 1 << 5;
+const u32 CPSR_SYSTEM_MODE = 0x1F;
+
+/// Context mode used by the kernel for new threads
+const u32 CONTEXT_MODE = 8;
+
+/// Maximum number of instructions of a generated program
+const u32 MAX_PROGRAM_LENGTH = 120;
+
+/// Number of slices each fuzz program is run in, state is compared after every slice
+const int FUZZ_SLICES = 10;
+
+/// Slice length of the benchmark, matching the slices of Core::RunLoop while the GPU is busy
+const int BENCH_SLICE = 1000;
+
+struct Backend {
+    const char* name;
+    std::unique_ptr<ARM_Interface> cpu;
+};
+
+/// State of a backend after running a slice of code
+struct Snapshot {
+    Core::ThreadContext context;
+    std::vector<u8> data;   ///< Contents of the data window, only captured after the last slice
+};
+
+struct Program {
+    std::vector<u32> words;
+    bool thumb;
+};
+
+/**
+ * Generates random guest code. Only registers R0-R12 and R14 are written so that SP stays a valid
+ * base address for the loads and stores, and branches only go forward to keep programs finite.
+ */
+class ProgramGenerator {
+public:
+    explicit ProgramGenerator(u32 seed) : rng(seed) {}
+
+    u32 Random(u32 bound) {
+        return std::uniform_int_distribution<u32>(0, bound - 1)(rng);
+    }
+
+    u32 RandomWord() {
+        return static_cast<u32>(rng());
+    }
+
+    /**
+     * Generates a program
+     * @param length Number of instructions, excluding the terminating branch
+     * @param thumb Whether to generate Thumb code
+     * @param loop Whether the program branches back to its start instead of halting, and avoids
+     *             instructions that would move SP away from the data window
+     */
+    Program Generate(u32 length, bool thumb, bool loop) {
+        Program program;
+        program.thumb = thumb;
+        if (thumb)
+            GenerateThumb(program, length, loop);
+        else
+            GenerateArm(program, length, loop);
+        return program;
+    }
+
+private:
+    u32 Condition() {
+        return Random(4) == 0 ? Random(15) : 0xE;
+    }
+
+    /// Any register but SP and PC
+    u32 DestinationRegister() {
+        const u32 reg = Random(14);
+        return reg == 13 ? 14 : reg;
+    }
+
+    /// Any register but PC, or PC as well if allow_pc is set
+    u32 SourceRegister(bool allow_pc) {
+        return allow_pc && Random(16) == 0 ? 15 : Random(15);
+    }
+
+    u32 DataProcessing() {
+        const u32 opcode = Random(16);
+        const bool is_compare = opcode >= 8 && opcode <= 11;
+        const u32 set_flags = is_compare ? 1 : Random(2);
+        const u32 immediate = Random(2);
+        u32 inst = (Condition() << 28) | (immediate << 25) | (opcode << 21) | (set_flags << 20) |
+                   (SourceRegister(true) << 16) | (DestinationRegister() << 12);
+        if (immediate)
+            inst |= Random(4096);
+        else
+            inst |= (Random(32) << 7) | (Random(4) << 5) | SourceRegister(true);
+        return inst;
+    }
+
+    u32 DataProcessingRegisterShift() {
+        return (Condition() << 28) | (Random(16) << 21) | (1 << 20) | (SourceRegister(false) << 16) |
+               (DestinationRegister() << 12) | (SourceRegister(false) << 8) | (Random(4) << 5) |
+               0x10 | SourceRegister(false);
+    }
+
+    u32 Multiply() {
+        return (Condition() << 28) | 0x90 | (Random(2) << 20) | (DestinationRegister() << 16) |
+               (SourceRegister(false) << 8) | SourceRegister(false);
+    }
+
+    u32 LoadStore(bool loop) {
+        const u32 register_offset = Random(2);
+        const u32 pre_indexed = loop ? 1 : Random(2);
+        const u32 write_back = (pre_indexed && !loop) ? Random(2) : 0;
+        const u32 load = Random(2);
+
+        // PC relative literal loads read the program itself
+        const u32 rn = (load && pre_indexed && !write_back && Random(8) == 0) ? 15 : 13;
+
+        u32 inst = (Condition() << 28) | (1 << 26) | (register_offset << 25) | (pre_indexed << 24) |
+                   (Random(2) << 23) | (Random(2) << 22) | (write_back << 21) | (load << 20) |
+                   (rn << 16) | (DestinationRegister() << 12);
+
+        // Register offsets are shifted right far enough to stay in the data window
+        if (register_offset)
+            inst |= ((20 + Random(12)) << 7) | (1 << 5) | SourceRegister(false);
+        else
+            inst |= Random(4096);
+        return inst;
+    }
+
+    u32 LoadStoreHalfword() {
+        return (Condition() << 28) | 0x01C000B0 | (Random(2) << 20) | (13 << 16) |
+               (DestinationRegister() << 12) | ((Random(256) & 0xF0) << 4) | Random(16);
+    }
+
+    /// LDM/STM on SP, with any register list that leaves out SP and PC
+    u32 BlockTransfer(bool loop) {
+        const u32 write_back = loop ? 0 : Random(2);
+        u32 list = Random(0x4000) & ~(1 << 13);
+        if (list == 0)
+            list = 1 << Random(13);
+        return (Condition() << 28) | (1 << 27) | (Random(4) << 23) | (write_back << 21) |
+               (Random(2) << 20) | (13 << 16) | list;
+    }
+
+    void GenerateArm(Program& program, u32 length, bool loop) {
+        for (u32 i = 0; i < length; ++i) {
+            const u32 kind = Random(100);
+            if (kind < 55) {
+                program.words.push_back(DataProcessing());
+            } else if (kind < 75) {
+                program.words.push_back(LoadStore(loop));
+            } else if (kind < 80) {
+                program.words.push_back(LoadStoreHalfword());
+            } else if (kind < 88 && length - i >= 2) {
+                // B or BL forward, at most to the terminating branch
+                const u32 offset = Random(std::min<u32>(length - i - 1, 8));
+                program.words.push_back((Condition() << 28) | (0xA << 24) | (Random(2) << 24) | offset);
+            } else if (kind < 92) {
+                program.words.push_back(Multiply());
+            } else if (kind < 96) {
+                program.words.push_back(DataProcessingRegisterShift());
+            } else {
+                program.words.push_back(BlockTransfer(loop));
+            }
+        }
+
+        // Either branch back to the start or to self
+        const s32 offset = loop ? -static_cast<s32>(length) - 2 : -2;
+        program.words.push_back(0xEA000000 | (static_cast<u32>(offset) & 0xFFFFFF));
+    }
+
+    u16 ThumbInstruction(bool loop) {
+        switch (Random(10)) {
+        case 0: // Move shifted register
+            return static_cast<u16>((Random(3) << 11) | (Random(32) << 6) | (Random(8) << 3) | Random(8));
+        case 1: // Add/subtract
+            return static_cast<u16>(0x1800 | (Random(4) << 9) | (Random(8) << 6) | (Random(8) << 3) | Random(8));
+        case 2: // Move/compare/add/subtract immediate
+            return static_cast<u16>(0x2000 | (Random(4) << 11) | (Random(8) << 8) | Random(256));
+        case 3: // ALU operations
+            return static_cast<u16>(0x4000 | (Random(16) << 6) | (Random(8) << 3) | Random(8));
+        case 4: // PC relative load
+            return static_cast<u16>(0x4800 | (Random(8) << 8) | Random(256));
+        case 5: // SP relative load/store
+            return static_cast<u16>(0x9000 | (Random(2) << 11) | (Random(8) << 8) | Random(256));
+        case 6: // Load address
+            return static_cast<u16>(0xA000 | (Random(2) << 11) | (Random(8) << 8) | Random(256));
+        case 7: // Add offset to SP, or a move immediate when looping so that SP stays put
+            if (loop)
+                return static_cast<u16>(0x2000 | (Random(8) << 8) | Random(256));
+            return static_cast<u16>(0xB000 | (Random(2) << 7) | Random(128));
+        case 8: // Push/pop with LR but never PC, or a move immediate when looping
+            if (loop)
+                return static_cast<u16>(0x2000 | (Random(8) << 8) | Random(256));
+            if (Random(2) == 0)
+                return static_cast<u16>(0xB400 | (Random(2) << 8) | Random(256));
+            return static_cast<u16>(0xBC00 | Random(256));
+        default: // Conditional branch, skipping the next instruction
+            return static_cast<u16>(0xD000 | (Random(14) << 8));
+        }
+    }
+
+    void GenerateThumb(Program& program, u32 length, bool loop) {
+        std::vector<u16> halfwords;
+        for (u32 i = 0; i < length; ++i) {
+            u16 inst = ThumbInstruction(loop);
+            // The terminating branch must not be skipped
+            while (i == length - 1 && (inst & 0xF000) == 0xD000)
+                inst = ThumbInstruction(loop);
+            halfwords.push_back(inst);
+        }
+
+        // Unconditional branch back to the start or to self
+        const s32 offset = loop ? -static_cast<s32>(length) - 2 : -2;
+        halfwords.push_back(static_cast<u16>(0xE000 | (static_cast<u32>(offset) & 0x7FF)));
+        if (halfwords.size() % 2 != 0)
+            halfwords.push_back(0xE7FE);
+
+        for (size_t i = 0; i < halfwords.size(); i += 2)
+            program.words.push_back(halfwords[i] | (halfwords[i + 1] << 16));
+    }
+
+    std::mt19937 rng;
+};
+
+std::vector<Backend> CreateBackends() {
+    std::vector<Backend> backends;
+    backends.push_back({ "dyncom", std::unique_ptr<ARM_Interface>(new ARM_DynCom) });
+#if defined(__x86_64__) || defined(_M_AMD64)
+    backends.push_back({ "jit_x64", std::unique_ptr<ARM_Interface>(new ARM_JitX64) });
+#endif
+    return backends;
+}
+
+void LoadCode(const std::vector<u32>& words) {
+    // Writing through Memory lets the backends invalidate code they translated earlier
+    for (size_t i = 0; i < words.size(); ++i)
+        Memory::Write32(CODE_VADDR + static_cast<u32>(i * 4), words[i]);
+}
+
+void LoadData(const std::vector<u8>& data) {
+    std::memcpy(Memory::GetPointer(DATA_VADDR), data.data(), data.size());
+}
+
+std::vector<u8> RandomData(ProgramGenerator& generator) {
+    std::vector<u8> data(DATA_SIZE);
+    for (u32 i = 0; i < DATA_SIZE; i += 4) {
+        const u32 word = generator.RandomWord();
+        std::memcpy(&data[i], &word, sizeof(word));
+    }
+    return data;
+}
+
+Core::ThreadContext RandomContext(ProgramGenerator& generator, VAddr pc, bool thumb) {
+    Core::ThreadContext context = {};
+    for (u32& reg : context.cpu_registers)
+        reg = generator.Random(4) == 0 ? generator.Random(16) : generator.RandomWord();
+    for (u32& reg : context.fpu_registers)
+        reg = generator.RandomWord();
+
+    context.sp = DATA_VADDR + DATA_SIZE / 2;
+    context.lr = generator.RandomWord();
+    context.pc = pc;
+    context.cpsr = (generator.RandomWord() & CPSR_USER_FLAGS_MASK) | (thumb ? CPSR_THUMB : 0) |
+                   CPSR_SYSTEM_MODE;
+    context.mode = CONTEXT_MODE;
+    return context;
+}
+
+/// Runs a backend for the given slices, taking a snapshot after each of them
+std::vector<Snapshot> RunSlices(ARM_Interface& cpu, const Core::ThreadContext& context,
+                                const std::vector<u8>& data, const std::vector<int>& slices) {
+    LoadData(data);
+    cpu.LoadContext(context);
+
+    std::vector<Snapshot> snapshots;
+    for (int slice : slices) {
+        // Keep CoreTiming out of the picture, no events are scheduled
+        cpu.down_count = std::numeric_limits<s64>::max();
+        cpu.Run(slice);
+
+        Snapshot snapshot;
+        cpu.SaveContext(snapshot.context);
+        snapshots.push_back(std::move(snapshot));
+    }
+
+    // Stores are never lost, so comparing memory once at the end is enough
+    const u8* data_ptr = Memory::GetPointer(DATA_VADDR);
+    snapshots.back().data.assign(data_ptr, data_ptr + DATA_SIZE);
+    return snapshots;
+}
+
+void PrintMismatch(const char* name, const Snapshot& expected, const Snapshot& actual) {
+    const Core::ThreadContext& a = expected.context;
+    const Core::ThreadContext& b = actual.context;
+    for (int i = 0; i < 13; ++i) {
+        if (a.cpu_registers[i] != b.cpu_registers[i])
+            std::printf("  r%d: dyncom %08x, %s %08x\n", i, a.cpu_registers[i], name, b.cpu_registers[i]);
+    }
+    if (a.sp != b.sp)
+        std::printf("  sp: dyncom %08x, %s %08x\n", a.sp, name, b.sp);
+    if (a.lr != b.lr)
+        std::printf("  lr: dyncom %08x, %s %08x\n", a.lr, name, b.lr);
+    if (a.pc != b.pc)
+        std::printf("  pc: dyncom %08x, %s %08x\n", a.pc, name, b.pc);
+    if (a.cpsr != b.cpsr)
+        std::printf("  cpsr: dyncom %08x, %s %08x\n", a.cpsr, name, b.cpsr);
+    for (int i = 0; i < 32; ++i) {
+        if (a.fpu_registers[i] != b.fpu_registers[i])
+            std::printf("  s%d: dyncom %08x, %s %08x\n", i, a.fpu_registers[i], name, b.fpu_registers[i]);
+    }
+    if (a.fpscr != b.fpscr)
+        std::printf("  fpscr: dyncom %08x, %s %08x\n", a.fpscr, name, b.fpscr);
+    for (size_t i = 0; i < std::min(expected.data.size(), actual.data.size()); ++i) {
+        if (expected.data[i] != actual.data[i]) {
+            std::printf("  first data mismatch at %08x: dyncom %02x, %s %02x\n", DATA_VADDR + static_cast<u32>(i),
+                        expected.data[i], name, actual.data[i]);
+            break;
+        }
+    }
+}
+
+bool SnapshotsMatch(const Snapshot& a, const Snapshot& b) {
+    return std::memcmp(a.context.cpu_registers, b.context.cpu_registers, sizeof(a.context.cpu_registers)) == 0 &&
+           std::memcmp(a.context.fpu_registers, b.context.fpu_registers, sizeof(a.context.fpu_registers)) == 0 &&
+           a.context.sp == b.context.sp && a.context.lr == b.context.lr && a.context.pc == b.context.pc &&
+           a.context.cpsr == b.context.cpsr && a.context.fpscr == b.context.fpscr &&
+           a.data == b.data;
+}
+
+/**
+ * Runs the code currently loaded at entry on every backend and compares the results
+ * @return true if all backends agree
+ */
+bool RunDifferential(std::vector<Backend>& backends, ProgramGenerator& generator, VAddr entry,
+                     bool thumb, const std::vector<u32>& code) {
+    const Core::ThreadContext context = RandomContext(generator, entry, thumb);
+
+    const std::vector<u8> data = RandomData(generator);
+
+    std::vector<int> slices;
+    for (int i = 0; i < FUZZ_SLICES; ++i)
+        slices.push_back(1 + generator.Random(30));
+
+    const std::vector<Snapshot> reference = RunSlices(*backends[0].cpu, context, data, slices);
+    for (size_t b = 1; b < backends.size(); ++b) {
+        const std::vector<Snapshot> result = RunSlices(*backends[b].cpu, context, data, slices);
+        for (size_t i = 0; i < slices.size(); ++i) {
+            if (SnapshotsMatch(reference[i], result[i]))
+                continue;
+
+            std::printf("%s differs from dyncom after slice %zu (%d instructions), %s code at %08x:\n",
+                        backends[b].name, i, slices[i], thumb ? "Thumb" : "ARM", entry);
+            const size_t first = (entry - CODE_VADDR) / 4;
+            const size_t last = std::min(code.size(), first + MAX_PROGRAM_LENGTH + 1);
+            for (size_t w = first; w < last; ++w)
+                std::printf("  %08x: %08x\n", CODE_VADDR + static_cast<u32>(w * 4), code[w]);
+            PrintMismatch(backends[b].name, reference[i], result[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int Fuzz(std::vector<Backend>& backends, ProgramGenerator& generator, int iterations) {
+    int failures = 0;
+    for (int i = 0; i < iterations; ++i) {
+        const bool thumb = (i % 2) != 0;
+        const Program program = generator.Generate(1 + generator.Random(MAX_PROGRAM_LENGTH), thumb, false);
+        LoadCode(program.words);
+        if (!RunDifferential(backends, generator, CODE_VADDR, thumb, program.words))
+            ++failures;
+    }
+    std::printf("fuzz: %d programs, %d mismatches\n", iterations, failures);
+    return failures;
+}
+
+/**
+ * Runs a raw code dump from random entry points. System calls are replaced with NOPs since there
+ * is no kernel to service them, and the dump is assumed to be ARM code. The dump should only hold
+ * code: data decoding as a switch to user mode stops the interpreter.
+ */
+int Replay(std::vector<Backend>& backends, ProgramGenerator& generator, const std::string& path,
+           int iterations) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::printf("replay: could not open %s\n", path.c_str());
+        return 1;
+    }
+
+    std::vector<u32> code;
+    u32 word;
+    while (file.read(reinterpret_cast<char*>(&word), sizeof(word)) &&
+           code.size() * 4 < Memory::EXEFS_CODE_SIZE) {
+        if ((word & 0x0F000000) == 0x0F000000 && (word >> 28) != 0xF)
+            word = (word & 0xF0000000) | 0x01A00000; // SVC -> MOV r0, r0
+        code.push_back(word);
+    }
+    if (code.empty()) {
+        std::printf("replay: %s is empty\n", path.c_str());
+        return 1;
+    }
+    LoadCode(code);
+
+    int failures = 0;
+    for (int i = 0; i < iterations; ++i) {
+        const VAddr entry = CODE_VADDR + generator.Random(static_cast<u32>(code.size())) * 4;
+        if (!RunDifferential(backends, generator, entry, false, code))
+            ++failures;
+    }
+    std::printf("replay: %d entry points of %s, %d mismatches\n", iterations, path.c_str(), failures);
+    return failures;
+}
+
+void Benchmark(std::vector<Backend>& backends, ProgramGenerator& generator, u64 instructions) {
+    const int NUM_PROGRAMS = 16;
+
+    std::vector<Program> programs;
+    for (int i = 0; i < NUM_PROGRAMS; ++i)
+        programs.push_back(generator.Generate(8 + generator.Random(MAX_PROGRAM_LENGTH - 8), (i % 2) != 0, true));
+
+    const std::vector<u8> data = RandomData(generator);
+
+    const u64 instructions_per_program = instructions / NUM_PROGRAMS;
+    for (Backend& backend : backends) {
+        std::chrono::steady_clock::duration elapsed(0);
+        ProgramGenerator context_generator(0);
+
+        for (const Program& program : programs) {
+            LoadCode(program.words);
+            LoadData(data);
+            backend.cpu->LoadContext(RandomContext(context_generator, CODE_VADDR, program.thumb));
+
+            const auto start = std::chrono::steady_clock::now();
+            for (u64 executed = 0; executed < instructions_per_program; executed += BENCH_SLICE) {
+                backend.cpu->down_count = std::numeric_limits<s64>::max();
+                backend.cpu->Run(BENCH_SLICE);
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        const double executed = static_cast<double>(instructions_per_program * NUM_PROGRAMS);
+        std::printf("bench: %-8s %8.2f MIPS (%.0f instructions in %.3f s)\n", backend.name,
+                    executed / seconds / 1000000.0, executed, seconds);
+    }
+}
+
+/**
+ * The chain of range checks that Memory::Read32 went through before the page table, kept as the
+ * baseline of the memory benchmark. Special regions (ConfigMem, the shared page) are left out,
+ * the benchmark doesn't access them.
+ */
+u8* ChainTranslate(VAddr vaddr) {
+    using namespace Memory;
+    if (vaddr >= KERNEL_MEMORY_VADDR && vaddr < KERNEL_MEMORY_VADDR_END) {
+        return &g_kernel_mem[vaddr - KERNEL_MEMORY_VADDR];
+    } else if (vaddr >= EXEFS_CODE_VADDR && vaddr < EXEFS_CODE_VADDR_END) {
+        return &g_exefs_code[vaddr - EXEFS_CODE_VADDR];
+    } else if (vaddr >= HEAP_LINEAR_VADDR && vaddr < HEAP_LINEAR_VADDR_END) {
+        return &g_heap_linear[vaddr - HEAP_LINEAR_VADDR];
+    } else if (vaddr >= HEAP_VADDR && vaddr < HEAP_VADDR_END) {
+        return &g_heap[vaddr - HEAP_VADDR];
+    } else if (vaddr >= SHARED_MEMORY_VADDR && vaddr < SHARED_MEMORY_VADDR_END) {
+        return &g_shared_mem[vaddr - SHARED_MEMORY_VADDR];
+    } else if (vaddr >= SYSTEM_MEMORY_VADDR && vaddr < SYSTEM_MEMORY_VADDR_END) {
+        return &g_system_mem[vaddr - SYSTEM_MEMORY_VADDR];
+    } else if (vaddr >= CONFIG_MEMORY_VADDR && vaddr < CONFIG_MEMORY_VADDR_END) {
+        return nullptr;
+    } else if (vaddr >= SHARED_PAGE_VADDR && vaddr < SHARED_PAGE_VADDR_END) {
+        return nullptr;
+    } else if (vaddr >= DSP_MEMORY_VADDR && vaddr < DSP_MEMORY_VADDR_END) {
+        return &g_dsp_mem[vaddr - DSP_MEMORY_VADDR];
+    } else if (vaddr >= VRAM_VADDR && vaddr < VRAM_VADDR_END) {
+        return &g_vram[vaddr - VRAM_VADDR];
+    }
+    return nullptr;
+}
+
+u32 ChainRead32(VAddr vaddr) {
+    const u8* pointer = ChainTranslate(vaddr);
+    u32 value = 0;
+    if (pointer != nullptr)
+        std::memcpy(&value, pointer, sizeof(value));
+    return value;
+}
+
+void ChainWrite32(VAddr vaddr, u32 data) {
+    u8* pointer = ChainTranslate(vaddr);
+    if (pointer != nullptr)
+        std::memcpy(pointer, &data, sizeof(data));
+}
+
+struct MemoryFunctions {
+    const char* name;
+    u32 (*read32)(VAddr);
+    void (*write32)(VAddr, u32);
+};
+
+/**
+ * Measures guest loads and stores per second through Memory::Read32/Write32 and through the old
+ * chain of range checks, on random word addresses spread over the regions games access most.
+ * @return The number of loads that read different values through the two paths
+ */
+int MemoryBenchmark(ProgramGenerator& generator, u64 accesses) {
+    // Starts of the first MiB of each region; the code region is skipped over the generated code,
+    // whose pages the CPU backends watch for writes
+    const VAddr regions[] = {
+        Memory::HEAP_VADDR, Memory::HEAP_VADDR,
+        Memory::HEAP_LINEAR_VADDR, Memory::HEAP_LINEAR_VADDR,
+        Memory::EXEFS_CODE_VADDR + 0x100000, Memory::VRAM_VADDR,
+    };
+    const int NUM_REGIONS = sizeof(regions) / sizeof(regions[0]);
+
+    std::vector<VAddr> addresses(64 * 1024);
+    for (VAddr& address : addresses)
+        address = regions[generator.Random(NUM_REGIONS)] + (generator.Random(DATA_SIZE) & ~3u);
+
+    const MemoryFunctions functions[] = {
+        { "page table", Memory::Read32, Memory::Write32 },
+        { "range checks", ChainRead32, ChainWrite32 },
+    };
+
+    // Stores write back the same values, so that every round loads the same checksum
+    for (VAddr address : addresses)
+        ChainWrite32(address, ~address);
+
+    int mismatches = 0;
+    for (VAddr address : addresses) {
+        if (Memory::Read32(address) != ChainRead32(address))
+            ++mismatches;
+    }
+
+    const u64 rounds = std::max<u64>(accesses / addresses.size(), 1);
+    const double total = static_cast<double>(rounds * addresses.size());
+    for (const MemoryFunctions& function : functions) {
+        u32 checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (u64 round = 0; round < rounds; ++round) {
+            for (VAddr address : addresses)
+                checksum += function.read32(address);
+        }
+        const double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (u64 round = 0; round < rounds; ++round) {
+            for (VAddr address : addresses)
+                function.write32(address, ~address);
+        }
+        const double store_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::printf("memory: %-12s %8.2f M loads/s %8.2f M stores/s (checksum %08x)\n", function.name,
+                    total / load_seconds / 1000000.0, total / store_seconds / 1000000.0, checksum);
+    }
+
+    if (mismatches != 0)
+        std::printf("memory: %d of %zu loads differ between the page table and the range checks\n",
+                    mismatches, addresses.size());
+    return mismatches;
+}
+
+void PrintUsage(const char* program) {
+    std::printf("Usage: %s [options]\n"
+                "  --fuzz N       run N random programs on every backend and compare (default 1000)\n"
+                "  --replay FILE  run a raw ARM code dump from random entry points\n"
+                "  --bench N      run N million instructions of generated loops per backend and\n"
+                "                 report MIPS (default 0, disabled)\n"
+                "  --memory N     run N million guest loads and stores through the page table and\n"
+                "                 through the old chain of range checks (default 0, disabled)\n"
+                "  --seed N       seed of the code and state generator (default 1)\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::shared_ptr<Log::Logger> logger = Log::InitGlobalLogger();
+    Log::Filter log_filter(Log::Level::Critical);
+    std::thread logging_thread(Log::TextLoggingLoop, logger, &log_filter);
+    SCOPE_EXIT({
+        logger->Close();
+        logging_thread.join();
+    });
+
+    int fuzz_iterations = 1000;
+    u64 bench_instructions = 0;
+    u64 memory_accesses = 0;
+    u32 seed = 1;
+    std::string replay_path;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--fuzz") {
+            fuzz_iterations = std::atoi(argv[++i]);
+        } else if (arg == "--replay") {
+            replay_path = argv[++i];
+        } else if (arg == "--bench") {
+            bench_instructions = std::strtoull(argv[++i], nullptr, 10) * 1000000;
+        } else if (arg == "--memory") {
+            memory_accesses = std::strtoull(argv[++i], nullptr, 10) * 1000000;
+        } else if (arg == "--seed") {
+            seed = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    Settings::values.translation_cache_size = 32;
+    Memory::Init();
+    SCOPE_EXIT({ Memory::Shutdown(); });
+
+    std::vector<Backend> backends = CreateBackends();
+    ProgramGenerator generator(seed);
+
+    int failures = 0;
+    if (backends.size() < 2) {
+        std::printf("fuzz: only one CPU backend is available on this host, nothing to compare\n");
+    } else {
+        failures += Fuzz(backends, generator, fuzz_iterations);
+        if (!replay_path.empty())
+            failures += Replay(backends, generator, replay_path, fuzz_iterations);
+    }
+
+    if (bench_instructions != 0)
+        Benchmark(backends, generator, bench_instructions);
+
+    if (memory_accesses != 0)
+        failures += MemoryBenchmark(generator, memory_accesses);
+
+    return failures == 0 ? 0 : 1;
+}
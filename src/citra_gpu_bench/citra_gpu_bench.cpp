@@ -0,0 +1,638 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Differential test and throughput benchmark for the software rasterizer.
+//
+// Random triangles are drawn into a 400x240 framebuffer in VRAM once per rasterizer
+// implementation (the scalar reference loop, plus the SSE one on x86-64 hosts). The color and
+// depth buffers of every implementation are compared against the scalar one, and the throughput
+// is reported in triangles and pixels per second. The shader test runs random vertex shaders
+// with random output mappings through the interpreter and the shader JIT and compares the
+// resulting output vertices. The transfer test runs random display transfers and memory fills
+// with and without the SSE2 kernels of the GPU transfer engine and compares the memory they write.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nihstro/shader_bytecode.h>
+
+#include "common/common.h"
+#include "common/logging/backend.h"
+#include "common/logging/filter.h"
+#include "common/logging/text_formatter.h"
+#include "common/scope_exit.h"
+
+#include "core/mem_map.h"
+#include "core/settings.h"
+#include "core/hw/gpu.h"
+#include "core/hw/gpu_transfer.h"
+
+#include "video_core/pica.h"
+#include "video_core/rasterizer.h"
+#include "video_core/texture_cache.h"
+#include "video_core/vertex_shader.h"
+
+namespace {
+
+const u32 FRAMEBUFFER_WIDTH = 400;
+const u32 FRAMEBUFFER_HEIGHT = 240;
+
+const PAddr COLOR_BUFFER_PADDR = Memory::VRAM_PADDR;
+const PAddr DEPTH_BUFFER_PADDR = Memory::VRAM_PADDR + 0x100000;
+const PAddr TEXTURE_PADDR = Memory::VRAM_PADDR + 0x200000;
+
+const u32 TEXTURE_SIZE = 128;
+
+// Source and destination of the display transfers and memory fills of the transfer test
+const PAddr TRANSFER_INPUT_PADDR = Memory::VRAM_PADDR + 0x280000;
+const PAddr TRANSFER_OUTPUT_PADDR = Memory::VRAM_PADDR + 0x400000;
+const u32 TRANSFER_OUTPUT_SIZE = 0x100000;
+const u32 MAX_TRANSFER_WIDTH = 400;
+const u32 MAX_TRANSFER_HEIGHT = 240;
+
+using nihstro::Instruction;
+using Pica::float24;
+using Pica::VertexShader::InputVertex;
+using Pica::VertexShader::OutputVertex;
+
+/// Number of swizzle patterns referenced by the generated vertex shaders
+const u32 NUM_SWIZZLE_PATTERNS = 32;
+/// Number of vertices run through each generated vertex shader
+const int VERTICES_PER_SHADER = 64;
+
+struct Implementation {
+    const char* name;
+    bool use_simd;
+};
+
+/// Framebuffer contents after drawing all triangles
+struct Snapshot {
+    std::vector<u8> color;
+    std::vector<u8> depth;
+};
+
+class TriangleGenerator {
+public:
+    explicit TriangleGenerator(u32 seed) : rng(seed) {}
+
+    float Random(float min, float max) {
+        return std::uniform_real_distribution<float>(min, max)(rng);
+    }
+
+    /**
+     * Generates a triangle within the framebuffer
+     * @param size Maximum distance of the vertices from the triangle's center, in pixels
+     */
+    void Generate(float size, OutputVertex vertices[3]) {
+        const float center_x = Random(0.0f, static_cast<float>(FRAMEBUFFER_WIDTH));
+        const float center_y = Random(0.0f, static_cast<float>(FRAMEBUFFER_HEIGHT));
+
+        for (int i = 0; i < 3; ++i) {
+            OutputVertex& vertex = vertices[i];
+            std::memset(&vertex, 0, sizeof(vertex));
+
+            const float x = Clamp(center_x + Random(-size, size), static_cast<float>(FRAMEBUFFER_WIDTH));
+            const float y = Clamp(center_y + Random(-size, size), static_cast<float>(FRAMEBUFFER_HEIGHT));
+            vertex.screenpos = Math::MakeVec(float24::FromFloat32(x), float24::FromFloat32(y),
+                                             float24::FromFloat32(Random(-1.0f, 0.0f)));
+            vertex.pos.w = float24::FromFloat32(Random(0.25f, 4.0f));
+            for (int component = 0; component < 4; ++component)
+                vertex.color[component] = float24::FromFloat32(Random(0.0f, 1.0f));
+            vertex.tc0 = Math::MakeVec(float24::FromFloat32(Random(-2.0f, 2.0f)), float24::FromFloat32(Random(-2.0f, 2.0f)));
+            vertex.tc1 = Math::MakeVec(float24::FromFloat32(Random(-2.0f, 2.0f)), float24::FromFloat32(Random(-2.0f, 2.0f)));
+        }
+    }
+
+private:
+    static float Clamp(float value, float max) {
+        return std::min(std::max(value, 0.0f), max);
+    }
+
+    std::mt19937 rng;
+};
+
+/**
+ * Generates random vertex shaders made of the instructions supported by the shader JIT. Flow
+ * control only leads forward, apart from returning from CALL and IF blocks and from CALLs to
+ * themselves, which recurse up to the maximum call depth. So every shader ends. Shaders are short,
+ * so that blocks often end at the same offset.
+ */
+class ShaderGenerator {
+public:
+    explicit ShaderGenerator(u32 seed) : rng(seed) {}
+
+    u32 Random(u32 min, u32 max) {
+        return std::uniform_int_distribution<u32>(min, max)(rng);
+    }
+
+    float24 RandomFloat() {
+        return float24::FromFloat32(std::uniform_real_distribution<float>(-4.0f, 4.0f)(rng));
+    }
+
+    /**
+     * Uploads a random shader along with random uniforms, swizzle patterns and register mappings.
+     * Output components are mapped to random semantics, which need not be contiguous and may be
+     * INVALID.
+     */
+    void Generate() {
+        using Pica::Regs;
+        using namespace Pica::VertexShader;
+
+        const u32 length = Random(8, 48);
+        for (u32 offset = 0; offset < length; ++offset) {
+            const u32 instr = (offset == length - 1) ? Encode(Instruction::OpCode::END, 0)
+                                                     : GenerateInstruction(offset, length);
+            SubmitShaderMemoryChange(offset, instr);
+        }
+        for (u32 i = 0; i < NUM_SWIZZLE_PATTERNS; ++i)
+            SubmitSwizzleDataChange(i, static_cast<u32>(rng()));
+
+        for (u32 i = 0; i < 96; ++i) {
+            for (int component = 0; component < 4; ++component)
+                GetFloatUniform(i)[component] = RandomFloat();
+        }
+        for (u32 i = 0; i < 16; ++i)
+            GetBoolUniform(i) = Random(0, 1) != 0;
+
+        Regs& regs = Pica::registers;
+        regs.vs_main_offset = 0;
+        regs[PICA_REG_INDEX(vs_input_register_map)] = static_cast<u32>(rng());
+        regs[PICA_REG_INDEX(vs_input_register_map) + 1] = static_cast<u32>(rng());
+        for (u32 i = 0; i < 7; ++i) {
+            u32 map = 0;
+            for (int component = 0; component < 4; ++component) {
+                const u32 semantic = (Random(0, 7) == 0) ? static_cast<u32>(Regs::VSOutputAttributes::INVALID)
+                                                         : Random(0, 23);
+                map |= semantic << (8 * component);
+            }
+            regs[PICA_REG_INDEX(vs_output_attributes) + i] = map;
+        }
+    }
+
+    void GenerateVertex(InputVertex& vertex) {
+        for (auto& attribute : vertex.attr) {
+            for (int component = 0; component < 4; ++component)
+                attribute[component] = RandomFloat();
+        }
+    }
+
+private:
+    static u32 Encode(Instruction::OpCode opcode, u32 operands) {
+        return (static_cast<u32>(opcode) << 26) | operands;
+    }
+
+    /**
+     * Returns random operands of a flow control instruction, jumping forward from offset
+     * @param recursive Jump to offset itself instead
+     */
+    u32 FlowControlOperands(u32 offset, u32 length, bool recursive) {
+        const u32 dest = recursive ? offset : Random(offset + 1, length - 1);
+        const u32 num_instructions = Random(0, length - 1 - dest);
+        return (Random(0, 0xF) << 22) | (dest << 10) | num_instructions;
+    }
+
+    u32 GenerateInstruction(u32 offset, u32 length) {
+        // Operands of arithmetic instructions are random, apart from the swizzle pattern index
+        const u32 operands = (static_cast<u32>(rng()) & 0x03FFFF80) | Random(0, NUM_SWIZZLE_PATTERNS - 1);
+
+        static const Instruction::OpCode arithmetic[] = {
+            Instruction::OpCode::ADD, Instruction::OpCode::DP3, Instruction::OpCode::DP4,
+            Instruction::OpCode::MUL, Instruction::OpCode::MAX, Instruction::OpCode::RCP,
+            Instruction::OpCode::RSQ, Instruction::OpCode::MOVA, Instruction::OpCode::MOV,
+        };
+        static const Instruction::OpCode flow_control[] = {
+            Instruction::OpCode::CALL, Instruction::OpCode::CALLC, Instruction::OpCode::CALLU,
+            Instruction::OpCode::IFU, Instruction::OpCode::IFC, Instruction::OpCode::JMPC,
+            Instruction::OpCode::JMPU,
+        };
+
+        switch (Random(0, 9)) {
+        case 0:
+            // The compare operations overlap the destination register and the lowest opcode bit
+            return Encode(Instruction::OpCode::CMP, (operands & ~0x07E00000) | (Random(0, 5) << 24) | (Random(0, 5) << 21));
+
+        case 1:
+            // MAD only uses the highest three opcode bits
+            return 0xE0000000 | (static_cast<u32>(rng()) & 0x1FFFFFE0) | Random(0, NUM_SWIZZLE_PATTERNS - 1);
+
+        case 2:
+        case 3:
+        case 4:
+        {
+            // Only CALLs may recurse, since they are the first three entries
+            const u32 index = Random(0, 6);
+            return Encode(flow_control[index], FlowControlOperands(offset, length, index < 3 && Random(0, 15) == 0));
+        }
+
+        default:
+            return Encode(arithmetic[Random(0, 8)], operands);
+        }
+    }
+
+    std::mt19937 rng;
+};
+
+/// Area of a triangle in pixels, used as an estimate of the number of pixels it covers
+float Area(const OutputVertex vertices[3]) {
+    const float x1 = vertices[1].screenpos.x.ToFloat32() - vertices[0].screenpos.x.ToFloat32();
+    const float y1 = vertices[1].screenpos.y.ToFloat32() - vertices[0].screenpos.y.ToFloat32();
+    const float x2 = vertices[2].screenpos.x.ToFloat32() - vertices[0].screenpos.x.ToFloat32();
+    const float y2 = vertices[2].screenpos.y.ToFloat32() - vertices[0].screenpos.y.ToFloat32();
+    return std::abs(x1 * y2 - x2 * y1) / 2.0f;
+}
+
+/**
+ * Sets up a blended, depth tested draw of the vertex color. If textured is set, the vertex color
+ * is modulated with the sum of two textures holding random data.
+ */
+void SetupRegisters(bool textured) {
+    using Pica::Regs;
+    Regs& regs = Pica::registers;
+    for (u32 id = 0; id < regs.NumIds(); ++id)
+        regs[id] = 0;
+
+    regs.framebuffer.width = FRAMEBUFFER_WIDTH;
+    regs.framebuffer.height = FRAMEBUFFER_HEIGHT - 1;
+    regs.framebuffer.color_buffer_address = COLOR_BUFFER_PADDR / 8;
+    regs.framebuffer.depth_buffer_address = DEPTH_BUFFER_PADDR / 8;
+
+    auto& output_merger = regs.output_merger;
+    output_merger.alphablend_enable = 1;
+    output_merger.alpha_blending.factor_source_rgb = output_merger.alpha_blending.SourceAlpha;
+    output_merger.alpha_blending.factor_dest_rgb = output_merger.alpha_blending.OneMinusSourceAlpha;
+    output_merger.alpha_blending.factor_source_a = output_merger.alpha_blending.One;
+    output_merger.alpha_blending.factor_dest_a = output_merger.alpha_blending.Zero;
+    output_merger.depth_test_enable = 1;
+    output_merger.depth_test_func = output_merger.LessThanOrEqual;
+    output_merger.depth_write_enable = 1;
+    output_merger.red_enable = output_merger.green_enable = 1;
+    output_merger.blue_enable = output_merger.alpha_enable = 1;
+
+    // The first stage passes through the vertex color, the rest pass through the previous stage
+    for (auto stage : { &regs.tev_stage0, &regs.tev_stage1, &regs.tev_stage2,
+                        &regs.tev_stage3, &regs.tev_stage4, &regs.tev_stage5 }) {
+        stage->color_source1 = (stage == &regs.tev_stage0) ? Regs::TevStageConfig::Source::PrimaryColor
+                                                            : Regs::TevStageConfig::Source::Previous;
+        stage->alpha_source1 = stage->color_source1.Value();
+    }
+
+    if (textured) {
+        regs.texture0_enable = 1;
+        regs.texture1_enable = 1;
+        for (auto texture : { &regs.texture0, &regs.texture1 }) {
+            texture->width = TEXTURE_SIZE;
+            texture->height = TEXTURE_SIZE;
+            texture->address = TEXTURE_PADDR / 8;
+        }
+        regs.texture0.wrap_s = regs.texture0.wrap_t = Regs::TextureConfig::Repeat;
+        regs.texture0_format = Regs::TextureFormat::RGBA8;
+        regs.texture1_format = Regs::TextureFormat::RGBA8;
+
+        regs.tev_stage1.color_source1 = Regs::TevStageConfig::Source::Texture0;
+        regs.tev_stage1.color_source2 = Regs::TevStageConfig::Source::Texture1;
+        regs.tev_stage1.color_op = Regs::TevStageConfig::Operation::Add;
+        regs.tev_stage2.color_source1 = Regs::TevStageConfig::Source::Previous;
+        regs.tev_stage2.color_source2 = Regs::TevStageConfig::Source::PrimaryColor;
+        regs.tev_stage2.color_op = Regs::TevStageConfig::Operation::Modulate;
+    }
+
+    regs.cull_mode = Regs::CullMode::KeepAll;
+}
+
+/// Clears the framebuffer like a GPU memory fill would
+void ClearFramebuffer() {
+    const VAddr color_buffer = Pica::PAddrToVAddr(COLOR_BUFFER_PADDR);
+    const VAddr depth_buffer = Pica::PAddrToVAddr(DEPTH_BUFFER_PADDR);
+    std::memset(Memory::GetPointer(color_buffer), 0, FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 4);
+    std::memset(Memory::GetPointer(depth_buffer), 0xFF, FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 2);
+    Memory::InvalidateRegion(color_buffer, FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 4);
+    Memory::InvalidateRegion(depth_buffer, FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 2);
+}
+
+Snapshot CaptureFramebuffer() {
+    const u8* color = Memory::GetPointer(Pica::PAddrToVAddr(COLOR_BUFFER_PADDR));
+    const u8* depth = Memory::GetPointer(Pica::PAddrToVAddr(DEPTH_BUFFER_PADDR));
+
+    Snapshot snapshot;
+    snapshot.color.assign(color, color + FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 4);
+    snapshot.depth.assign(depth, depth + FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT * 2);
+    return snapshot;
+}
+
+/// Returns the number of pixels whose color or depth differs between the two snapshots
+unsigned CountMismatches(const Snapshot& reference, const Snapshot& snapshot) {
+    unsigned mismatches = 0;
+    for (u32 pixel = 0; pixel < FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT; ++pixel) {
+        if (std::memcmp(&reference.color[pixel * 4], &snapshot.color[pixel * 4], 4) != 0 ||
+            std::memcmp(&reference.depth[pixel * 2], &snapshot.depth[pixel * 2], 2) != 0)
+            ++mismatches;
+    }
+    return mismatches;
+}
+
+/**
+ * Compares two output vertices bit by bit, except that any two NaNs are equal. When both operands
+ * of an addition or multiplication are NaNs, the host returns the first one, and the order of the
+ * operands in the interpreter is up to the compiler.
+ */
+bool VerticesMatch(const OutputVertex& reference, const OutputVertex& vertex) {
+    u32 reference_words[32], vertex_words[32];
+    std::memcpy(reference_words, &reference, sizeof(reference_words));
+    std::memcpy(vertex_words, &vertex, sizeof(vertex_words));
+
+    auto is_nan = [](u32 word) { return (word & 0x7FFFFFFF) > 0x7F800000; };
+    for (int i = 0; i < 32; ++i) {
+        if (reference_words[i] != vertex_words[i] && !(is_nan(reference_words[i]) && is_nan(vertex_words[i])))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Runs random vertex shaders through the interpreter and the shader JIT, and compares the output
+ * vertices
+ * @return Number of shaders whose output vertices differ
+ */
+int ShaderBenchmark(u32 seed, int num_shaders) {
+#if defined(__x86_64__) || defined(_M_AMD64)
+    ShaderGenerator generator(seed);
+    std::vector<InputVertex> inputs(VERTICES_PER_SHADER);
+    std::vector<OutputVertex> reference(VERTICES_PER_SHADER);
+    std::vector<OutputVertex> outputs(VERTICES_PER_SHADER);
+
+    int failures = 0;
+    std::chrono::steady_clock::duration elapsed[2] = {};
+    for (int shader = 0; shader < num_shaders; ++shader) {
+        generator.Generate();
+        for (InputVertex& input : inputs)
+            generator.GenerateVertex(input);
+        const int num_attributes = static_cast<int>(generator.Random(1, 16));
+
+        for (int jit = 0; jit < 2; ++jit) {
+            Settings::values.use_shader_jit = jit != 0;
+            Pica::VertexShader::Setup();
+
+            std::vector<OutputVertex>& results = jit ? outputs : reference;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < VERTICES_PER_SHADER; ++i)
+                results[i] = Pica::VertexShader::RunShader(inputs[i], num_attributes);
+            elapsed[jit] += std::chrono::steady_clock::now() - start;
+        }
+
+        if (!std::equal(reference.begin(), reference.end(), outputs.begin(), VerticesMatch)) {
+            std::printf("shaders: output of shader %d differs between the interpreter and the JIT\n", shader);
+            ++failures;
+        }
+    }
+
+    const char* names[2] = { "interpreter", "jit" };
+    for (int jit = 0; jit < 2; ++jit) {
+        std::printf("shaders: %-12s %10.0f vertices/s\n", names[jit],
+                    num_shaders * VERTICES_PER_SHADER / std::chrono::duration<double>(elapsed[jit]).count());
+    }
+    std::printf("shaders: %d of %d shaders differ between the interpreter and the JIT\n", failures, num_shaders);
+    return failures;
+#else
+    std::printf("shaders: the shader JIT is only available on x86-64 hosts\n");
+    return 0;
+#endif
+}
+
+/**
+ * Runs random display transfers and memory fills with and without the SSE2 kernels, and compares
+ * the memory written by them
+ * @return Number of transfers and fills whose output differs
+ */
+int TransferTest(u32 seed, int count) {
+#if defined(__x86_64__) || defined(_M_AMD64)
+    std::mt19937 rng(seed);
+    auto random = [&rng](u32 bound) { return std::uniform_int_distribution<u32>(0, bound - 1)(rng); };
+
+    u8* input = Memory::GetPointer(Pica::PAddrToVAddr(TRANSFER_INPUT_PADDR));
+    u8* output = Memory::GetPointer(Pica::PAddrToVAddr(TRANSFER_OUTPUT_PADDR));
+    const u32 input_size = (2 * MAX_TRANSFER_WIDTH + 16) * 2 * MAX_TRANSFER_HEIGHT * 4;
+    for (u32 offset = 0; offset < input_size; ++offset)
+        input[offset] = static_cast<u8>(random(256));
+
+    // Runs an operation on a fresh output buffer with and without the SSE2 kernels, returning true
+    // if both write the same memory
+    std::vector<u8> reference(TRANSFER_OUTPUT_SIZE);
+    std::chrono::steady_clock::duration elapsed[2] = {};
+    auto compare = [&](const std::function<void()>& operation) {
+        for (int sse = 0; sse < 2; ++sse) {
+            GPU::g_use_sse_transfers = sse != 0;
+            std::memset(output, 0xCD, TRANSFER_OUTPUT_SIZE);
+
+            const auto start = std::chrono::steady_clock::now();
+            operation();
+            elapsed[sse] += std::chrono::steady_clock::now() - start;
+
+            if (!sse)
+                std::memcpy(reference.data(), output, TRANSFER_OUTPUT_SIZE);
+        }
+        return std::memcmp(reference.data(), output, TRANSFER_OUTPUT_SIZE) == 0;
+    };
+
+    int failures = 0;
+    for (int i = 0; i < count; ++i) {
+        GPU::Regs::DisplayTransferConfig transfer = {};
+        transfer.input_address = TRANSFER_INPUT_PADDR / 8;
+        transfer.output_address = TRANSFER_OUTPUT_PADDR / 8;
+        transfer.input_format = static_cast<GPU::Regs::PixelFormat>(random(5));
+        transfer.output_format = static_cast<GPU::Regs::PixelFormat>(random(5));
+        transfer.scaling = static_cast<GPU::Regs::DisplayTransferConfig::ScalingMode>(random(3));
+        transfer.output_tiled = random(2);
+
+        // The output width is in output pixels before downscaling, and tiled outputs hold whole tiles
+        const u32 x_scale = (transfer.scaling != GPU::Regs::DisplayTransferConfig::NoScale) ? 2 : 1;
+        const u32 y_scale = (transfer.scaling == GPU::Regs::DisplayTransferConfig::ScaleXY) ? 2 : 1;
+        const u32 width = transfer.output_tiled ? 8 * (1 + random(MAX_TRANSFER_WIDTH / 8)) : 1 + random(MAX_TRANSFER_WIDTH);
+        const u32 height = 1 + random(MAX_TRANSFER_HEIGHT);
+        transfer.output_width = width * x_scale;
+        transfer.output_height = height * y_scale;
+        transfer.input_width = width * x_scale + random(16);
+        transfer.input_height = height * y_scale;
+
+        if (!compare([&transfer] { GPU::DisplayTransfer(transfer); })) {
+            std::printf("transfers: display transfer %d (format %u -> %u, %ux%u, scaling %u, tiled %u) differs\n",
+                        i, (u32)transfer.input_format.Value(), (u32)transfer.output_format.Value(),
+                        (u32)transfer.output_width, (u32)transfer.output_height,
+                        (u32)transfer.scaling.Value(), (u32)transfer.output_tiled);
+            ++failures;
+        }
+
+        GPU::Regs::MemoryFillConfig fill = {};
+        const u32 fill_start = TRANSFER_OUTPUT_PADDR + 8 * random(TRANSFER_OUTPUT_SIZE / 16);
+        const u32 fill_end = fill_start + 8 * random((TRANSFER_OUTPUT_PADDR + TRANSFER_OUTPUT_SIZE - fill_start) / 8);
+        fill.address_start = fill_start / 8;
+        fill.address_end = fill_end / 8;
+        fill.value_32bit = random(0x10000) | (random(0x10000) << 16);
+        fill.fill_24bit = random(3) == 0;
+        fill.fill_32bit = !fill.fill_24bit && random(2) == 0;
+
+        if (!compare([&fill] { GPU::MemoryFill(fill); })) {
+            std::printf("transfers: memory fill %d (0x%08x to 0x%08x, 24-bit %u, 32-bit %u) differs\n",
+                        i, fill_start, fill_end, (u32)fill.fill_24bit, (u32)fill.fill_32bit);
+            ++failures;
+        }
+    }
+
+    GPU::g_use_sse_transfers = true;
+
+    const char* names[2] = { "scalar", "sse" };
+    for (int sse = 0; sse < 2; ++sse)
+        std::printf("transfers: %-8s %8.3f s\n", names[sse], std::chrono::duration<double>(elapsed[sse]).count());
+    std::printf("transfers: %d of %d display transfers and memory fills differ with SSE2\n", failures, 2 * count);
+    return failures;
+#else
+    std::printf("transfers: the SSE2 transfer kernels are only available on x86-64 hosts\n");
+    return 0;
+#endif
+}
+
+void PrintUsage(const char* program) {
+    std::printf("Usage: %s [options]\n"
+                "  --triangles N  number of random triangles drawn per run (default 20000)\n"
+                "  --size N       maximum distance of the vertices from a triangle's center, in\n"
+                "                 pixels (default 16)\n"
+                "  --runs N       number of times the triangles are drawn per implementation (default 5)\n"
+                "  --textured N   1 to sample two textures per pixel (default 0)\n"
+                "  --threads N    GPU worker threads, 0 for one per CPU core (default 1)\n"
+                "  --seed N       seed of the triangle and shader generators (default 1)\n"
+                "  --shaders N    also run N random vertex shaders through the interpreter and the\n"
+                "                 shader JIT and compare their output (default 0)\n"
+                "  --transfers N  also run N random display transfers and N random memory fills\n"
+                "                 with and without SSE2 and compare their output (default 0)\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::shared_ptr<Log::Logger> logger = Log::InitGlobalLogger();
+    Log::Filter log_filter(Log::Level::Critical);
+    std::thread logging_thread(Log::TextLoggingLoop, logger, &log_filter);
+    SCOPE_EXIT({
+        logger->Close();
+        logging_thread.join();
+    });
+
+    int num_triangles = 20000;
+    float size = 16.0f;
+    int runs = 5;
+    bool textured = false;
+    int num_threads = 1;
+    u32 seed = 1;
+    int num_shaders = 0;
+    int num_transfers = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--triangles") {
+            num_triangles = std::atoi(argv[++i]);
+        } else if (arg == "--size") {
+            size = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--runs") {
+            runs = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--textured") {
+            textured = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--threads") {
+            num_threads = std::atoi(argv[++i]);
+        } else if (arg == "--seed") {
+            seed = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--shaders") {
+            num_shaders = std::atoi(argv[++i]);
+        } else if (arg == "--transfers") {
+            num_transfers = std::atoi(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    Memory::Init();
+    SCOPE_EXIT({ Memory::Shutdown(); });
+
+    Settings::values.gpu_worker_threads = num_threads;
+
+    std::vector<Implementation> implementations = { { "scalar", false } };
+#if defined(__x86_64__) || defined(_M_AMD64)
+    implementations.push_back({ "sse", true });
+#endif
+
+    TriangleGenerator generator(seed);
+    std::vector<OutputVertex> vertices(num_triangles * 3);
+    double total_area = 0.0;
+    for (int i = 0; i < num_triangles; ++i) {
+        generator.Generate(size, &vertices[i * 3]);
+        total_area += Area(&vertices[i * 3]);
+    }
+
+    u8* texture_data = Memory::GetPointer(Pica::PAddrToVAddr(TEXTURE_PADDR));
+    for (u32 i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE * 4; ++i)
+        texture_data[i] = static_cast<u8>(generator.Random(0.0f, 256.0f));
+
+    SetupRegisters(textured);
+
+    int failures = 0;
+    Snapshot reference;
+    for (const Implementation& implementation : implementations) {
+        Settings::values.use_simd_rasterizer = implementation.use_simd;
+
+        std::chrono::steady_clock::duration elapsed(0);
+        for (int run = 0; run < runs; ++run) {
+            ClearFramebuffer();
+
+            // Each run stands in for a single draw call
+            const auto start = std::chrono::steady_clock::now();
+            const auto draw_state = Pica::Rasterizer::GetDrawState();
+            for (int i = 0; i < num_triangles; ++i)
+                Pica::Rasterizer::ProcessTriangle(draw_state, vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]);
+            Pica::Rasterizer::Flush();
+            elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        const Snapshot snapshot = CaptureFramebuffer();
+        unsigned mismatches = 0;
+        if (&implementation == &implementations[0])
+            reference = snapshot;
+        else
+            mismatches = CountMismatches(reference, snapshot);
+        if (mismatches != 0)
+            ++failures;
+
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+        std::printf("bench: %-8s %10.0f triangles/s %8.2f Mpixels/s (%d mismatching pixels)\n",
+                    implementation.name, num_triangles * runs / seconds,
+                    total_area * runs / seconds / 1000000.0, mismatches);
+    }
+
+    if (textured) {
+        const auto stats = Pica::TextureCache::GetStats();
+        std::printf("texture cache: %llu hits, %llu misses, %llu revalidations, %llu invalidations, %.3f ms decoding\n",
+                    (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+                    (unsigned long long)stats.revalidations, (unsigned long long)stats.invalidations,
+                    stats.decode_time_us / 1000.0);
+    }
+
+    Pica::Rasterizer::Shutdown();
+
+    if (num_shaders > 0)
+        failures += ShaderBenchmark(seed, num_shaders);
+    if (num_transfers > 0)
+        failures += TransferTest(seed, num_transfers);
+
+    return failures == 0 ? 0 : 1;
+}
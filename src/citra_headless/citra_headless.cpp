@@ -0,0 +1,191 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Runs a title for a fixed number of frames without a window or graphics context, as fast as
+// the host allows, and reports the emulation throughput. The presented screens can be hashed on
+// every frame, e.g. to check that changes to the emulator don't affect the output, and dumped
+// to disk as images. The PICA command stream of a range of frames can be captured to a file for
+// citra-pica-replay.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "common/common.h"
+#include "common/logging/backend.h"
+#include "common/logging/filter.h"
+#include "common/logging/text_formatter.h"
+#include "common/scope_exit.h"
+
+#include "core/core.h"
+#include "core/settings.h"
+#include "core/system.h"
+#include "core/loader/loader.h"
+
+#include "video_core/video_core.h"
+#include "video_core/debug_utils/pica_capture.h"
+#include "video_core/renderer_headless/renderer_headless.h"
+
+#include "citra_headless/emu_window/emu_window_headless.h"
+
+namespace {
+
+/// Uses the same defaults as the default configuration of the other frontends
+void SetDefaultSettings() {
+    Settings::values.gpu_refresh_rate = 30;
+    Settings::values.frame_skip = 0;
+    Settings::values.translation_cache_size = 32;
+    Settings::values.use_cpu_jit = false;
+    Settings::values.skip_idle_loops = true;
+    Settings::values.vertex_cache_size = 32;
+    Settings::values.vertex_cache_policy = 0;
+    Settings::values.gpu_worker_threads = 0;
+    Settings::values.use_gpu_thread = true;
+    Settings::values.use_shader_jit = true;
+    Settings::values.use_simd_rasterizer = true;
+    Settings::values.use_virtual_sd = true;
+    Settings::values.log_filter = "*:Info";
+}
+
+void PrintUsage(const char* program) {
+    std::printf("Usage: %s <file> [options]\n"
+                "  --frames N         number of frames to run (default 600)\n"
+                "  --hash N           1 to print a hash of both screens on every frame (default 0)\n"
+                "  --dump-dir DIR     directory to write screen images to (default: no dumps)\n"
+                "  --dump-interval N  number of frames between two dumps (default 60)\n"
+                "  --cpu-jit N        1 to use the x86-64 CPU JIT (default 0)\n"
+                "  --idle-loops N     1 to skip ahead to the next event in guest idle loops (default 1)\n"
+                "  --gpu-threads N    GPU worker threads, 0 for one per CPU core (default 0)\n"
+                "  --gpu-thread N     1 to execute GPU commands on a separate thread (default 1, or 0\n"
+                "                     with --hash or --capture, so that their output is reproducible)\n"
+                "  --frame-skip N     frame skip setting (default 0)\n"
+                "  --log-filter F     log filter string (default *:Info)\n"
+                "  --capture FILE     file to capture the PICA command stream to, for citra-pica-replay\n"
+                "  --capture-start N  first frame to capture (default 0)\n"
+                "  --capture-frames N number of frames to capture (default 1)\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::shared_ptr<Log::Logger> logger = Log::InitGlobalLogger();
+    Log::Filter log_filter(Log::Level::Debug);
+    std::thread logging_thread(Log::TextLoggingLoop, logger, &log_filter);
+    SCOPE_EXIT({
+        logger->Close();
+        logging_thread.join();
+    });
+
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    SetDefaultSettings();
+
+    const std::string boot_filename = argv[1];
+    int num_frames = 600;
+    bool hashing = false;
+    std::string dump_directory;
+    int dump_interval = 60;
+    std::string capture_filename;
+    int capture_start = 0;
+    int capture_frames = 1;
+    bool gpu_thread_set = false;
+
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--frames") {
+            num_frames = std::atoi(argv[++i]);
+        } else if (arg == "--hash") {
+            hashing = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--dump-dir") {
+            dump_directory = argv[++i];
+        } else if (arg == "--dump-interval") {
+            dump_interval = std::atoi(argv[++i]);
+        } else if (arg == "--cpu-jit") {
+            Settings::values.use_cpu_jit = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--idle-loops") {
+            Settings::values.skip_idle_loops = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--gpu-threads") {
+            Settings::values.gpu_worker_threads = std::atoi(argv[++i]);
+        } else if (arg == "--gpu-thread") {
+            Settings::values.use_gpu_thread = std::atoi(argv[++i]) != 0;
+            gpu_thread_set = true;
+        } else if (arg == "--frame-skip") {
+            Settings::values.frame_skip = std::atoi(argv[++i]);
+        } else if (arg == "--log-filter") {
+            Settings::values.log_filter = argv[++i];
+        } else if (arg == "--capture") {
+            capture_filename = argv[++i];
+        } else if (arg == "--capture-start") {
+            capture_start = std::atoi(argv[++i]);
+        } else if (arg == "--capture-frames") {
+            capture_frames = std::atoi(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // With the GPU thread, interrupts are delivered depending on the timing of the host threads,
+    // so the emulated frames, and with them the hashes and captures, differ from run to run
+    if (!gpu_thread_set && (hashing || !capture_filename.empty()))
+        Settings::values.use_gpu_thread = false;
+
+    log_filter.ParseFilterString(Settings::values.log_filter);
+
+    EmuWindow_Headless emu_window;
+    VideoCore::g_create_renderer = []() -> RendererBase* { return new RendererHeadless(); };
+    System::Init(&emu_window);
+    SCOPE_EXIT({
+        // Commands still being executed may write to the capture until the system is shut down
+        System::Shutdown();
+        Pica::DebugUtils::FinishPicaCapture();
+    });
+
+    auto renderer = static_cast<RendererHeadless*>(VideoCore::g_renderer);
+    renderer->SetHashing(hashing);
+    renderer->SetFrameDump(dump_directory, dump_interval);
+
+    Loader::ResultStatus load_result = Loader::LoadFile(boot_filename);
+    if (Loader::ResultStatus::Success != load_result) {
+        LOG_CRITICAL(Frontend, "Failed to load ROM (Error %i)!", static_cast<int>(load_result));
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < num_frames; ) {
+        // The capture begins at the next frame boundary
+        if (!capture_filename.empty() && frame >= capture_start) {
+            Pica::DebugUtils::StartPicaCapture(capture_filename, capture_frames);
+            capture_filename.clear();
+        }
+
+        Core::RunLoop();
+
+        // Frames are counted by the renderer, so skipped frames don't count towards the total. A
+        // single run of the loop may present several frames, so the last run can overshoot.
+        for (; frame < std::min(renderer->current_frame(), num_frames); ++frame) {
+            if (hashing) {
+                const auto& hashes = renderer->GetFrameHashes()[frame];
+                std::printf("frame %d: top %016llx bottom %016llx\n", frame,
+                            (unsigned long long)hashes[0], (unsigned long long)hashes[1]);
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const int frames_run = renderer->current_frame();
+    std::printf("headless: %d frames in %.3f s, %.2f frames/s\n", frames_run, seconds, frames_run / seconds);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include "video_core/video_core.h"
+
+#include "citra_headless/emu_window/emu_window_headless.h"
+
+/// EmuWindow_Headless constructor
+EmuWindow_Headless::EmuWindow_Headless() {
+    // There is nothing to draw to, so report the size of the emulated screens
+    const std::pair<unsigned,unsigned> size(VideoCore::kScreenTopWidth,
+                                            VideoCore::kScreenTopHeight + VideoCore::kScreenBottomHeight);
+    NotifyFramebufferSizeChanged(size);
+    NotifyClientAreaSizeChanged(size);
+}
+
+/// EmuWindow_Headless destructor
+EmuWindow_Headless::~EmuWindow_Headless() {
+}
+
+/// Frames are presented without waiting for a vertical blank, so this returns immediately
+void EmuWindow_Headless::SwapBuffers() {
+}
+
+/// There is no input to poll for
+void EmuWindow_Headless::PollEvents() {
+}
+
+void EmuWindow_Headless::MakeCurrent() {
+}
+
+void EmuWindow_Headless::DoneCurrent() {
+}
+
+void EmuWindow_Headless::ReloadSetKeymaps() {
+}
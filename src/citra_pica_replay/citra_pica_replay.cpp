@@ -0,0 +1,301 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Replays a PICA command stream captured with citra-headless --capture and reports how long the
+// GPU emulation took for each frame and draw.
+//
+// The captured register writes are fed to the command processor as command lists, so neither the
+// CPU nor the kernel are emulated. Each draw is submitted as its own command list together with
+// the register writes leading up to it, and is timed including its rasterization. Memory uploads
+// recorded in the capture are applied between command lists and aren't timed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/common.h"
+#include "common/hash.h"
+#include "common/logging/backend.h"
+#include "common/logging/filter.h"
+#include "common/logging/text_formatter.h"
+#include "common/scope_exit.h"
+
+#include "core/mem_map.h"
+#include "core/settings.h"
+#include "core/hw/gpu_transfer.h"
+
+#include "video_core/command_processor.h"
+#include "video_core/pica.h"
+#include "video_core/rasterizer.h"
+#include "video_core/vertex_shader.h"
+#include "video_core/debug_utils/pica_capture.h"
+
+namespace {
+
+using Pica::DebugUtils::PicaCapture;
+
+/// Register writes up to and including a draw trigger, and the memory updates preceding them
+struct Segment {
+    std::vector<const PicaCapture::Packet*> memory_packets;
+    std::vector<u32> command_list;
+    bool is_draw;
+};
+
+typedef std::vector<Segment> Frame;
+
+/// Splits the captured packets into frames of separately timed segments
+std::vector<Frame> BuildFrames(const PicaCapture& capture) {
+    std::vector<Frame> frames(1);
+    Segment segment = {};
+
+    auto finish_segment = [&] {
+        if (!segment.memory_packets.empty() || !segment.command_list.empty())
+            frames.back().push_back(std::move(segment));
+        segment = Segment();
+    };
+
+    for (const auto& packet : capture.packets) {
+        switch (packet.type) {
+        case PicaCapture::PacketType::RegisterWrite:
+        {
+            const u32 id = packet.args[0];
+            const u32 mask = packet.args[2];
+
+            Pica::CommandProcessor::CommandHeader header;
+            header.hex = 0;
+            header.cmd_id = id;
+            header.parameter_mask = ((mask & 0x000000FF) ? 0x1 : 0) | ((mask & 0x0000FF00) ? 0x2 : 0) |
+                                    ((mask & 0x00FF0000) ? 0x4 : 0) | ((mask & 0xFF000000) ? 0x8 : 0);
+            segment.command_list.push_back(packet.args[1]);
+            segment.command_list.push_back(header.hex);
+
+            if (id == PICA_REG_INDEX(trigger_draw) || id == PICA_REG_INDEX(trigger_draw_indexed)) {
+                segment.is_draw = true;
+                finish_segment();
+            }
+            break;
+        }
+
+        // Memory is only read by draws, so updates can be applied before the whole segment
+        case PicaCapture::PacketType::MemoryUpdate:
+        case PicaCapture::PacketType::MemoryFill:
+            segment.memory_packets.push_back(&packet);
+            break;
+
+        case PicaCapture::PacketType::FrameEnd:
+            finish_segment();
+            frames.emplace_back();
+            break;
+        }
+    }
+
+    finish_segment();
+    if (frames.back().empty())
+        frames.pop_back();
+    return frames;
+}
+
+void RestoreInitialState(const PicaCapture::InitialState& state) {
+    for (unsigned i = 0; i < state.registers.size(); ++i)
+        Pica::registers[i] = state.registers[i];
+
+    for (u32 i = 0; i < state.shader_binary.size(); ++i)
+        Pica::VertexShader::SubmitShaderMemoryChange(i, state.shader_binary[i]);
+    for (u32 i = 0; i < state.swizzle_patterns.size(); ++i)
+        Pica::VertexShader::SubmitSwizzleDataChange(i, state.swizzle_patterns[i]);
+
+    for (u32 i = 0; i < 96; ++i) {
+        for (unsigned comp = 0; comp < 4; ++comp)
+            Pica::VertexShader::GetFloatUniform(i)[comp] = Pica::float24::FromFloat32(state.float_uniforms[i * 4 + comp]);
+    }
+    for (u32 i = 0; i < 4; ++i) {
+        for (unsigned comp = 0; comp < 4; ++comp)
+            Pica::VertexShader::GetIntUniform(i)[comp] = state.int_uniforms[i * 4 + comp];
+    }
+    for (u32 i = 0; i < 16; ++i)
+        Pica::VertexShader::GetBoolUniform(i) = state.bool_uniforms[i] != 0;
+}
+
+void ApplyMemoryPacket(const PicaCapture::Packet& packet) {
+    if (packet.type == PicaCapture::PacketType::MemoryFill) {
+        GPU::Regs::MemoryFillConfig config;
+        config.address_start = packet.args[0];
+        config.address_end = packet.args[1];
+        config.value_32bit = packet.args[2];
+        config.control = packet.args[3];
+        GPU::MemoryFill(config);
+        return;
+    }
+
+    const VAddr address = Pica::PAddrToVAddr(packet.args[0]);
+    u8* data = Memory::GetPointer(address);
+    if (data == nullptr) {
+        LOG_ERROR(HW_GPU, "Captured memory at invalid address 0x%08x", packet.args[0]);
+        return;
+    }
+
+    std::memcpy(data, packet.data.data(), packet.data.size());
+    Memory::InvalidateRegion(address, static_cast<u32>(packet.data.size()));
+}
+
+/// Returns a hash of the color buffer currently rendered to
+u64 HashColorBuffer() {
+    const auto& framebuffer = Pica::registers.framebuffer;
+    const u8* color_buffer = Memory::GetPointer(Pica::PAddrToVAddr(framebuffer.GetColorBufferPhysicalAddress()));
+    if (color_buffer == nullptr)
+        return 0;
+    return GetMurmurHash3(color_buffer, framebuffer.GetWidth() * framebuffer.GetHeight() * 4, 0);
+}
+
+void PrintUsage(const char* program) {
+    std::printf("Usage: %s <capture file> [options]\n"
+                "  --runs N         number of times the capture is replayed (default 1)\n"
+                "  --per-frame N    1 to print the time of every frame (default 1)\n"
+                "  --per-draw N     1 to print the time of every draw (default 0)\n"
+                "  --hash N         1 to print a hash of the color buffer after every frame (default 0)\n"
+                "  --gpu-threads N  GPU worker threads, 0 for one per CPU core (default 0)\n"
+                "  --simd N         1 to use the SIMD rasterizer (default 1)\n"
+                "  --shader-jit N   1 to use the vertex shader JIT (default 1)\n"
+                "  --log-filter F   log filter string (default *:Info Service.GSP:Error)\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::shared_ptr<Log::Logger> logger = Log::InitGlobalLogger();
+    Log::Filter log_filter(Log::Level::Debug);
+    std::thread logging_thread(Log::TextLoggingLoop, logger, &log_filter);
+    SCOPE_EXIT({
+        logger->Close();
+        logging_thread.join();
+    });
+
+    if (argc < 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    const std::string capture_filename = argv[1];
+    int runs = 1;
+    bool per_frame = true;
+    bool per_draw = false;
+    bool hashing = false;
+
+    // Triggered interrupts can't be delivered without the kernel, which GSP warns about
+    std::string filter = "*:Info Service.GSP:Error";
+
+    Settings::values.vertex_cache_size = 32;
+    Settings::values.vertex_cache_policy = 0;
+    Settings::values.gpu_worker_threads = 0;
+    Settings::values.use_shader_jit = true;
+    Settings::values.use_simd_rasterizer = true;
+
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--runs") {
+            runs = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--per-frame") {
+            per_frame = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--per-draw") {
+            per_draw = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--hash") {
+            hashing = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--gpu-threads") {
+            Settings::values.gpu_worker_threads = std::atoi(argv[++i]);
+        } else if (arg == "--simd") {
+            Settings::values.use_simd_rasterizer = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--shader-jit") {
+            Settings::values.use_shader_jit = std::atoi(argv[++i]) != 0;
+        } else if (arg == "--log-filter") {
+            filter = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    log_filter.ParseFilterString(filter);
+
+    PicaCapture capture;
+    if (!Pica::DebugUtils::LoadPicaCapture(capture_filename, capture))
+        return 1;
+
+    const std::vector<Frame> frames = BuildFrames(capture);
+
+    Memory::Init();
+    SCOPE_EXIT({ Memory::Shutdown(); });
+
+    typedef std::chrono::steady_clock Clock;
+
+    for (int run = 0; run < runs; ++run) {
+        RestoreInitialState(capture.initial_state);
+
+        Clock::duration total_time(0);
+        Clock::duration max_draw_time(0);
+        unsigned total_draws = 0;
+
+        for (unsigned frame_index = 0; frame_index < frames.size(); ++frame_index) {
+            Clock::duration frame_time(0);
+            unsigned frame_draws = 0;
+
+            for (const Segment& segment : frames[frame_index]) {
+                for (const PicaCapture::Packet* packet : segment.memory_packets)
+                    ApplyMemoryPacket(*packet);
+
+                if (segment.command_list.empty())
+                    continue;
+
+                const auto start = Clock::now();
+                Pica::CommandProcessor::ProcessCommandList(segment.command_list.data(),
+                                                           static_cast<u32>(segment.command_list.size() * sizeof(u32)));
+                const auto elapsed = Clock::now() - start;
+                frame_time += elapsed;
+
+                if (!segment.is_draw)
+                    continue;
+
+                if (per_draw) {
+                    std::printf("frame %u draw %u: %u vertices, %.3f ms\n", frame_index, frame_draws,
+                                Pica::registers.num_vertices,
+                                std::chrono::duration<double, std::milli>(elapsed).count());
+                }
+                max_draw_time = std::max(max_draw_time, elapsed);
+                ++frame_draws;
+            }
+
+            if (per_frame) {
+                std::printf("frame %u: %u draws, %.3f ms", frame_index, frame_draws,
+                            std::chrono::duration<double, std::milli>(frame_time).count());
+                if (hashing)
+                    std::printf(", color buffer %016llx", (unsigned long long)HashColorBuffer());
+                std::printf("\n");
+            } else if (hashing) {
+                std::printf("frame %u: color buffer %016llx\n", frame_index, (unsigned long long)HashColorBuffer());
+            }
+
+            total_time += frame_time;
+            total_draws += frame_draws;
+        }
+
+        const double seconds = std::chrono::duration<double>(total_time).count();
+        std::printf("replay: run %d, %u frames in %.3f ms, %.2f frames/s, %u draws, %.3f ms average / %.3f ms max per draw\n",
+                    run, static_cast<unsigned>(frames.size()), seconds * 1000.0, frames.size() / seconds, total_draws,
+                    total_draws ? seconds * 1000.0 / total_draws : 0.0,
+                    std::chrono::duration<double, std::milli>(max_draw_time).count());
+    }
+
+    Pica::CommandProcessor::Shutdown();
+    Pica::Rasterizer::Shutdown();
+
+    return 0;
+}
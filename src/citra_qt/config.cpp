@@ -45,6 +45,15 @@ void Config::ReadValues() {
     qt_config->beginGroup("Core");
     Settings::values.gpu_refresh_rate = qt_config->value("gpu_refresh_rate", 30).toInt();
     Settings::values.frame_skip = qt_config->value("frame_skip", 0).toInt();
+    Settings::values.translation_cache_size = qt_config->value("translation_cache_size", 32).toInt();
+    Settings::values.use_cpu_jit = qt_config->value("use_cpu_jit", false).toBool();
+    Settings::values.skip_idle_loops = qt_config->value("skip_idle_loops", true).toBool();
+    Settings::values.vertex_cache_size = qt_config->value("vertex_cache_size", 32).toInt();
+    Settings::values.vertex_cache_policy = qt_config->value("vertex_cache_policy", 0).toInt();
+    Settings::values.gpu_worker_threads = qt_config->value("gpu_worker_threads", 0).toInt();
+    Settings::values.use_gpu_thread = qt_config->value("use_gpu_thread", true).toBool();
+    Settings::values.use_shader_jit = qt_config->value("use_shader_jit", true).toBool();
+    Settings::values.use_simd_rasterizer = qt_config->value("use_simd_rasterizer", true).toBool();
     qt_config->endGroup();
 
     qt_config->beginGroup("Data Storage");
@@ -80,6 +89,15 @@ void Config::SaveValues() {
     qt_config->beginGroup("Core");
     qt_config->setValue("gpu_refresh_rate", Settings::values.gpu_refresh_rate);
     qt_config->setValue("frame_skip", Settings::values.frame_skip);
+    qt_config->setValue("translation_cache_size", Settings::values.translation_cache_size);
+    qt_config->setValue("use_cpu_jit", Settings::values.use_cpu_jit);
+    qt_config->setValue("skip_idle_loops", Settings::values.skip_idle_loops);
+    qt_config->setValue("vertex_cache_size", Settings::values.vertex_cache_size);
+    qt_config->setValue("vertex_cache_policy", Settings::values.vertex_cache_policy);
+    qt_config->setValue("gpu_worker_threads", Settings::values.gpu_worker_threads);
+    qt_config->setValue("use_gpu_thread", Settings::values.use_gpu_thread);
+    qt_config->setValue("use_shader_jit", Settings::values.use_shader_jit);
+    qt_config->setValue("use_simd_rasterizer", Settings::values.use_simd_rasterizer);
     qt_config->endGroup();
 
     qt_config->beginGroup("Data Storage");
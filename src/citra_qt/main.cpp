@@ -40,6 +40,10 @@
 #include "core/core.h"
 #include "core/loader/loader.h"
 #include "core/arm/disassembler/load_symbol_map.h"
+
+#include "video_core/video_core.h"
+#include "video_core/renderer_opengl/renderer_opengl.h"
+
 #include "citra_qt/config.h"
 
 #include "version.h"
@@ -187,6 +191,7 @@ void GMainWindow::OnDisplayTitleBars(bool show)
 void GMainWindow::BootGame(std::string filename)
 {
     LOG_INFO(Frontend, "Citra starting...\n");
+    VideoCore::g_create_renderer = []() -> RendererBase* { return new RendererOpenGL(); };
     System::Init(render_window);
 
     // Load a game or die...
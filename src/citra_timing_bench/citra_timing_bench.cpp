@@ -0,0 +1,338 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Differential test and throughput benchmark for the CoreTiming event queue.
+//
+// The test runs random sequences of scheduling, unscheduling and time advances against CoreTiming
+// and against a plain sorted list with the same semantics (events with equal times fire in the
+// order they were scheduled), and compares the fired events, their lateness and the unschedule
+// results. The benchmark measures schedule/unschedule pairs and schedule/dispatch cycles with a
+// given number of events pending in the background, like the thread wakeups and timers of a game.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/common.h"
+#include "common/logging/backend.h"
+#include "common/logging/filter.h"
+#include "common/logging/text_formatter.h"
+#include "common/scope_exit.h"
+
+#include "core/core.h"
+#include "core/core_timing.h"
+#include "core/arm/arm_interface.h"
+#include "core/arm/dyncom/arm_dyncom.h"
+
+namespace {
+
+const int NUM_EVENT_TYPES = 4;
+
+/// Userdata values are drawn from a small range, so that unscheduling finds several matches
+const u64 NUM_USERDATA_VALUES = 16;
+
+/// Events of the first type with userdata divisible by this reschedule themselves when they fire
+const u64 RESCHEDULE_DIVISOR = 3;
+
+struct FiredEvent {
+    int type;
+    u64 userdata;
+    int cycles_late;
+
+    bool operator==(const FiredEvent& other) const {
+        return type == other.type && userdata == other.userdata && cycles_late == other.cycles_late;
+    }
+};
+
+/// Reference model of the event queue
+class ReferenceQueue {
+public:
+    void Schedule(s64 time, int type, u64 userdata) {
+        const Event event = { time, type, userdata };
+        // Insert after all events with the same time, so that they fire in FIFO order
+        auto it = std::upper_bound(events.begin(), events.end(), event,
+                                   [](const Event& a, const Event& b) { return a.time < b.time; });
+        events.insert(it, event);
+    }
+
+    void ScheduleThreadsafe(s64 time, int type, u64 userdata) {
+        const Event event = { time, type, userdata };
+        ts_events.push_back(event);
+    }
+
+    s64 Unschedule(int type, u64 userdata) {
+        s64 result = 0;
+        auto matches = [&](const Event& event) {
+            if (event.type != type || event.userdata != userdata)
+                return false;
+            result = event.time - now;
+            return true;
+        };
+        events.erase(std::remove_if(events.begin(), events.end(), matches), events.end());
+        return result;
+    }
+
+    void Remove(int type) {
+        events.erase(std::remove_if(events.begin(), events.end(), [&](const Event& event) { return event.type == type; }),
+                     events.end());
+    }
+
+    bool IsScheduled(int type) const {
+        return std::any_of(events.begin(), events.end(), [&](const Event& event) { return event.type == type; });
+    }
+
+    void Advance(s64 cycles, std::vector<FiredEvent>& fired) {
+        now += cycles;
+
+        for (const Event& event : ts_events)
+            Schedule(event.time, event.type, event.userdata);
+        ts_events.clear();
+
+        while (!events.empty() && events.front().time <= now) {
+            const Event event = events.front();
+            events.erase(events.begin());
+
+            const FiredEvent fired_event = { event.type, event.userdata, (int)(now - event.time) };
+            fired.push_back(fired_event);
+            if (event.type == 0 && event.userdata % RESCHEDULE_DIVISOR == 0)
+                Schedule(now + 1000 + (s64)(event.userdata * 37), event.type, event.userdata);
+        }
+    }
+
+    s64 GetTicks() const {
+        return now;
+    }
+
+private:
+    struct Event {
+        s64 time;
+        int type;
+        u64 userdata;
+    };
+
+    std::vector<Event> events;
+    std::vector<Event> ts_events;
+    s64 now = 0;
+};
+
+std::vector<FiredEvent> fired_events;
+int event_types[NUM_EVENT_TYPES];
+
+void RecordingCallback(int type, u64 userdata, int cycles_late) {
+    const FiredEvent fired_event = { type, userdata, cycles_late };
+    fired_events.push_back(fired_event);
+    if (type == 0 && userdata % RESCHEDULE_DIVISOR == 0)
+        CoreTiming::ScheduleEvent(1000 + (s64)(userdata * 37), event_types[type], userdata);
+}
+
+void RegisterEvents(CoreTiming::TimedCallback (*make_callback)(int type)) {
+    for (int type = 0; type < NUM_EVENT_TYPES; ++type)
+        event_types[type] = CoreTiming::RegisterEvent("TimingBench", make_callback(type));
+}
+
+CoreTiming::TimedCallback MakeRecordingCallback(int type) {
+    return [type](u64 userdata, int cycles_late) { RecordingCallback(type, userdata, cycles_late); };
+}
+
+CoreTiming::TimedCallback MakeEmptyCallback(int) {
+    return [](u64, int) {};
+}
+
+/// Lets the given number of cycles pass, as if the CPU had executed them, and dispatches due events
+void RunCycles(s64 cycles) {
+    Core::g_app_core->down_count -= cycles;
+    CoreTiming::Advance();
+}
+
+/// Returns the number of differences found
+int RunDifferentialTest(int num_operations, u32 seed) {
+    std::mt19937 rng(seed);
+    auto random = [&rng](u32 n) { return std::uniform_int_distribution<u32>(0, n - 1)(rng); };
+
+    CoreTiming::Init();
+    RegisterEvents(MakeRecordingCallback);
+    fired_events.clear();
+
+    ReferenceQueue reference;
+    std::vector<FiredEvent> reference_fired;
+    int errors = 0;
+
+    auto report = [&](int operation, const char* what) {
+        if (errors++ < 10)
+            std::printf("seed %u, operation %d: %s differs\n", seed, operation, what);
+    };
+
+    for (int operation = 0; operation < num_operations && errors == 0; ++operation) {
+        const int type = random(NUM_EVENT_TYPES);
+        const u64 userdata = random(NUM_USERDATA_VALUES);
+        // Mostly short delays, sometimes several events at the same time or far in the future
+        const u32 kind = random(16);
+        const s64 cycles = kind == 0 ? 0 : kind < 12 ? random(20000) : random(10000000);
+
+        const s64 now = (s64)CoreTiming::GetTicks();
+        if (now != reference.GetTicks()) {
+            report(operation, "time");
+            break;
+        }
+
+        switch (random(10)) {
+        case 0: case 1: case 2: case 3:
+            CoreTiming::ScheduleEvent(cycles, event_types[type], userdata);
+            reference.Schedule(now + cycles, type, userdata);
+            break;
+
+        case 4:
+            CoreTiming::ScheduleEvent_Threadsafe(cycles, event_types[type], userdata);
+            reference.ScheduleThreadsafe(now + cycles, type, userdata);
+            break;
+
+        case 5: case 6:
+            if (CoreTiming::UnscheduleEvent(event_types[type], userdata) != reference.Unschedule(type, userdata))
+                report(operation, "UnscheduleEvent result");
+            break;
+
+        case 7:
+            if (random(8) == 0) {
+                CoreTiming::RemoveEvent(event_types[type]);
+                reference.Remove(type);
+            } else if (CoreTiming::IsScheduled(event_types[type]) != reference.IsScheduled(type)) {
+                report(operation, "IsScheduled result");
+            }
+            break;
+
+        default:
+            RunCycles(cycles);
+            reference.Advance(cycles, reference_fired);
+            if (fired_events != reference_fired)
+                report(operation, "sequence of fired events");
+            break;
+        }
+    }
+
+    CoreTiming::Shutdown();
+    return errors;
+}
+
+struct BenchResult {
+    double schedule_unschedule_ns;
+    double schedule_dispatch_ns;
+};
+
+BenchResult RunBenchmark(int pending_events, int iterations, u32 seed) {
+    std::mt19937 rng(seed);
+    auto random = [&rng](u32 n) { return std::uniform_int_distribution<u32>(0, n - 1)(rng); };
+
+    typedef std::chrono::steady_clock Clock;
+    BenchResult result;
+
+    CoreTiming::Init();
+    RegisterEvents(MakeEmptyCallback);
+
+    // Background events are far enough in the future to stay pending during the whole benchmark
+    const s64 far_future = 1000000000000LL;
+    for (int i = 0; i < pending_events; ++i)
+        CoreTiming::ScheduleEvent(far_future + random(1000000), event_types[i % NUM_EVENT_TYPES], 1000 + i);
+
+    std::vector<s64> delays(1024);
+    for (s64& delay : delays)
+        delay = 1 + random(100000);
+
+    // Like a thread waking up early: schedule a wakeup and cancel it before it fires
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        CoreTiming::ScheduleEvent(delays[i & 1023], event_types[0], i & 7);
+        CoreTiming::UnscheduleEvent(event_types[0], i & 7);
+    }
+    result.schedule_unschedule_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+    // Like a timer: schedule an event and run until it has fired
+    start = Clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        CoreTiming::ScheduleEvent(delays[i & 1023], event_types[1], 0);
+        RunCycles(delays[i & 1023]);
+    }
+    result.schedule_dispatch_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+    CoreTiming::Shutdown();
+    return result;
+}
+
+void PrintUsage(const char* program) {
+    std::printf("Usage: %s [options]\n"
+                "  --test N         number of differential test sequences, 0 to skip (default 20)\n"
+                "  --operations N   number of operations per test sequence (default 20000)\n"
+                "  --iterations N   benchmark iterations per queue size (default 1000000)\n"
+                "  --pending N      benchmark only with N pending events (default 0, 16, 256 and 4096)\n"
+                "  --seed N         random seed (default 1)\n", program);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::shared_ptr<Log::Logger> logger = Log::InitGlobalLogger();
+    Log::Filter log_filter(Log::Level::Critical);
+    std::thread logging_thread(Log::TextLoggingLoop, logger, &log_filter);
+    SCOPE_EXIT({
+        logger->Close();
+        logging_thread.join();
+    });
+
+    int num_tests = 20;
+    int num_operations = 20000;
+    int iterations = 1000000;
+    int pending = -1;
+    u32 seed = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--test") {
+            num_tests = std::atoi(argv[++i]);
+        } else if (arg == "--operations") {
+            num_operations = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--iterations") {
+            iterations = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--pending") {
+            pending = std::max(std::atoi(argv[++i]), 0);
+        } else if (arg == "--seed") {
+            seed = static_cast<u32>(std::strtoul(argv[++i], nullptr, 0));
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // CoreTiming counts down the cycles of the current slice in the application core
+    Core::g_app_core = new ARM_DynCom();
+    SCOPE_EXIT({
+        delete Core::g_app_core;
+        Core::g_app_core = nullptr;
+    });
+
+    int errors = 0;
+    for (int test = 0; test < num_tests; ++test)
+        errors += RunDifferentialTest(num_operations, seed + test);
+    if (num_tests > 0)
+        std::printf("test: %d sequences of %d operations, %d failed\n", num_tests, num_operations, errors);
+
+    std::vector<int> queue_sizes = { 0, 16, 256, 4096 };
+    if (pending >= 0)
+        queue_sizes = { pending };
+
+    for (int pending_events : queue_sizes) {
+        const BenchResult result = RunBenchmark(pending_events, iterations, seed);
+        std::printf("bench: %5d pending events, schedule+unschedule %7.1f ns, schedule+dispatch %7.1f ns\n",
+                    pending_events, result.schedule_unschedule_ns, result.schedule_dispatch_ns);
+    }
+
+    return errors != 0 ? 1 : 0;
+}
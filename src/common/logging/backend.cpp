@@ -3,10 +3,14 @@
 // Refer to the license.txt file included.
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
 #include "common/log.h" // For _dbg_assert_
 
 #include "common/logging/backend.h"
+#include "common/logging/filter.h"
 #include "common/logging/log.h"
 #include "common/logging/text_formatter.h"
 
@@ -48,18 +52,19 @@ static std::shared_ptr<Logger> global_logger;
         CLS(Render) \
         SUB(Render, Software) \
         SUB(Render, OpenGL) \
+        SUB(Render, Headless) \
         CLS(Loader)
 
-Logger::Logger() {
+Logger::Logger() : filter(nullptr) {
     // Register logging classes so that they can be queried at runtime
     size_t parent_class;
     all_classes.reserve((size_t)Class::Count);
 
 #define CLS(x) \
-        all_classes.push_back(Class::x); \
+        all_classes.emplace_back(Class::x); \
         parent_class = all_classes.size() - 1;
 #define SUB(x, y) \
-        all_classes.push_back(Class::x##_##y); \
+        all_classes.emplace_back(Class::x##_##y); \
         all_classes[parent_class].num_children += 1;
 
     ALL_LOG_CLASSES()
@@ -96,6 +101,11 @@ const char* Logger::GetLevelName(Level log_level) {
 #undef LVL
 }
 
+bool Logger::CheckMessage(Class log_class, Level log_level) const {
+    const Filter* current_filter = filter.load(std::memory_order_acquire);
+    return current_filter == nullptr || current_filter->CheckMessage(log_class, log_level);
+}
+
 void Logger::LogMessage(Entry entry) {
     ring_buffer.Push(std::move(entry));
 }
@@ -109,6 +119,323 @@ std::shared_ptr<Logger> InitGlobalLogger() {
     return global_logger;
 }
 
+/// Length modifier of a printf conversion specification
+enum class LengthModifier {
+    None, Char, Short, Long, LongLong, IntMax, Size, PtrDiff, LongDouble,
+};
+
+/// A printf conversion specification, e.g. `%-*.8llx`
+struct Conversion {
+    bool width_star;        ///< Whether the width is given as an argument
+    bool precision_star;    ///< Whether the precision is given as an argument
+    bool has_precision;
+    int precision;          ///< Precision, if given as a number
+    LengthModifier length;
+    char conversion;        ///< Conversion character, or '\0' if the format string ends early
+};
+
+/**
+ * Parses the conversion specification following a '%' of a format string.
+ * @param spec Pointer to the character following the '%'
+ * @return Pointer to the character following the conversion specification
+ */
+static const char* ParseConversion(const char* spec, Conversion& conversion) {
+    const char* p = spec;
+    conversion.width_star = false;
+    conversion.precision_star = false;
+    conversion.has_precision = false;
+    conversion.precision = 0;
+    conversion.length = LengthModifier::None;
+
+    while (*p != '\0' && std::strchr("-+ #0", *p) != nullptr)
+        ++p;
+
+    if (*p == '*') {
+        conversion.width_star = true;
+        ++p;
+    } else {
+        while (*p >= '0' && *p <= '9')
+            ++p;
+    }
+
+    if (*p == '.') {
+        ++p;
+        conversion.has_precision = true;
+        if (*p == '*') {
+            conversion.precision_star = true;
+            ++p;
+        } else {
+            while (*p >= '0' && *p <= '9')
+                conversion.precision = conversion.precision * 10 + (*p++ - '0');
+        }
+    }
+
+    switch (*p) {
+    case 'h':
+        conversion.length = (p[1] == 'h') ? LengthModifier::Char : LengthModifier::Short;
+        p += (p[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        conversion.length = (p[1] == 'l') ? LengthModifier::LongLong : LengthModifier::Long;
+        p += (p[1] == 'l') ? 2 : 1;
+        break;
+    case 'j': conversion.length = LengthModifier::IntMax; ++p; break;
+    case 'z': conversion.length = LengthModifier::Size; ++p; break;
+    case 't': conversion.length = LengthModifier::PtrDiff; ++p; break;
+    case 'L': conversion.length = LengthModifier::LongDouble; ++p; break;
+    }
+
+    conversion.conversion = *p;
+    return (*p != '\0') ? p + 1 : p;
+}
+
+/// Packs values into the arguments of an entry, failing once they don't fit
+class ArgumentWriter {
+public:
+    explicit ArgumentWriter(Entry& entry) : entry(entry) {}
+
+    template <typename T>
+    bool Write(T value) {
+        if (sizeof(T) > Entry::ARGUMENTS_SIZE - position)
+            return false;
+        std::memcpy(&entry.arguments[position], &value, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    bool WriteString(const char* str, size_t max_length) {
+        if (str == nullptr)
+            str = "(null)";
+        size_t length = 0;
+        while (length < max_length && str[length] != '\0')
+            ++length;
+        if (length + 1 > Entry::ARGUMENTS_SIZE - position)
+            return false;
+        std::memcpy(&entry.arguments[position], str, length);
+        entry.arguments[position + length] = '\0';
+        position += length + 1;
+        return true;
+    }
+
+private:
+    Entry& entry;
+    size_t position = 0;
+};
+
+/// Reads values from the arguments of an entry in the order they were packed
+class ArgumentReader {
+public:
+    explicit ArgumentReader(const Entry& entry) : entry(entry) {}
+
+    template <typename T>
+    T Read() {
+        T value;
+        std::memcpy(&value, &entry.arguments[position], sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    const char* ReadString() {
+        const char* str = &entry.arguments[position];
+        position += std::strlen(str) + 1;
+        return str;
+    }
+
+private:
+    const Entry& entry;
+    size_t position = 0;
+};
+
+/**
+ * Copies the arguments of a message into the entry. Integers are widened to 64 bits and floating
+ * point values to double, so that formatting only needs to handle a few types.
+ * @return False if a conversion isn't supported or the arguments don't fit
+ */
+static bool PackArguments(Entry& entry, const char* format, va_list args) {
+    ArgumentWriter writer(entry);
+
+    for (const char* p = format; *p != '\0'; ) {
+        if (*p++ != '%')
+            continue;
+        if (*p == '%') {
+            ++p;
+            continue;
+        }
+
+        Conversion conversion;
+        p = ParseConversion(p, conversion);
+
+        if (conversion.width_star && !writer.Write<s32>(va_arg(args, int)))
+            return false;
+        int precision = conversion.precision;
+        if (conversion.precision_star) {
+            precision = va_arg(args, int);
+            if (!writer.Write<s32>(precision))
+                return false;
+        }
+
+        bool written;
+        switch (conversion.conversion) {
+        case 'd': case 'i':
+            switch (conversion.length) {
+            case LengthModifier::Char: written = writer.Write<s64>((signed char)va_arg(args, int)); break;
+            case LengthModifier::Short: written = writer.Write<s64>((short)va_arg(args, int)); break;
+            case LengthModifier::Long: written = writer.Write<s64>(va_arg(args, long)); break;
+            case LengthModifier::LongLong: written = writer.Write<s64>(va_arg(args, long long)); break;
+            case LengthModifier::IntMax: written = writer.Write<s64>(va_arg(args, intmax_t)); break;
+            case LengthModifier::Size: written = writer.Write<s64>((s64)va_arg(args, size_t)); break;
+            case LengthModifier::PtrDiff: written = writer.Write<s64>(va_arg(args, ptrdiff_t)); break;
+            default: written = writer.Write<s64>(va_arg(args, int)); break;
+            }
+            break;
+
+        case 'u': case 'o': case 'x': case 'X':
+            switch (conversion.length) {
+            case LengthModifier::Char: written = writer.Write<u64>((unsigned char)va_arg(args, unsigned)); break;
+            case LengthModifier::Short: written = writer.Write<u64>((unsigned short)va_arg(args, unsigned)); break;
+            case LengthModifier::Long: written = writer.Write<u64>(va_arg(args, unsigned long)); break;
+            case LengthModifier::LongLong: written = writer.Write<u64>(va_arg(args, unsigned long long)); break;
+            case LengthModifier::IntMax: written = writer.Write<u64>(va_arg(args, uintmax_t)); break;
+            case LengthModifier::Size: written = writer.Write<u64>(va_arg(args, size_t)); break;
+            case LengthModifier::PtrDiff: written = writer.Write<u64>((u64)va_arg(args, ptrdiff_t)); break;
+            default: written = writer.Write<u64>(va_arg(args, unsigned)); break;
+            }
+            break;
+
+        case 'c':
+            written = conversion.length == LengthModifier::None && writer.Write<s32>(va_arg(args, int));
+            break;
+
+        case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+            if (conversion.length == LengthModifier::LongDouble) {
+                written = writer.Write<double>((double)va_arg(args, long double));
+            } else {
+                written = writer.Write<double>(va_arg(args, double));
+            }
+            break;
+
+        case 's':
+            // Only as many characters as the precision allows are read, the string doesn't need to
+            // be null-terminated then
+            written = conversion.length == LengthModifier::None &&
+                      writer.WriteString(va_arg(args, const char*),
+                                         (conversion.has_precision && precision >= 0) ? precision : SIZE_MAX);
+            break;
+
+        case 'p':
+            written = writer.Write<u64>(reinterpret_cast<uintptr_t>(va_arg(args, void*)));
+            break;
+
+        default:
+            // %n, wide characters and malformed conversions
+            written = false;
+            break;
+        }
+
+        if (!written)
+            return false;
+    }
+
+    return true;
+}
+
+void FormatEntryMessage(const Entry& entry, char* out_text, size_t text_len) {
+    if (text_len == 0)
+        return;
+
+    if (entry.format == nullptr) {
+        snprintf(out_text, text_len, "%s", entry.long_message ? entry.long_message.get() : entry.arguments.data());
+        return;
+    }
+
+    ArgumentReader reader(entry);
+    size_t position = 0;
+    auto append = [&](int length) {
+        if (length > 0)
+            position = std::min(position + length, text_len - 1);
+    };
+
+    for (const char* p = entry.format; *p != '\0' && position < text_len - 1; ) {
+        if (*p != '%') {
+            out_text[position++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out_text[position++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Rebuild the conversion specification with the widths from the arguments filled in and
+        // the length modifier of the packed type
+        const char* spec = ++p;
+        Conversion conversion;
+        p = ParseConversion(p, conversion);
+
+        char format[64];
+        size_t format_length = 0;
+        format[format_length++] = '%';
+        for (const char* c = spec; c != p - 1 && format_length < 32; ++c) {
+            if (*c == '*') {
+                const int value = reader.Read<s32>();
+                // A negative precision counts as if it was omitted
+                if (value < 0 && c != spec && *(c - 1) == '.') {
+                    --format_length;
+                    continue;
+                }
+                format_length += snprintf(&format[format_length], 12, "%d", value);
+            } else if (std::strchr("hljztL", *c) == nullptr) {
+                format[format_length++] = *c;
+            }
+        }
+
+        switch (conversion.conversion) {
+        case 'd': case 'i':
+            std::strcpy(&format[format_length], "ll");
+            format_length += 2;
+            format[format_length++] = conversion.conversion;
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format, (long long)reader.Read<s64>()));
+            break;
+
+        case 'u': case 'o': case 'x': case 'X':
+            std::strcpy(&format[format_length], "ll");
+            format_length += 2;
+            format[format_length++] = conversion.conversion;
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format, (unsigned long long)reader.Read<u64>()));
+            break;
+
+        case 'c':
+            format[format_length++] = 'c';
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format, (int)reader.Read<s32>()));
+            break;
+
+        case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+            format[format_length++] = conversion.conversion;
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format, reader.Read<double>()));
+            break;
+
+        case 's':
+            format[format_length++] = 's';
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format, reader.ReadString()));
+            break;
+
+        case 'p':
+            format[format_length++] = 'p';
+            format[format_length] = '\0';
+            append(snprintf(&out_text[position], text_len - position, format,
+                            reinterpret_cast<void*>(static_cast<uintptr_t>(reader.Read<u64>()))));
+            break;
+        }
+    }
+
+    out_text[position] = '\0';
+}
+
 Entry CreateEntry(Class log_class, Level log_level,
                         const char* filename, unsigned int line_nr, const char* function,
                         const char* format, va_list args) {
@@ -117,20 +444,37 @@ Entry CreateEntry(Class log_class, Level log_level,
 
     static steady_clock::time_point time_origin = steady_clock::now();
 
-    std::array<char, 4 * 1024> formatting_buffer;
-
     Entry entry;
     entry.timestamp = duration_cast<std::chrono::microseconds>(steady_clock::now() - time_origin);
     entry.log_class = log_class;
     entry.log_level = log_level;
+    entry.line_nr = line_nr;
+    entry.filename = filename;
+    entry.function = function;
+    entry.format = format;
+
+    va_list packed_args;
+    va_copy(packed_args, args);
+    const bool packed = PackArguments(entry, format, packed_args);
+    va_end(packed_args);
 
-    snprintf(formatting_buffer.data(), formatting_buffer.size(), "%s:%s:%u", filename, function, line_nr);
-    entry.location = std::string(formatting_buffer.data());
+    if (!packed) {
+        // Format the message right away. The rare messages that don't fit into the entry are kept
+        // on the heap, so that they aren't cut shorter than messages formatted later.
+        std::array<char, 4 * 1024> formatting_buffer;
+        vsnprintf(formatting_buffer.data(), formatting_buffer.size(), format, args);
 
-    vsnprintf(formatting_buffer.data(), formatting_buffer.size(), format, args);
-    entry.message = std::string(formatting_buffer.data());
+        const size_t length = std::strlen(formatting_buffer.data());
+        entry.format = nullptr;
+        if (length < entry.arguments.size()) {
+            std::memcpy(entry.arguments.data(), formatting_buffer.data(), length + 1);
+        } else {
+            entry.long_message.reset(new char[length + 1]);
+            std::memcpy(entry.long_message.get(), formatting_buffer.data(), length + 1);
+        }
+    }
 
-    return std::move(entry);
+    return entry;
 }
 
 void LogMessage(Class log_class, Level log_level,
@@ -138,16 +482,19 @@ void LogMessage(Class log_class, Level log_level,
                 const char* format, ...) {
     va_list args;
     va_start(args, format);
-    Entry entry = CreateEntry(log_class, log_level,
-            filename, line_nr, function, format, args);
-    va_end(args);
 
     if (global_logger != nullptr && !global_logger->IsClosed()) {
-        global_logger->LogMessage(std::move(entry));
+        // Filtered messages are dropped before anything is copied or formatted
+        if (global_logger->CheckMessage(log_class, log_level)) {
+            global_logger->LogMessage(CreateEntry(log_class, log_level,
+                    filename, line_nr, function, format, args));
+        }
     } else {
         // Fall back to directly printing to stderr
-        PrintMessage(entry);
+        PrintMessage(CreateEntry(log_class, log_level, filename, line_nr, function, format, args));
     }
+
+    va_end(args);
 }
 
 }
@@ -4,44 +4,69 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdarg>
 #include <memory>
 #include <vector>
 
-#include "common/concurrent_ring_buffer.h"
+#include "common/mpsc_ring_buffer.h"
 
 #include "common/logging/log.h"
 
 namespace Log {
 
+class Filter;
+
 /**
  * A log entry. Log entries are store in a structured format to permit more varied output
  * formatting on different frontends, as well as facilitating filtering and aggregation.
+ *
+ * To keep logging cheap for the emulation threads, the message isn't formatted when it is logged:
+ * the entry only references the format string and the source location, which are string literals,
+ * and holds a copy of the arguments of the message. It is formatted by the log outputter, see
+ * FormatEntryMessage.
  */
 struct Entry {
+    /// Size of the packed arguments, including the characters of string arguments
+    static const size_t ARGUMENTS_SIZE = 216;
+
     std::chrono::microseconds timestamp;
     Class log_class;
     Level log_level;
-    std::string location;
-    std::string message;
+    unsigned int line_nr;
+    const char* filename;
+    const char* function;
+    /**
+     * Format string of the message. If the arguments couldn't be packed (e.g. because they don't
+     * fit), this is nullptr and `arguments` holds the already formatted message instead.
+     */
+    const char* format;
+    std::array<char, ARGUMENTS_SIZE> arguments;
+    /// Formatted message that is too long for `arguments`, only set if `format` is nullptr
+    std::unique_ptr<char[]> long_message;
 
     Entry() = default;
 
     // TODO(yuriks) Use defaulted move constructors once MSVC supports them
 #define MOVE(member) member(std::move(o.member))
     Entry(Entry&& o)
-        : MOVE(timestamp), MOVE(log_class), MOVE(log_level),
-        MOVE(location), MOVE(message)
+        : MOVE(timestamp), MOVE(log_class), MOVE(log_level), MOVE(line_nr), MOVE(filename),
+        MOVE(function), MOVE(format), MOVE(arguments), MOVE(long_message)
     {}
 #undef MOVE
 
-    Entry& operator=(const Entry&& o) {
+    Entry& operator=(Entry&& o) {
 #define MOVE(member) member = std::move(o.member)
         MOVE(timestamp);
         MOVE(log_class);
         MOVE(log_level);
-        MOVE(location);
-        MOVE(message);
+        MOVE(line_nr);
+        MOVE(filename);
+        MOVE(function);
+        MOVE(format);
+        MOVE(arguments);
+        MOVE(long_message);
 #undef MOVE
         return *this;
     }
@@ -54,9 +79,10 @@ struct ClassInfo {
         * Total number of (direct or indirect) sub classes this class has. If any, they follow in
         * sequence after this class in the class list.
         */
-    unsigned int num_children = 0;
+    unsigned int num_children;
 
-    ClassInfo(Class log_class) : log_class(log_class) {}
+    explicit ClassInfo(Class log_class, unsigned int num_children = 0)
+        : log_class(log_class), num_children(num_children) {}
 };
 
 /**
@@ -66,7 +92,7 @@ struct ClassInfo {
  */
 class Logger {
 private:
-    using Buffer = Common::ConcurrentRingBuffer<Entry, 16 * 1024 / sizeof(Entry)>;
+    using Buffer = Common::MPSCRingBuffer<Entry, 1024>;
 
 public:
     static const size_t QUEUE_CLOSED = Buffer::QUEUE_CLOSED;
@@ -92,14 +118,28 @@ public:
     static const char* GetLevelName(Level log_level);
 
     /**
-     * Appends a messages to the log buffer.
+     * Sets the filter that messages are checked against before they are added to the log buffer,
+     * or nullptr to accept all messages.
+     * @note The filter must stay alive until it is replaced or the logger is closed.
+     */
+    void SetFilter(const Filter* filter) { this->filter = filter; }
+
+    /**
+     * Returns true if a message of the given class and level passes the filter.
      * @note This function is thread safe.
      */
+    bool CheckMessage(Class log_class, Level log_level) const;
+
+    /**
+     * Appends a messages to the log buffer. If the buffer is full, the message is dropped instead
+     * of waiting for the log outputter.
+     * @note This function is thread safe and lock-free.
+     */
     void LogMessage(Entry entry);
 
     /**
      * Retrieves a batch of messages from the log buffer, blocking until they are available.
-     * @note This function is thread safe.
+     * @note Only one thread may retrieve messages.
      *
      * @param out_buffer Destination buffer that will receive the log entries.
      * @param buffer_len The maximum size of `out_buffer`.
@@ -108,6 +148,9 @@ public:
      */
     size_t GetEntries(Entry* out_buffer, size_t buffer_len);
 
+    /// Returns the number of messages dropped so far because the log buffer was full.
+    size_t GetDroppedCount() const { return ring_buffer.GetDroppedCount(); }
+
     /**
      * Initiates a shutdown of the logger. This will indicate to log output clients that they
      * should shutdown.
@@ -122,12 +165,15 @@ public:
 private:
     Buffer ring_buffer;
     std::vector<ClassInfo> all_classes;
+    std::atomic<const Filter*> filter;
 };
 
-/// Creates a log entry by formatting the given source location, and message.
+/// Creates a log entry from the given source location, format string and message arguments.
 Entry CreateEntry(Class log_class, Level log_level,
                         const char* filename, unsigned int line_nr, const char* function,
                         const char* format, va_list args);
+/// Formats the message of a log entry into the provided text buffer.
+void FormatEntryMessage(const Entry& entry, char* out_text, size_t text_len);
 /// Initializes the default Logger.
 std::shared_ptr<Logger> InitGlobalLogger();
 
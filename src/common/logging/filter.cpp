@@ -15,11 +15,13 @@ Filter::Filter(Level default_level) {
 }
 
 void Filter::ResetAll(Level level) {
-    class_levels.fill(level);
+    for (auto& class_level : class_levels) {
+        class_level.store(level, std::memory_order_relaxed);
+    }
 }
 
 void Filter::SetClassLevel(Class log_class, Level level) {
-    class_levels[static_cast<size_t>(log_class)] = level;
+    class_levels[static_cast<size_t>(log_class)].store(level, std::memory_order_relaxed);
 }
 
 void Filter::SetSubclassesLevel(const ClassInfo& log_class, Level level) {
@@ -27,8 +29,8 @@ void Filter::SetSubclassesLevel(const ClassInfo& log_class, Level level) {
 
     const size_t begin = log_class_i + 1;
     const size_t end = begin + log_class.num_children;
-    for (size_t i = begin; begin < end; ++i) {
-        class_levels[i] = level;
+    for (size_t i = begin; i < end; ++i) {
+        class_levels[i].store(level, std::memory_order_relaxed);
     }
 }
 
@@ -72,6 +74,19 @@ static Class GetClassByName(const It begin, const It end) {
     return Class::Count;
 }
 
+/// Returns the class info of a log class, counting its subclasses, which directly follow it
+static ClassInfo GetClassInfo(Class log_class) {
+    const std::string prefix = std::string(Logger::GetLogClassName(log_class)) + '.';
+
+    unsigned int num_children = 0;
+    for (ClassType i = static_cast<ClassType>(log_class) + 1; i < static_cast<ClassType>(Class::Count); ++i) {
+        if (std::string(Logger::GetLogClassName(static_cast<Class>(i))).compare(0, prefix.size(), prefix) != 0)
+            break;
+        ++num_children;
+    }
+    return ClassInfo(log_class, num_children);
+}
+
 template <typename InputIt, typename T>
 static InputIt find_last(InputIt begin, const InputIt end, const T& value) {
     auto match = end;
@@ -121,12 +136,13 @@ bool Filter::ParseFilterRule(const std::string::const_iterator begin,
     if (class_name_end == level_separator) {
         SetClassLevel(log_class, level);
     }
-    SetSubclassesLevel(log_class, level);
+    SetSubclassesLevel(GetClassInfo(log_class), level);
     return true;
 }
 
 bool Filter::CheckMessage(Class log_class, Level level) const {
-    return static_cast<u8>(level) >= static_cast<u8>(class_levels[static_cast<size_t>(log_class)]);
+    const Level class_level = class_levels[static_cast<size_t>(log_class)].load(std::memory_order_relaxed);
+    return static_cast<u8>(level) >= static_cast<u8>(class_level);
 }
 
 }
@@ -3,6 +3,7 @@
 // Refer to the license.txt file included.
 
 #include <array>
+#include <atomic>
 #include <string>
 
 #include "common/logging/log.h"
@@ -14,7 +15,8 @@ struct ClassInfo;
 /**
  * Implements a log message filter which allows different log classes to have different minimum
  * severity levels. The filter can be changed at runtime and can be parsed from a string to allow
- * editing via the interface or loading from a configuration file.
+ * editing via the interface or loading from a configuration file. It is checked by all threads
+ * that log messages, so the levels are atomic.
  */
 class Filter {
 public:
@@ -57,7 +59,7 @@ public:
     bool CheckMessage(Class log_class, Level level) const;
 
 private:
-    std::array<Level, (size_t)Class::Count> class_levels;
+    std::array<std::atomic<Level>, (size_t)Class::Count> class_levels;
 };
 
 }
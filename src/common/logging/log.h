@@ -68,6 +68,7 @@ enum class Class : ClassType {
     Render,                     ///< Emulator video output and hardware acceleration
     Render_Software,            ///< Software renderer backend
     Render_OpenGL,              ///< OpenGL backend
+    Render_Headless,            ///< Headless backend
     Loader,                     ///< ROM loader
 
     Count ///< Total number of logging classes
@@ -75,8 +76,11 @@ enum class Class : ClassType {
 
 /**
  * Logs a message to the global logger. This proxy exists to avoid exposing the details of the
- * Logger class, including the ConcurrentRingBuffer template, to all files that desire to log
+ * Logger class, including the MPSCRingBuffer template, to all files that desire to log
  * messages, reducing unecessary recompilations.
+ *
+ * The message is formatted later on the logging thread, so `filename`, `function` and `format`
+ * must be string literals (as passed by the LOG_* macros). String arguments are copied.
  */
 void LogMessage(Class log_class, Level log_level,
     const char* filename, unsigned int line_nr, const char* function,
@@ -49,9 +49,12 @@ void FormatLogMessage(const Entry& entry, char* out_text, size_t text_len) {
     const char* class_name = Logger::GetLogClassName(entry.log_class);
     const char* level_name = Logger::GetLevelName(entry.log_level);
 
-    snprintf(out_text, text_len, "[%4u.%06u] %s <%s> %s: %s",
+    std::array<char, 4 * 1024> message;
+    FormatEntryMessage(entry, message.data(), message.size());
+
+    snprintf(out_text, text_len, "[%4u.%06u] %s <%s> %s:%s:%u: %s",
         time_seconds, time_fractional, class_name, level_name,
-        TrimSourcePath(entry.location.c_str()), entry.message.c_str());
+        TrimSourcePath(entry.filename), entry.function, entry.line_nr, message.data());
 }
 
 void PrintMessage(const Entry& entry) {
@@ -119,11 +122,22 @@ void PrintColoredMessage(const Entry& entry) {
 void TextLoggingLoop(std::shared_ptr<Logger> logger, const Filter* filter) {
     std::array<Entry, 256> entry_buffer;
 
+    logger->SetFilter(filter);
+    size_t num_dropped = 0;
+
     while (true) {
         size_t num_entries = logger->GetEntries(entry_buffer.data(), entry_buffer.size());
         if (num_entries == Logger::QUEUE_CLOSED) {
             break;
         }
+
+        // Logged like any other message, so that the filter applies to it as well
+        const size_t dropped = logger->GetDroppedCount();
+        if (dropped != num_dropped) {
+            LOG_WARNING(Log, "%u messages were dropped because the log buffer was full",
+                        static_cast<unsigned int>(dropped - num_dropped));
+            num_dropped = dropped;
+        }
         for (size_t i = 0; i < num_entries; ++i) {
             const Entry& entry = entry_buffer[i];
             if (filter->CheckMessage(entry.log_class, entry.log_level)) {
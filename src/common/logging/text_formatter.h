@@ -34,7 +34,8 @@ void PrintColoredMessage(const Entry& entry);
 
 /**
  * Logging loop that repeatedly reads messages from the provided logger and prints them to the
- * console. It is the baseline barebones log outputter.
+ * console. It is the baseline barebones log outputter. The filter is also registered with the
+ * logger, so that filtered out messages are dropped before they are even queued.
  */
 void TextLoggingLoop(std::shared_ptr<Logger> logger, const Filter* filter);
 
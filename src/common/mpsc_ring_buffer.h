@@ -0,0 +1,190 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+#include "common/common.h" // for NonCopyable
+
+namespace Common {
+
+/**
+ * A lock-free MPSC (Multiple-Producer Single-Consumer) ring buffer of preallocated slots. Pushing
+ * never blocks or takes a lock while the consumer is busy: if the buffer is full, the value is
+ * dropped and counted instead. The consumer pops values in batches, and only sleeps on a condition
+ * variable when the buffer is empty.
+ *
+ * Each slot has a sequence number which tells whether it is free for the producer that claimed its
+ * index, or holds a value for the consumer (D. Vyukov's bounded queue).
+ *
+ * @tparam T Type of the values, which are moved into and out of the slots
+ * @tparam ArraySize Number of slots, a power of two
+ */
+template <typename T, size_t ArraySize>
+class MPSCRingBuffer : private NonCopyable {
+    static_assert(ArraySize >= 2 && (ArraySize & (ArraySize - 1)) == 0, "ArraySize must be a power of two");
+
+public:
+    /// Value returned by the popping functions when the queue has been closed.
+    static const size_t QUEUE_CLOSED = -1;
+
+    MPSCRingBuffer() {
+        for (size_t i = 0; i < ArraySize; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * Pushes a value to the queue. Does nothing if the queue is closed.
+     * @note This function is thread safe.
+     * @return False if the value was dropped because the queue was full or closed, `value` is
+     *         left untouched then
+     */
+    bool Push(T&& value) {
+        if (closed.load(std::memory_order_relaxed))
+            return false;
+
+        size_t index = write_index.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[index % ArraySize];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const ptrdiff_t difference = static_cast<ptrdiff_t>(sequence - index);
+
+            if (difference == 0) {
+                // The slot is free, try to claim it
+                if (write_index.compare_exchange_weak(index, index + 1, std::memory_order_relaxed))
+                    break;
+            } else if (difference < 0) {
+                // The slot still holds the value pushed one lap ago, the queue is full
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                // Another producer claimed the slot first
+                index = write_index.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->sequence.store(index + 1, std::memory_order_release);
+
+        // Pairs with the fence in BlockingPop, so that either the consumer sees the value before
+        // going to sleep, or it is seen waiting here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumer_waiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            reader.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * Pops up to `dest_len` items from the queue, storing them in `dest`. This function will not
+     * block, and might return 0 values if there are no elements in the queue when it is called.
+     * @note Only one thread may pop from the queue.
+     *
+     * @return The number of elements stored in `dest`. If the queue has been closed and drained,
+     *         returns `QUEUE_CLOSED`.
+     */
+    size_t Pop(T* dest, size_t dest_len) {
+        // Read the flag first, values pushed before the queue was closed are still returned
+        const bool is_closed = closed.load(std::memory_order_acquire);
+        const size_t count = PopInternal(dest, dest_len);
+        return (count == 0 && is_closed) ? QUEUE_CLOSED : count;
+    }
+
+    /**
+     * Pops up to `dest_len` items from the queue, storing them in `dest`. This function will block
+     * if there are no elements in the queue when it is called.
+     * @note Only one thread may pop from the queue.
+     *
+     * @return The number of elements stored in `dest`. If the queue has been closed and drained,
+     *         returns `QUEUE_CLOSED`.
+     */
+    size_t BlockingPop(T* dest, size_t dest_len) {
+        while (true) {
+            const size_t count = Pop(dest, dest_len);
+            if (count != 0)
+                return count;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            consumer_waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            reader.wait(lock, [this] { return CanRead() || closed.load(std::memory_order_relaxed); });
+            consumer_waiting.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Closes the queue. After calling this method, `Push` operations won't have any effect, and
+     * `Pop` and `BlockingPop` will start returning `QUEUE_CLOSED` once the queue is drained. This is
+     * intended to allow a graceful shutdown of the consumer.
+     */
+    void Close() {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed.store(true, std::memory_order_release);
+        // We need to wake up the reader if it is waiting for an item that will never come.
+        lock.unlock();
+        reader.notify_all();
+    }
+
+    /// Returns true if `Close()` has been called.
+    bool IsClosed() const {
+        return closed.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the number of values dropped so far because the queue was full.
+    size_t GetDroppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        /// Equal to the write index that may claim the slot if it is free, one more if it holds a value
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    size_t PopInternal(T* dest, size_t dest_len) {
+        size_t output_count = 0;
+        while (output_count < dest_len && CanRead()) {
+            Slot& slot = slots[read_index % ArraySize];
+            dest[output_count++] = std::move(slot.value);
+            // Free the slot for the producer of the next lap
+            slot.sequence.store(read_index + ArraySize, std::memory_order_release);
+            ++read_index;
+        }
+        return output_count;
+    }
+
+    /// Returns true if the next slot holds a value. Values are popped in the order the slots were
+    /// claimed, so a producer that has claimed a slot but not written it yet holds up the consumer.
+    bool CanRead() const {
+        return slots[read_index % ArraySize].sequence.load(std::memory_order_acquire) == read_index + 1;
+    }
+
+    std::array<Slot, ArraySize> slots;
+
+    /// Index of the next slot to be claimed by a producer
+    std::atomic<size_t> write_index{0};
+    /// Keeps the index written by producers and the consumer state on separate cache lines
+    char padding[64];
+    /// Index of the next slot to be popped, only accessed by the consumer
+    size_t read_index = 0;
+
+    std::atomic<size_t> dropped{0};
+    std::atomic<bool> closed{false};
+    std::atomic<bool> consumer_waiting{false};
+
+    /// Mutex used for sleeping while the queue is empty, producers only take it to wake the consumer
+    std::mutex mutex;
+    /// Signaling wakes up the reader which is waiting for storage to be non-empty.
+    std::condition_variable reader;
+};
+
+} // namespace
@@ -0,0 +1,71 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <string>
+
+#include "common/thread.h"
+#include "common/thread_pool.h"
+
+namespace Common {
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    if (num_threads == 0)
+        num_threads = HardwareConcurrency();
+
+    for (unsigned i = 0; i < num_threads; ++i)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+std::future<void> ThreadPool::Push(std::function<void()> task) {
+    std::packaged_task<void()> packaged_task(std::move(task));
+    std::future<void> result = packaged_task.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(packaged_task));
+    }
+    task_available.notify_one();
+
+    return result;
+}
+
+unsigned ThreadPool::HardwareConcurrency() {
+    const unsigned count = std::thread::hardware_concurrency();
+    return (count != 0) ? count : 1;
+}
+
+void ThreadPool::WorkerLoop(unsigned worker_index) {
+    SetCurrentThreadName(("ThreadPoolWorker" + std::to_string(worker_index)).c_str());
+
+    while (true) {
+        std::packaged_task<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_available.wait(lock, [&]{ return stopping || !tasks.empty(); });
+
+            // Drain the queue before stopping so that no future is left without a result
+            if (tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
+
+} // namespace
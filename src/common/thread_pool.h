@@ -0,0 +1,57 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "common/common.h" // for NonCopyable
+
+namespace Common {
+
+/**
+ * A fixed-size pool of worker threads running tasks in submission order. Tasks are expected to be
+ * short-lived pieces of a larger job, e.g. a batch of vertices, which the submitting thread waits
+ * for through the returned future.
+ */
+class ThreadPool : private NonCopyable {
+public:
+    /**
+     * Starts the worker threads.
+     * @param num_threads Number of worker threads, 0 uses one thread per hardware thread
+     */
+    explicit ThreadPool(unsigned num_threads);
+
+    /// Finishes all pending tasks and joins the worker threads
+    ~ThreadPool();
+
+    /**
+     * Queues a task for execution on one of the worker threads.
+     * @return Future which becomes ready once the task has completed
+     */
+    std::future<void> Push(std::function<void()> task);
+
+    /// Returns the number of worker threads
+    unsigned NumThreads() const { return static_cast<unsigned>(workers.size()); }
+
+    /// Returns the number of hardware threads, or 1 if it can't be determined
+    static unsigned HardwareConcurrency();
+
+private:
+    void WorkerLoop(unsigned worker_index);
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    bool stopping = false;
+};
+
+} // namespace
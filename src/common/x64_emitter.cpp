@@ -0,0 +1,475 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <cstring>
+
+#include "common/common.h"
+#include "common/x64_emitter.h"
+
+namespace Gen {
+
+void XEmitter::Write8(u8 value) {
+    *code++ = value;
+}
+
+void XEmitter::Write32(u32 value) {
+    std::memcpy(code, &value, sizeof(value));
+    code += sizeof(value);
+}
+
+void XEmitter::Write64(u64 value) {
+    std::memcpy(code, &value, sizeof(value));
+    code += sizeof(value);
+}
+
+void XEmitter::WriteREX(bool w, int reg, int rm, bool force) {
+    u8 rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (rex != 0x40 || force)
+        Write8(rex);
+}
+
+void XEmitter::WriteModRM_Reg(int reg, int rm) {
+    Write8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void XEmitter::WriteModRM_Mem(int reg, X64Reg base, s32 disp) {
+    const bool disp8 = (disp >= -128 && disp <= 127);
+    Write8((disp8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+
+    // RSP and R12 can only be used as a base through a SIB byte
+    if ((base & 7) == 4)
+        Write8(0x24);
+
+    if (disp8)
+        Write8(static_cast<u8>(disp));
+    else
+        Write32(static_cast<u32>(disp));
+}
+
+void XEmitter::MOV_RR(X64Reg dst, X64Reg src) {
+    WriteREX(false, src, dst);
+    Write8(0x89);
+    WriteModRM_Reg(src, dst);
+}
+
+void XEmitter::MOV_RI(X64Reg dst, u32 imm) {
+    WriteREX(false, 0, dst);
+    Write8(0xB8 + (dst & 7));
+    Write32(imm);
+}
+
+void XEmitter::MOV_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(0x8B);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOV_MR(X64Reg base, s32 disp, X64Reg src) {
+    WriteREX(false, src, base);
+    Write8(0x89);
+    WriteModRM_Mem(src, base, disp);
+}
+
+void XEmitter::MOV_MI(X64Reg base, s32 disp, u32 imm) {
+    WriteREX(false, 0, base);
+    Write8(0xC7);
+    WriteModRM_Mem(0, base, disp);
+    Write32(imm);
+}
+
+void XEmitter::MOV8_MI(X64Reg base, s32 disp, u8 imm) {
+    WriteREX(false, 0, base);
+    Write8(0xC6);
+    WriteModRM_Mem(0, base, disp);
+    Write8(imm);
+}
+
+void XEmitter::MOV16_MR(X64Reg base, s32 disp, X64Reg src) {
+    Write8(0x66);
+    WriteREX(false, src, base);
+    Write8(0x89);
+    WriteModRM_Mem(src, base, disp);
+}
+
+void XEmitter::MOV8_MR(X64Reg base, s32 disp, X64Reg src) {
+    // Without REX, registers 4 to 7 would be AH, CH, DH and BH instead of SPL, BPL, SIL and DIL
+    WriteREX(false, src, base, src >= RSP && src <= RDI);
+    Write8(0x88);
+    WriteModRM_Mem(src, base, disp);
+}
+
+void XEmitter::MOVZX8_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(0x0F);
+    Write8(0xB6);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOVZX16_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(0x0F);
+    Write8(0xB7);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOVSX8_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(0x0F);
+    Write8(0xBE);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOVSX16_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(0x0F);
+    Write8(0xBF);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOV64_RR(X64Reg dst, X64Reg src) {
+    WriteREX(true, src, dst);
+    Write8(0x89);
+    WriteModRM_Reg(src, dst);
+}
+
+void XEmitter::MOV64_RI(X64Reg dst, u64 imm) {
+    WriteREX(true, 0, dst);
+    Write8(0xB8 + (dst & 7));
+    Write64(imm);
+}
+
+void XEmitter::MOV64_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(true, dst, base);
+    Write8(0x8B);
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::MOVSXD(X64Reg dst, X64Reg src) {
+    WriteREX(true, dst, src);
+    Write8(0x63);
+    WriteModRM_Reg(dst, src);
+}
+
+void XEmitter::ALU_RR(ALUOp op, X64Reg dst, X64Reg src) {
+    WriteREX(false, src, dst);
+    Write8(static_cast<u8>(op * 8 + 1));
+    WriteModRM_Reg(src, dst);
+}
+
+void XEmitter::ALU_RI(ALUOp op, X64Reg dst, u32 imm) {
+    WriteREX(false, 0, dst);
+    const s32 simm = static_cast<s32>(imm);
+    if (simm >= -128 && simm <= 127) {
+        Write8(0x83);
+        WriteModRM_Reg(op, dst);
+        Write8(static_cast<u8>(imm));
+    } else {
+        Write8(0x81);
+        WriteModRM_Reg(op, dst);
+        Write32(imm);
+    }
+}
+
+void XEmitter::ALU_RM(ALUOp op, X64Reg dst, X64Reg base, s32 disp) {
+    WriteREX(false, dst, base);
+    Write8(static_cast<u8>(op * 8 + 3));
+    WriteModRM_Mem(dst, base, disp);
+}
+
+void XEmitter::ALU_MI(ALUOp op, X64Reg base, s32 disp, u32 imm) {
+    WriteREX(false, 0, base);
+    const s32 simm = static_cast<s32>(imm);
+    if (simm >= -128 && simm <= 127) {
+        Write8(0x83);
+        WriteModRM_Mem(op, base, disp);
+        Write8(static_cast<u8>(imm));
+    } else {
+        Write8(0x81);
+        WriteModRM_Mem(op, base, disp);
+        Write32(imm);
+    }
+}
+
+void XEmitter::ALU64_RI(ALUOp op, X64Reg dst, s32 imm) {
+    WriteREX(true, 0, dst);
+    if (imm >= -128 && imm <= 127) {
+        Write8(0x83);
+        WriteModRM_Reg(op, dst);
+        Write8(static_cast<u8>(imm));
+    } else {
+        Write8(0x81);
+        WriteModRM_Reg(op, dst);
+        Write32(static_cast<u32>(imm));
+    }
+}
+
+void XEmitter::ALU64_RR(ALUOp op, X64Reg dst, X64Reg src) {
+    WriteREX(true, src, dst);
+    Write8(static_cast<u8>(op * 8 + 1));
+    WriteModRM_Reg(src, dst);
+}
+
+void XEmitter::TEST_RR(X64Reg a, X64Reg b) {
+    WriteREX(false, b, a);
+    Write8(0x85);
+    WriteModRM_Reg(b, a);
+}
+
+void XEmitter::TEST_RI(X64Reg reg, u32 imm) {
+    WriteREX(false, 0, reg);
+    Write8(0xF7);
+    WriteModRM_Reg(0, reg);
+    Write32(imm);
+}
+
+void XEmitter::TEST64_RR(X64Reg a, X64Reg b) {
+    WriteREX(true, b, a);
+    Write8(0x85);
+    WriteModRM_Reg(b, a);
+}
+
+void XEmitter::NOT(X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0xF7);
+    WriteModRM_Reg(2, reg);
+}
+
+void XEmitter::SHIFT_RI(ShiftOp op, X64Reg reg, u8 amount) {
+    _dbg_assert_msg_(Common, amount != 0 && amount < 32, "invalid shift amount %u", amount);
+
+    WriteREX(false, 0, reg);
+    if (amount == 1) {
+        Write8(0xD1);
+        WriteModRM_Reg(op, reg);
+    } else {
+        Write8(0xC1);
+        WriteModRM_Reg(op, reg);
+        Write8(amount);
+    }
+}
+
+void XEmitter::SHIFT_CL(ShiftOp op, X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0xD3);
+    WriteModRM_Reg(op, reg);
+}
+
+void XEmitter::SHIFT64_RI(ShiftOp op, X64Reg reg, u8 amount) {
+    _dbg_assert_msg_(Common, amount != 0 && amount < 64, "invalid shift amount %u", amount);
+
+    WriteREX(true, 0, reg);
+    if (amount == 1) {
+        Write8(0xD1);
+        WriteModRM_Reg(op, reg);
+    } else {
+        Write8(0xC1);
+        WriteModRM_Reg(op, reg);
+        Write8(amount);
+    }
+}
+
+void XEmitter::IMUL_RR(X64Reg dst, X64Reg src) {
+    WriteREX(false, dst, src);
+    Write8(0x0F);
+    Write8(0xAF);
+    WriteModRM_Reg(dst, src);
+}
+
+void XEmitter::IMUL64_RR(X64Reg dst, X64Reg src) {
+    WriteREX(true, dst, src);
+    Write8(0x0F);
+    Write8(0xAF);
+    WriteModRM_Reg(dst, src);
+}
+
+void XEmitter::BT_RI(X64Reg reg, u8 bit) {
+    WriteREX(false, 0, reg);
+    Write8(0x0F);
+    Write8(0xBA);
+    WriteModRM_Reg(4, reg);
+    Write8(bit);
+}
+
+void XEmitter::BT_MI(X64Reg base, s32 disp, u8 bit) {
+    WriteREX(false, 0, base);
+    Write8(0x0F);
+    Write8(0xBA);
+    WriteModRM_Mem(4, base, disp);
+    Write8(bit);
+}
+
+void XEmitter::CMC() {
+    Write8(0xF5);
+}
+
+void XEmitter::SETcc_M(CCFlags cc, X64Reg base, s32 disp) {
+    WriteREX(false, 0, base);
+    Write8(0x0F);
+    Write8(static_cast<u8>(0x90 + cc));
+    WriteModRM_Mem(0, base, disp);
+}
+
+void XEmitter::PUSH(X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0x50 + (reg & 7));
+}
+
+void XEmitter::POP(X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0x58 + (reg & 7));
+}
+
+void XEmitter::CALL_R(X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0xFF);
+    WriteModRM_Reg(2, reg);
+}
+
+void XEmitter::JMP_R(X64Reg reg) {
+    WriteREX(false, 0, reg);
+    Write8(0xFF);
+    WriteModRM_Reg(4, reg);
+}
+
+void XEmitter::RET() {
+    Write8(0xC3);
+}
+
+FixupBranch XEmitter::J() {
+    Write8(0xE9);
+    Write32(0);
+    return { code };
+}
+
+FixupBranch XEmitter::J_CC(CCFlags cc) {
+    Write8(0x0F);
+    Write8(static_cast<u8>(0x80 + cc));
+    Write32(0);
+    return { code };
+}
+
+void XEmitter::SetJumpTarget(const FixupBranch& branch) {
+    SetJumpTarget(branch, code);
+}
+
+void XEmitter::SetJumpTarget(const FixupBranch& branch, const u8* target) {
+    const s32 distance = static_cast<s32>(target - branch.ptr);
+    std::memcpy(branch.ptr - sizeof(distance), &distance, sizeof(distance));
+}
+
+// SSE instructions are encoded as an optional mandatory prefix, REX, the 0x0F escape and the opcode
+
+void XEmitter::WriteSSE_RR(u8 prefix, u8 opcode, X64Reg dst, X64Reg src) {
+    if (prefix != 0)
+        Write8(prefix);
+    WriteREX(false, dst, src);
+    Write8(0x0F);
+    Write8(opcode);
+    WriteModRM_Reg(dst, src);
+}
+
+void XEmitter::WriteSSE_RM(u8 prefix, u8 opcode, X64Reg reg, X64Reg base, s32 disp) {
+    if (prefix != 0)
+        Write8(prefix);
+    WriteREX(false, reg, base);
+    Write8(0x0F);
+    Write8(opcode);
+    WriteModRM_Mem(reg, base, disp);
+}
+
+void XEmitter::MOVUPS_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteSSE_RM(0, 0x10, dst, base, disp);
+}
+
+void XEmitter::MOVUPS_MR(X64Reg base, s32 disp, X64Reg src) {
+    WriteSSE_RM(0, 0x11, src, base, disp);
+}
+
+void XEmitter::MOVSS_MR(X64Reg base, s32 disp, X64Reg src) {
+    WriteSSE_RM(0xF3, 0x11, src, base, disp);
+}
+
+void XEmitter::MOVAPS_RR(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x28, dst, src);
+}
+
+void XEmitter::MOVHLPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x12, dst, src);
+}
+
+void XEmitter::MOVLHPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x16, dst, src);
+}
+
+void XEmitter::ADDPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x58, dst, src);
+}
+
+void XEmitter::ADDSS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0xF3, 0x58, dst, src);
+}
+
+void XEmitter::MULPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x59, dst, src);
+}
+
+void XEmitter::DIVPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x5E, dst, src);
+}
+
+void XEmitter::MAXPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x5F, dst, src);
+}
+
+void XEmitter::ANDPS_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteSSE_RM(0, 0x54, dst, base, disp);
+}
+
+void XEmitter::ORPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x56, dst, src);
+}
+
+void XEmitter::XORPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x57, dst, src);
+}
+
+void XEmitter::XORPS_RM(X64Reg dst, X64Reg base, s32 disp) {
+    WriteSSE_RM(0, 0x57, dst, base, disp);
+}
+
+void XEmitter::SHUFPS(X64Reg dst, X64Reg src, u8 shuffle) {
+    WriteSSE_RR(0, 0xC6, dst, src);
+    Write8(shuffle);
+}
+
+void XEmitter::CMPPS(X64Reg dst, X64Reg src, SSECompare compare) {
+    WriteSSE_RR(0, 0xC2, dst, src);
+    Write8(static_cast<u8>(compare));
+}
+
+void XEmitter::MOVMSKPS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x50, dst, src);
+}
+
+void XEmitter::CVTTSS2SI(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0xF3, 0x2C, dst, src);
+}
+
+void XEmitter::CVTPS2PD(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0, 0x5A, dst, src);
+}
+
+void XEmitter::CVTPD2PS(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0x66, 0x5A, dst, src);
+}
+
+void XEmitter::SQRTPD(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0x66, 0x51, dst, src);
+}
+
+void XEmitter::DIVPD(X64Reg dst, X64Reg src) {
+    WriteSSE_RR(0x66, 0x5E, dst, src);
+}
+
+} // namespace
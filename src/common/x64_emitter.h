@@ -0,0 +1,161 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "common/common_types.h"
+
+/**
+ * A minimal x86-64 machine code emitter. Only the instruction forms needed by the CPU and vertex
+ * shader recompilers are provided: 32-bit ALU operations on registers and on [base + displacement]
+ * memory operands, flag manipulation, control flow and packed single precision SSE operations.
+ */
+namespace Gen {
+
+enum X64Reg {
+    EAX = 0, ECX, EDX, EBX, ESP, EBP, ESI, EDI,
+    R8D, R9D, R10D, R11D, R12D, R13D, R14D, R15D,
+
+    RAX = EAX, RCX = ECX, RDX = EDX, RBX = EBX, RSP = ESP, RBP = EBP, RSI = ESI, RDI = EDI,
+    R8 = R8D, R9 = R9D, R10 = R10D, R11 = R11D, R12 = R12D, R13 = R13D, R14 = R14D, R15 = R15D,
+
+    XMM0 = 0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+    XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+};
+
+enum CCFlags {
+    CC_O = 0, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G,
+
+    CC_C = CC_B, CC_NC = CC_AE, CC_Z = CC_E, CC_NZ = CC_NE,
+};
+
+/// Arithmetic and logic operations, numbered by their ModRM /digit encoding
+enum ALUOp {
+    ALU_ADD = 0, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP,
+};
+
+/// Shift and rotate operations, numbered by their ModRM /digit encoding
+enum ShiftOp {
+    SHIFT_ROL = 0, SHIFT_ROR, SHIFT_RCL, SHIFT_RCR, SHIFT_SHL, SHIFT_SHR, SHIFT_SAR = 7,
+};
+
+/// Comparison predicates of CMPPS, numbered by their immediate encoding
+enum SSECompare {
+    CMP_EQ = 0, CMP_LT, CMP_LE, CMP_UNORD, CMP_NEQ, CMP_NLT, CMP_NLE, CMP_ORD,
+};
+
+/// A forward branch whose displacement is patched by XEmitter::SetJumpTarget
+struct FixupBranch {
+    u8* ptr; ///< Points just past the 32-bit displacement
+};
+
+class XEmitter {
+public:
+    XEmitter() : code(nullptr) {}
+    explicit XEmitter(u8* code_ptr) : code(code_ptr) {}
+
+    void SetCodePtr(u8* ptr) { code = ptr; }
+    const u8* GetCodePtr() const { return code; }
+    u8* GetWritableCodePtr() { return code; }
+
+    // 32-bit moves
+    void MOV_RR(X64Reg dst, X64Reg src);
+    void MOV_RI(X64Reg dst, u32 imm);
+    void MOV_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOV_MR(X64Reg base, s32 disp, X64Reg src);
+    void MOV_MI(X64Reg base, s32 disp, u32 imm);
+    void MOV8_MI(X64Reg base, s32 disp, u8 imm);
+
+    void MOV16_MR(X64Reg base, s32 disp, X64Reg src);
+    void MOV8_MR(X64Reg base, s32 disp, X64Reg src);
+
+    void MOVZX8_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOVZX16_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOVSX8_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOVSX16_RM(X64Reg dst, X64Reg base, s32 disp);
+
+    // 64-bit moves
+    void MOV64_RR(X64Reg dst, X64Reg src);
+    void MOV64_RI(X64Reg dst, u64 imm);
+    void MOV64_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOVSXD(X64Reg dst, X64Reg src);
+
+    // 32-bit arithmetic and logic
+    void ALU_RR(ALUOp op, X64Reg dst, X64Reg src);
+    void ALU_RI(ALUOp op, X64Reg dst, u32 imm);
+    void ALU_RM(ALUOp op, X64Reg dst, X64Reg base, s32 disp);
+    void ALU_MI(ALUOp op, X64Reg base, s32 disp, u32 imm);
+    void ALU64_RI(ALUOp op, X64Reg dst, s32 imm);
+    void ALU64_RR(ALUOp op, X64Reg dst, X64Reg src);
+    void TEST_RR(X64Reg a, X64Reg b);
+    void TEST_RI(X64Reg reg, u32 imm);
+    void TEST64_RR(X64Reg a, X64Reg b);
+    void NOT(X64Reg reg);
+    void SHIFT_RI(ShiftOp op, X64Reg reg, u8 amount);
+    void SHIFT_CL(ShiftOp op, X64Reg reg);
+    void SHIFT64_RI(ShiftOp op, X64Reg reg, u8 amount);
+    void IMUL_RR(X64Reg dst, X64Reg src);
+    void IMUL64_RR(X64Reg dst, X64Reg src);
+
+    // Flags
+    void BT_RI(X64Reg reg, u8 bit);
+    void BT_MI(X64Reg base, s32 disp, u8 bit);
+    void CMC();
+    void SETcc_M(CCFlags cc, X64Reg base, s32 disp);
+
+    // Stack and control flow
+    void PUSH(X64Reg reg);
+    void POP(X64Reg reg);
+    void CALL_R(X64Reg reg);
+    void JMP_R(X64Reg reg);
+    void RET();
+    FixupBranch J();
+    FixupBranch J_CC(CCFlags cc);
+    void SetJumpTarget(const FixupBranch& branch);
+    void SetJumpTarget(const FixupBranch& branch, const u8* target);
+
+    // Packed single precision SSE operations, on registers or unaligned [base + displacement]
+    void MOVUPS_RM(X64Reg dst, X64Reg base, s32 disp);
+    void MOVUPS_MR(X64Reg base, s32 disp, X64Reg src);
+    void MOVSS_MR(X64Reg base, s32 disp, X64Reg src);
+    void MOVAPS_RR(X64Reg dst, X64Reg src);
+    void MOVHLPS(X64Reg dst, X64Reg src);
+    void MOVLHPS(X64Reg dst, X64Reg src);
+    void ADDPS(X64Reg dst, X64Reg src);
+    void ADDSS(X64Reg dst, X64Reg src);
+    void MULPS(X64Reg dst, X64Reg src);
+    void DIVPS(X64Reg dst, X64Reg src);
+    void MAXPS(X64Reg dst, X64Reg src);
+    void ANDPS_RM(X64Reg dst, X64Reg base, s32 disp);
+    void ORPS(X64Reg dst, X64Reg src);
+    void XORPS(X64Reg dst, X64Reg src);
+    void XORPS_RM(X64Reg dst, X64Reg base, s32 disp);
+    void SHUFPS(X64Reg dst, X64Reg src, u8 shuffle);
+    void CMPPS(X64Reg dst, X64Reg src, SSECompare compare);
+    void MOVMSKPS(X64Reg dst, X64Reg src);
+    void CVTTSS2SI(X64Reg dst, X64Reg src);
+
+    // Packed double precision SSE2 operations and conversions
+    void CVTPS2PD(X64Reg dst, X64Reg src);
+    void CVTPD2PS(X64Reg dst, X64Reg src);
+    void SQRTPD(X64Reg dst, X64Reg src);
+    void DIVPD(X64Reg dst, X64Reg src);
+
+private:
+    void Write8(u8 value);
+    void Write32(u32 value);
+    void Write64(u64 value);
+
+    void WriteREX(bool w, int reg, int rm, bool force = false);
+    void WriteModRM_Reg(int reg, int rm);
+    void WriteModRM_Mem(int reg, X64Reg base, s32 disp);
+
+    void WriteSSE_RR(u8 prefix, u8 opcode, X64Reg dst, X64Reg src);
+    void WriteSSE_RM(u8 prefix, u8 opcode, X64Reg reg, X64Reg base, s32 disp);
+
+    u8* code;
+};
+
+} // namespace
@@ -16,6 +16,7 @@ class ARM_Interface : NonCopyable {
 public:
     ARM_Interface() {
         num_instructions = 0;
+        in_idle_loop = false;
     }
 
     virtual ~ARM_Interface() {
@@ -105,6 +106,11 @@ public:
         return num_instructions;
     }
 
+    /// Returns true if the last Run stopped in an idle loop, which won't exit before the next event
+    bool IsInIdleLoop() const {
+        return in_idle_loop;
+    }
+
     s64 down_count; ///< A decreasing counter of remaining cycles before the next event, decreased by the cpu run loop
 
 protected:
@@ -115,6 +121,8 @@ protected:
      */
     virtual void ExecuteInstructions(int num_instructions) = 0;
 
+    bool in_idle_loop; ///< Set by ExecuteInstructions when it stopped in an idle loop
+
 private:
 
     u64 num_instructions; ///< Number of instructions executed
@@ -46,6 +46,9 @@ ARM_DynCom::ARM_DynCom() {
 }
 
 ARM_DynCom::~ARM_DynCom() {
+    const InterpreterBlockStats& stats = GetInterpreterBlockStats();
+    LOG_DEBUG(Core_ARM11, "block link hits: %llu, dispatcher lookups: %llu",
+              stats.link_hits, stats.dispatcher_lookups);
 }
 
 void ARM_DynCom::SetPC(u32 pc) {
@@ -79,17 +82,19 @@ u64 ARM_DynCom::GetTicks() const {
 
 void ARM_DynCom::AddTicks(u64 ticks) {
     down_count -= ticks;
-    if (down_count < 0)
+    if (down_count <= 0)
         CoreTiming::Advance();
 }
 
 void ARM_DynCom::ExecuteInstructions(int num_instructions) {
     state->NumInstrsToExecute = num_instructions;
+    state->InIdleLoop = false;
 
     // Dyncom only breaks on instruction dispatch. This only happens on every instruction when
     // executing one instruction at a time. Otherwise, if a block is being executed, more
     // instructions may actually be executed than specified.
     unsigned ticks_executed = InterpreterMainLoop(state.get());
+    in_idle_loop = state->InIdleLoop;
     AddTicks(ticks_executed);
 }
 
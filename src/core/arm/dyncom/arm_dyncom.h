@@ -88,6 +88,11 @@ public:
      */
     void ExecuteInstructions(int num_instructions) override;
 
+    /// Gets the emulated CPU state, also used by the JIT for the instructions it interprets
+    ARMul_State* GetState() const {
+        return state.get();
+    }
+
 private:
     std::unique_ptr<ARMul_State> state;
 };
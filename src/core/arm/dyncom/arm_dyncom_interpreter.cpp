@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <stdio.h>
 #include <assert.h>
 #include <cstdio>
@@ -17,10 +18,13 @@ using namespace std;
 #include "core/arm/skyeye_common/armmmu.h"
 #include "arm_dyncom_thumb.h"
 #include "arm_dyncom_run.h"
+#include "arm_dyncom_interpreter.h"
 #include "core/arm/skyeye_common/vfp/vfp.h"
 #include "core/arm/disassembler/arm_disasm.h"
+#include "core/arm/idle_loop.h"
 
 #include "core/mem_map.h"
+#include "core/settings.h"
 #include "core/hle/hle.h"
 
 enum {
@@ -1102,14 +1106,23 @@ typedef struct _pkh_inst {
 
 typedef arm_inst * ARM_INST_PTR;
 
-#define CACHE_BUFFER_SIZE    (64 * 1024 * 2000)
-char inst_buf[CACHE_BUFFER_SIZE];
-int top = 0;
+// Translated instructions are stored in inst_buf, whose size is set by
+// Settings::values.translation_cache_size. The buffer is split into TRANSLATION_CACHE_REGIONS
+// equally sized regions which are filled in round-robin order. When the region being filled runs
+// out of space, the next (i.e. oldest) region is evicted as a whole, see ReserveTranslationSpace.
+static const int TRANSLATION_CACHE_REGIONS = 8;
+// Upper bound of the space taken by a single translated instruction (arm_inst + component)
+static const int MAX_INST_SIZE = 128;
+
+static std::vector<char> inst_buf;
+static int top = 0;         // Offset of the next allocation in inst_buf
+static int region_end = 0;  // End offset of the region currently being filled
+
 inline void *AllocBuffer(unsigned int size) {
     int start = top;
     top += size;
-    if (top > CACHE_BUFFER_SIZE) {
-        LOG_ERROR(Core_ARM11, "inst_buf is full");
+    if (top > region_end) {
+        LOG_ERROR(Core_ARM11, "translation cache region overflow");
         CITRA_IGNORE_EXIT(-1);
     }
     return (void *)&inst_buf[start];
@@ -3472,6 +3485,59 @@ const transop_fp_t arm_instruction_trans[] = {
 typedef std::unordered_map<u32, int> bb_map;
 bb_map CreamCache;
 
+// Guest addresses of the blocks in CreamCache, indexed by guest page number. Blocks never cross
+// page boundaries, so each block is listed under exactly one page.
+static std::unordered_map<u32, std::unordered_set<u32>> page_blocks;
+
+// Cached successor of a translated basic block. Links are only valid while their generation
+// matches link_generation, which is bumped whenever blocks are removed from CreamCache.
+typedef struct _bb_link {
+    u32 pc;             // Guest address of the successor block
+    u32 generation;     // Value of link_generation when the link was made
+    int ptr;            // Offset of the successor block in inst_buf, or -1 if unused
+} bb_link;
+
+// Placed in inst_buf in front of the instructions of every translated basic block.
+typedef struct _bb_header {
+    // Slot 0 holds the first successor that was executed after this block, which is usually
+    // the taken or not-taken target of its terminating branch. Slot 1 holds the most recent
+    // other successor.
+    bb_link link[2];
+    // Set if the block is an idle loop, see IdleLoop::IsIdleLoop
+    bool idle_loop;
+} bb_header;
+
+static u32 link_generation = 1;
+static InterpreterBlockStats block_stats;
+
+const InterpreterBlockStats& GetInterpreterBlockStats() {
+    return block_stats;
+}
+
+static inline int find_linked_bb(int prev_bb, unsigned int addr) {
+    if (prev_bb == -1)
+        return -1;
+
+    const bb_header* header = (bb_header*)&inst_buf[prev_bb];
+    for (const bb_link& link : header->link) {
+        if (link.ptr != -1 && link.pc == addr && link.generation == link_generation)
+            return link.ptr;
+    }
+    return -1;
+}
+
+static inline void link_bb(int prev_bb, unsigned int addr, int ptr) {
+    if (prev_bb == -1)
+        return;
+
+    bb_header* header = (bb_header*)&inst_buf[prev_bb];
+    bb_link& link = (header->link[0].ptr == -1 || header->link[0].generation != link_generation) ?
+                    header->link[0] : header->link[1];
+    link.pc = addr;
+    link.generation = link_generation;
+    link.ptr = ptr;
+}
+
 void insert_bb(unsigned int addr, int start) {
     CreamCache[addr] = start;
 }
@@ -3556,23 +3622,80 @@ typedef struct instruction_set_encoding_item ISEITEM;
 
 extern const ISEITEM arm_instruction[];
 
-vector<uint64_t> code_page_set;
+static std::vector<u32> region_blocks[TRANSLATION_CACHE_REGIONS]; // Blocks translated into each region
+static int current_region = 0;
 
+// Removes every block translated from the page containing the given address from CreamCache
 void flush_bb(uint32_t addr) {
-    bb_map::iterator it;
-    uint32_t start;
+    auto page = page_blocks.find(addr >> 12);
+    if (page == page_blocks.end())
+        return;
+
+    for (u32 pc : page->second)
+        CreamCache.erase(pc);
+    page_blocks.erase(page);
+
+    // Links may point to one of the erased blocks, so drop all of them
+    link_generation++;
+}
+
+static int GetRegionSize() {
+    return static_cast<int>(inst_buf.size()) / TRANSLATION_CACHE_REGIONS;
+}
+
+static void InitTranslationCache() {
+    const int size_mb = std::max(Settings::values.translation_cache_size, 1);
+    inst_buf.resize(size_mb * 1024 * 1024);
+
+    current_region = 0;
+    top = 0;
+    region_end = GetRegionSize();
+
+    // Writes to pages holding translated code invalidate the blocks translated from them
+    Memory::RegisterWriteHandler(Memory::PageWatch::Code, flush_bb);
+
+    LOG_DEBUG(Core_ARM11, "translation cache initialized with %d MiB", size_mb);
+}
+
+// Removes every block translated into the given region from CreamCache
+static void EvictRegion(int region) {
+    const int start = region * GetRegionSize();
+    const int end = start + GetRegionSize();
 
-    addr  &= 0xfffff000;
-    for (it = CreamCache.begin(); it != CreamCache.end(); ) {
-        start = static_cast<uint32_t>(it->first);
-        start &= 0xfffff000;
-        if (start == addr) {
-            CreamCache.erase(it++);
-        } else
-            ++it;
+    for (u32 pc : region_blocks[region]) {
+        bb_map::iterator it = CreamCache.find(pc);
+
+        // The block may have been flushed and translated again into another region since
+        if (it != CreamCache.end() && it->second >= start && it->second < end) {
+            CreamCache.erase(it);
+            page_blocks[pc >> 12].erase(pc);
+        }
     }
+    region_blocks[region].clear();
+
+    // Links may point into the evicted region, so drop all of them
+    link_generation++;
+
+    LOG_TRACE(Core_ARM11, "evicted translation cache region %d", region);
 }
 
+// Makes sure there is room to start translating a new basic block, evicting the oldest region if
+// the current one is full.
+static void ReserveTranslationSpace() {
+    if (inst_buf.empty())
+        InitTranslationCache();
+
+    if (region_end - top >= static_cast<int>(sizeof(bb_header)) + MAX_INST_SIZE)
+        return;
+
+    current_region = (current_region + 1) % TRANSLATION_CACHE_REGIONS;
+    EvictRegion(current_region);
+
+    top = current_region * GetRegionSize();
+    region_end = top + GetRegionSize();
+}
+
+
 int InterpreterTranslate(arm_processor *cpu, int &bb_start, addr_t addr) {
     // Decode instruction, get index
     // Allocate memory and init InsCream
@@ -3584,6 +3707,8 @@ int InterpreterTranslate(arm_processor *cpu, int &bb_start, addr_t addr) {
     int ret = NON_BRANCH;
     int thumb = 0;
     int size = 0; // instruction size of basic block
+
+    ReserveTranslationSpace();
     bb_start = top;
 
     if (cpu->TFlag)
@@ -3592,6 +3717,11 @@ int InterpreterTranslate(arm_processor *cpu, int &bb_start, addr_t addr) {
     addr_t phys_addr = addr;
     addr_t pc_start = cpu->Reg[15];
 
+    bb_header* header = (bb_header*)AllocBuffer(sizeof(bb_header));
+    for (bb_link& link : header->link)
+        link.ptr = -1;
+    header->idle_loop = Settings::values.skip_idle_loops && IdleLoop::IsIdleLoop(pc_start, thumb != 0);
+
     while(ret == NON_BRANCH) {
         inst = Memory::Read32(phys_addr & 0xFFFFFFFC);
 
@@ -3620,12 +3750,16 @@ int InterpreterTranslate(arm_processor *cpu, int &bb_start, addr_t addr) {
 translated:
         phys_addr += inst_size;
 
-        if ((phys_addr & 0xfff) == 0) {
+        // Blocks end at page boundaries, and early when the current cache region is full
+        if ((phys_addr & 0xfff) == 0 || region_end - top < MAX_INST_SIZE) {
             inst_base->br = END_OF_PAGE;
         }
         ret = inst_base->br;
     };
     insert_bb(pc_start, bb_start);
+    region_blocks[current_region].push_back(pc_start);
+    page_blocks[pc_start >> 12].insert(pc_start);
+    Memory::WatchPage(Memory::PageWatch::Code, pc_start);
     return KEEP_GOING;
 }
 
@@ -3941,6 +4075,7 @@ unsigned InterpreterMainLoop(ARMul_State* state) {
     unsigned int num_instrs = 0;
 
     int ptr;
+    int prev_bb = -1;
 
     LOAD_NZCVT;
     DISPATCH:
@@ -3958,10 +4093,32 @@ unsigned InterpreterMainLoop(ARMul_State* state) {
 
         phys_addr = cpu->Reg[15];
 
-        if (find_bb(cpu->Reg[15], ptr) == -1)
-            if (InterpreterTranslate(cpu, ptr, cpu->Reg[15]) == FETCH_EXCEPTION)
-                goto END;
+        ptr = find_linked_bb(prev_bb, cpu->Reg[15]);
+        if (ptr != -1) {
+            block_stats.link_hits++;
+        } else {
+            const u32 generation = link_generation;
+
+            block_stats.dispatcher_lookups++;
+            if (find_bb(cpu->Reg[15], ptr) == -1)
+                if (InterpreterTranslate(cpu, ptr, cpu->Reg[15]) == FETCH_EXCEPTION)
+                    goto END;
+
+            // The previous block may have been evicted while translating this one
+            if (generation == link_generation)
+                link_bb(prev_bb, cpu->Reg[15], ptr);
+        }
+
+        // Stop once an idle loop has branched back to itself, so that the run loop can skip ahead
+        // to the next event
+        if (ptr == prev_bb && ((bb_header*)&inst_buf[ptr])->idle_loop) {
+            cpu->InIdleLoop = true;
+            goto END;
+        }
+        prev_bb = ptr;
 
+        // INC_PC advances ptr from the first instruction, which follows the block header
+        ptr += sizeof(bb_header);
         inst_base = (arm_inst *)&inst_buf[ptr];
         GOTO_NEXT_INST;
     }
@@ -6279,6 +6436,12 @@ unsigned InterpreterMainLoop(ARMul_State* state) {
     SWI_INST:
     {
         if (inst_base->cond == 0xE || CondPassed(cpu, inst_base->cond)) {
+            // The instructions executed in this slice are only added to the CoreTiming ticks at
+            // its end, so end it before the SVC and execute the SVC first thing in the next one
+            if (num_instrs > 1) {
+                num_instrs--;
+                goto END;
+            }
             HLE::CallSVC(Memory::Read32(cpu->Reg[15]));
         }
 
@@ -4,4 +4,17 @@
 
 #pragma once
 
+#include "common/common_types.h"
+
+#include "core/arm/skyeye_common/armdefs.h"
+
+/// Counters describing how the interpreter reaches the translated basic blocks it executes
+struct InterpreterBlockStats {
+    u64 link_hits;          ///< Blocks reached through a cached successor link
+    u64 dispatcher_lookups; ///< Blocks that had to be looked up in (or added to) the block cache
+};
+
 unsigned InterpreterMainLoop(ARMul_State* state);
+
+/// Returns the block dispatch statistics accumulated since startup
+const InterpreterBlockStats& GetInterpreterBlockStats();
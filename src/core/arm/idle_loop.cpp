@@ -0,0 +1,262 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include "core/mem_map.h"
+#include "core/arm/idle_loop.h"
+
+namespace IdleLoop {
+
+/// Idle loops are only searched for up to this length, polling loops are much shorter
+static const unsigned MAX_LOOP_INSTRUCTIONS = 16;
+
+static const u32 PC_MASK = 1 << 15;
+
+/// Effect of an instruction of the loop on the registers, as masks of register numbers
+struct Effect {
+    u32 reads;
+    u32 writes;
+};
+
+enum class InstructionType {
+    Unsupported,  ///< Has side effects, reads the flags, or writes the PC
+    Branch,       ///< B to the target address
+    Plain,        ///< Only reads and writes registers, and loads from memory
+};
+
+static u32 Bit(u32 reg) {
+    return 1 << reg;
+}
+
+static InstructionType DecodeARM(u32 pc, u32 inst, Effect& effect, u32& target) {
+    const u32 cond = inst >> 28;
+    if (cond == 0xF)
+        return InstructionType::Unsupported;
+
+    if ((inst & 0x0F000000) == 0x0A000000) {
+        const s32 offset = static_cast<s32>(inst << 8) >> 6;
+        target = pc + 8 + offset;
+        return InstructionType::Branch;
+    }
+
+    // Conditional instructions would read the flags
+    if (cond != 0xE)
+        return InstructionType::Unsupported;
+
+    const u32 rn = (inst >> 16) & 0xF;
+    const u32 rd = (inst >> 12) & 0xF;
+    const u32 rs = (inst >> 8) & 0xF;
+    const u32 rm = inst & 0xF;
+    const bool pre_indexed = (inst & (1 << 24)) != 0;
+    const bool writeback = (inst & (1 << 21)) != 0;
+    const bool load = (inst & (1 << 20)) != 0;
+
+    // LDR/LDRB with an immediate or shifted register offset, without writeback
+    if ((inst & 0x0C000000) == 0x04000000) {
+        if (!load || !pre_indexed || writeback || rd == 15)
+            return InstructionType::Unsupported;
+
+        effect.reads = Bit(rn);
+        if (inst & (1 << 25)) {
+            // Register offsets rotated right by 0 are RRX, which reads the carry flag
+            if ((inst & 0x00000010) || (inst & 0x00000FE0) == 0x00000060)
+                return InstructionType::Unsupported;
+            effect.reads |= Bit(rm);
+        }
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    if ((inst & 0x0C000000) != 0)
+        return InstructionType::Unsupported;
+
+    // LDRH/LDRSB/LDRSH with an immediate or register offset, without writeback
+    if ((inst & 0x02000090) == 0x00000090) {
+        if ((inst & 0x00000060) == 0 || !load || !pre_indexed || writeback || rd == 15)
+            return InstructionType::Unsupported;
+
+        effect.reads = Bit(rn);
+        if (!(inst & (1 << 22)))
+            effect.reads |= Bit(rm);
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // Data processing, except ADC, SBC and RSC, which read the carry flag
+    const u32 opcode = (inst >> 21) & 0xF;
+    const bool set_flags = (inst & (1 << 20)) != 0;
+    const bool is_compare = opcode >= 0x8 && opcode <= 0xB;
+    if ((opcode >= 0x5 && opcode <= 0x7) || (is_compare && !set_flags))
+        return InstructionType::Unsupported;
+
+    effect.reads = (opcode == 0xD || opcode == 0xF) ? 0 : Bit(rn);
+    if (!(inst & (1 << 25))) {
+        if (inst & 0x00000010) {
+            effect.reads |= Bit(rs);
+        } else if ((inst & 0x00000FE0) == 0x00000060) {
+            return InstructionType::Unsupported;
+        }
+        effect.reads |= Bit(rm);
+    }
+
+    if (is_compare) {
+        effect.writes = 0;
+    } else if (rd == 15) {
+        return InstructionType::Unsupported;
+    } else {
+        effect.writes = Bit(rd);
+    }
+    return InstructionType::Plain;
+}
+
+static InstructionType DecodeThumb(u32 pc, u16 inst, Effect& effect, u32& target) {
+    const u32 rd = inst & 7;
+    const u32 rn = (inst >> 3) & 7;
+    const u32 rm = (inst >> 6) & 7;
+
+    if ((inst & 0xF000) == 0xD000) {
+        // Condition 0xE is undefined, 0xF is SWI
+        if (((inst >> 8) & 0xF) >= 0xE)
+            return InstructionType::Unsupported;
+        target = pc + 4 + (static_cast<s32>(static_cast<s8>(inst & 0xFF)) << 1);
+        return InstructionType::Branch;
+    }
+
+    if ((inst & 0xF800) == 0xE000) {
+        const s32 offset = static_cast<s32>(static_cast<u32>(inst) << 21) >> 20;
+        target = pc + 4 + offset;
+        return InstructionType::Branch;
+    }
+
+    // LSL/LSR/ASR with an immediate shift amount
+    if ((inst & 0xE000) == 0x0000 && (inst & 0x1800) != 0x1800) {
+        effect.reads = Bit(rn);
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // ADD/SUB with a register or 3-bit immediate
+    if ((inst & 0xF800) == 0x1800) {
+        effect.reads = Bit(rn) | ((inst & 0x0400) ? 0 : Bit(rm));
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // MOV/CMP/ADD/SUB with an 8-bit immediate
+    if ((inst & 0xE000) == 0x2000) {
+        const u32 op = (inst >> 11) & 3;
+        const u32 reg = (inst >> 8) & 7;
+        effect.reads = (op == 0) ? 0 : Bit(reg);
+        effect.writes = (op == 1) ? 0 : Bit(reg);
+        return InstructionType::Plain;
+    }
+
+    // Data processing, except ADC and SBC, which read the carry flag
+    if ((inst & 0xFC00) == 0x4000) {
+        const u32 op = (inst >> 6) & 0xF;
+        if (op == 0x5 || op == 0x6)
+            return InstructionType::Unsupported;
+
+        const bool is_compare = op == 0x8 || op == 0xA || op == 0xB;
+        const bool reads_rd = op != 0x9 && op != 0xF;
+        effect.reads = Bit(rn) | (reads_rd ? Bit(rd) : 0);
+        effect.writes = is_compare ? 0 : Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // ADD/CMP/MOV with high registers
+    if ((inst & 0xFC00) == 0x4400) {
+        const u32 op = (inst >> 8) & 3;
+        const u32 hi_rd = rd | ((inst >> 4) & 8);
+        const u32 hi_rm = (inst >> 3) & 0xF;
+        if (op == 3 || (op != 1 && hi_rd == 15))
+            return InstructionType::Unsupported;
+
+        effect.reads = Bit(hi_rm) | (op == 2 ? 0 : Bit(hi_rd));
+        effect.writes = (op == 1) ? 0 : Bit(hi_rd);
+        return InstructionType::Plain;
+    }
+
+    // LDR from a PC relative address
+    if ((inst & 0xF800) == 0x4800) {
+        effect.reads = 0;
+        effect.writes = Bit((inst >> 8) & 7);
+        return InstructionType::Plain;
+    }
+
+    // LDRSB/LDR/LDRH/LDRB/LDRSH with a register offset
+    if ((inst & 0xF000) == 0x5000) {
+        if (((inst >> 9) & 7) < 3)
+            return InstructionType::Unsupported;
+        effect.reads = Bit(rn) | Bit(rm);
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // LDR/LDRB/LDRH with an immediate offset
+    if ((inst & 0xE800) == 0x6800 || (inst & 0xF800) == 0x8800) {
+        effect.reads = Bit(rn);
+        effect.writes = Bit(rd);
+        return InstructionType::Plain;
+    }
+
+    // LDR from an SP relative address
+    if ((inst & 0xF800) == 0x9800) {
+        effect.reads = Bit(13);
+        effect.writes = Bit((inst >> 8) & 7);
+        return InstructionType::Plain;
+    }
+
+    // ADD of the PC or SP and an immediate
+    if ((inst & 0xF000) == 0xA000) {
+        effect.reads = (inst & 0x0800) ? Bit(13) : 0;
+        effect.writes = Bit((inst >> 8) & 7);
+        return InstructionType::Plain;
+    }
+
+    return InstructionType::Unsupported;
+}
+
+bool IsIdleLoop(u32 pc, bool thumb) {
+    const u32 inst_size = thumb ? 2 : 4;
+    const u32 page = pc >> Memory::PAGE_BITS;
+
+    Effect effects[MAX_LOOP_INSTRUCTIONS];
+    unsigned num_instructions = 0;
+    u32 written = 0;
+
+    for (u32 addr = pc; ; addr += inst_size) {
+        if (num_instructions == MAX_LOOP_INSTRUCTIONS || (addr >> Memory::PAGE_BITS) != page)
+            return false;
+
+        Effect effect = { 0, 0 };
+        u32 target = 0;
+        const InstructionType type = thumb ? DecodeThumb(addr, Memory::Read16(addr), effect, target) :
+                                             DecodeARM(addr, Memory::Read32(addr), effect, target);
+
+        if (type == InstructionType::Unsupported)
+            return false;
+        if (type == InstructionType::Branch) {
+            if (target != pc)
+                return false;
+            break;
+        }
+
+        effects[num_instructions++] = effect;
+        written |= effect.writes;
+    }
+
+    // Every iteration computes the same register values from the same memory contents, unless an
+    // instruction reads a register before the loop writes it, and so sees the previous iteration's
+    // value. Reading the PC gives the address of the instruction, which is the same every time.
+    u32 defined = 0;
+    for (unsigned i = 0; i < num_instructions; ++i) {
+        if (effects[i].reads & written & ~defined & ~PC_MASK)
+            return false;
+        defined |= effects[i].writes;
+    }
+
+    return true;
+}
+
+} // namespace
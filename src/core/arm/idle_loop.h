@@ -0,0 +1,24 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "common/common_types.h"
+
+namespace IdleLoop {
+
+/**
+ * Checks whether the guest code at the given address is an idle loop: a short loop which branches
+ * back to its start, and which only loads from memory and computes registers from the loaded
+ * values, e.g. a thread polling a flag in shared memory. Every iteration of such a loop does the
+ * same thing until the memory it reads changes, which can only happen once something else runs,
+ * i.e. not before the next CoreTiming event. The CPU backends stop when they run into one, so that
+ * the run loop can skip ahead to the next event.
+ * @param pc Guest address of the first instruction of the loop
+ * @param thumb Whether the loop consists of Thumb instructions
+ * @return True if the code at pc is an idle loop
+ */
+bool IsIdleLoop(u32 pc, bool thumb);
+
+} // namespace
@@ -0,0 +1,150 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include "core/arm/dyncom/arm_dyncom_interpreter.h"
+#include "core/arm/jit_x64/arm_jit_x64.h"
+#include "core/arm/jit_x64/jit_x64_compiler.h"
+
+#include "core/core.h"
+#include "core/core_timing.h"
+#include "core/mem_map.h"
+
+// Compiled code keeps the condition flags and the Thumb bit in the separate ARMul_State fields,
+// the interpreter loads them from and stores them to the CPSR.
+
+static void LoadFlags(ARMul_State* state) {
+    state->NFlag = (state->Cpsr >> 31) & 1;
+    state->ZFlag = (state->Cpsr >> 30) & 1;
+    state->CFlag = (state->Cpsr >> 29) & 1;
+    state->VFlag = (state->Cpsr >> 28) & 1;
+    state->TFlag = (state->Cpsr >> 5) & 1;
+}
+
+static void SaveFlags(ARMul_State* state) {
+    state->Cpsr = (state->Cpsr & 0x0FFFFFDF) | (state->NFlag << 31) | (state->ZFlag << 30) |
+                  (state->CFlag << 29) | (state->VFlag << 28) | (state->TFlag << 5);
+}
+
+/// Returns true if the instruction at the given address is an SVC
+static bool IsSVC(u32 pc, bool thumb) {
+    if (thumb)
+        return (Memory::Read16(pc) & 0xFF00) == 0xDF00;
+
+    const u32 inst = Memory::Read32(pc);
+    return (inst & 0x0F000000) == 0x0F000000 && (inst >> 28) != 0xF;
+}
+
+ARM_JitX64::ARM_JitX64() : reschedule_pending(false), block_budget(0) {
+}
+
+ARM_JitX64::~ARM_JitX64() {
+}
+
+void ARM_JitX64::SetPC(u32 pc) {
+    interpreter.SetPC(pc);
+}
+
+u32 ARM_JitX64::GetPC() const {
+    return interpreter.GetPC();
+}
+
+u32 ARM_JitX64::GetReg(int index) const {
+    return interpreter.GetReg(index);
+}
+
+void ARM_JitX64::SetReg(int index, u32 value) {
+    interpreter.SetReg(index, value);
+}
+
+u32 ARM_JitX64::GetCPSR() const {
+    return interpreter.GetCPSR();
+}
+
+void ARM_JitX64::SetCPSR(u32 cpsr) {
+    interpreter.SetCPSR(cpsr);
+}
+
+u64 ARM_JitX64::GetTicks() const {
+    return CoreTiming::GetTicks();
+}
+
+void ARM_JitX64::AddTicks(u64 ticks) {
+    down_count -= ticks;
+    if (down_count <= 0)
+        CoreTiming::Advance();
+}
+
+unsigned ARM_JitX64::InterpretInstruction() {
+    ARMul_State* state = interpreter.GetState();
+
+    SaveFlags(state);
+    state->NumInstrsToExecute = 1;
+    return InterpreterMainLoop(state);
+}
+
+void ARM_JitX64::ExecuteInstructions(int num_instructions) {
+    ARMul_State* state = interpreter.GetState();
+
+    reschedule_pending = false;
+    in_idle_loop = false;
+    LoadFlags(state);
+
+    unsigned ticks_executed = 0;
+    while (ticks_executed < static_cast<unsigned>(num_instructions) && !reschedule_pending) {
+        if (!state->NirqSig && !(state->Cpsr & 0x80))
+            break;
+
+        const bool thumb = state->TFlag != 0;
+        state->Reg[15] &= thumb ? 0xFFFFFFFE : 0xFFFFFFFC;
+
+        const JitX64::Block block = JitX64::GetBlock(state->Reg[15], thumb);
+
+        // Blocks are not entered when they would run past the requested number of instructions,
+        // so that single stepping stays exact. Linked blocks check the remaining budget themselves.
+        const unsigned remaining = static_cast<unsigned>(num_instructions) - ticks_executed;
+        if (block.entry != nullptr && block.num_instructions <= remaining) {
+            const u32 block_pc = state->Reg[15];
+            block_budget = remaining;
+            state->NumInstrsToExecute = remaining;
+            block.entry(state);
+            ticks_executed += block_budget - state->NumInstrsToExecute;
+
+            // Stop once an idle loop has branched back to itself, so that the run loop can skip
+            // ahead to the next event
+            if (block.idle_loop && state->Reg[15] == block_pc) {
+                in_idle_loop = true;
+                break;
+            }
+        } else {
+            // Like the interpreter, end the slice before an SVC so that the SVC sees the ticks
+            // taken by the instructions before it
+            if (ticks_executed != 0 && IsSVC(state->Reg[15], thumb))
+                break;
+
+            const unsigned interpreted = InterpretInstruction();
+            if (interpreted == 0)
+                break;
+            ticks_executed += interpreted;
+        }
+    }
+
+    SaveFlags(state);
+    AddTicks(ticks_executed);
+}
+
+void ARM_JitX64::SaveContext(Core::ThreadContext& ctx) {
+    interpreter.SaveContext(ctx);
+}
+
+void ARM_JitX64::LoadContext(const Core::ThreadContext& ctx) {
+    interpreter.LoadContext(ctx);
+}
+
+void ARM_JitX64::PrepareReschedule() {
+    // Clearing the budget stops compiled code at the next linked block. Keep the instructions run
+    // so far counted, since the budget is how they are counted.
+    block_budget -= interpreter.GetState()->NumInstrsToExecute;
+    reschedule_pending = true;
+    interpreter.PrepareReschedule();
+}
@@ -0,0 +1,101 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "common/common_types.h"
+
+#include "core/arm/arm_interface.h"
+#include "core/arm/dyncom/arm_dyncom.h"
+
+/**
+ * ARM11 core recompiling guest code to x86-64. Instructions the recompiler does not support are
+ * run through the dyncom interpreter, which also owns the CPU state.
+ */
+class ARM_JitX64 final : virtual public ARM_Interface {
+public:
+
+    ARM_JitX64();
+    ~ARM_JitX64();
+
+    /**
+     * Set the Program Counter to an address
+     * @param pc Address to set PC to
+     */
+    void SetPC(u32 pc) override;
+
+    /*
+     * Get the current Program Counter
+     * @return Returns current PC
+     */
+    u32 GetPC() const override;
+
+    /**
+     * Get an ARM register
+     * @param index Register index (0-15)
+     * @return Returns the value in the register
+     */
+    u32 GetReg(int index) const override;
+
+    /**
+     * Set an ARM register
+     * @param index Register index (0-15)
+     * @param value Value to set register to
+     */
+    void SetReg(int index, u32 value) override;
+
+    /**
+     * Get the current CPSR register
+     * @return Returns the value of the CPSR register
+     */
+    u32 GetCPSR() const override;
+
+    /**
+     * Set the current CPSR register
+     * @param cpsr Value to set CPSR to
+     */
+    void SetCPSR(u32 cpsr) override;
+
+    /**
+     * Returns the number of clock ticks since the last reset
+     * @return Returns number of clock ticks
+     */
+    u64 GetTicks() const override;
+
+    /**
+    * Advance the CPU core by the specified number of ticks (e.g. to simulate CPU execution time)
+    * @param ticks Number of ticks to advance the CPU core
+    */
+    void AddTicks(u64 ticks) override;
+
+    /**
+     * Saves the current CPU context
+     * @param ctx Thread context to save
+     */
+    void SaveContext(Core::ThreadContext& ctx) override;
+
+    /**
+     * Loads a CPU context
+     * @param ctx Thread context to load
+     */
+    void LoadContext(const Core::ThreadContext& ctx) override;
+
+    /// Prepare core for thread reschedule (if needed to correctly handle state)
+    void PrepareReschedule() override;
+
+    /**
+     * Executes the given number of instructions
+     * @param num_instructions Number of instructions to executes
+     */
+    void ExecuteInstructions(int num_instructions) override;
+
+private:
+    /// Runs a single instruction through the interpreter, returns the number of instructions run
+    unsigned InterpretInstruction();
+
+    ARM_DynCom interpreter;
+    bool reschedule_pending;
+    /// Instruction budget given to the compiled code last entered, see JitX64::BlockEntry
+    unsigned block_budget;
+};
@@ -0,0 +1,1372 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "common/common.h"
+#include "common/memory_util.h"
+#include "common/x64_emitter.h"
+
+#include "core/arm/jit_x64/jit_x64_compiler.h"
+#include "core/arm/dyncom/arm_dyncom_thumb.h"
+#include "core/arm/idle_loop.h"
+#include "core/arm/skyeye_common/arm_regformat.h"
+#include "core/mem_map.h"
+#include "core/settings.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace JitX64 {
+
+using namespace Gen;
+
+// Register holding the ARMul_State pointer for the whole block
+static const X64Reg STATE = RBX;
+// Register holding the address of the current memory access, preserved across helper calls
+static const X64Reg ADDR = R12D;
+
+#ifdef _WIN32
+static const X64Reg ABI_PARAM1 = RCX;
+static const X64Reg ABI_PARAM2 = RDX;
+static const X64Reg ABI_PARAM3 = R8;
+#else
+static const X64Reg ABI_PARAM1 = RDI;
+static const X64Reg ABI_PARAM2 = RSI;
+static const X64Reg ABI_PARAM3 = RDX;
+#endif
+
+// Stack space reserved by the prologue. Together with the two pushed registers this keeps the stack
+// 16-byte aligned for helper calls and provides the Win64 shadow space.
+static const s32 STACK_RESERVE = 40;
+
+// Small enough for the instruction count to fit the 8-bit immediate of the budget check
+static const u32 MAX_BLOCK_INSTRUCTIONS = 64;
+// Upper bound of the host code emitted for a single guest instruction, prologue or epilogue
+static const size_t MAX_INSTRUCTION_CODE_SIZE = 512;
+static const size_t MAX_BLOCK_CODE_SIZE = (MAX_BLOCK_INSTRUCTIONS + 2) * MAX_INSTRUCTION_CODE_SIZE;
+
+enum ConditionCode {
+    COND_EQ, COND_NE, COND_CS, COND_CC, COND_MI, COND_PL, COND_VS, COND_VC,
+    COND_HI, COND_LS, COND_GE, COND_LT, COND_GT, COND_LE, COND_AL, COND_NV,
+};
+
+enum DataProcessingOpcode {
+    OP_AND, OP_EOR, OP_SUB, OP_RSB, OP_ADD, OP_ADC, OP_SBC, OP_RSC,
+    OP_TST, OP_TEQ, OP_CMP, OP_CMN, OP_ORR, OP_MOV, OP_BIC, OP_MVN,
+};
+
+enum ShiftType {
+    SHIFT_TYPE_LSL, SHIFT_TYPE_LSR, SHIFT_TYPE_ASR, SHIFT_TYPE_ROR,
+};
+
+/// A jump from the end of a compiled block to a known guest address
+struct LinkSite {
+    FixupBranch jump;       ///< Jump to patch once the block at the address is compiled
+    const u8* epilogue;     ///< Target of the jump while that block isn't linked
+};
+
+struct CachedBlock {
+    Block block;
+    /// Entered by the jumps of linked blocks, past the prologue. nullptr for blocks which are not
+    /// linked to, because they have no host code or are idle loops the dispatcher has to see.
+    const u8* chain_entry;
+};
+
+static u8* code_space = nullptr;
+static size_t code_space_size = 0;
+static u8* code_top = nullptr;
+
+static std::unordered_map<u64, CachedBlock> blocks;
+// Keys of the blocks compiled from each guest page, used to invalidate code written by the guest
+static std::unordered_map<u32, std::vector<u64>> page_blocks;
+// Jumps to the block with the given key, including those of blocks dropped since, whose code is
+// never entered again and can be patched harmlessly
+static std::unordered_map<u64, std::vector<LinkSite>> link_sites;
+
+static u64 GetBlockKey(u32 pc, bool thumb) {
+    return (static_cast<u64>(thumb) << 32) | pc;
+}
+
+static s32 RegOffset(int reg) {
+    return static_cast<s32>(offsetof(ARMul_State, Reg) + reg * sizeof(ARMword));
+}
+
+static const s32 N_FLAG_OFFSET = static_cast<s32>(offsetof(ARMul_State, NFlag));
+static const s32 Z_FLAG_OFFSET = static_cast<s32>(offsetof(ARMul_State, ZFlag));
+static const s32 C_FLAG_OFFSET = static_cast<s32>(offsetof(ARMul_State, CFlag));
+static const s32 V_FLAG_OFFSET = static_cast<s32>(offsetof(ARMul_State, VFlag));
+static const s32 T_FLAG_OFFSET = static_cast<s32>(offsetof(ARMul_State, TFlag));
+// Compiled code counts down NumInstrsToExecute, which is cleared to stop it early
+static const s32 BUDGET_OFFSET = static_cast<s32>(offsetof(ARMul_State, NumInstrsToExecute));
+
+// The page table and watch masks are read directly by the inlined fast path of memory accesses
+static_assert(sizeof(u8*) == 8, "page table entries are expected to be 64-bit pointers");
+static_assert(sizeof(std::atomic<u8>) == 1, "page watches are expected to be plain bytes");
+
+// Memory access helpers called from compiled code. These go through the same Memory functions as
+// the interpreter, including its handling of unaligned word loads.
+
+static u32 ReadWord(ARMul_State* state, u32 addr) {
+    u32 value = Memory::Read32(addr);
+    if (BIT(state->CP15[CP15(CP15_CONTROL)], 22) == 0 && (addr & 3) != 0) {
+        const u32 rotation = 8 * (addr & 3);
+        value = (value >> rotation) | (value << (32 - rotation));
+    }
+    return value;
+}
+
+static u32 ReadHalfword(ARMul_State* state, u32 addr) {
+    return Memory::Read16(addr);
+}
+
+static u32 ReadByte(ARMul_State* state, u32 addr) {
+    return Memory::Read8(addr);
+}
+
+static u32 ReadSignedHalfword(ARMul_State* state, u32 addr) {
+    return static_cast<u32>(static_cast<s16>(Memory::Read16(addr)));
+}
+
+static u32 ReadSignedByte(ARMul_State* state, u32 addr) {
+    return static_cast<u32>(static_cast<s8>(Memory::Read8(addr)));
+}
+
+static void WriteWord(ARMul_State* state, u32 addr, u32 value) {
+    Memory::Write32(addr, value);
+}
+
+static void WriteHalfword(ARMul_State* state, u32 addr, u32 value) {
+    Memory::Write16(addr, static_cast<u16>(value));
+}
+
+static void WriteByte(ARMul_State* state, u32 addr, u32 value) {
+    Memory::Write8(addr, static_cast<u8>(value));
+}
+
+static void LoadMultiple(ARMul_State* state, u32 addr, u32 register_list) {
+    for (int i = 0; i < 16; ++i) {
+        if (BIT(register_list, i)) {
+            state->Reg[i] = Memory::Read32(addr);
+            addr += 4;
+        }
+    }
+}
+
+static void StoreMultiple(ARMul_State* state, u32 addr, u32 register_list) {
+    for (int i = 0; i < 16; ++i) {
+        if (BIT(register_list, i)) {
+            Memory::Write32(addr, state->Reg[i]);
+            addr += 4;
+        }
+    }
+}
+
+static void SetLinkTarget(const LinkSite& site, const u8* target) {
+    XEmitter().SetJumpTarget(site.jump, target);
+}
+
+void ClearCache() {
+    blocks.clear();
+    page_blocks.clear();
+    link_sites.clear();
+    code_top = code_space;
+}
+
+/// Code write handler, drops the blocks compiled from a page the guest has written to
+static void InvalidatePage(VAddr page_address) {
+    auto page = page_blocks.find(page_address >> Memory::PAGE_BITS);
+    if (page == page_blocks.end())
+        return;
+
+    for (u64 key : page->second) {
+        blocks.erase(key);
+
+        // Blocks linked to the dropped one return to the dispatcher again, which recompiles it
+        auto sites = link_sites.find(key);
+        if (sites != link_sites.end()) {
+            for (const LinkSite& site : sites->second)
+                SetLinkTarget(site, site.epilogue);
+        }
+    }
+    page_blocks.erase(page);
+}
+
+static void InitCodeSpace() {
+    const int size_mb = std::max(Settings::values.translation_cache_size, 1);
+    code_space_size = static_cast<size_t>(size_mb) * 1024 * 1024;
+    code_space = static_cast<u8*>(AllocateExecutableMemory(code_space_size, false));
+    code_top = code_space;
+
+    Memory::RegisterWriteHandler(Memory::PageWatch::Code, InvalidatePage);
+
+    LOG_DEBUG(Core_ARM11, "JIT code space initialized with %d MiB", size_mb);
+}
+
+/// Result of compiling a single guest instruction
+enum class CompileResult {
+    Unsupported,    ///< Nothing was emitted, the instruction has to be interpreted
+    Continue,       ///< The instruction was compiled, the block continues with the next one
+    EndBlock,       ///< The instruction was compiled and wrote R15, the block ends
+};
+
+/// Jump from the end of a block to a known guest address, which can be linked to the block there
+struct BlockExit {
+    u64 target_key;
+    LinkSite site;
+};
+
+class BlockCompiler {
+public:
+    BlockCompiler(u8* code, u32 start_pc, bool thumb)
+        : emit(code), start_pc(start_pc), thumb(thumb), inst_size(thumb ? 2 : 4) {}
+
+    const u8* GetCodePtr() const {
+        return emit.GetCodePtr();
+    }
+
+    const u8* GetChainEntry() const {
+        return chain_entry;
+    }
+
+    const std::vector<BlockExit>& GetExits() const {
+        return exits;
+    }
+
+    /**
+     * Emits the prologue, used when the dispatcher enters the block, followed by the check of the
+     * instruction budget, where linked blocks enter it
+     */
+    void EmitPrologue() {
+        emit.PUSH(RBX);
+        emit.PUSH(Gen::R12);
+        emit.ALU64_RI(ALU_SUB, RSP, STACK_RESERVE);
+        emit.MOV64_RR(STATE, ABI_PARAM1);
+
+        // The number of instructions is patched in by EmitEpilogue once it is known
+        chain_entry = emit.GetCodePtr();
+        emit.MOV_RM(EAX, STATE, BUDGET_OFFSET);
+        emit.ALU_RI(ALU_SUB, EAX, MAX_BLOCK_INSTRUCTIONS);
+        budget_immediate = emit.GetWritableCodePtr() - 1;
+        out_of_budget = emit.J_CC(CC_B);
+        emit.MOV_MR(STATE, BUDGET_OFFSET, EAX);
+    }
+
+    /**
+     * Emits the epilogue shared by all exits of the block, which returns to the dispatcher
+     * @param num_instructions Number of guest instructions in the block
+     */
+    void EmitEpilogue(u32 num_instructions) {
+        *budget_immediate = static_cast<u8>(num_instructions);
+
+        const u8* epilogue = emit.GetCodePtr();
+        emit.ALU64_RI(ALU_ADD, RSP, STACK_RESERVE);
+        emit.POP(Gen::R12);
+        emit.POP(RBX);
+        emit.RET();
+
+        for (const FixupBranch& jump : dynamic_exits)
+            emit.SetJumpTarget(jump, epilogue);
+        for (BlockExit& exit : exits) {
+            exit.site.epilogue = epilogue;
+            emit.SetJumpTarget(exit.site.jump, epilogue);
+        }
+
+        // Without enough budget left, nothing is run and the dispatcher continues at the block start
+        emit.SetJumpTarget(out_of_budget);
+        emit.MOV_MI(STATE, RegOffset(15), start_pc);
+        emit.SetJumpTarget(emit.J(), epilogue);
+    }
+
+    /**
+     * Ends the block, continuing execution at a known address. The exit goes through the
+     * epilogue until it is linked to the block at the address.
+     */
+    void EmitLinkedExit(u32 target, bool target_thumb) {
+        emit.MOV_MI(STATE, RegOffset(15), target);
+        exits.push_back({ GetBlockKey(target, target_thumb), { emit.J(), nullptr } });
+    }
+
+    void EmitLinkedExit(u32 target) {
+        EmitLinkedExit(target, thumb);
+    }
+
+    /// Ends the block, continuing execution at the address the block has stored to R15
+    void EmitDynamicExit() {
+        dynamic_exits.push_back(emit.J());
+    }
+
+    CompileResult CompileInstruction(u32 inst, u32 pc) {
+        has_bl_prefix = false;
+
+        const u32 cond = BITS(inst, 28, 31);
+        if (cond == COND_NV)
+            return CompileResult::Unsupported;
+
+        switch (BITS(inst, 25, 27)) {
+        case 0:
+        case 1:
+            // Multiplies and extra loads and stores are encoded as register shifted operands
+            if (BITS(inst, 25, 27) == 0 && (inst & 0x90) == 0x90) {
+                if (BITS(inst, 5, 6) != 0)
+                    return CompileExtraLoadStore(inst, pc) ? CompileResult::Continue : CompileResult::Unsupported;
+                return CompileMultiply(inst) ? CompileResult::Continue : CompileResult::Unsupported;
+            }
+            if (IsBranchExchange(inst))
+                return CompileBranchExchange(inst, pc);
+            return CompileDataProcessing(inst, pc) ? CompileResult::Continue : CompileResult::Unsupported;
+
+        case 2:
+        case 3:
+            return CompileLoadStore(inst, pc) ? CompileResult::Continue : CompileResult::Unsupported;
+
+        case 4:
+            return CompileBlockTransfer(inst, pc);
+
+        case 5:
+            return CompileBranch(inst, pc);
+
+        default:
+            return CompileResult::Unsupported;
+        }
+    }
+
+    /// Compiles the Thumb branches, which have no ARM equivalent
+    CompileResult CompileThumbBranch(u32 inst, u32 pc) {
+        const bool after_bl_prefix = has_bl_prefix;
+        has_bl_prefix = false;
+
+        switch (BITS(inst, 11, 15)) {
+        case 26:
+        case 27: {
+            // Conditional branch, condition codes AL and NV are undefined and SWI respectively
+            const u32 offset = static_cast<u32>(static_cast<s32>(inst << 24) >> 23);
+            FixupBranch skip = EmitConditionCheck(BITS(inst, 8, 11));
+            EmitLinkedExit(pc + 4 + offset);
+            emit.SetJumpTarget(skip);
+            EmitLinkedExit(pc + 2);
+            return CompileResult::EndBlock;
+        }
+
+        case 28: {
+            const u32 offset = static_cast<u32>(static_cast<s32>(inst << 21) >> 20);
+            EmitLinkedExit(pc + 4 + offset);
+            return CompileResult::EndBlock;
+        }
+
+        case 30:
+            // First half of BL or BLX, the offset is only added to LR
+            bl_prefix_lr = pc + 4 + (static_cast<u32>(static_cast<s32>(inst << 21) >> 9));
+            has_bl_prefix = true;
+            emit.MOV_MI(STATE, RegOffset(14), bl_prefix_lr);
+            return CompileResult::Continue;
+
+        case 29:
+        case 31: {
+            // Second half of BLX (29) or BL (31). The target is only known if the first half has
+            // been compiled with it, as it always is except when the block ends between them.
+            const bool exchange = BITS(inst, 11, 15) == 29;
+            const u32 offset = BITS(inst, 0, 10) << 1;
+            const u32 mask = exchange ? 0xFFFFFFFC : 0xFFFFFFFF;
+
+            if (!after_bl_prefix) {
+                emit.MOV_RM(EAX, STATE, RegOffset(14));
+                emit.ALU_RI(ALU_ADD, EAX, offset);
+                if (exchange)
+                    emit.ALU_RI(ALU_AND, EAX, mask);
+                emit.MOV_MR(STATE, RegOffset(15), EAX);
+            }
+            emit.MOV_MI(STATE, RegOffset(14), (pc + 2) | 1);
+            if (exchange)
+                emit.MOV_MI(STATE, T_FLAG_OFFSET, 0);
+
+            if (after_bl_prefix)
+                EmitLinkedExit((bl_prefix_lr + offset) & mask, !exchange);
+            else
+                EmitDynamicExit();
+            return CompileResult::EndBlock;
+        }
+
+        default:
+            return CompileResult::Unsupported;
+        }
+    }
+
+private:
+    /**
+     * Emits a check of the given condition against the guest flags
+     * @return Branch taken when the condition fails
+     */
+    FixupBranch EmitConditionCheck(u32 cond) {
+        switch (cond) {
+        case COND_EQ:
+        case COND_NE:
+            emit.ALU_MI(ALU_CMP, STATE, Z_FLAG_OFFSET, 0);
+            return emit.J_CC(cond == COND_EQ ? CC_E : CC_NE);
+        case COND_CS:
+        case COND_CC:
+            emit.ALU_MI(ALU_CMP, STATE, C_FLAG_OFFSET, 0);
+            return emit.J_CC(cond == COND_CS ? CC_E : CC_NE);
+        case COND_MI:
+        case COND_PL:
+            emit.ALU_MI(ALU_CMP, STATE, N_FLAG_OFFSET, 0);
+            return emit.J_CC(cond == COND_MI ? CC_E : CC_NE);
+        case COND_VS:
+        case COND_VC:
+            emit.ALU_MI(ALU_CMP, STATE, V_FLAG_OFFSET, 0);
+            return emit.J_CC(cond == COND_VS ? CC_E : CC_NE);
+        case COND_HI:
+        case COND_LS:
+            // C && !Z
+            emit.MOV_RM(EAX, STATE, Z_FLAG_OFFSET);
+            emit.ALU_RI(ALU_XOR, EAX, 1);
+            emit.ALU_RM(ALU_AND, EAX, STATE, C_FLAG_OFFSET);
+            return emit.J_CC(cond == COND_HI ? CC_Z : CC_NZ);
+        case COND_GE:
+        case COND_LT:
+            // N == V
+            emit.MOV_RM(EAX, STATE, N_FLAG_OFFSET);
+            emit.ALU_RM(ALU_XOR, EAX, STATE, V_FLAG_OFFSET);
+            return emit.J_CC(cond == COND_GE ? CC_NZ : CC_Z);
+        default:
+            // GT and LE: !Z && N == V
+            emit.MOV_RM(EAX, STATE, N_FLAG_OFFSET);
+            emit.ALU_RM(ALU_XOR, EAX, STATE, V_FLAG_OFFSET);
+            emit.ALU_RM(ALU_OR, EAX, STATE, Z_FLAG_OFFSET);
+            return emit.J_CC(cond == COND_GT ? CC_NZ : CC_Z);
+        }
+    }
+
+    /**
+     * Shifts ECX by an immediate amount, following the ARM encoding where an amount of zero means
+     * LSR #32, ASR #32 or RRX. The host carry flag holds the shifter carry out if the function
+     * returns true, otherwise the carry out is the unchanged C flag.
+     */
+    bool EmitShiftByImmediate(u32 type, u32 amount) {
+        switch (type) {
+        case SHIFT_TYPE_LSL:
+            if (amount == 0)
+                return false;
+            emit.SHIFT_RI(SHIFT_SHL, ECX, amount);
+            return true;
+        case SHIFT_TYPE_LSR:
+            if (amount == 0) {
+                emit.SHIFT_RI(SHIFT_SHL, ECX, 1);
+                emit.MOV_RI(ECX, 0);
+            } else {
+                emit.SHIFT_RI(SHIFT_SHR, ECX, amount);
+            }
+            return true;
+        case SHIFT_TYPE_ASR:
+            if (amount == 0) {
+                emit.SHIFT_RI(SHIFT_SAR, ECX, 31);
+                emit.BT_RI(ECX, 0);
+            } else {
+                emit.SHIFT_RI(SHIFT_SAR, ECX, amount);
+            }
+            return true;
+        default:
+            if (amount == 0) {
+                emit.BT_MI(STATE, C_FLAG_OFFSET, 0);
+                emit.SHIFT_RI(SHIFT_RCR, ECX, 1);
+            } else {
+                emit.SHIFT_RI(SHIFT_ROR, ECX, amount);
+            }
+            return true;
+        }
+    }
+
+    /**
+     * Shifts Rm by the bottom byte of Rs into ECX, following the ARM rules for shifts by 32 or
+     * more. Stores the shifter carry out to the C flag if store_carry is set, except for shifts
+     * by 0, which leave it unchanged.
+     */
+    void EmitShiftByRegister(u32 type, u32 rm, u32 rs, bool store_carry) {
+        emit.MOV_RM(ECX, STATE, RegOffset(rs));
+        emit.ALU_RI(ALU_AND, ECX, 0xFF);
+        emit.MOV_RM(EDX, STATE, RegOffset(rm));
+        emit.TEST_RR(ECX, ECX);
+        FixupBranch no_shift = emit.J_CC(CC_Z);
+
+        if (type == SHIFT_TYPE_ROR) {
+            // Rotations by a multiple of 32 keep the value and carry out bit 31
+            emit.ALU_RI(ALU_AND, ECX, 31);
+            FixupBranch multiple_of_32 = emit.J_CC(CC_Z);
+            emit.SHIFT_CL(SHIFT_ROR, EDX);
+            if (store_carry)
+                emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+            FixupBranch rotated = emit.J();
+
+            emit.SetJumpTarget(multiple_of_32);
+            if (store_carry) {
+                emit.BT_RI(EDX, 31);
+                emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+            }
+            emit.SetJumpTarget(rotated);
+        } else {
+            // The host masks the shift amount, so shifts by 32 or more are handled separately
+            emit.ALU_RI(ALU_CMP, ECX, 32);
+            FixupBranch large = emit.J_CC(CC_AE);
+            static const ShiftOp host_shifts[] = { SHIFT_SHL, SHIFT_SHR, SHIFT_SAR };
+            emit.SHIFT_CL(host_shifts[type], EDX);
+            if (store_carry)
+                emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+            FixupBranch shifted = emit.J();
+
+            emit.SetJumpTarget(large);
+            if (type == SHIFT_TYPE_ASR) {
+                emit.SHIFT_RI(SHIFT_SAR, EDX, 31);
+                if (store_carry) {
+                    emit.BT_RI(EDX, 0);
+                    emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+                }
+            } else {
+                // Shifting by exactly 32 carries out the last bit, larger shifts carry out 0
+                if (store_carry) {
+                    emit.BT_RI(EDX, type == SHIFT_TYPE_LSL ? 0 : 31);
+                    emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+                    emit.ALU_RI(ALU_CMP, ECX, 32);
+                    FixupBranch exactly_32 = emit.J_CC(CC_E);
+                    emit.MOV8_MI(STATE, C_FLAG_OFFSET, 0);
+                    emit.SetJumpTarget(exactly_32);
+                }
+                emit.MOV_RI(EDX, 0);
+            }
+            emit.SetJumpTarget(shifted);
+        }
+
+        emit.SetJumpTarget(no_shift);
+        emit.MOV_RR(ECX, EDX);
+    }
+
+    /**
+     * Returns true if the interpreter reads Rn as PC + 8 (PC + 4 in Thumb) for the given data
+     * processing opcode. The other opcodes read it differently and are left to the interpreter.
+     */
+    bool ReadsPCAsRn(u32 opcode) const {
+        switch (opcode) {
+        case OP_EOR: case OP_RSB: case OP_ADD: case OP_TST:
+        case OP_TEQ: case OP_CMP: case OP_BIC:
+            return true;
+        case OP_SUB:
+            // Always reads PC + 8, even in Thumb
+            return inst_size == 4;
+        default:
+            return false;
+        }
+    }
+
+    bool CompileDataProcessing(u32 inst, u32 pc) {
+        const u32 opcode = BITS(inst, 21, 24);
+        const bool set_flags = BIT(inst, 20) != 0;
+        const u32 rn = BITS(inst, 16, 19);
+        const u32 rd = BITS(inst, 12, 15);
+        const u32 rs = BITS(inst, 8, 11);
+        const u32 rm = BITS(inst, 0, 3);
+        const bool immediate = BIT(inst, 25) != 0;
+        const bool register_shift = !immediate && BIT(inst, 4) != 0;
+
+        const bool is_compare = opcode >= OP_TST && opcode <= OP_CMN;
+        const bool uses_rn = opcode != OP_MOV && opcode != OP_MVN;
+        const bool is_logical = opcode == OP_AND || opcode == OP_EOR || opcode == OP_TST ||
+                                opcode == OP_TEQ || opcode >= OP_ORR;
+
+        // Register shifted operands share their encoding space with multiplies and extra loads
+        // and stores, and compares without S are miscellaneous instructions such as MRS and MSR.
+        if (register_shift && BIT(inst, 7))
+            return false;
+        if (is_compare && !set_flags)
+            return false;
+
+        // Writing the PC is left to the interpreter, as is reading it where the interpreter
+        // doesn't read it as PC + 8 (PC + 4 in Thumb)
+        if (!is_compare && rd == 15)
+            return false;
+        if (uses_rn && rn == 15 && (register_shift || !ReadsPCAsRn(opcode)))
+            return false;
+        if (register_shift && (rm == 15 || rs == 15))
+            return false;
+
+        const u32 pc_value = pc + 2 * inst_size;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        // The second operand is either an immediate or is held in ECX
+        u32 operand = 0;
+        if (immediate) {
+            const u32 rotation = BITS(inst, 8, 11) * 2;
+            operand = BITS(inst, 0, 7);
+            if (rotation != 0) {
+                operand = (operand >> rotation) | (operand << (32 - rotation));
+                if (set_flags && is_logical)
+                    emit.MOV8_MI(STATE, C_FLAG_OFFSET, operand >> 31);
+            }
+        } else if (register_shift) {
+            EmitShiftByRegister(BITS(inst, 5, 6), rm, rs, set_flags && is_logical);
+        } else {
+            if (rm == 15)
+                emit.MOV_RI(ECX, pc_value);
+            else
+                emit.MOV_RM(ECX, STATE, RegOffset(rm));
+            if (EmitShiftByImmediate(BITS(inst, 5, 6), BITS(inst, 7, 11)) && set_flags && is_logical)
+                emit.SETcc_M(CC_C, STATE, C_FLAG_OFFSET);
+        }
+
+        auto load_rn = [&] {
+            if (rn == 15)
+                emit.MOV_RI(EAX, pc_value);
+            else
+                emit.MOV_RM(EAX, STATE, RegOffset(rn));
+        };
+        auto apply_operand = [&](ALUOp op) {
+            if (immediate)
+                emit.ALU_RI(op, EAX, operand);
+            else
+                emit.ALU_RR(op, EAX, ECX);
+        };
+        auto load_operand = [&] {
+            if (immediate)
+                emit.MOV_RI(EAX, operand);
+            else
+                emit.MOV_RR(EAX, ECX);
+        };
+
+        // Whether the ARM carry flag is the inverse of the host carry flag (subtractions)
+        bool inverted_carry = false;
+
+        switch (opcode) {
+        case OP_AND:
+        case OP_TST:
+            load_rn();
+            apply_operand(ALU_AND);
+            break;
+        case OP_EOR:
+        case OP_TEQ:
+            load_rn();
+            apply_operand(ALU_XOR);
+            break;
+        case OP_SUB:
+        case OP_CMP:
+            load_rn();
+            apply_operand(ALU_SUB);
+            inverted_carry = true;
+            break;
+        case OP_RSB:
+            load_operand();
+            if (rn == 15)
+                emit.ALU_RI(ALU_SUB, EAX, pc_value);
+            else
+                emit.ALU_RM(ALU_SUB, EAX, STATE, RegOffset(rn));
+            inverted_carry = true;
+            break;
+        case OP_ADD:
+        case OP_CMN:
+            load_rn();
+            apply_operand(ALU_ADD);
+            break;
+        case OP_ADC:
+            load_rn();
+            emit.BT_MI(STATE, C_FLAG_OFFSET, 0);
+            apply_operand(ALU_ADC);
+            break;
+        case OP_SBC:
+            // The host borrows when the ARM carry flag is clear
+            load_rn();
+            emit.BT_MI(STATE, C_FLAG_OFFSET, 0);
+            emit.CMC();
+            apply_operand(ALU_SBB);
+            inverted_carry = true;
+            break;
+        case OP_RSC:
+            load_operand();
+            emit.BT_MI(STATE, C_FLAG_OFFSET, 0);
+            emit.CMC();
+            emit.ALU_RM(ALU_SBB, EAX, STATE, RegOffset(rn));
+            inverted_carry = true;
+            break;
+        case OP_ORR:
+            load_rn();
+            apply_operand(ALU_OR);
+            break;
+        case OP_MOV:
+            load_operand();
+            if (set_flags)
+                emit.TEST_RR(EAX, EAX);
+            break;
+        case OP_BIC:
+            load_rn();
+            if (immediate) {
+                emit.ALU_RI(ALU_AND, EAX, ~operand);
+            } else {
+                emit.NOT(ECX);
+                emit.ALU_RR(ALU_AND, EAX, ECX);
+            }
+            break;
+        case OP_MVN:
+            load_operand();
+            emit.NOT(EAX);
+            if (set_flags)
+                emit.TEST_RR(EAX, EAX);
+            break;
+        }
+
+        // Neither MOV nor SETcc modify the host flags. The guest flags are always 0 or 1, so it is
+        // enough to set their lowest byte.
+        if (!is_compare)
+            emit.MOV_MR(STATE, RegOffset(rd), EAX);
+
+        if (set_flags) {
+            emit.SETcc_M(CC_S, STATE, N_FLAG_OFFSET);
+            emit.SETcc_M(CC_Z, STATE, Z_FLAG_OFFSET);
+            if (!is_logical) {
+                emit.SETcc_M(inverted_carry ? CC_NC : CC_C, STATE, C_FLAG_OFFSET);
+                emit.SETcc_M(CC_O, STATE, V_FLAG_OFFSET);
+            }
+        }
+
+        if (cond != COND_AL)
+            emit.SetJumpTarget(skip);
+
+        return true;
+    }
+
+    /// Loads the page number of the guest address in ADDR into EAX and the host pointer of the page into RCX
+    void EmitPageLookup() {
+        emit.MOV_RR(EAX, ADDR);
+        emit.SHIFT_RI(SHIFT_SHR, EAX, Memory::PAGE_BITS);
+        emit.MOV_RR(EDX, EAX);
+        emit.SHIFT_RI(SHIFT_SHL, EDX, 3);
+        emit.MOV64_RI(RCX, reinterpret_cast<u64>(Memory::GetPageTablePointers()));
+        emit.ALU64_RR(ALU_ADD, RCX, RDX);
+        emit.MOV64_RM(RCX, RCX, 0);
+    }
+
+    /// Emits a jump taken if the page with the number in EAX is watched, clobbers RDX
+    FixupBranch EmitWatchCheck() {
+        emit.MOV64_RI(RDX, reinterpret_cast<u64>(Memory::GetPageWatches()));
+        emit.ALU64_RR(ALU_ADD, RDX, RAX);
+        emit.MOVZX8_RM(EDX, RDX, 0);
+        emit.TEST_RR(EDX, EDX);
+        return emit.J_CC(CC_NZ);
+    }
+
+    /// Adds the page offset of the guest address in ADDR to the host page pointer in RCX
+    void EmitHostAddress() {
+        emit.MOV_RR(EAX, ADDR);
+        emit.ALU_RI(ALU_AND, EAX, Memory::PAGE_MASK);
+        emit.ALU64_RR(ALU_ADD, RCX, RAX);
+    }
+
+    void EmitHelperCall(const void* helper) {
+        emit.MOV64_RR(ABI_PARAM1, STATE);
+        emit.MOV_RR(ABI_PARAM2, ADDR);
+        emit.MOV64_RI(RAX, reinterpret_cast<u64>(helper));
+        emit.CALL_R(RAX);
+    }
+
+    /**
+     * Loads from the guest address in ADDR into EAX. Aligned loads from pages backed by host memory
+     * read it directly, like Memory::Read does, everything else calls the helper.
+     * @param size Size of the access in bytes
+     * @param sign_extend Whether to sign extend bytes and halfwords instead of zero extending them
+     * @param helper Slow path, which also handles unaligned loads
+     */
+    void EmitLoad(u32 size, bool sign_extend, u32 (*helper)(ARMul_State*, u32)) {
+        EmitPageLookup();
+        emit.TEST64_RR(RCX, RCX);
+        FixupBranch unmapped = emit.J_CC(CC_Z);
+        FixupBranch unaligned;
+        if (size > 1) {
+            emit.TEST_RI(ADDR, size - 1);
+            unaligned = emit.J_CC(CC_NZ);
+        }
+
+        EmitHostAddress();
+        if (size == 1)
+            sign_extend ? emit.MOVSX8_RM(EAX, RCX, 0) : emit.MOVZX8_RM(EAX, RCX, 0);
+        else if (size == 2)
+            sign_extend ? emit.MOVSX16_RM(EAX, RCX, 0) : emit.MOVZX16_RM(EAX, RCX, 0);
+        else
+            emit.MOV_RM(EAX, RCX, 0);
+        FixupBranch done = emit.J();
+
+        emit.SetJumpTarget(unmapped);
+        if (size > 1)
+            emit.SetJumpTarget(unaligned);
+        EmitHelperCall(reinterpret_cast<const void*>(helper));
+        emit.SetJumpTarget(done);
+    }
+
+    /**
+     * Stores the guest register at the given offset to the guest address in ADDR. Aligned stores to
+     * unwatched pages backed by host memory write it directly, like Memory::Write does, everything
+     * else calls the helper.
+     * @param size Size of the access in bytes
+     * @param value_offset Offset of the stored register in the state
+     * @param helper Slow path, which also notifies the write handlers of watched pages
+     */
+    void EmitStore(u32 size, s32 value_offset, void (*helper)(ARMul_State*, u32, u32)) {
+        EmitPageLookup();
+        emit.TEST64_RR(RCX, RCX);
+        FixupBranch unmapped = emit.J_CC(CC_Z);
+        FixupBranch watched = EmitWatchCheck();
+        FixupBranch unaligned;
+        if (size > 1) {
+            emit.TEST_RI(ADDR, size - 1);
+            unaligned = emit.J_CC(CC_NZ);
+        }
+
+        EmitHostAddress();
+        emit.MOV_RM(EDX, STATE, value_offset);
+        if (size == 1)
+            emit.MOV8_MR(RCX, 0, EDX);
+        else if (size == 2)
+            emit.MOV16_MR(RCX, 0, EDX);
+        else
+            emit.MOV_MR(RCX, 0, EDX);
+        FixupBranch done = emit.J();
+
+        emit.SetJumpTarget(unmapped);
+        emit.SetJumpTarget(watched);
+        if (size > 1)
+            emit.SetJumpTarget(unaligned);
+        emit.MOV_RM(ABI_PARAM3, STATE, value_offset);
+        EmitHelperCall(reinterpret_cast<const void*>(helper));
+        emit.SetJumpTarget(done);
+    }
+
+    /**
+     * Computes the address of a single load or store into ADDR and writes the base register back.
+     * As in the interpreter, the base register is written back before the access.
+     * @param register_offset Whether the offset is held in ECX instead of being the immediate
+     */
+    void EmitAddress(u32 rn, bool pre_indexed, bool write_back, bool add, bool register_offset,
+                     u32 offset, u32 pc) {
+        auto apply_offset = [&](X64Reg reg) {
+            if (register_offset)
+                emit.ALU_RR(add ? ALU_ADD : ALU_SUB, reg, ECX);
+            else if (offset != 0)
+                emit.ALU_RI(add ? ALU_ADD : ALU_SUB, reg, offset);
+        };
+
+        if (rn == 15) {
+            // PC relative literal loads have a constant address
+            const u32 base = (pc & ~3) + 2 * inst_size;
+            emit.MOV_RI(ADDR, add ? base + offset : base - offset);
+        } else {
+            emit.MOV_RM(ADDR, STATE, RegOffset(rn));
+            if (pre_indexed) {
+                apply_offset(ADDR);
+                if (write_back)
+                    emit.MOV_MR(STATE, RegOffset(rn), ADDR);
+            } else {
+                emit.MOV_RR(EAX, ADDR);
+                apply_offset(EAX);
+                emit.MOV_MR(STATE, RegOffset(rn), EAX);
+            }
+        }
+    }
+
+    /// Compiles LDR, LDRB, STR and STRB with immediate and immediate-shifted register offsets
+    bool CompileLoadStore(u32 inst, u32 pc) {
+        const bool register_offset = BIT(inst, 25) != 0;
+        const bool pre_indexed = BIT(inst, 24) != 0;
+        const bool add = BIT(inst, 23) != 0;
+        const bool byte = BIT(inst, 22) != 0;
+        const bool write_back = BIT(inst, 21) != 0;
+        const bool load = BIT(inst, 20) != 0;
+        const u32 rn = BITS(inst, 16, 19);
+        const u32 rd = BITS(inst, 12, 15);
+        const u32 rm = BITS(inst, 0, 3);
+        const u32 shift_type = BITS(inst, 5, 6);
+        const u32 shift_amount = BITS(inst, 7, 11);
+
+        // Media instructions share the register offset encoding space
+        if (register_offset && BIT(inst, 4))
+            return false;
+        // LDRT, STRT, LDRBT and STRBT
+        if (!pre_indexed && write_back)
+            return false;
+        if (rd == 15)
+            return false;
+
+        const bool updates_base = !pre_indexed || write_back;
+        if (rn == 15 && (updates_base || register_offset))
+            return false;
+        if (register_offset && (rm == 15 || (shift_type == SHIFT_TYPE_ROR && shift_amount == 0)))
+            return false;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        if (register_offset) {
+            emit.MOV_RM(ECX, STATE, RegOffset(rm));
+            EmitShiftByImmediate(shift_type, shift_amount);
+        }
+        EmitAddress(rn, pre_indexed, write_back, add, register_offset, BITS(inst, 0, 11), pc);
+
+        if (load) {
+            if (byte)
+                EmitLoad(1, false, &ReadByte);
+            else
+                EmitLoad(4, false, &ReadWord);
+            emit.MOV_MR(STATE, RegOffset(rd), EAX);
+        } else {
+            if (byte)
+                EmitStore(1, RegOffset(rd), &WriteByte);
+            else
+                EmitStore(4, RegOffset(rd), &WriteWord);
+        }
+
+        if (cond != COND_AL)
+            emit.SetJumpTarget(skip);
+
+        return true;
+    }
+
+    /// Compiles LDRH, STRH, LDRSB and LDRSH with immediate and register offsets
+    bool CompileExtraLoadStore(u32 inst, u32 pc) {
+        const bool pre_indexed = BIT(inst, 24) != 0;
+        const bool add = BIT(inst, 23) != 0;
+        const bool immediate = BIT(inst, 22) != 0;
+        const bool write_back = BIT(inst, 21) != 0;
+        const bool load = BIT(inst, 20) != 0;
+        const u32 rn = BITS(inst, 16, 19);
+        const u32 rd = BITS(inst, 12, 15);
+        const u32 rm = BITS(inst, 0, 3);
+        const u32 type = BITS(inst, 5, 6);
+
+        // LDRD and STRD, and the unpredictable post-indexed forms with write back
+        if (!load && type != 1)
+            return false;
+        if (!pre_indexed && write_back)
+            return false;
+        if (rd == 15)
+            return false;
+
+        const bool updates_base = !pre_indexed || write_back;
+        if (rn == 15 && (updates_base || !immediate))
+            return false;
+        if (!immediate && rm == 15)
+            return false;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        if (!immediate)
+            emit.MOV_RM(ECX, STATE, RegOffset(rm));
+        EmitAddress(rn, pre_indexed, write_back, add, !immediate, (BITS(inst, 8, 11) << 4) | rm, pc);
+
+        if (load) {
+            switch (type) {
+            case 1:
+                EmitLoad(2, false, &ReadHalfword);
+                break;
+            case 2:
+                EmitLoad(1, true, &ReadSignedByte);
+                break;
+            default:
+                EmitLoad(2, true, &ReadSignedHalfword);
+                break;
+            }
+            emit.MOV_MR(STATE, RegOffset(rd), EAX);
+        } else {
+            EmitStore(2, RegOffset(rd), &WriteHalfword);
+        }
+
+        if (cond != COND_AL)
+            emit.SetJumpTarget(skip);
+
+        return true;
+    }
+
+    /// Compiles LDM and STM, except for the forms accessing user mode registers
+    CompileResult CompileBlockTransfer(u32 inst, u32 pc) {
+        const bool pre_indexed = BIT(inst, 24) != 0;
+        const bool add = BIT(inst, 23) != 0;
+        const bool user_registers = BIT(inst, 22) != 0;
+        const bool write_back = BIT(inst, 21) != 0;
+        const bool load = BIT(inst, 20) != 0;
+        const u32 rn = BITS(inst, 16, 19);
+        const u32 register_list = BITS(inst, 0, 15);
+
+        if (user_registers || register_list == 0 || rn == 15)
+            return CompileResult::Unsupported;
+        // The interpreter stores an unusual value for PC, leave it to the interpreter
+        if (!load && BIT(register_list, 15))
+            return CompileResult::Unsupported;
+
+        u32 count = 0;
+        for (u32 list = register_list; list != 0; list &= list - 1)
+            ++count;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        // The registers are transferred in ascending order starting at the lowest address
+        s32 start_offset;
+        if (add)
+            start_offset = pre_indexed ? 4 : 0;
+        else
+            start_offset = pre_indexed ? -4 * static_cast<s32>(count) : 4 - 4 * static_cast<s32>(count);
+
+        emit.MOV_RM(ADDR, STATE, RegOffset(rn));
+        if (start_offset != 0)
+            emit.ALU_RI(ALU_ADD, ADDR, static_cast<u32>(start_offset));
+
+        // As in the interpreter, loads write the base register back first so that a loaded base
+        // register wins, while stores see the original value of the base register
+        auto emit_write_back = [&] {
+            if (write_back)
+                emit.ALU_MI(add ? ALU_ADD : ALU_SUB, STATE, RegOffset(rn), 4 * count);
+        };
+        if (load)
+            emit_write_back();
+
+        // Transfers which stay within an aligned page backed by host memory access it directly
+        emit.TEST_RI(ADDR, 3);
+        FixupBranch unaligned = emit.J_CC(CC_NZ);
+        emit.MOV_RR(EAX, ADDR);
+        emit.ALU_RI(ALU_AND, EAX, Memory::PAGE_MASK);
+        emit.ALU_RI(ALU_CMP, EAX, Memory::PAGE_SIZE - 4 * count);
+        FixupBranch crosses_page = emit.J_CC(CC_A);
+        EmitPageLookup();
+        emit.TEST64_RR(RCX, RCX);
+        FixupBranch unmapped = emit.J_CC(CC_Z);
+        FixupBranch watched;
+        if (!load)
+            watched = EmitWatchCheck();
+
+        EmitHostAddress();
+        s32 offset = 0;
+        for (int i = 0; i < 16; ++i) {
+            if (!BIT(register_list, i))
+                continue;
+            if (load) {
+                emit.MOV_RM(EAX, RCX, offset);
+                emit.MOV_MR(STATE, RegOffset(i), EAX);
+            } else {
+                emit.MOV_RM(EAX, STATE, RegOffset(i));
+                emit.MOV_MR(RCX, offset, EAX);
+            }
+            offset += 4;
+        }
+        FixupBranch done = emit.J();
+
+        emit.SetJumpTarget(unaligned);
+        emit.SetJumpTarget(crosses_page);
+        emit.SetJumpTarget(unmapped);
+        if (!load)
+            emit.SetJumpTarget(watched);
+        emit.MOV_RI(ABI_PARAM3, register_list);
+        EmitHelperCall(reinterpret_cast<const void*>(load ? &LoadMultiple : &StoreMultiple));
+        emit.SetJumpTarget(done);
+
+        if (!load)
+            emit_write_back();
+
+        if (!BIT(register_list, 15)) {
+            if (cond != COND_AL)
+                emit.SetJumpTarget(skip);
+            return CompileResult::Continue;
+        }
+
+        // Loading PC switches to Thumb if bit 0 is set
+        emit.MOV_RM(EAX, STATE, RegOffset(15));
+        emit.MOV_RR(ECX, EAX);
+        emit.ALU_RI(ALU_AND, ECX, 1);
+        emit.MOV_MR(STATE, T_FLAG_OFFSET, ECX);
+        emit.ALU_RI(ALU_AND, EAX, 0xFFFFFFFE);
+        emit.MOV_MR(STATE, RegOffset(15), EAX);
+        EmitDynamicExit();
+
+        if (cond != COND_AL) {
+            emit.SetJumpTarget(skip);
+            EmitLinkedExit(pc + inst_size);
+        }
+        return CompileResult::EndBlock;
+    }
+
+    /// Compiles MUL, MLA and the 64-bit UMULL, UMLAL, SMULL and SMLAL
+    bool CompileMultiply(u32 inst) {
+        const u32 opcode = BITS(inst, 21, 23);
+        const bool set_flags = BIT(inst, 20) != 0;
+        const u32 rd = BITS(inst, 16, 19);      // RdHi of the long multiplies
+        const u32 rn = BITS(inst, 12, 15);      // RdLo of the long multiplies
+        const u32 rs = BITS(inst, 8, 11);
+        const u32 rm = BITS(inst, 0, 3);
+
+        const bool is_long = opcode >= 4;
+        const bool accumulate = (opcode & 1) != 0;
+        const bool is_signed = opcode >= 6;
+
+        // UMAAL and the undefined opcodes
+        if (opcode == 2 || opcode == 3)
+            return false;
+        if (rd == 15 || rs == 15 || rm == 15)
+            return false;
+        if ((accumulate || is_long) && rn == 15)
+            return false;
+        // The result of writing both halves to the same register is unpredictable
+        if (is_long && rd == rn)
+            return false;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        if (!is_long) {
+            emit.MOV_RM(EAX, STATE, RegOffset(rm));
+            emit.MOV_RM(ECX, STATE, RegOffset(rs));
+            emit.IMUL_RR(EAX, ECX);
+            if (accumulate)
+                emit.ALU_RM(ALU_ADD, EAX, STATE, RegOffset(rn));
+            emit.MOV_MR(STATE, RegOffset(rd), EAX);
+            if (set_flags)
+                emit.TEST_RR(EAX, EAX);
+        } else {
+            // The low 64 bits of the product are the same for signed and unsigned operands, as long
+            // as they are extended accordingly
+            emit.MOV_RM(EAX, STATE, RegOffset(rm));
+            emit.MOV_RM(ECX, STATE, RegOffset(rs));
+            if (is_signed) {
+                emit.MOVSXD(RAX, EAX);
+                emit.MOVSXD(RCX, ECX);
+            }
+            emit.IMUL64_RR(RAX, RCX);
+            if (accumulate) {
+                emit.MOV_RM(ECX, STATE, RegOffset(rd));
+                emit.SHIFT64_RI(SHIFT_SHL, RCX, 32);
+                emit.MOV_RM(EDX, STATE, RegOffset(rn));
+                emit.ALU64_RR(ALU_OR, RCX, RDX);
+                emit.ALU64_RR(ALU_ADD, RAX, RCX);
+            }
+            emit.MOV_MR(STATE, RegOffset(rn), EAX);
+            if (set_flags) {
+                emit.TEST64_RR(RAX, RAX);
+                emit.SETcc_M(CC_S, STATE, N_FLAG_OFFSET);
+                emit.SETcc_M(CC_Z, STATE, Z_FLAG_OFFSET);
+            }
+            emit.SHIFT64_RI(SHIFT_SHR, RAX, 32);
+            emit.MOV_MR(STATE, RegOffset(rd), EAX);
+        }
+
+        // Multiplies leave C and V alone
+        if (set_flags && !is_long) {
+            emit.SETcc_M(CC_S, STATE, N_FLAG_OFFSET);
+            emit.SETcc_M(CC_Z, STATE, Z_FLAG_OFFSET);
+        }
+
+        if (cond != COND_AL)
+            emit.SetJumpTarget(skip);
+
+        return true;
+    }
+
+    static bool IsBranchExchange(u32 inst) {
+        return (inst & 0x0FFFFFF0) == 0x012FFF10;
+    }
+
+    CompileResult CompileBranchExchange(u32 inst, u32 pc) {
+        const u32 rm = BITS(inst, 0, 3);
+        if (rm == 15)
+            return CompileResult::Unsupported;
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        emit.MOV_RM(EAX, STATE, RegOffset(rm));
+        emit.MOV_RR(ECX, EAX);
+        emit.ALU_RI(ALU_AND, ECX, 1);
+        emit.MOV_MR(STATE, T_FLAG_OFFSET, ECX);
+        emit.ALU_RI(ALU_AND, EAX, 0xFFFFFFFE);
+        emit.MOV_MR(STATE, RegOffset(15), EAX);
+        EmitDynamicExit();
+
+        if (cond != COND_AL) {
+            emit.SetJumpTarget(skip);
+            EmitLinkedExit(pc + inst_size);
+        }
+        return CompileResult::EndBlock;
+    }
+
+    CompileResult CompileBranch(u32 inst, u32 pc) {
+        const bool link = BIT(inst, 24) != 0;
+        const u32 offset = static_cast<u32>(static_cast<s32>(inst << 8) >> 6);
+
+        const u32 cond = BITS(inst, 28, 31);
+        FixupBranch skip;
+        if (cond != COND_AL)
+            skip = EmitConditionCheck(cond);
+
+        if (link)
+            emit.MOV_MI(STATE, RegOffset(14), pc + 4);
+        EmitLinkedExit(pc + 8 + offset);
+
+        if (cond != COND_AL) {
+            emit.SetJumpTarget(skip);
+            EmitLinkedExit(pc + 4);
+        }
+        return CompileResult::EndBlock;
+    }
+
+    XEmitter emit;
+    u32 start_pc;
+    bool thumb;
+    u32 inst_size;
+
+    const u8* chain_entry = nullptr;
+    u8* budget_immediate = nullptr;
+    FixupBranch out_of_budget;
+
+    std::vector<BlockExit> exits;
+    std::vector<FixupBranch> dynamic_exits;
+
+    /// Whether the previous instruction is the first half of a Thumb BL, which has set LR to bl_prefix_lr
+    bool has_bl_prefix = false;
+    u32 bl_prefix_lr = 0;
+};
+
+
+/// Kind of instruction returned by FetchInstruction
+enum class FetchResult {
+    Arm,            ///< An ARM instruction, or a Thumb instruction translated to its ARM equivalent
+    ThumbBranch,    ///< A Thumb branch, which has no ARM equivalent
+    Undefined,      ///< An undefined Thumb instruction
+};
+
+/**
+ * Fetches the instruction at the given address, translating Thumb instructions to their ARM
+ * equivalent like the interpreter does. Thumb branches are returned untranslated.
+ */
+static FetchResult FetchInstruction(u32 pc, bool thumb, u32& inst) {
+    const u32 word = Memory::Read32(pc & ~3);
+    if (!thumb) {
+        inst = word;
+        return FetchResult::Arm;
+    }
+
+    // Translated instructions are reported as t_uninitialized
+    u32 inst_size;
+    const tdstate result = thumb_translate(pc, word, &inst, &inst_size);
+    if (result == t_branch) {
+        inst = get_thumb_instr(word, pc);
+        return FetchResult::ThumbBranch;
+    }
+    return result == t_undefined ? FetchResult::Undefined : FetchResult::Arm;
+}
+
+static CachedBlock Compile(u32 pc, bool thumb, std::vector<BlockExit>& exits) {
+    const u32 inst_size = thumb ? 2 : 4;
+    const u32 page = pc >> Memory::PAGE_BITS;
+
+    BlockCompiler compiler(code_top, pc, thumb);
+    compiler.EmitPrologue();
+
+    CachedBlock cached = { { nullptr, 0, false }, nullptr };
+    Block& block = cached.block;
+    bool ended = false;
+
+    while (block.num_instructions < MAX_BLOCK_INSTRUCTIONS && (pc >> Memory::PAGE_BITS) == page) {
+        u32 inst;
+        const FetchResult fetched = FetchInstruction(pc, thumb, inst);
+        if (fetched == FetchResult::Undefined)
+            break;
+
+        const u8* inst_code = compiler.GetCodePtr();
+        const CompileResult result = fetched == FetchResult::ThumbBranch
+                                   ? compiler.CompileThumbBranch(inst, pc)
+                                   : compiler.CompileInstruction(inst, pc);
+        if (result == CompileResult::Unsupported)
+            break;
+
+        _dbg_assert_msg_(Core_ARM11, static_cast<size_t>(compiler.GetCodePtr() - inst_code) <= MAX_INSTRUCTION_CODE_SIZE,
+                         "host code of instruction %08X at %08X is too large", inst, pc);
+
+        block.num_instructions++;
+        pc += inst_size;
+
+        if (result == CompileResult::EndBlock) {
+            ended = true;
+            break;
+        }
+    }
+
+    // Nothing is kept for blocks starting with an instruction that has to be interpreted
+    if (block.num_instructions == 0)
+        return cached;
+
+    if (!ended)
+        compiler.EmitLinkedExit(pc);
+    compiler.EmitEpilogue(block.num_instructions);
+
+    block.entry = reinterpret_cast<BlockEntry>(code_top);
+    cached.chain_entry = compiler.GetChainEntry();
+    exits = compiler.GetExits();
+    code_top = const_cast<u8*>(compiler.GetCodePtr());
+    return cached;
+}
+
+Block GetBlock(u32 pc, bool thumb) {
+    const u64 key = GetBlockKey(pc, thumb);
+
+    auto it = blocks.find(key);
+    if (it != blocks.end())
+        return it->second.block;
+
+    if (code_space == nullptr)
+        InitCodeSpace();
+
+    // Start over with an empty cache when running out of code space. This is safe since compiled
+    // blocks are only ever entered from the dispatcher, and left before it compiles anything.
+    if (static_cast<size_t>(code_top - code_space) + MAX_BLOCK_CODE_SIZE > code_space_size)
+        ClearCache();
+
+    std::vector<BlockExit> exits;
+    CachedBlock cached = Compile(pc, thumb, exits);
+    Block& block = cached.block;
+    block.idle_loop = block.entry != nullptr && Settings::values.skip_idle_loops &&
+                      IdleLoop::IsIdleLoop(pc, thumb);
+
+    // Idle loops are always entered from the dispatcher, which stops running once one loops
+    if (block.idle_loop)
+        cached.chain_entry = nullptr;
+
+    blocks.emplace(key, cached);
+    page_blocks[pc >> Memory::PAGE_BITS].push_back(key);
+    Memory::WatchPage(Memory::PageWatch::Code, pc);
+
+    // Link the exits of the new block to the blocks compiled so far, and the blocks compiled so far
+    // to the new block
+    for (const BlockExit& exit : exits) {
+        link_sites[exit.target_key].push_back(exit.site);
+
+        auto target = blocks.find(exit.target_key);
+        if (target != blocks.end() && target->second.chain_entry != nullptr)
+            SetLinkTarget(exit.site, target->second.chain_entry);
+    }
+    if (cached.chain_entry != nullptr) {
+        for (const LinkSite& site : link_sites[key])
+            SetLinkTarget(site, cached.chain_entry);
+    }
+
+    return block;
+}
+
+} // namespace
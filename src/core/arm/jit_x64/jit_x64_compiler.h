@@ -0,0 +1,40 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "common/common_types.h"
+
+#include "core/arm/skyeye_common/armdefs.h"
+
+namespace JitX64 {
+
+/**
+ * Host code of a compiled block. Runs the block on the given state and updates R15 on exit. Blocks
+ * ending in a branch to a known address jump straight into the block there, as long as
+ * NumInstrsToExecute is large enough for it, and subtract the instructions they run from it.
+ */
+typedef void (*BlockEntry)(ARMul_State* state);
+
+struct Block {
+    BlockEntry entry;       ///< Host code, or nullptr if the first instruction must be interpreted
+    u32 num_instructions;   ///< Number of guest instructions executed by the host code
+    bool idle_loop;         ///< True if the block is an idle loop, see IdleLoop::IsIdleLoop
+};
+
+/**
+ * Looks up the block starting at the given address, compiling it if needed and linking it to the
+ * blocks it branches to. Blocks end at the first branch, at the end of the guest page, or before
+ * the first instruction the compiler does not support, which the caller is expected to run
+ * through the interpreter.
+ * @param pc Guest address of the first instruction
+ * @param thumb Whether the block consists of Thumb instructions
+ * @return The block starting at pc
+ */
+Block GetBlock(u32 pc, bool thumb);
+
+/// Drops every compiled block
+void ClearCache();
+
+} // namespace
@@ -117,6 +117,7 @@ struct ARMul_State
 
     unsigned long long NumInstrs; // The number of instructions executed
     unsigned NumInstrsToExecute;
+    bool InIdleLoop; // Set when execution stopped in an idle loop
 
     unsigned NextInstr;
     unsigned VectorCatch;                   // Caught exception mask
@@ -44,6 +44,10 @@ void vfp_raise_exceptions(ARMul_State* state, u32 exceptions, u32 inst, u32 fpsc
 u32 vfp_single_cpdo(ARMul_State* state, u32 inst, u32 fpscr);
 u32 vfp_double_cpdo(ARMul_State* state, u32 inst, u32 fpscr);
 
+// Host FPU fast path of vfp_single_cpdo/vfp_double_cpdo, returns false if SoftFloat has to be used
+bool vfp_single_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions);
+bool vfp_double_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions);
+
 // MRC
 void VMRS(ARMul_State* state, ARMword reg, ARMword Rt, ARMword* value);
 void VMOVBRS(ARMul_State* state, ARMword to_arm, ARMword t, ARMword n, ARMword* value);
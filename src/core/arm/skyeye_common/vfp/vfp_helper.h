@@ -327,6 +327,7 @@ static inline int vfp_single_type(struct vfp_single *s)
 
 
 u32 vfp_single_normaliseround(ARMul_State* state, int sd, struct vfp_single *vs, u32 fpscr, u32 exceptions, const char *func);
+u32 vfp_single_normaliseroundintern(ARMul_State* state, struct vfp_single *vs, u32 fpscr, u32 exceptions, const char *func);
 
 /*
  * Double-precision
@@ -208,7 +208,7 @@ u32 vfp_double_normaliseroundintern(ARMul_State* state, struct vfp_double *vd, u
         vd->significand = significand >> 1;
     }
  pack:
-    return 0;
+    return exceptions;
 }
 
 u32 vfp_double_normaliseround(ARMul_State* state, int dd, struct vfp_double *vd, u32 fpscr, u32 exceptions, const char *func)
@@ -1075,6 +1075,16 @@ vfp_double_multiply_accumulate(ARMul_State* state, int dd, int dn, int dm, u32 f
         vfp_double_normalise_denormal(&vdm);
 
     exceptions = vfp_double_multiply(&vdp, &vdn, &vdm, fpscr);
+
+    /*
+     * The VFP11 rounds the product to double precision before
+     * accumulating it. NaNs are passed on as they are.
+     */
+    if (!(exceptions & VFP_NAN_FLAG)) {
+        exceptions = vfp_double_normaliseroundintern(state, &vdp, fpscr, exceptions, func);
+        vfp_double_unpack(&vdp, vfp_double_pack(&vdp));
+    }
+
     if (negate & NEG_MULTIPLY)
         vdp.sign = vfp_sign_negate(vdp.sign);
 
@@ -1355,6 +1365,10 @@ u32 vfp_double_cpdo(ARMul_State* state, u32 inst, u32 fpscr)
     struct op *fop;
 
     LOG_TRACE(Core_ARM11, "In %s\n", __FUNCTION__);
+
+    if (vfp_double_cpdo_fast(state, inst, fpscr, &exceptions))
+        return exceptions;
+
     vecstride = (1 + ((fpscr & FPSCR_STRIDE_MASK) == FPSCR_STRIDE_MASK));
 
     fop = (op == FOP_EXT) ? &fops_ext[FEXT_TO_IDX(inst)] : &fops[FOP_TO_IDX(op)];
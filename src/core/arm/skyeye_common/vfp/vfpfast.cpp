@@ -0,0 +1,502 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+// Host floating point fast path for the VFP data processing instructions.
+//
+// The SoftFloat routines in vfpsingle.cpp and vfpdouble.cpp handle every FPSCR mode and special
+// value, but they are slow. When FPSCR is in its default mode (round to nearest, no flush to zero,
+// no vector operations, no traps) and all operands and results are zero or normal numbers, the
+// host FPU gives the same results. Inexact results are detected with error-free transformations
+// so that FPSCR.IXC stays accurate. Anything else (NaNs, infinities, denormals, overflow and
+// underflow) is left to the SoftFloat code.
+//
+// Single precision operations are computed in double precision and rounded once to single
+// precision. This is exact for multiplication and correctly rounded for addition, subtraction,
+// division and square root, since double precision has more than 2 * 24 + 2 bits of precision.
+
+#include <cmath>
+#include <cstring>
+
+#include "common/common.h"
+
+#include "core/arm/skyeye_common/armdefs.h"
+#include "core/arm/skyeye_common/vfp/vfp_helper.h"
+#include "core/arm/skyeye_common/vfp/asm_vfp.h"
+#include "core/arm/skyeye_common/vfp/vfp.h"
+
+#ifdef EMU_ARCHITECTURE_X64
+
+namespace {
+
+/// FPSCR bits that have to be clear for the fast path to apply
+const u32 NON_DEFAULT_FPSCR_MASK = FPSCR_FLUSH_TO_ZERO | FPSCR_RMODE_MASK | FPSCR_LENGTH_MASK |
+                                   FPSCR_IDE | FPSCR_IXE | FPSCR_UFE | FPSCR_OFE | FPSCR_DZE |
+                                   FPSCR_IOE;
+
+/**
+ * Biased double precision exponent range of operands for which products and quotients can be
+ * checked for exactness without intermediate overflow or underflow
+ */
+const u32 DOUBLE_SAFE_EXPONENT_MIN = 1023 - 450;
+const u32 DOUBLE_SAFE_EXPONENT_MAX = 1023 + 450;
+
+inline float BitsToFloat(u32 bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline u32 FloatToBits(float value) {
+    u32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double BitsToDouble(u64 bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline u64 DoubleToBits(double value) {
+    u64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline u32 SingleExponent(u32 bits) {
+    return (bits >> 23) & 0xFF;
+}
+
+inline u32 DoubleExponent(u64 bits) {
+    return static_cast<u32>(bits >> 52) & 0x7FF;
+}
+
+/// Whether the single precision value is a zero or a normal number
+inline bool IsSingleZeroOrNormal(u32 bits) {
+    const u32 exponent = SingleExponent(bits);
+    return exponent != 0xFF && (exponent != 0 || (bits & 0x7FFFFFFF) == 0);
+}
+
+inline bool IsDoubleZero(u64 bits) {
+    return (bits & ~(1ULL << 63)) == 0;
+}
+
+/// Whether the double precision value is a zero or a normal number within the safe exponent range
+inline bool IsDoubleZeroOrSafe(u64 bits) {
+    const u32 exponent = DoubleExponent(bits);
+    return IsDoubleZero(bits) ||
+           (exponent >= DOUBLE_SAFE_EXPONENT_MIN && exponent <= DOUBLE_SAFE_EXPONENT_MAX);
+}
+
+/// Whether the double precision value is a zero or a normal number
+inline bool IsDoubleZeroOrNormal(u64 bits) {
+    const u32 exponent = DoubleExponent(bits);
+    return exponent != 0x7FF && (exponent != 0 || IsDoubleZero(bits));
+}
+
+/// Error of the rounded sum s = a + b (Knuth's TwoSum)
+inline double SumError(double a, double b, double s) {
+    const double b_virtual = s - a;
+    return (a - (s - b_virtual)) + (b - b_virtual);
+}
+
+/// Splits a into two halves of 26 bits that can be multiplied exactly (Veltkamp's splitting)
+inline void Split(double a, double& high, double& low) {
+    const double scaled = 134217729.0 * a; // 2^27 + 1
+    high = scaled - (scaled - a);
+    low = a - high;
+}
+
+/// Error of the rounded product p = a * b (Dekker's TwoProduct), a and b have to be safe
+inline double ProductError(double a, double b, double p) {
+    double a_high, a_low, b_high, b_low;
+    Split(a, a_high, a_low);
+    Split(b, b_high, b_low);
+    return ((a_high * b_high - p) + a_high * b_low + a_low * b_high) + a_low * b_low;
+}
+
+/**
+ * Rounds a result to single precision and checks that it is a zero or a normal number, i.e. that
+ * it neither overflowed nor underflowed. Results close to the smallest normal number are rejected
+ * too, since the VFP detects underflow before rounding.
+ * @param value Result, either exact or correctly rounded to double precision
+ * @param inexact Whether value itself is inexact
+ * @param result Single precision result
+ * @return true if the result is valid, false if the SoftFloat code has to be used
+ */
+bool RoundToSingle(double value, bool& inexact, u32& result) {
+    const float rounded = static_cast<float>(value);
+    inexact |= static_cast<double>(rounded) != value;
+    result = FloatToBits(rounded);
+
+    const u32 exponent = SingleExponent(result);
+    if (exponent == 0)
+        return (result & 0x7FFFFFFF) == 0 && !inexact;
+    return exponent >= 2 && exponent != 0xFF;
+}
+
+/// Same as RoundToSingle for results that already are in double precision
+bool CheckDouble(double value, bool inexact, u64& result) {
+    result = DoubleToBits(value);
+
+    const u32 exponent = DoubleExponent(result);
+    if (exponent == 0)
+        return IsDoubleZero(result) && !inexact;
+    return exponent >= 2 && exponent != 0x7FF;
+}
+
+/// Sum of two single precision values
+bool SingleAdd(u32 n, u32 m, bool& inexact, u32& result) {
+    const double a = BitsToFloat(n);
+    const double b = BitsToFloat(m);
+    const double sum = a + b;
+    inexact |= SumError(a, b, sum) != 0.0;
+    return RoundToSingle(sum, inexact, result);
+}
+
+/// Product of two single precision values, optionally negated
+bool SingleMultiply(u32 n, u32 m, bool negate, bool& inexact, u32& result) {
+    // The product of two single precision values is exact in double precision
+    const double product = static_cast<double>(BitsToFloat(n)) * BitsToFloat(m);
+    return RoundToSingle(negate ? -product : product, inexact, result);
+}
+
+bool SingleDivide(u32 n, u32 m, bool& inexact, u32& result) {
+    if ((m & 0x7FFFFFFF) == 0)
+        return false; // Division by zero
+
+    const double a = BitsToFloat(n);
+    const double b = BitsToFloat(m);
+    if (!RoundToSingle(a / b, inexact, result))
+        return false;
+
+    // The quotient is exact if multiplying it back gives the dividend, which is exact in double
+    inexact |= static_cast<double>(BitsToFloat(result)) * b != a;
+    return true;
+}
+
+bool SingleSqrt(u32 m, bool& inexact, u32& result) {
+    if ((m & 0x7FFFFFFF) == 0) {
+        result = m;
+        return true;
+    }
+    if (m & 0x80000000)
+        return false; // Invalid operation
+
+    const double a = BitsToFloat(m);
+    if (!RoundToSingle(std::sqrt(a), inexact, result))
+        return false;
+
+    const double root = BitsToFloat(result);
+    inexact |= root * root != a;
+    return true;
+}
+
+bool DoubleAdd(u64 n, u64 m, bool& inexact, u64& result) {
+    const double a = BitsToDouble(n);
+    const double b = BitsToDouble(m);
+    const double sum = a + b;
+    if (!std::isfinite(sum))
+        return false;
+
+    inexact |= SumError(a, b, sum) != 0.0;
+    return CheckDouble(sum, inexact, result);
+}
+
+bool DoubleMultiply(u64 n, u64 m, bool negate, bool& inexact, u64& result) {
+    if (!IsDoubleZeroOrSafe(n) || !IsDoubleZeroOrSafe(m))
+        return false;
+
+    const double a = BitsToDouble(n);
+    const double b = BitsToDouble(m);
+    const double product = a * b;
+    if (!IsDoubleZero(n) && !IsDoubleZero(m))
+        inexact |= ProductError(a, b, product) != 0.0;
+    return CheckDouble(negate ? -product : product, inexact, result);
+}
+
+bool DoubleDivide(u64 n, u64 m, bool& inexact, u64& result) {
+    if (IsDoubleZero(m))
+        return false; // Division by zero
+    if (!IsDoubleZeroOrSafe(n) || !IsDoubleZeroOrSafe(m))
+        return false;
+
+    const double a = BitsToDouble(n);
+    const double b = BitsToDouble(m);
+    const double quotient = a / b;
+    if (!CheckDouble(quotient, inexact, result))
+        return false;
+
+    // The quotient is exact if quotient * b == a exactly, i.e. without any rounding error
+    if (!IsDoubleZero(n)) {
+        const double product = quotient * b;
+        inexact |= product != a || ProductError(quotient, b, product) != 0.0;
+    }
+    return true;
+}
+
+bool DoubleSqrt(u64 m, bool& inexact, u64& result) {
+    if (IsDoubleZero(m)) {
+        result = m;
+        return true;
+    }
+    if ((m >> 63) != 0 || !IsDoubleZeroOrSafe(m))
+        return false;
+
+    const double a = BitsToDouble(m);
+    const double root = std::sqrt(a);
+    const double square = root * root;
+    inexact |= square != a || ProductError(root, root, square) != 0.0;
+    return CheckDouble(root, inexact, result);
+}
+
+/// Float to integer conversion rounding towards zero. Out of range values are left to SoftFloat.
+bool ToIntegerTowardZero(double value, bool is_signed, bool& inexact, u32& result) {
+    if (is_signed) {
+        if (!(value > -2147483649.0 && value < 2147483648.0))
+            return false;
+        const s32 integer = static_cast<s32>(value);
+        inexact |= static_cast<double>(integer) != value;
+        result = static_cast<u32>(integer);
+    } else {
+        if (!(value > -1.0 && value < 4294967296.0))
+            return false;
+        const u32 integer = value > 0.0 ? static_cast<u32>(value) : 0;
+        inexact |= static_cast<double>(integer) != value;
+        result = integer;
+    }
+    return true;
+}
+
+} // namespace
+
+bool vfp_single_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions) {
+    if (fpscr & NON_DEFAULT_FPSCR_MASK)
+        return false;
+
+    const u32 op = inst & FOP_MASK;
+    const u32 sd = vfp_get_sd(inst);
+    const u32 m = state->ExtReg[vfp_get_sm(inst)];
+    bool inexact = false;
+    u32 result;
+
+    if (op == FOP_EXT) {
+        const u32 ext = inst & FEXT_MASK;
+
+        // Integer to float conversions read an integer
+        if (ext == FEXT_FSITO || ext == FEXT_FUITO) {
+            const double value = (ext == FEXT_FSITO) ? static_cast<double>(static_cast<s32>(m))
+                                                     : static_cast<double>(m);
+            if (!RoundToSingle(value, inexact, result))
+                return false;
+            state->ExtReg[sd] = result;
+            *exceptions = inexact ? FPSCR_IXC : 0;
+            return true;
+        }
+
+        if (!IsSingleZeroOrNormal(m))
+            return false;
+
+        switch (ext) {
+        case FEXT_FSQRT:
+            if (!SingleSqrt(m, inexact, result))
+                return false;
+            break;
+
+        case FEXT_FCVT:
+            // Single to double precision conversion is always exact
+            vfp_put_double(state, DoubleToBits(BitsToFloat(m)), vfp_get_dd(inst));
+            *exceptions = 0;
+            return true;
+
+        case FEXT_FTOSIZ:
+        case FEXT_FTOUIZ:
+            if (!ToIntegerTowardZero(BitsToFloat(m), ext == FEXT_FTOSIZ, inexact, result))
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+    } else {
+        const u32 n = state->ExtReg[vfp_get_sn(inst)];
+        if (!IsSingleZeroOrNormal(n) || !IsSingleZeroOrNormal(m))
+            return false;
+
+        switch (op) {
+        case FOP_FMAC:
+        case FOP_FNMAC:
+        case FOP_FMSC:
+        case FOP_FNMSC: {
+            // The product is rounded before the accumulation, as the VFP does
+            const u32 d = state->ExtReg[sd];
+            if (!IsSingleZeroOrNormal(d))
+                return false;
+
+            u32 product;
+            if (!SingleMultiply(n, m, op == FOP_FNMAC || op == FOP_FNMSC, inexact, product))
+                return false;
+
+            const u32 accumulator = (op == FOP_FMSC || op == FOP_FNMSC) ? d ^ 0x80000000 : d;
+            if (!SingleAdd(accumulator, product, inexact, result))
+                return false;
+            break;
+        }
+
+        case FOP_FMUL:
+        case FOP_FNMUL:
+            if (!SingleMultiply(n, m, op == FOP_FNMUL, inexact, result))
+                return false;
+            break;
+
+        case FOP_FADD:
+            if (!SingleAdd(n, m, inexact, result))
+                return false;
+            break;
+
+        case FOP_FSUB:
+            if (!SingleAdd(n, m ^ 0x80000000, inexact, result))
+                return false;
+            break;
+
+        case FOP_FDIV:
+            if (!SingleDivide(n, m, inexact, result))
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    state->ExtReg[sd] = result;
+    *exceptions = inexact ? FPSCR_IXC : 0;
+    return true;
+}
+
+bool vfp_double_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions) {
+    if (fpscr & NON_DEFAULT_FPSCR_MASK)
+        return false;
+
+    const u32 op = inst & FOP_MASK;
+    bool inexact = false;
+
+    if (op == FOP_EXT) {
+        const u32 ext = inst & FEXT_MASK;
+
+        // Integer to float conversions read an integer from a single precision register and are
+        // always exact
+        if (ext == FEXT_FSITO || ext == FEXT_FUITO) {
+            const u32 m = state->ExtReg[vfp_get_sm(inst)];
+            const double value = (ext == FEXT_FSITO) ? static_cast<double>(static_cast<s32>(m))
+                                                     : static_cast<double>(m);
+            vfp_put_double(state, DoubleToBits(value), vfp_get_dd(inst));
+            *exceptions = 0;
+            return true;
+        }
+
+        const u64 m = vfp_get_double(state, vfp_get_dm(inst));
+        if (!IsDoubleZeroOrNormal(m))
+            return false;
+
+        u32 single_result;
+        switch (ext) {
+        case FEXT_FSQRT: {
+            u64 result;
+            if (!DoubleSqrt(m, inexact, result))
+                return false;
+            vfp_put_double(state, result, vfp_get_dd(inst));
+            *exceptions = inexact ? FPSCR_IXC : 0;
+            return true;
+        }
+
+        case FEXT_FCVT:
+            if (!RoundToSingle(BitsToDouble(m), inexact, single_result))
+                return false;
+            break;
+
+        case FEXT_FTOSIZ:
+        case FEXT_FTOUIZ:
+            if (!ToIntegerTowardZero(BitsToDouble(m), ext == FEXT_FTOSIZ, inexact, single_result))
+                return false;
+            break;
+
+        default:
+            return false;
+        }
+
+        // The remaining operations write a single precision register
+        state->ExtReg[vfp_get_sd(inst)] = single_result;
+        *exceptions = inexact ? FPSCR_IXC : 0;
+        return true;
+    }
+
+    const u32 dd = vfp_get_dd(inst);
+    const u64 n = vfp_get_double(state, vfp_get_dn(inst));
+    const u64 m = vfp_get_double(state, vfp_get_dm(inst));
+    if (!IsDoubleZeroOrNormal(n) || !IsDoubleZeroOrNormal(m))
+        return false;
+
+    u64 result;
+    switch (op) {
+    case FOP_FMAC:
+    case FOP_FNMAC:
+    case FOP_FMSC:
+    case FOP_FNMSC: {
+        const u64 d = vfp_get_double(state, dd);
+        if (!IsDoubleZeroOrNormal(d))
+            return false;
+
+        u64 product;
+        if (!DoubleMultiply(n, m, op == FOP_FNMAC || op == FOP_FNMSC, inexact, product))
+            return false;
+
+        const u64 accumulator = (op == FOP_FMSC || op == FOP_FNMSC) ? d ^ (1ULL << 63) : d;
+        if (!DoubleAdd(accumulator, product, inexact, result))
+            return false;
+        break;
+    }
+
+    case FOP_FMUL:
+    case FOP_FNMUL:
+        if (!DoubleMultiply(n, m, op == FOP_FNMUL, inexact, result))
+            return false;
+        break;
+
+    case FOP_FADD:
+        if (!DoubleAdd(n, m, inexact, result))
+            return false;
+        break;
+
+    case FOP_FSUB:
+        if (!DoubleAdd(n, m ^ (1ULL << 63), inexact, result))
+            return false;
+        break;
+
+    case FOP_FDIV:
+        if (!DoubleDivide(n, m, inexact, result))
+            return false;
+        break;
+
+    default:
+        return false;
+    }
+
+    vfp_put_double(state, result, dd);
+    *exceptions = inexact ? FPSCR_IXC : 0;
+    return true;
+}
+
+#else
+
+bool vfp_single_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions) {
+    return false;
+}
+
+bool vfp_double_cpdo_fast(ARMul_State* state, u32 inst, u32 fpscr, u32* exceptions) {
+    return false;
+}
+
+#endif
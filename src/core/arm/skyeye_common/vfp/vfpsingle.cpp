@@ -82,12 +82,12 @@ static void vfp_single_normalise_denormal(struct vfp_single *vs)
 }
 
 
-u32 vfp_single_normaliseround(ARMul_State* state, int sd, struct vfp_single *vs, u32 fpscr, u32 exceptions, const char *func)
+u32 vfp_single_normaliseroundintern(ARMul_State* state, struct vfp_single *vs, u32 fpscr, u32 exceptions, const char *func)
 {
     u32 significand, incr, rmode;
     int exponent, shift, underflow;
 
-    vfp_single_dump("pack: in", vs);
+    vfp_single_dump("round: in", vs);
 
     /*
      * Infinities and NaNs are a special case.
@@ -206,6 +206,15 @@ u32 vfp_single_normaliseround(ARMul_State* state, int sd, struct vfp_single *vs,
     }
 
 pack:
+    return exceptions;
+}
+
+u32 vfp_single_normaliseround(ARMul_State* state, int sd, struct vfp_single *vs, u32 fpscr, u32 exceptions, const char *func)
+{
+    vfp_single_dump("pack: in", vs);
+
+    exceptions = vfp_single_normaliseroundintern(state, vs, fpscr, exceptions, func);
+
     vfp_single_dump("pack: final", vs);
     {
         s32 d = vfp_single_pack(vs);
@@ -975,6 +984,15 @@ vfp_single_multiply_accumulate(ARMul_State* state, int sd, int sn, s32 m, u32 fp
 
     exceptions = vfp_single_multiply(&vsp, &vsn, &vsm, fpscr);
 
+    /*
+     * The VFP11 rounds the product to single precision before
+     * accumulating it. NaNs are passed on as they are.
+     */
+    if (!(exceptions & VFP_NAN_FLAG)) {
+        exceptions = vfp_single_normaliseroundintern(state, &vsp, fpscr, exceptions, func);
+        vfp_single_unpack(&vsp, vfp_single_pack(&vsp));
+    }
+
     if (negate & NEG_MULTIPLY)
         vsp.sign = vfp_sign_negate(vsp.sign);
 
@@ -1252,6 +1270,9 @@ u32 vfp_single_cpdo(ARMul_State* state, u32 inst, u32 fpscr)
     struct op *fop;
     pr_debug("In %s\n", __FUNCTION__);
 
+    if (vfp_single_cpdo_fast(state, inst, fpscr, &exceptions))
+        return exceptions;
+
     vecstride = 1 + ((fpscr & FPSCR_STRIDE_MASK) == FPSCR_STRIDE_MASK);
 
     fop = (op == FOP_EXT) ? &fops_ext[FEXT_TO_IDX(inst)] : &fops[FOP_TO_IDX(op)];
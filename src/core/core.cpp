@@ -2,6 +2,8 @@
 // Licensed under GPLv2 or any later version
 // Refer to the license.txt file included.
 
+#include <algorithm>
+
 #include "common/common_types.h"
 
 #include "core/core.h"
@@ -11,26 +13,56 @@
 #include "core/arm/arm_interface.h"
 #include "core/arm/disassembler/arm_disasm.h"
 #include "core/arm/dyncom/arm_dyncom.h"
+#include "core/arm/jit_x64/arm_jit_x64.h"
 #include "core/hle/hle.h"
 #include "core/hle/kernel/thread.h"
 #include "core/hw/hw.h"
+#include "core/hw/gpu_thread.h"
 
 namespace Core {
 
 ARM_Interface*     g_app_core = nullptr;  ///< ARM11 application core
 ARM_Interface*     g_sys_core = nullptr;  ///< ARM11 system (OS) core
 
+/// Maximum number of instructions per slice while GPU commands are executing on the GPU thread
+static const int GPU_BUSY_SLICE_LENGTH = 1000;
+
+/// Skips ahead to the next event, for when the threads have nothing to do until then
+static void Idle() {
+    if (GPU::IsThreadBusy()) {
+        // The threads are likely waiting for GPU commands to complete, so wait for their
+        // interrupts rather than skipping ahead to the next event
+        GPU::SyncThread();
+    } else if (!GPU::ProcessCompletions()) {
+        // Commands which completed since the last HW::Update may have signalled interrupts that
+        // wake up a thread, so only skip ahead if there were none
+        LOG_TRACE(Core_ARM11, "Idling");
+        CoreTiming::Idle();
+        CoreTiming::Advance();
+    }
+}
+
 /// Run the core CPU loop
 void RunLoop(int tight_loop) {
     // If the current thread is an idle thread, then don't execute instructions,
     // instead advance to the next event and try to yield to the next thread
     if (Kernel::GetCurrentThread()->IsIdle()) {
-        LOG_TRACE(Core_ARM11, "Idling");
-        CoreTiming::Idle();
-        CoreTiming::Advance();
+        Idle();
         HLE::Reschedule(__func__);
     } else {
-        g_app_core->Run(tight_loop);
+        // The slice ends when the next event is due, so that it fires on time. Completed GPU
+        // commands are only processed between slices, so keep them short while the GPU is busy.
+        s64 slice_length = std::max<s64>(g_app_core->down_count, 1);
+        if (tight_loop != 0)
+            slice_length = std::min<s64>(slice_length, tight_loop);
+        if (GPU::IsThreadBusy())
+            slice_length = std::min<s64>(slice_length, GPU_BUSY_SLICE_LENGTH);
+
+        g_app_core->Run(static_cast<int>(slice_length));
+
+        // A thread spinning in an idle loop won't get anywhere before the next event
+        if (g_app_core->IsInIdleLoop())
+            Idle();
     }
 
     HW::Update();
@@ -58,6 +90,17 @@ void Stop() {
 int Init() {
     LOG_DEBUG(Core, "initialized OK");
 
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (Settings::values.use_cpu_jit) {
+        g_sys_core = new ARM_JitX64();
+        g_app_core = new ARM_JitX64();
+        return 0;
+    }
+#else
+    if (Settings::values.use_cpu_jit)
+        LOG_WARNING(Core, "CPU JIT is only supported on x86-64 hosts, using the interpreter");
+#endif
+
     g_sys_core = new ARM_DynCom();
     g_app_core = new ARM_DynCom();
 
@@ -36,13 +36,13 @@ void Start();
 
 /**
  * Run the core CPU loop
- * This function runs the core for the specified number of CPU instructions before trying to update
+ * This function runs the core until the next CoreTiming event is due before trying to update
  * hardware. This is much faster than SingleStep (and should be equivalent), as the CPU is not
- * required to do a full dispatch with each instruction. NOTE: the number of instructions requested
- * is not guaranteed to run, as this will be interrupted preemptively if a hardware update is
- * requested (e.g. on a thread switch).
+ * required to do a full dispatch with each instruction. NOTE: the slice ends early on SVCs and
+ * when a hardware update is requested (e.g. on a thread switch).
+ * @param tight_loop Maximum number of CPU instructions to run, or 0 to run until the next event
  */
-void RunLoop(int tight_loop=1000);
+void RunLoop(int tight_loop=0);
 
 /// Step the CPU one instruction
 void SingleStep();
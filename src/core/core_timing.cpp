@@ -2,13 +2,14 @@
 // Licensed under GPLv2 or any later version
 // Refer to the license.txt file included.
 
+#include <algorithm>
 #include <atomic>
 #include <cstdio>
 #include <mutex>
 #include <vector>
 
-#include "common/chunk_file.h"
 #include "common/log.h"
+#include "common/string_util.h"
 
 #include "core/arm/arm_interface.h"
 #include "core/core.h"
@@ -42,16 +43,35 @@ struct BaseEvent
     int type;
 };
 
-typedef LinkedListItem<BaseEvent> Event;
+/// Scheduled event, stored in a slot of event_pool
+struct Event
+{
+    s64 time;
+    u64 order;      ///< Scheduling order, so that events due at the same time fire in that order
+    u64 userdata;
+    int type;
+    u32 heap_index; ///< Position of the event in event_queue
+    u32 next_in_bucket; ///< Next event in the same key_buckets chain
+};
+
+static const u32 INVALID_SLOT = 0xFFFFFFFF;
+static const u32 MIN_KEY_BUCKETS = 64;
+
+// The event queue is a binary min-heap of event_pool slots, ordered by time. Events are also
+// indexed by type and userdata in a hash table, whose buckets are chains of slots linked through
+// the events, so that scheduling, unscheduling and firing an event all take logarithmic time
+// without allocating memory once the pool has grown. Slots of fired events are reused by later ones.
+static std::vector<Event> event_pool;
+static std::vector<u32> free_slots;
+static std::vector<u32> event_queue;
+static std::vector<u32> key_buckets;
+static u64 next_event_order;
 
-static Event* first;
-static Event* ts_first;
-static Event* ts_last;
+/// Number of scheduled events of each event type
+static std::vector<u32> num_scheduled;
 
-// event pools
-static Event* event_pool = nullptr;
-static Event* event_ts_pool = nullptr;
-static int allocated_ts_events = 0;
+// Events scheduled from other threads, moved into the event queue by MoveEvents
+static std::vector<BaseEvent> ts_events;
 // Optimization to skip MoveEvents when possible.
 static std::atomic<bool> has_ts_events(false);
 
@@ -97,39 +117,9 @@ u64 GetGlobalTimeUs() {
     return last_global_time_us + us_since_last;
 }
 
-Event* GetNewEvent() {
-    if (!event_pool)
-        return new Event;
-
-    Event* event = event_pool;
-    event_pool = event->next;
-    return event;
-}
-
-Event* GetNewTsEvent() {
-    allocated_ts_events++;
-
-    if (!event_ts_pool)
-        return new Event;
-
-    Event* event = event_ts_pool;
-    event_ts_pool = event->next;
-    return event;
-}
-
-void FreeEvent(Event* event) {
-    event->next = event_pool;
-    event_pool = event;
-}
-
-void FreeTsEvent(Event* event) {
-    event->next = event_ts_pool;
-    event_ts_pool = event;
-    allocated_ts_events--;
-}
-
 int RegisterEvent(const char* name, TimedCallback callback) {
     event_types.push_back(EventType(callback, name));
+    num_scheduled.push_back(0);
     return (int)event_types.size() - 1;
 }
 
@@ -139,16 +129,19 @@ void AntiCrashCallback(u64 userdata, int cycles_late) {
 }
 
 void RestoreRegisterEvent(int event_type, const char* name, TimedCallback callback) {
-    if (event_type >= (int)event_types.size())
+    if (event_type >= (int)event_types.size()) {
         event_types.resize(event_type + 1, EventType(AntiCrashCallback, "INVALID EVENT"));
+        num_scheduled.resize(event_type + 1, 0);
+    }
 
     event_types[event_type] = EventType(callback, name);
 }
 
 void UnregisterAllEvents() {
-    if (first)
+    if (!event_queue.empty())
         PanicAlert("Cannot unregister events with events pending");
     event_types.clear();
+    num_scheduled.clear();
 }
 
 void Init() {
@@ -159,6 +152,8 @@ void Init() {
     last_global_time_ticks = 0;
     last_global_time_us = 0;
     has_ts_events = 0;
+    next_event_order = 0;
+    key_buckets.assign(MIN_KEY_BUCKETS, INVALID_SLOT);
     mhz_change_callbacks.clear();
 }
 
@@ -166,19 +161,6 @@ void Shutdown() {
     MoveEvents();
     ClearPendingEvents();
     UnregisterAllEvents();
-
-    while (event_pool) {
-        Event* event = event_pool;
-        event_pool = event->next;
-        delete event;
-    }
-
-    std::lock_guard<std::recursive_mutex> lock(external_event_section);
-    while (event_ts_pool) {
-        Event* event = event_ts_pool;
-        event_ts_pool = event->next;
-        delete event;
-    }
 }
 
 u64 GetTicks() {
@@ -194,16 +176,11 @@ u64 GetIdleTicks() {
 // schedule things to be executed on the main thread.
 void ScheduleEvent_Threadsafe(s64 cycles_into_future, int event_type, u64 userdata) {
     std::lock_guard<std::recursive_mutex> lock(external_event_section);
-    Event* new_event = GetNewTsEvent();
-    new_event->time = GetTicks() + cycles_into_future;
-    new_event->type = event_type;
-    new_event->next = 0;
-    new_event->userdata = userdata;
-    if (!ts_first)
-        ts_first = new_event;
-    if (ts_last)
-        ts_last->next = new_event;
-    ts_last = new_event;
+    BaseEvent new_event;
+    new_event.time = GetTicks() + cycles_into_future;
+    new_event.userdata = userdata;
+    new_event.type = event_type;
+    ts_events.push_back(new_event);
 
     has_ts_events = true;
 }
@@ -221,114 +198,175 @@ void ScheduleEvent_Threadsafe_Immediate(int event_type, u64 userdata) {
 }
 
 void ClearPendingEvents() {
-    while (first) {
-        Event* event = first->next;
-        FreeEvent(first);
-        first = event;
-    }
+    event_pool.clear();
+    free_slots.clear();
+    event_queue.clear();
+    key_buckets.assign(MIN_KEY_BUCKETS, INVALID_SLOT);
+    std::fill(num_scheduled.begin(), num_scheduled.end(), 0);
 }
 
-void AddEventToQueue(Event* new_event) {
-    Event* prev_event = nullptr;
-    Event** next_event = &first;
-    for (;;) {
-        Event*& next = *next_event;
-        if (!next || new_event->time < next->time) {
-            new_event->next = next;
-            next = new_event;
-            break;
-        }
-        prev_event = next;
-        next_event = &prev_event->next;
-    }
+/// Returns true if event a fires before event b
+static bool FiresBefore(const Event& a, const Event& b) {
+    return a.time < b.time || (a.time == b.time && a.order < b.order);
 }
 
-void ScheduleEvent(s64 cycles_into_future, int event_type, u64 userdata) {
-    Event* new_event = GetNewEvent();
-    new_event->userdata = userdata;
-    new_event->type = event_type;
-    new_event->time = GetTicks() + cycles_into_future;
-    AddEventToQueue(new_event);
+static void SetQueueEntry(u32 index, u32 slot) {
+    event_queue[index] = slot;
+    event_pool[slot].heap_index = index;
 }
 
-s64 UnscheduleEvent(int event_type, u64 userdata) {
-    s64 result = 0;
-    if (!first)
-        return result;
-    while (first) {
-        if (first->type == event_type && first->userdata == userdata) {
-            result = first->time - GetTicks();
-
-            Event* next = first->next;
-            FreeEvent(first);
-            first = next;
-        } else {
+/// Moves the event at the given queue position towards the front until its parent fires before it
+static void SiftUp(u32 index) {
+    const u32 slot = event_queue[index];
+    while (index > 0) {
+        const u32 parent = (index - 1) / 2;
+        if (!FiresBefore(event_pool[slot], event_pool[event_queue[parent]]))
             break;
-        }
+        SetQueueEntry(index, event_queue[parent]);
+        index = parent;
     }
-    if (!first)
-        return result;
-
-    Event* prev_event = first;
-    Event* ptr = prev_event->next;
-
-    while (ptr) {
-        if (ptr->type == event_type && ptr->userdata == userdata) {
-            result = ptr->time - GetTicks();
-
-            prev_event->next = ptr->next;
-            FreeEvent(ptr);
-            ptr = prev_event->next;
-        } else {
-            prev_event = ptr;
-            ptr = ptr->next;
-        }
+    SetQueueEntry(index, slot);
+}
+
+/// Moves the event at the given queue position towards the back until it fires before its children
+static void SiftDown(u32 index) {
+    const u32 slot = event_queue[index];
+    const u32 size = static_cast<u32>(event_queue.size());
+    while (true) {
+        u32 child = 2 * index + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && FiresBefore(event_pool[event_queue[child + 1]], event_pool[event_queue[child]]))
+            ++child;
+        if (!FiresBefore(event_pool[event_queue[child]], event_pool[slot]))
+            break;
+        SetQueueEntry(index, event_queue[child]);
+        index = child;
     }
+    SetQueueEntry(index, slot);
+}
 
-    return result;
+/// Returns the key_buckets chain holding the events with the given type and userdata
+static u32& GetKeyBucket(int event_type, u64 userdata) {
+    const u64 hash = (userdata ^ (static_cast<u64>(event_type) << 40)) * 0x9E3779B97F4A7C15ULL;
+    return key_buckets[static_cast<u32>(hash >> 32) & (key_buckets.size() - 1)];
 }
 
-s64 UnscheduleThreadsafeEvent(int event_type, u64 userdata) {
-    s64 result = 0;
-    std::lock_guard<std::recursive_mutex> lock(external_event_section);
-    if (!ts_first)
-        return result;
+static void AddToIndex(u32 slot) {
+    Event& event = event_pool[slot];
+    u32& bucket = GetKeyBucket(event.type, event.userdata);
+    event.next_in_bucket = bucket;
+    bucket = slot;
+}
 
-    while (ts_first) {
-        if (ts_first->type == event_type && ts_first->userdata == userdata) {
-            result = ts_first->time - GetTicks();
+/// Keeps the hash table at least as large as the pool, so that its chains stay short
+static void GrowIndex() {
+    if (key_buckets.size() >= event_pool.size())
+        return;
 
-            Event* next = ts_first->next;
-            FreeTsEvent(ts_first);
-            ts_first = next;
-        } else {
-            break;
-        }
+    key_buckets.assign(std::max<size_t>(key_buckets.size() * 2, MIN_KEY_BUCKETS), INVALID_SLOT);
+    for (u32 slot : event_queue)
+        AddToIndex(slot);
+}
+
+static void AddEventToQueue(s64 time, int event_type, u64 userdata) {
+    u32 slot;
+    if (free_slots.empty()) {
+        slot = static_cast<u32>(event_pool.size());
+        event_pool.emplace_back();
+        GrowIndex();
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
     }
 
-    if (!ts_first)
-    {
-        ts_last = nullptr;
-        return result;
+    Event& event = event_pool[slot];
+    event.time = time;
+    event.order = next_event_order++;
+    event.userdata = userdata;
+    event.type = event_type;
+
+    event_queue.push_back(slot);
+    SiftUp(static_cast<u32>(event_queue.size() - 1));
+
+    AddToIndex(slot);
+    ++num_scheduled[event_type];
+}
+
+/// Removes the event in the given slot from the queue. The caller removes it from key_buckets.
+static void RemoveFromQueue(u32 slot) {
+    const u32 index = event_pool[slot].heap_index;
+    const u32 last_slot = event_queue.back();
+    event_queue.pop_back();
+
+    // Fill the gap with the last event, which may belong either further up or further down
+    if (slot != last_slot) {
+        SetQueueEntry(index, last_slot);
+        SiftDown(index);
+        SiftUp(event_pool[last_slot].heap_index);
+    }
+
+    --num_scheduled[event_pool[slot].type];
+    free_slots.push_back(slot);
+}
+
+static void RemoveFromIndex(u32 slot) {
+    const Event& event = event_pool[slot];
+    u32* link = &GetKeyBucket(event.type, event.userdata);
+    while (*link != slot)
+        link = &event_pool[*link].next_in_bucket;
+    *link = event.next_in_bucket;
+}
+
+void ScheduleEvent(s64 cycles_into_future, int event_type, u64 userdata) {
+    AddEventToQueue(GetTicks() + cycles_into_future, event_type, userdata);
+
+    // The CPU runs until the end of the slice, so end it early if the event is due before then
+    const s64 cycles_left = Core::g_app_core->down_count;
+    if (cycles_into_future < cycles_left) {
+        const s64 cut = cycles_left - std::max<s64>(cycles_into_future, 0);
+        g_slice_length -= (int)cut;
+        Core::g_app_core->down_count -= cut;
     }
+}
 
-    Event* prev_event = ts_first;
-    Event* next = prev_event->next;
-    while (next) {
-        if (next->type == event_type && next->userdata == userdata) {
-            result = next->time - GetTicks();
-
-            prev_event->next = next->next;
-            if (next == ts_last)
-                ts_last = prev_event;
-            FreeTsEvent(next);
-            next = prev_event->next;
-        } else {
-            prev_event = next;
-            next = next->next;
+s64 UnscheduleEvent(int event_type, u64 userdata) {
+    // If there are several matching events, report the one firing last
+    bool found = false;
+    Event last_event = {};
+
+    u32* link = &GetKeyBucket(event_type, userdata);
+    while (*link != INVALID_SLOT) {
+        const u32 slot = *link;
+        const Event& event = event_pool[slot];
+        if (event.type != event_type || event.userdata != userdata) {
+            link = &event_pool[slot].next_in_bucket;
+            continue;
         }
+
+        if (!found || FiresBefore(last_event, event))
+            last_event = event;
+        found = true;
+
+        *link = event.next_in_bucket;
+        RemoveFromQueue(slot);
     }
 
+    return found ? last_event.time - GetTicks() : 0;
+}
+
+s64 UnscheduleThreadsafeEvent(int event_type, u64 userdata) {
+    s64 result = 0;
+    std::lock_guard<std::recursive_mutex> lock(external_event_section);
+
+    auto matches = [&](const BaseEvent& event) {
+        if (event.type != event_type || event.userdata != userdata)
+            return false;
+        result = event.time - GetTicks();
+        return true;
+    };
+    ts_events.erase(std::remove_if(ts_events.begin(), ts_events.end(), matches), ts_events.end());
+
     return result;
 }
 
@@ -342,79 +380,30 @@ void RegisterMHzChangeCallback(MHzChangeCallback callback) {
 }
 
 bool IsScheduled(int event_type) {
-    if (!first)
-        return false;
-    Event* event = first;
-    while (event) {
-        if (event->type == event_type)
-            return true;
-        event = event->next;
-    }
-    return false;
+    return event_type >= 0 && event_type < (int)num_scheduled.size() && num_scheduled[event_type] != 0;
 }
 
 void RemoveEvent(int event_type) {
-    if (!first)
+    if (!IsScheduled(event_type))
         return;
-    while (first) {
-        if (first->type == event_type) {
-            Event *next = first->next;
-            FreeEvent(first);
-            first = next;
-        } else {
-            break;
-        }
+
+    std::vector<u32> slots;
+    for (u32 slot : event_queue) {
+        if (event_pool[slot].type == event_type)
+            slots.push_back(slot);
     }
-    if (!first)
-        return;
-    Event* prev = first;
-    Event* next = prev->next;
-    while (next) {
-        if (next->type == event_type) {
-            prev->next = next->next;
-            FreeEvent(next);
-            next = prev->next;
-        } else {
-            prev = next;
-            next = next->next;
-        }
+
+    for (u32 slot : slots) {
+        RemoveFromIndex(slot);
+        RemoveFromQueue(slot);
     }
 }
 
 void RemoveThreadsafeEvent(int event_type) {
     std::lock_guard<std::recursive_mutex> lock(external_event_section);
-    if (!ts_first)
-        return;
-
-    while (ts_first) {
-        if (ts_first->type == event_type) {
-            Event* next = ts_first->next;
-            FreeTsEvent(ts_first);
-            ts_first = next;
-        } else {
-            break;
-        }
-    }
-
-    if (!ts_first) {
-        ts_last = nullptr;
-        return;
-    }
-
-    Event* prev = ts_first;
-    Event* next = prev->next;
-    while (next) {
-        if (next->type == event_type) {
-            prev->next = next->next;
-            if (next == ts_last)
-                ts_last = prev;
-            FreeTsEvent(next);
-            next = prev->next;
-        } else {
-            prev = next;
-            next = next->next;
-        }
-    }
+    ts_events.erase(std::remove_if(ts_events.begin(), ts_events.end(),
+                                   [&](const BaseEvent& event) { return event.type == event_type; }),
+                    ts_events.end());
 }
 
 void RemoveAllEvents(int event_type) {
@@ -424,15 +413,16 @@ void RemoveAllEvents(int event_type) {
 
 // This raise only the events required while the fifo is processing data
 void ProcessFifoWaitEvents() {
-    while (first) {
-        if (first->time <= (s64)GetTicks()) {
-            Event* evt = first;
-            first = first->next;
-            event_types[evt->type].callback(evt->userdata, (int)(GetTicks() - evt->time));
-            FreeEvent(evt);
-        } else {
+    while (!event_queue.empty()) {
+        const u32 slot = event_queue.front();
+        const Event event = event_pool[slot];
+        if (event.time > (s64)GetTicks())
             break;
-        }
+
+        // The callback may schedule further events, so the event is removed first
+        RemoveFromIndex(slot);
+        RemoveFromQueue(slot);
+        event_types[event.type].callback(event.userdata, (int)(GetTicks() - event.time));
     }
 }
 
@@ -441,21 +431,9 @@ void MoveEvents() {
 
     std::lock_guard<std::recursive_mutex> lock(external_event_section);
     // Move events from async queue into main queue
-    while (ts_first) {
-        Event* next = ts_first->next;
-        AddEventToQueue(ts_first);
-        ts_first = next;
-    }
-    ts_last = nullptr;
-
-    // Move free events to threadsafe pool
-    while (allocated_ts_events > 0 && event_pool) {
-        Event* event = event_pool;
-        event_pool = event->next;
-        event->next = event_ts_pool;
-        event_ts_pool = event;
-        allocated_ts_events--;
-    }
+    for (const BaseEvent& event : ts_events)
+        AddEventToQueue(event.time, event.type, event.userdata);
+    ts_events.clear();
 }
 
 void ForceCheck() {
@@ -476,14 +454,15 @@ void Advance() {
         MoveEvents();
     ProcessFifoWaitEvents();
 
-    if (!first) {
+    if (event_queue.empty()) {
+        // Only the added cycles count down, otherwise GetTicks() would go backwards
         if (g_slice_length < 10000) {
             g_slice_length += 10000;
-            Core::g_app_core->down_count += g_slice_length;
+            Core::g_app_core->down_count += 10000;
         }
     } else {
         // Note that events can eat cycles as well.
-        int target = (int)(first->time - global_timer);
+        int target = (int)(event_pool[event_queue.front()].time - global_timer);
         if (target > MAX_SLICE_LENGTH)
             target = MAX_SLICE_LENGTH;
 
@@ -495,11 +474,18 @@ void Advance() {
         advance_callback(cycles_executed);
 }
 
+/// Returns the pool slots of all scheduled events, in the order they fire
+static std::vector<u32> GetEventsInOrder() {
+    std::vector<u32> slots = event_queue;
+    std::sort(slots.begin(), slots.end(), [](u32 a, u32 b) { return FiresBefore(event_pool[a], event_pool[b]); });
+    return slots;
+}
+
 void LogPendingEvents() {
-    Event* event = first;
-    while (event) {
-        //LOG_TRACE(Core_Timing, "PENDING: Now: %lld Pending: %lld Type: %d", globalTimer, next->time, next->type);
-        event = event->next;
+    for (u32 slot : GetEventsInOrder()) {
+        const Event& event = event_pool[slot];
+        LOG_DEBUG(Core_Timing, "PENDING: Now: %lld Pending: %lld Type: %d",
+                  (long long)global_timer, (long long)event.time, event.type);
     }
 }
 
@@ -508,9 +494,9 @@ void Idle(int max_idle) {
     if (max_idle != 0 && cycles_down > max_idle)
         cycles_down = max_idle;
 
-    if (first && cycles_down > 0) {
+    if (!event_queue.empty() && cycles_down > 0) {
         int cycles_executed = g_slice_length - Core::g_app_core->down_count;
-        int cycles_next_event = (int)(first->time - global_timer);
+        int cycles_next_event = (int)(event_pool[event_queue.front()].time - global_timer);
 
         if (cycles_next_event < cycles_executed + cycles_down) {
             cycles_down = cycles_next_event - cycles_executed;
@@ -529,19 +515,18 @@ void Idle(int max_idle) {
 }
 
 std::string GetScheduledEventsSummary() {
-    Event* event = first;
     std::string text = "Scheduled events\n";
     text.reserve(1000);
-    while (event) {
-        unsigned int t = event->type;
+    for (u32 slot : GetEventsInOrder()) {
+        const Event& event = event_pool[slot];
+        unsigned int t = event.type;
         if (t >= event_types.size())
             PanicAlert("Invalid event type"); // %i", t);
-        const char* name = event_types[event->type].name;
+        const char* name = event_types[event.type].name;
         if (!name)
             name = "[unknown]";
-        text += Common::StringFromFormat("%s : %i %08x%08x\n", name, (int)event->time, 
-                (u32)(event->userdata >> 32), (u32)(event->userdata));
-        event = event->next;
+        text += Common::StringFromFormat("%s : %i %08x%08x\n", name, (int)event.time,
+                (u32)(event.userdata >> 32), (u32)(event.userdata));
     }
     return text;
 }
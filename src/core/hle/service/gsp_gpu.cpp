@@ -11,6 +11,7 @@
 #include "core/hle/kernel/shared_memory.h"
 #include "gsp_gpu.h"
 #include "core/hw/gpu.h"
+#include "core/hw/gpu_thread.h"
 
 #include "video_core/gpu_debugger.h"
 
@@ -205,6 +206,12 @@ static void RegisterInterruptRelayQueue(Service::Interface* self) {
  * @todo This probably does not belong in the GSP module, instead move to video_core
  */
 void SignalInterrupt(InterruptId interrupt_id) {
+    // Commands running on the GPU thread have their interrupts delivered by the emulation thread
+    if (GPU::IsGPUThread()) {
+        GPU::RunOnEmulationThread([interrupt_id] { SignalInterrupt(interrupt_id); });
+        return;
+    }
+
     if (0 == g_interrupt_event) {
         LOG_WARNING(Service_GSP, "cannot synchronize until GSP event has been created!");
         return;
@@ -251,11 +258,18 @@ static void ExecuteCommand(const Command& command, u32 thread_id) {
 
     // GX request DMA - typically used for copying memory from GSP heap to VRAM
     case CommandId::REQUEST_DMA:
-        memcpy(Memory::GetPointer(command.dma_request.dest_address),
-               Memory::GetPointer(command.dma_request.source_address),
-               command.dma_request.size);
-        SignalInterrupt(InterruptId::DMA);
+    {
+        // DMAs are ordered with the other GPU commands, e.g. texture uploads with the draws using them
+        const VAddr source_address = command.dma_request.source_address;
+        const VAddr dest_address = command.dma_request.dest_address;
+        const u32 size = command.dma_request.size;
+        GPU::PushCommand([source_address, dest_address, size] {
+            memcpy(Memory::GetPointer(dest_address), Memory::GetPointer(source_address), size);
+            Memory::InvalidateRegion(dest_address, size);
+            SignalInterrupt(InterruptId::DMA);
+        });
         break;
+    }
 
     // ctrulib homebrew sends all relevant command list data with this command,
     // hence we do all "interesting" stuff here and do nothing in SET_COMMAND_LIST_FIRST.
@@ -280,13 +294,13 @@ static void ExecuteCommand(const Command& command, u32 thread_id) {
         auto& params = command.memory_fill;
         WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].address_start), Memory::VirtualToPhysicalAddress(params.start1) >> 3);
         WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].address_end), Memory::VirtualToPhysicalAddress(params.end1) >> 3);
-        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].size), params.end1 - params.start1);
-        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].value), params.value1);
+        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].value_32bit), params.value1);
+        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[0].control), params.control1);
 
         WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].address_start), Memory::VirtualToPhysicalAddress(params.start2) >> 3);
         WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].address_end), Memory::VirtualToPhysicalAddress(params.end2) >> 3);
-        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].size), params.end2 - params.start2);
-        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].value), params.value2);
+        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].value_32bit), params.value2);
+        WriteGPURegister(GPU_REG_INDEX(memory_fill_config[1].control), params.control2);
         break;
     }
 
@@ -329,7 +343,11 @@ static void ExecuteCommand(const Command& command, u32 thread_id) {
     }
 }
 
-/// This triggers handling of the GX command written to the command buffer in shared memory.
+/**
+ * This triggers handling of the GX command written to the command buffer in shared memory.
+ * Commands are submitted to the GPU thread and complete asynchronously, signalling their
+ * interrupts once they are done.
+ */
 static void TriggerCmdReqQueue(Service::Interface* self) {
     // Iterate through each thread's command queue...
     for (unsigned thread_id = 0; thread_id < 0x4; ++thread_id) {
@@ -16,9 +16,12 @@
 #include "core/hle/service/dsp_dsp.h"
 
 #include "core/hw/gpu.h"
+#include "core/hw/gpu_thread.h"
+#include "core/hw/gpu_transfer.h"
 
 #include "video_core/command_processor.h"
 #include "video_core/video_core.h"
+#include "video_core/debug_utils/pica_capture.h"
 
 
 namespace GPU {
@@ -66,28 +69,40 @@ inline void Write(u32 addr, const T data) {
 
     switch (index) {
 
-    // Memory fills are triggered once the fill value is written.
-    // NOTE: This is not verified.
-    case GPU_REG_INDEX_WORKAROUND(memory_fill_config[0].value, 0x00004 + 0x3):
-    case GPU_REG_INDEX_WORKAROUND(memory_fill_config[1].value, 0x00008 + 0x3):
+    // Memory fills are triggered by setting the trigger bit of the control register.
+    case GPU_REG_INDEX_WORKAROUND(memory_fill_config[0].control, 0x00004 + 0x3):
+    case GPU_REG_INDEX_WORKAROUND(memory_fill_config[1].control, 0x00008 + 0x3):
     {
-        const bool is_second_filler = (index != GPU_REG_INDEX(memory_fill_config[0].value));
-        const auto& config = g_regs.memory_fill_config[is_second_filler];
-
-        // TODO: Not sure if this check should be done at GSP level instead
-        if (config.address_start) {
-            // TODO: Not sure if this algorithm is correct, particularly because it doesn't use the size member at all
-            u32* start = (u32*)Memory::GetPointer(Memory::PhysicalToVirtualAddress(config.GetStartAddress()));
-            u32* end = (u32*)Memory::GetPointer(Memory::PhysicalToVirtualAddress(config.GetEndAddress()));
-            for (u32* ptr = start; ptr < end; ++ptr)
-                *ptr = bswap32(config.value); // TODO: This is just a workaround to missing framebuffer format emulation
-
-            LOG_TRACE(HW_GPU, "MemoryFill from 0x%08x to 0x%08x", config.GetStartAddress(), config.GetEndAddress());
-
-            if (!is_second_filler) {
-                GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PSC0);
+        const bool is_second_filler = (index != GPU_REG_INDEX(memory_fill_config[0].control));
+        auto& config = g_regs.memory_fill_config[is_second_filler];
+
+        if (config.trigger) {
+            // TODO: Not sure if this check should be done at GSP level instead
+            if (config.address_start) {
+                // The filler stays busy until the GPU thread has run the fill
+                const Regs::MemoryFillConfig fill_config = config;
+                PushCommand([fill_config, is_second_filler] {
+                    MemoryFill(fill_config);
+                    Pica::DebugUtils::CaptureMemoryFill(fill_config);
+
+                    LOG_TRACE(HW_GPU, "MemoryFill from 0x%08x to 0x%08x",
+                              fill_config.GetStartAddress(), fill_config.GetEndAddress());
+
+                    RunOnEmulationThread([is_second_filler] {
+                        auto& config = g_regs.memory_fill_config[is_second_filler];
+                        config.trigger = 0;
+                        config.finished = 1;
+
+                        if (!is_second_filler) {
+                            GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PSC0);
+                        } else {
+                            GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PSC1);
+                        }
+                    });
+                });
             } else {
-                GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PSC1);
+                config.trigger = 0;
+                config.finished = 1;
             }
         }
         break;
@@ -97,76 +112,19 @@ inline void Write(u32 addr, const T data) {
     {
         const auto& config = g_regs.display_transfer_config;
         if (config.trigger & 1) {
-            u8* source_pointer = Memory::GetPointer(Memory::PhysicalToVirtualAddress(config.GetPhysicalInputAddress()));
-            u8* dest_pointer = Memory::GetPointer(Memory::PhysicalToVirtualAddress(config.GetPhysicalOutputAddress()));
-
-            // Cheap emulation of horizontal scaling: Just skip each second pixel of the
-            // input framebuffer. We keep track of this in the pixel_skip variable.
-            unsigned pixel_skip = (config.scale_horizontally != 0) ? 2 : 1;
-
-            u32 output_width = config.output_width / pixel_skip;
-
-            for (u32 y = 0; y < config.output_height; ++y) {
-                // TODO: Why does the register seem to hold twice the framebuffer width?
-
-                for (u32 x = 0; x < output_width; ++x) {
-                    struct {
-                        int r, g, b, a;
-                    } source_color = { 0, 0, 0, 0 };
-
-                    switch (config.input_format) {
-                    case Regs::PixelFormat::RGBA8:
-                    {
-                        // TODO: Most likely got the component order messed up.
-                        u8* srcptr = source_pointer + (x * pixel_skip + y * config.input_width) * 4;
-                        source_color.r = srcptr[0]; // blue
-                        source_color.g = srcptr[1]; // green
-                        source_color.b = srcptr[2]; // red
-                        source_color.a = srcptr[3]; // alpha
-                        break;
-                    }
-
-                    default:
-                        LOG_ERROR(HW_GPU, "Unknown source framebuffer format %x", config.input_format.Value());
-                        break;
-                    }
-
-                    switch (config.output_format) {
-                    /*case Regs::PixelFormat::RGBA8:
-                    {
-                        // TODO: Untested
-                        u8* dstptr = (u32*)(dest_pointer + x * 4 + y * config.output_width * 4);
-                        dstptr[0] = source_color.r;
-                        dstptr[1] = source_color.g;
-                        dstptr[2] = source_color.b;
-                        dstptr[3] = source_color.a;
-                        break;
-                    }*/
-
-                    case Regs::PixelFormat::RGB8:
-                    {
-                        // TODO: Most likely got the component order messed up.
-                        u8* dstptr = dest_pointer + (x + y * output_width) * 3;
-                        dstptr[0] = source_color.r; // blue
-                        dstptr[1] = source_color.g; // green
-                        dstptr[2] = source_color.b; // red
-                        break;
-                    }
-
-                    default:
-                        LOG_ERROR(HW_GPU, "Unknown destination framebuffer format %x", config.output_format.Value());
-                        break;
-                    }
-                }
-            }
-
-            LOG_TRACE(HW_GPU, "DisplayTriggerTransfer: 0x%08x bytes from 0x%08x(%ux%u)-> 0x%08x(%ux%u), dst format %x",
-                      config.output_height * output_width * 4,
-                      config.GetPhysicalInputAddress(), (u32)config.input_width, (u32)config.input_height,
-                      config.GetPhysicalOutputAddress(), (u32)output_width, (u32)config.output_height,
-                      config.output_format.Value());
-
-            GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PPF);
+            const Regs::DisplayTransferConfig transfer_config = config;
+            PushCommand([transfer_config] {
+                const auto& config = transfer_config;
+                DisplayTransfer(config);
+
+                LOG_TRACE(HW_GPU, "DisplayTriggerTransfer: 0x%08x(%ux%u) format %u -> 0x%08x(%ux%u) format %u, scaling %u, tiled %u",
+                          config.GetPhysicalInputAddress(), (u32)config.input_width, (u32)config.input_height,
+                          (u32)config.input_format.Value(),
+                          config.GetPhysicalOutputAddress(), (u32)config.output_width, (u32)config.output_height,
+                          (u32)config.output_format.Value(), (u32)config.scaling.Value(), (u32)config.output_tiled);
+
+                GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::PPF);
+            });
         }
         break;
     }
@@ -178,7 +136,10 @@ inline void Write(u32 addr, const T data) {
         if (config.trigger & 1)
         {
             u32* buffer = (u32*)Memory::GetPointer(Memory::PhysicalToVirtualAddress(config.GetPhysicalAddress()));
-            Pica::CommandProcessor::ProcessCommandList(buffer, config.size);
+            const u32 size = config.size;
+            PushCommand([buffer, size] {
+                Pica::CommandProcessor::ProcessCommandList(buffer, size);
+            });
         }
         break;
     }
@@ -202,6 +163,10 @@ template void Write<u8>(u32 addr, const u8 data);
 
 /// Update hardware
 static void VBlankCallback(u64 userdata, int cycles_late) {
+    // The displayed framebuffers and captured frames have to include all commands submitted so
+    // far, and the frame skipping state mustn't change while they are executed
+    SyncThread();
+
     frame_count++;
     last_skip_frame = g_skip_frame;
     g_skip_frame = (frame_count & Settings::values.frame_skip) != 0;
@@ -217,6 +182,8 @@ static void VBlankCallback(u64 userdata, int cycles_late) {
         VideoCore::g_renderer->SwapBuffers();
     }
 
+    Pica::DebugUtils::CaptureFrameEnd();
+
     // Signal to GSP that GPU interrupt has occurred
     // TODO(yuriks): hwtest to determine if PDC0 is for the Top screen and PDC1 for the Sub
     // screen, or if both use the same interrupts and these two instead determine the
@@ -271,11 +238,20 @@ void Init() {
     vblank_event = CoreTiming::RegisterEvent("GPU::VBlankCallback", VBlankCallback);
     CoreTiming::ScheduleEvent(frame_ticks, vblank_event);
 
+    StartThread();
+
     LOG_DEBUG(HW_GPU, "initialized OK");
 }
 
+/// Update hardware
+void Update() {
+    ProcessCompletions();
+}
+
 /// Shutdown hardware
 void Shutdown() {
+    StopThread();
+
     LOG_DEBUG(HW_GPU, "shutdown OK");
 }
 
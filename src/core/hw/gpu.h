@@ -63,11 +63,34 @@ struct Regs {
 
     INSERT_PADDING_WORDS(0x4);
 
-    struct {
+    struct MemoryFillConfig {
         u32 address_start;
-        u32 address_end; // ?
-        u32 size;
-        u32 value; // ?
+        u32 address_end;
+
+        union {
+            u32 value_32bit;
+
+            BitField< 0, 16, u32> value_16bit;
+
+            // TODO: Verify component order
+            BitField< 0,  8, u32> value_24bit_r;
+            BitField< 8,  8, u32> value_24bit_g;
+            BitField<16,  8, u32> value_24bit_b;
+        };
+
+        union {
+            u32 control;
+
+            // Writing 1 triggers the memory fill
+            BitField< 0,  1, u32> trigger;
+
+            // Set to 1 upon completion
+            BitField< 1,  1, u32> finished;
+
+            // The memory is filled with 16-bit values unless one of these is set
+            BitField< 8,  1, u32> fill_24bit;
+            BitField< 9,  1, u32> fill_32bit;
+        };
 
         inline u32 GetStartAddress() const {
             return DecodeAddressRegister(address_start);
@@ -124,7 +147,13 @@ struct Regs {
 
     INSERT_PADDING_WORDS(0x169);
 
-    struct {
+    struct DisplayTransferConfig {
+        enum ScalingMode : u32 {
+            NoScale = 0,  // Doesn't scale the image
+            ScaleX  = 1,  // Downscales the image in width
+            ScaleXY = 2,  // Downscales the image in both width and height
+        };
+
         u32 input_address;
         u32 output_address;
 
@@ -158,8 +187,8 @@ struct Regs {
             BitField<12, 3, PixelFormat> output_format;
             BitField<16, 1, u32> output_tiled;     // stores output in a tiled format
 
-            // TODO: Not really sure if this actually scales, or even resizes at all.
-            BitField<24, 1, u32> scale_horizontally;
+            // Averages pairs of pixels in the given directions
+            BitField<24, 2, ScalingMode> scaling;
         };
 
         INSERT_PADDING_WORDS(0x1);
@@ -255,6 +284,9 @@ void Write(u32 addr, const T data);
 /// Initialize hardware
 void Init();
 
+/// Update hardware, delivering the interrupts of completed GPU commands
+void Update();
+
 /// Shutdown hardware
 void Shutdown();
 
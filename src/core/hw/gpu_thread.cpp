@@ -0,0 +1,158 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/common.h"
+#include "common/thread.h"
+
+#include "core/settings.h"
+#include "core/hw/gpu_thread.h"
+
+namespace GPU {
+
+static std::thread gpu_thread;
+static std::thread::id gpu_thread_id;
+static bool running = false;
+
+static std::mutex mutex;
+static std::condition_variable command_available;
+static std::condition_variable commands_done;
+
+// Guarded by mutex
+static std::deque<std::function<void()>> commands;
+static std::vector<std::function<void()>> completions;
+static bool executing = false;
+static bool stopping = false;
+
+/// Set whenever completions are queued, so that polling for them doesn't need to lock the mutex
+static std::atomic<bool> has_completions(false);
+
+static void ThreadLoop() {
+    Common::SetCurrentThreadName("GPU");
+
+    while (true) {
+        std::function<void()> command;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            command_available.wait(lock, [] { return stopping || !commands.empty(); });
+
+            // Finish the submitted commands before stopping, since their results may be shown
+            if (commands.empty())
+                return;
+
+            command = std::move(commands.front());
+            commands.pop_front();
+            executing = true;
+        }
+
+        command();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        executing = false;
+        if (commands.empty())
+            commands_done.notify_all();
+    }
+}
+
+void StartThread() {
+    if (running || !Settings::values.use_gpu_thread)
+        return;
+
+    stopping = false;
+    gpu_thread = std::thread(ThreadLoop);
+    gpu_thread_id = gpu_thread.get_id();
+    running = true;
+
+    LOG_DEBUG(HW_GPU, "GPU thread started");
+}
+
+void StopThread() {
+    if (!running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    command_available.notify_one();
+    gpu_thread.join();
+
+    running = false;
+    gpu_thread_id = std::thread::id();
+    completions.clear();
+    has_completions = false;
+
+    LOG_DEBUG(HW_GPU, "GPU thread stopped");
+}
+
+void PushCommand(std::function<void()> command) {
+    if (!running || IsGPUThread()) {
+        command();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+    }
+    command_available.notify_one();
+}
+
+void RunOnEmulationThread(std::function<void()> callback) {
+    if (!IsGPUThread()) {
+        callback();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    completions.push_back(std::move(callback));
+    has_completions = true;
+}
+
+bool ProcessCompletions() {
+    if (!has_completions)
+        return false;
+
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        callbacks.swap(completions);
+        has_completions = false;
+    }
+
+    // Callbacks may submit further commands, so the mutex must not be held while they run
+    for (auto& callback : callbacks)
+        callback();
+    return !callbacks.empty();
+}
+
+void SyncThread() {
+    if (running) {
+        std::unique_lock<std::mutex> lock(mutex);
+        commands_done.wait(lock, [] { return commands.empty() && !executing; });
+    }
+
+    ProcessCompletions();
+}
+
+bool IsThreadBusy() {
+    if (!running)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return !commands.empty() || executing;
+}
+
+bool IsGPUThread() {
+    return running && std::this_thread::get_id() == gpu_thread_id;
+}
+
+} // namespace
@@ -0,0 +1,62 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <functional>
+
+namespace GPU {
+
+// GPU commands (command lists, memory fills, display transfers and DMAs) can be executed on a
+// dedicated GPU thread, so that the emulated CPU keeps running while the GPU works, like on
+// hardware. Commands run in submission order. Anything they need to do on the emulation thread,
+// in particular signalling their completion interrupts, is handed back to it and run the next time
+// the emulation thread processes completions. When the GPU thread is disabled, commands and their
+// completions run right away on the emulation thread, which is easier to debug.
+//
+// State owned by the GPU thread (the PICA registers, the rasterizer and its caches) must not be
+// touched by the emulation thread unless it has synchronized with the GPU thread first.
+
+/**
+ * Starts the GPU thread if it is enabled in the settings
+ */
+void StartThread();
+
+/**
+ * Waits for all submitted commands, stops the GPU thread and drops pending completions
+ */
+void StopThread();
+
+/**
+ * Submits a command for execution on the GPU thread. Runs it right away if the GPU thread isn't
+ * running or the caller is the GPU thread itself.
+ */
+void PushCommand(std::function<void()> command);
+
+/**
+ * Queues work for the emulation thread, e.g. signalling an interrupt. Runs it right away if the
+ * caller isn't the GPU thread.
+ */
+void RunOnEmulationThread(std::function<void()> callback);
+
+/**
+ * Runs the work queued for the emulation thread by commands which have completed. Must be called
+ * from the emulation thread.
+ * @return True if any work was queued
+ */
+bool ProcessCompletions();
+
+/**
+ * Waits until all submitted commands have completed and processes their completions. Must be
+ * called from the emulation thread before it accesses state owned by the GPU thread.
+ */
+void SyncThread();
+
+/// Returns true if submitted commands are still pending or executing
+bool IsThreadBusy();
+
+/// Returns true if the caller is the GPU thread
+bool IsGPUThread();
+
+} // namespace
@@ -0,0 +1,471 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
+#include "common/common.h"
+
+#include "core/mem_map.h"
+#include "core/hw/gpu_transfer.h"
+
+#include "video_core/color.h"
+
+namespace GPU {
+
+bool g_use_sse_transfers = true;
+
+// Pixels are converted between formats through 32-bit words holding 0xAARRGGBB, which is also how
+// the rasterizer stores RGBA8 framebuffers. RGB8 pixels are stored as blue, green, red bytes.
+
+u32 BytesPerPixel(Regs::PixelFormat format) {
+    switch (format) {
+    case Regs::PixelFormat::RGBA8:
+        return 4;
+
+    case Regs::PixelFormat::RGB8:
+        return 3;
+
+    default:
+        return 2;
+    }
+}
+
+static bool IsValidFormat(Regs::PixelFormat format) {
+    return format <= Regs::PixelFormat::RGBA4;
+}
+
+static u32 DecodePixel(Regs::PixelFormat format, const u8* src) {
+    u16 value;
+    std::memcpy(&value, src, sizeof(value));
+
+    switch (format) {
+    case Regs::PixelFormat::RGBA8:
+    {
+        u32 color;
+        std::memcpy(&color, src, sizeof(color));
+        return color;
+    }
+
+    case Regs::PixelFormat::RGB8:
+        return 0xFF000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+
+    case Regs::PixelFormat::RGB565:
+        return 0xFF000000 | (Color::Convert5To8(value >> 11) << 16) |
+               (Color::Convert6To8((value >> 5) & 0x3F) << 8) | Color::Convert5To8(value & 0x1F);
+
+    case Regs::PixelFormat::RGB5A1:
+        return (static_cast<u32>(Color::Convert1To8(value & 0x1)) << 24) | (Color::Convert5To8(value >> 11) << 16) |
+               (Color::Convert5To8((value >> 6) & 0x1F) << 8) | Color::Convert5To8((value >> 1) & 0x1F);
+
+    case Regs::PixelFormat::RGBA4:
+        return (static_cast<u32>(Color::Convert4To8(value & 0xF)) << 24) | (Color::Convert4To8(value >> 12) << 16) |
+               (Color::Convert4To8((value >> 8) & 0xF) << 8) | Color::Convert4To8((value >> 4) & 0xF);
+
+    default:
+        return 0;
+    }
+}
+
+static void EncodePixel(Regs::PixelFormat format, u32 color, u8* dst) {
+    const u32 a = color >> 24;
+    const u32 r = (color >> 16) & 0xFF;
+    const u32 g = (color >> 8) & 0xFF;
+    const u32 b = color & 0xFF;
+    u16 value;
+
+    switch (format) {
+    case Regs::PixelFormat::RGBA8:
+        std::memcpy(dst, &color, sizeof(color));
+        return;
+
+    case Regs::PixelFormat::RGB8:
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        return;
+
+    case Regs::PixelFormat::RGB565:
+        value = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        break;
+
+    case Regs::PixelFormat::RGB5A1:
+        value = ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | (a >> 7);
+        break;
+
+    case Regs::PixelFormat::RGBA4:
+        value = ((r >> 4) << 12) | ((g >> 4) << 8) | ((b >> 4) << 4) | (a >> 4);
+        break;
+
+    default:
+        return;
+    }
+    std::memcpy(dst, &value, sizeof(value));
+}
+
+/// Averages each color component of two pixels, rounding up
+static u32 AveragePixels(u32 a, u32 b) {
+    return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+
+// The SSE2 kernels process four pixels at a time and return the number of pixels they handled,
+// leaving the remainder of the row to the scalar code. They produce the same results as it, which
+// citra-gpu-bench --transfers checks.
+
+/// Expands the n-bit color components in the lowest bits of each 32-bit lane to 8 bits
+template <int bits>
+static __m128i ExpandComponent(__m128i value) {
+    return _mm_or_si128(_mm_slli_epi32(value, 8 - bits), _mm_srli_epi32(value, 2 * bits - 8));
+}
+
+static __m128i Component(__m128i value, int shift, u32 mask) {
+    return _mm_and_si128(_mm_srli_epi32(value, shift), _mm_set1_epi32(mask));
+}
+
+static __m128i ComposePixels(__m128i a, __m128i r, __m128i g, __m128i b) {
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(a, 24), _mm_slli_epi32(r, 16)),
+                        _mm_or_si128(_mm_slli_epi32(g, 8), b));
+}
+
+template <Regs::PixelFormat format>
+static u32 DecodeRowSSE(const u8* src, u32* dst, u32 count) {
+    const __m128i opaque = _mm_set1_epi32(0xFF000000);
+    u32 x = 0;
+
+    for (; x + 4 <= count; x += 4) {
+        __m128i pixels;
+
+        if (format == Regs::PixelFormat::RGBA8) {
+            pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        } else if (format == Regs::PixelFormat::RGB8) {
+            // Load pixels 0-1 and 2-3 into one 64-bit lane each, then move the odd ones up a byte
+            const u8* row = src + x * 3;
+            const __m128i low = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+            const __m128i high = _mm_srli_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + 4)), 16);
+            const __m128i packed = _mm_unpacklo_epi64(low, high);
+            pixels = _mm_or_si128(_mm_and_si128(packed, _mm_set_epi32(0, 0xFFFFFF, 0, 0xFFFFFF)),
+                                  _mm_and_si128(_mm_slli_epi64(packed, 8), _mm_set_epi32(0xFFFFFF, 0, 0xFFFFFF, 0)));
+            pixels = _mm_or_si128(pixels, opaque);
+        } else {
+            const __m128i value = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + x * 2)),
+                                                     _mm_setzero_si128());
+
+            if (format == Regs::PixelFormat::RGB565) {
+                pixels = ComposePixels(_mm_setzero_si128(),
+                                       ExpandComponent<5>(_mm_srli_epi32(value, 11)),
+                                       ExpandComponent<6>(Component(value, 5, 0x3F)),
+                                       ExpandComponent<5>(Component(value, 0, 0x1F)));
+                pixels = _mm_or_si128(pixels, opaque);
+            } else if (format == Regs::PixelFormat::RGB5A1) {
+                pixels = ComposePixels(_mm_sub_epi32(_mm_setzero_si128(), Component(value, 0, 0x1)),
+                                       ExpandComponent<5>(_mm_srli_epi32(value, 11)),
+                                       ExpandComponent<5>(Component(value, 6, 0x1F)),
+                                       ExpandComponent<5>(Component(value, 1, 0x1F)));
+            } else {
+                pixels = ComposePixels(ExpandComponent<4>(Component(value, 0, 0xF)),
+                                       ExpandComponent<4>(_mm_srli_epi32(value, 12)),
+                                       ExpandComponent<4>(Component(value, 8, 0xF)),
+                                       ExpandComponent<4>(Component(value, 4, 0xF)));
+            }
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), pixels);
+    }
+
+    return x;
+}
+
+template <Regs::PixelFormat format>
+static u32 EncodeRowSSE(const u32* src, u8* dst, u32 count) {
+    u32 x = 0;
+
+    for (; x + 4 <= count; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+
+        if (format == Regs::PixelFormat::RGBA8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), pixels);
+            continue;
+        }
+
+        if (format == Regs::PixelFormat::RGB8) {
+            // Drop the alpha byte of each pixel, packing each pair of pixels into 6 bytes of its
+            // 64-bit lane, then move the upper pair right behind the lower one
+            const __m128i packed = _mm_or_si128(_mm_and_si128(pixels, _mm_set_epi32(0, 0xFFFFFF, 0, 0xFFFFFF)),
+                                                _mm_and_si128(_mm_srli_epi64(pixels, 8), _mm_set_epi32(0xFFFF, 0xFF000000, 0xFFFF, 0xFF000000)));
+            const __m128i row = _mm_or_si128(_mm_move_epi64(packed), _mm_slli_si128(_mm_srli_si128(packed, 8), 6));
+
+            // The 4 bytes past these pixels are overwritten by the next ones, except at the end
+            u8* out = dst + x * 3;
+            if (x + 8 <= count) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), row);
+            } else {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out), row);
+                const u32 last = _mm_cvtsi128_si32(_mm_srli_si128(row, 8));
+                std::memcpy(out + 8, &last, sizeof(last));
+            }
+            continue;
+        }
+
+        const __m128i a = _mm_srli_epi32(pixels, 24);
+        const __m128i r = Component(pixels, 16, 0xFF);
+        const __m128i g = Component(pixels, 8, 0xFF);
+        const __m128i b = Component(pixels, 0, 0xFF);
+        __m128i value;
+
+        if (format == Regs::PixelFormat::RGB565) {
+            value = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11),
+                                              _mm_slli_epi32(_mm_srli_epi32(g, 2), 5)),
+                                 _mm_srli_epi32(b, 3));
+        } else if (format == Regs::PixelFormat::RGB5A1) {
+            value = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11),
+                                              _mm_slli_epi32(_mm_srli_epi32(g, 3), 6)),
+                                 _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(b, 3), 1),
+                                              _mm_srli_epi32(a, 7)));
+        } else {
+            value = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 4), 12),
+                                              _mm_slli_epi32(_mm_srli_epi32(g, 4), 8)),
+                                 _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(b, 4), 4),
+                                              _mm_srli_epi32(a, 4)));
+        }
+
+        // Sign extend the 16-bit values so that the saturating pack keeps them as they are
+        value = _mm_srai_epi32(_mm_slli_epi32(value, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 2), _mm_packs_epi32(value, value));
+    }
+
+    return x;
+}
+
+static u32 AverageRowsSSE(u32* row, const u32* other, u32 count) {
+    u32 x = 0;
+    for (; x + 4 <= count; x += 4) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm_avg_epu8(a, b));
+    }
+    return x;
+}
+
+static u32 AveragePairsSSE(u32* row, u32 count) {
+    u32 x = 0;
+    for (; x + 4 <= count; x += 4) {
+        // Reorder both groups of four pixels to even, even, odd, odd and combine them
+        const __m128i a = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * x)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i b = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * x + 4)), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i average = _mm_avg_epu8(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), average);
+    }
+    return x;
+}
+
+#endif // defined(__x86_64__) || defined(_M_AMD64)
+
+/// Decodes a row of pixels to 0xAARRGGBB words
+static void DecodeRow(Regs::PixelFormat format, const u8* src, u32* dst, u32 count) {
+    u32 x = 0;
+#if defined(__x86_64__) || defined(_M_AMD64)
+    // Each format gets its own instantiation, keeping the format checks out of the pixel loop
+    if (g_use_sse_transfers) {
+        switch (format) {
+        case Regs::PixelFormat::RGBA8:  x = DecodeRowSSE<Regs::PixelFormat::RGBA8>(src, dst, count); break;
+        case Regs::PixelFormat::RGB8:   x = DecodeRowSSE<Regs::PixelFormat::RGB8>(src, dst, count); break;
+        case Regs::PixelFormat::RGB565: x = DecodeRowSSE<Regs::PixelFormat::RGB565>(src, dst, count); break;
+        case Regs::PixelFormat::RGB5A1: x = DecodeRowSSE<Regs::PixelFormat::RGB5A1>(src, dst, count); break;
+        case Regs::PixelFormat::RGBA4:  x = DecodeRowSSE<Regs::PixelFormat::RGBA4>(src, dst, count); break;
+        default: break;
+        }
+    }
+#endif
+    const u32 bytes_per_pixel = BytesPerPixel(format);
+    for (; x < count; ++x)
+        dst[x] = DecodePixel(format, src + x * bytes_per_pixel);
+}
+
+/// Encodes a row of 0xAARRGGBB words to the given format
+static void EncodeRow(Regs::PixelFormat format, const u32* src, u8* dst, u32 count) {
+    u32 x = 0;
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (g_use_sse_transfers) {
+        switch (format) {
+        case Regs::PixelFormat::RGBA8:  x = EncodeRowSSE<Regs::PixelFormat::RGBA8>(src, dst, count); break;
+        case Regs::PixelFormat::RGB8:   x = EncodeRowSSE<Regs::PixelFormat::RGB8>(src, dst, count); break;
+        case Regs::PixelFormat::RGB565: x = EncodeRowSSE<Regs::PixelFormat::RGB565>(src, dst, count); break;
+        case Regs::PixelFormat::RGB5A1: x = EncodeRowSSE<Regs::PixelFormat::RGB5A1>(src, dst, count); break;
+        case Regs::PixelFormat::RGBA4:  x = EncodeRowSSE<Regs::PixelFormat::RGBA4>(src, dst, count); break;
+        default: break;
+        }
+    }
+#endif
+    const u32 bytes_per_pixel = BytesPerPixel(format);
+    for (; x < count; ++x)
+        EncodePixel(format, src[x], dst + x * bytes_per_pixel);
+}
+
+/// Averages another row of pixels into the given one
+static void AverageRows(u32* row, const u32* other, u32 count) {
+    u32 x = 0;
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (g_use_sse_transfers)
+        x = AverageRowsSSE(row, other, count);
+#endif
+    for (; x < count; ++x)
+        row[x] = AveragePixels(row[x], other[x]);
+}
+
+/// Averages each pair of adjacent pixels into one, leaving count pixels at the start of the row
+static void AveragePairs(u32* row, u32 count) {
+    u32 x = 0;
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (g_use_sse_transfers)
+        x = AveragePairsSSE(row, count);
+#endif
+    for (; x < count; ++x)
+        row[x] = AveragePixels(row[2 * x], row[2 * x + 1]);
+}
+
+/**
+ * Copies a row of pixels to a tiled image, in which pixels are stored in 8x8 tiles. Within each
+ * tile, they are arranged in a Z-order curve, the same way as in textures; horizontally adjacent
+ * pairs of pixels stay adjacent.
+ */
+static void TileRow(const u8* row, u8* dst, u32 y, u32 width, u32 bytes_per_pixel) {
+    const u32 coarse_y = y & ~7;
+    for (u32 x = 0; x < width; x += 2) {
+        // Interleave the lower 3 bits of each coordinate, as in DebugUtils::LookupTexture
+        u32 i = (x | (y << 8)) & 0x0707;
+        i = (i ^ (i << 2)) & 0x1313;
+        i = (i ^ (i << 1)) & 0x1515;
+        i = (i | (i >> 7)) & 0x3F;
+
+        const u32 offset = coarse_y * width + (x & ~7) * 8 + i;
+        std::memcpy(dst + offset * bytes_per_pixel, row + x * bytes_per_pixel, 2 * bytes_per_pixel);
+    }
+}
+
+/// Fills memory with a repeating 48-byte pattern, which holds a whole number of 16-, 24- and 32-bit values
+static void FillPattern(u8* dst, u32 size, const u8 (&pattern)[48]) {
+    u32 offset = 0;
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (g_use_sse_transfers) {
+        const __m128i pattern0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pattern[0]));
+        const __m128i pattern1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pattern[16]));
+        const __m128i pattern2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pattern[32]));
+        for (; offset + 48 <= size; offset += 48) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset), pattern0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset + 16), pattern1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset + 32), pattern2);
+        }
+    }
+#endif
+    for (; offset + 48 <= size; offset += 48)
+        std::memcpy(dst + offset, pattern, sizeof(pattern));
+    std::memcpy(dst + offset, pattern, size - offset);
+}
+
+void MemoryFill(const Regs::MemoryFillConfig& config) {
+    const VAddr start_vaddr = Memory::PhysicalToVirtualAddress(config.GetStartAddress());
+    const u32 size = config.GetEndAddress() - config.GetStartAddress();
+    u8* start = Memory::GetPointer(start_vaddr);
+
+    if (start == nullptr || config.GetEndAddress() < config.GetStartAddress()) {
+        LOG_ERROR(HW_GPU, "Invalid memory fill from 0x%08x to 0x%08x",
+                  config.GetStartAddress(), config.GetEndAddress());
+        return;
+    }
+
+    u8 pattern[48];
+    if (config.fill_24bit) {
+        for (unsigned i = 0; i < sizeof(pattern); i += 3) {
+            pattern[i] = config.value_24bit_r;
+            pattern[i + 1] = config.value_24bit_g;
+            pattern[i + 2] = config.value_24bit_b;
+        }
+    } else if (config.fill_32bit) {
+        // TODO: This is just a workaround to missing framebuffer format emulation
+        const u32 value = bswap32(config.value_32bit);
+        for (unsigned i = 0; i < sizeof(pattern); i += 4)
+            std::memcpy(&pattern[i], &value, sizeof(value));
+    } else {
+        const u16 value = config.value_16bit;
+        for (unsigned i = 0; i < sizeof(pattern); i += 2)
+            std::memcpy(&pattern[i], &value, sizeof(value));
+    }
+
+    FillPattern(start, size, pattern);
+
+    Memory::InvalidateRegion(start_vaddr, size);
+}
+
+void DisplayTransfer(const Regs::DisplayTransferConfig& config) {
+    const VAddr input_vaddr = Memory::PhysicalToVirtualAddress(config.GetPhysicalInputAddress());
+    const VAddr output_vaddr = Memory::PhysicalToVirtualAddress(config.GetPhysicalOutputAddress());
+    const u8* source_pointer = Memory::GetPointer(input_vaddr);
+    u8* dest_pointer = Memory::GetPointer(output_vaddr);
+
+    if (source_pointer == nullptr || dest_pointer == nullptr) {
+        LOG_ERROR(HW_GPU, "Invalid display transfer from 0x%08x to 0x%08x",
+                  config.GetPhysicalInputAddress(), config.GetPhysicalOutputAddress());
+        return;
+    }
+
+    if (!IsValidFormat(config.input_format)) {
+        LOG_ERROR(HW_GPU, "Unknown source framebuffer format %x", static_cast<u32>(config.input_format.Value()));
+        return;
+    }
+
+    if (!IsValidFormat(config.output_format)) {
+        LOG_ERROR(HW_GPU, "Unknown destination framebuffer format %x", static_cast<u32>(config.output_format.Value()));
+        return;
+    }
+
+    const u32 x_scale = (config.scaling != Regs::DisplayTransferConfig::NoScale) ? 2 : 1;
+    const u32 y_scale = (config.scaling == Regs::DisplayTransferConfig::ScaleXY) ? 2 : 1;
+
+    // TODO: Why does the register seem to hold twice the framebuffer width?
+    const u32 output_width = config.output_width / x_scale;
+    const u32 output_height = config.output_height / y_scale;
+    const u32 input_stride = config.input_width * BytesPerPixel(config.input_format);
+    const u32 output_bytes_per_pixel = BytesPerPixel(config.output_format);
+
+    if (config.output_tiled && output_width % 8 != 0) {
+        LOG_ERROR(HW_GPU, "Tiled display transfer output width %u isn't a multiple of 8", output_width);
+        return;
+    }
+
+    // NOTE: The rasterizer doesn't tile framebuffers, so unlike on hardware the input is assumed
+    // to be linear even if the output isn't tiled
+    std::vector<u32> row(output_width * x_scale);
+    std::vector<u32> next_row(y_scale > 1 ? row.size() : 0);
+    std::vector<u8> encoded_row(config.output_tiled ? output_width * output_bytes_per_pixel : 0);
+
+    for (u32 y = 0; y < output_height; ++y) {
+        const u8* source_row = source_pointer + y * y_scale * input_stride;
+        DecodeRow(config.input_format, source_row, row.data(), static_cast<u32>(row.size()));
+
+        if (y_scale > 1) {
+            DecodeRow(config.input_format, source_row + input_stride, next_row.data(), static_cast<u32>(next_row.size()));
+            AverageRows(row.data(), next_row.data(), static_cast<u32>(row.size()));
+        }
+
+        if (x_scale > 1)
+            AveragePairs(row.data(), output_width);
+
+        if (config.output_tiled) {
+            EncodeRow(config.output_format, row.data(), encoded_row.data(), output_width);
+            TileRow(encoded_row.data(), dest_pointer, y, output_width, output_bytes_per_pixel);
+        } else {
+            EncodeRow(config.output_format, row.data(), dest_pointer + y * output_width * output_bytes_per_pixel, output_width);
+        }
+    }
+
+    Memory::InvalidateRegion(output_vaddr, output_height * output_width * output_bytes_per_pixel);
+}
+
+} // namespace
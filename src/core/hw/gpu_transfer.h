@@ -0,0 +1,33 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "core/hw/gpu.h"
+
+namespace GPU {
+
+/**
+ * Whether transfers and fills use the SSE2 kernels on x86-64 hosts. They produce the same results
+ * as the scalar code, so this is only cleared to compare the two.
+ */
+extern bool g_use_sse_transfers;
+
+/**
+ * Fills the memory range of a memory filler with its 16-, 24- or 32-bit value, and invalidates
+ * anything cached from it.
+ */
+void MemoryFill(const Regs::MemoryFillConfig& config);
+
+/**
+ * Copies a framebuffer to another one as configured by the display transfer registers,
+ * converting between pixel formats, downscaling and tiling the output as requested. Invalidates
+ * anything cached from the output memory.
+ */
+void DisplayTransfer(const Regs::DisplayTransferConfig& config);
+
+/// Returns the size of a pixel in the given format, in bytes
+u32 BytesPerPixel(Regs::PixelFormat format);
+
+} // namespace
@@ -75,6 +75,7 @@ template void Write<u8>(u32 addr, const u8 data);
 
 /// Update hardware
 void Update() {
+    GPU::Update();
 }
 
 /// Initialize hardware
@@ -85,6 +86,7 @@ void Init() {
 
 /// Shutdown hardware
 void Shutdown() {
+    GPU::Shutdown();
     LOG_DEBUG(HW, "shutdown OK");
 }
 
@@ -74,12 +74,29 @@ void Init() {
 
     g_base = MemoryMap_Setup(g_views, kNumMemViews, flags, &arena);
 
+    // Build the page table used by the memory access fast path. The IO region is mapped first
+    // because it overlaps VRAM, which must take precedence.
+    MapSpecialRegion(HARDWARE_IO_VADDR, HARDWARE_IO_SIZE);
+    MapSpecialRegion(CONFIG_MEMORY_VADDR, CONFIG_MEMORY_SIZE);
+    MapSpecialRegion(SHARED_PAGE_VADDR, SHARED_PAGE_SIZE);
+    for (size_t i = 0; i < ARRAY_SIZE(g_views); i++) {
+        MapMemoryRegion(g_views[i].virtual_address, g_views[i].size, *g_views[i].out_ptr_low);
+    }
+
     LOG_DEBUG(HW_Memory, "initialized OK, RAM at %p (mirror at 0 @ %p)", g_heap,
         physical_fcram);
 }
 
 void Shutdown() {
     u32 flags = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(g_views); i++) {
+        UnmapRegion(g_views[i].virtual_address, g_views[i].size);
+    }
+    UnmapRegion(HARDWARE_IO_VADDR, HARDWARE_IO_SIZE);
+    UnmapRegion(CONFIG_MEMORY_VADDR, CONFIG_MEMORY_SIZE);
+    UnmapRegion(SHARED_PAGE_VADDR, SHARED_PAGE_SIZE);
+
     MemoryMap_Shutdown(g_views, kNumMemViews, flags, &arena);
 
     arena.ReleaseSpace();
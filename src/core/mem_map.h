@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "common/common.h"
 #include "common/common_types.h"
 
@@ -96,6 +98,13 @@ enum : u32 {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+const u32 PAGE_BITS             = 12;                       ///< Guest page size is 4KiB
+const u32 PAGE_SIZE             = 1 << PAGE_BITS;
+const u32 PAGE_MASK             = PAGE_SIZE - 1;
+const u32 PAGE_TABLE_NUM_ENTRIES = 1 << (32 - PAGE_BITS);   ///< Pages in the 32-bit address space
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 /// Represents a block of memory mapped by ControlMemory/MapMemoryBlock
 struct MemoryBlock {
     MemoryBlock() : handle(0), base_address(0), address(0), size(0), operation(0), permissions(0) {
@@ -160,6 +169,86 @@ void WriteBlock(VAddr addr, const u8* data, size_t size);
 
 u8* GetPointer(VAddr virtual_address);
 
+/**
+ * Returns the host pointers of all guest pages, indexed by page number, so that the CPU JIT can
+ * inline the fast path of Read/Write. Pages whose pointer is nullptr must go through Read/Write.
+ */
+u8* const* GetPageTablePointers();
+
+/**
+ * Returns the watch masks of all guest pages, indexed by page number. Writes to a page with a
+ * non-zero mask must go through Write, which notifies the write handlers.
+ */
+const std::atomic<u8>* GetPageWatches();
+
+/**
+ * Maps a region of host memory into the guest page table, so that accesses to it are served by
+ * the fast path in Read/Write/GetPointer.
+ * @param base Page-aligned guest virtual address of the region
+ * @param size Size of the region in bytes, must be a multiple of PAGE_SIZE
+ * @param target Host memory backing the region
+ */
+void MapMemoryRegion(VAddr base, u32 size, u8* target);
+
+/**
+ * Marks a region of the guest page table as special (e.g. ConfigMem, SharedPage or hardware
+ * registers). Accesses to it are always dispatched through the slow path.
+ * @param base Page-aligned guest virtual address of the region
+ * @param size Size of the region in bytes, must be a multiple of PAGE_SIZE
+ */
+void MapSpecialRegion(VAddr base, u32 size);
+
+/**
+ * Removes a region from the guest page table. Accesses to it will be reported as errors.
+ * @param base Page-aligned guest virtual address of the region
+ * @param size Size of the region in bytes, must be a multiple of PAGE_SIZE
+ */
+void UnmapRegion(VAddr base, u32 size);
+
+/// Host-side caches of data derived from guest memory, which watch their source pages for writes
+enum class PageWatch : u8 {
+    Code,           ///< Code translated by the CPU cores
+    Texture,        ///< Textures decoded by the rasterizer
+    DepthBuffer,    ///< Coarse depth bounds kept by the rasterizer
+};
+
+/// Function called with the page-aligned address of a watched page that has been written to
+typedef void (*WriteHandler)(VAddr page_address);
+
+/**
+ * Registers a function notified about writes to pages watched with the given kind of watch.
+ * Registering the same handler twice has no effect.
+ * @param watch Kind of watch the handler is responsible for
+ * @param handler Function to call
+ */
+void RegisterWriteHandler(PageWatch watch, WriteHandler handler);
+
+/**
+ * Watches the page containing the given address. The next write to the page calls the write
+ * handlers of the watch and removes it.
+ * @param watch Kind of watch, e.g. PageWatch::Code if the page holds translated code
+ * @param addr Virtual address inside the page
+ */
+void WatchPage(PageWatch watch, VAddr addr);
+
+/**
+ * Notifies the write handlers about every watched page in the given region. This must be
+ * called after writing to guest memory through a host pointer (e.g. DMA or file reads), since
+ * such writes are not seen by Write.
+ * @param addr Virtual address of the region
+ * @param size Size of the region in bytes
+ */
+void InvalidateRegion(VAddr addr, u32 size);
+
+/**
+ * Like InvalidateRegion, but for writes made by the owner of a watch, which keeps its own data
+ * up to date. Pages stay watched for it and its write handlers are not called.
+ * @param addr Virtual address of the region
+ * @param size Size of the region in bytes
+ * @param writer Kind of watch whose owner wrote to the region
+ */
+void InvalidateRegion(VAddr addr, u32 size, PageWatch writer);
+
 /**
  * Maps a block of memory on the heap
  * @param size Size of block in bytes
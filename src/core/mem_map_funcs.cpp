@@ -2,12 +2,17 @@
 // Licensed under GPLv2 or any later version
 // Refer to the license.txt file included.
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <map>
+#include <vector>
 
 #include "common/common.h"
 
 #include "core/mem_map.h"
 #include "core/hw/hw.h"
+#include "core/hw/gpu_thread.h"
 #include "hle/config_mem.h"
 #include "hle/shared_page.h"
 
@@ -49,51 +54,137 @@ PAddr VirtualToPhysicalAddress(const VAddr addr) {
     return addr;
 }
 
-template <typename T>
-inline void Read(T &var, const VAddr vaddr) {
-    // TODO: Figure out the fastest order of tests for both read and write (they are probably different).
-    // TODO: Make sure this represents the mirrors in a correct way.
-    // Could just do a base-relative read, too.... TODO
+enum class PageType : u8 {
+    /// Page is unmapped and accesses to it are reported as errors.
+    Unmapped,
+    /// Page is backed by host memory and accessed directly through the page table.
+    Memory,
+    /// Page is backed by an emulated device (ConfigMem, SharedPage, hardware registers).
+    Special,
+};
+
+/**
+ * Flat table with one entry per guest page. Entries for RAM-backed pages hold the host pointer
+ * of the page; entries for all other pages are nullptr and have their type stored in attributes.
+ */
+struct PageTable {
+    std::array<u8*, PAGE_TABLE_NUM_ENTRIES> pointers;
+    std::array<PageType, PAGE_TABLE_NUM_ENTRIES> attributes;
+    /// Bit mask of the kinds of watches set on each page by WatchPage. Pages are watched and
+    /// written to by both the emulation thread and the GPU thread.
+    std::array<std::atomic<u8>, PAGE_TABLE_NUM_ENTRIES> watches;
+};
+
+static const int NUM_PAGE_WATCHES = 3;
+
+static PageTable page_table;
+static std::array<std::vector<WriteHandler>, NUM_PAGE_WATCHES> write_handlers;
+
+static void MapPages(VAddr base, u32 size, u8* target, PageType type) {
+    _dbg_assert_msg_(HW_Memory, (base & PAGE_MASK) == 0, "non-page aligned base: %08X", base);
+    _dbg_assert_msg_(HW_Memory, (size & PAGE_MASK) == 0, "non-page aligned size: %08X", size);
+
+    u32 index = base >> PAGE_BITS;
+    const u32 end = index + (size >> PAGE_BITS);
+
+    for (; index < end; ++index) {
+        page_table.attributes[index] = type;
+        page_table.pointers[index] = target;
+        page_table.watches[index] = 0;
+        if (target != nullptr)
+            target += PAGE_SIZE;
+    }
+}
+
+void MapMemoryRegion(VAddr base, u32 size, u8* target) {
+    MapPages(base, size, target, PageType::Memory);
+}
+
+void MapSpecialRegion(VAddr base, u32 size) {
+    MapPages(base, size, nullptr, PageType::Special);
+}
+
+void UnmapRegion(VAddr base, u32 size) {
+    MapPages(base, size, nullptr, PageType::Unmapped);
+}
+
+void RegisterWriteHandler(PageWatch watch, WriteHandler handler) {
+    auto& handlers = write_handlers[static_cast<int>(watch)];
+    if (std::find(handlers.begin(), handlers.end(), handler) == handlers.end())
+        handlers.push_back(handler);
+}
+
+void WatchPage(PageWatch watch, const VAddr addr) {
+    if (!write_handlers[static_cast<int>(watch)].empty())
+        page_table.watches[addr >> PAGE_BITS].fetch_or(1 << static_cast<int>(watch));
+}
 
-    // Kernel memory command buffer
-    if (vaddr >= KERNEL_MEMORY_VADDR && vaddr < KERNEL_MEMORY_VADDR_END) {
-        var = *((const T*)&g_kernel_mem[vaddr - KERNEL_MEMORY_VADDR]);
+static void RunWriteHandlers(int watch, const VAddr page_address) {
+    for (WriteHandler handler : write_handlers[watch])
+        handler(page_address);
+}
 
-    // ExeFS:/.code is loaded here
-    } else if ((vaddr >= EXEFS_CODE_VADDR)  && (vaddr < EXEFS_CODE_VADDR_END)) {
-        var = *((const T*)&g_exefs_code[vaddr - EXEFS_CODE_VADDR]);
+/**
+ * Removes the watches of a page that has been written to and notifies their write handlers
+ * @param vaddr Virtual address inside the page
+ * @param kept_watches Mask of watches left armed and not notified
+ */
+static void OnWatchedPageWrite(const VAddr vaddr, const u8 kept_watches = 0) {
+    const VAddr page_address = vaddr & ~PAGE_MASK;
+    const u8 watches = page_table.watches[vaddr >> PAGE_BITS].fetch_and(kept_watches) & ~kept_watches;
+    const bool on_gpu_thread = GPU::IsGPUThread();
+
+    for (int watch = 0; watch < NUM_PAGE_WATCHES; ++watch) {
+        if (!(watches & (1 << watch)))
+            continue;
+
+        // Translated code is only used by the emulation thread and the rasterizer caches only by
+        // the GPU thread, so writes from the other thread are handed over to the owner. Commands
+        // submitted later still see the write, since the GPU thread runs everything in order.
+        const bool gpu_watch = (watch != static_cast<int>(PageWatch::Code));
+        if (gpu_watch && !on_gpu_thread) {
+            GPU::PushCommand([watch, page_address] { RunWriteHandlers(watch, page_address); });
+        } else if (!gpu_watch && on_gpu_thread) {
+            GPU::RunOnEmulationThread([watch, page_address] { RunWriteHandlers(watch, page_address); });
+        } else {
+            RunWriteHandlers(watch, page_address);
+        }
+    }
+}
 
-    // FCRAM - linear heap
-    } else if ((vaddr >= HEAP_LINEAR_VADDR) && (vaddr < HEAP_LINEAR_VADDR_END)) {
-        var = *((const T*)&g_heap_linear[vaddr - HEAP_LINEAR_VADDR]);
+static void InvalidateRegion(const VAddr addr, const u32 size, const u8 kept_watches) {
+    if (size == 0)
+        return;
 
-    // FCRAM - application heap
-    } else if ((vaddr >= HEAP_VADDR)  && (vaddr < HEAP_VADDR_END)) {
-        var = *((const T*)&g_heap[vaddr - HEAP_VADDR]);
+    const u32 first_page = addr >> PAGE_BITS;
+    const u32 last_page = (addr + size - 1) >> PAGE_BITS;
+    for (u32 page = first_page; page <= last_page; ++page) {
+        if (page_table.watches[page] & ~kept_watches)
+            OnWatchedPageWrite(page << PAGE_BITS, kept_watches);
+    }
+}
 
-    // Shared memory
-    } else if ((vaddr >= SHARED_MEMORY_VADDR)  && (vaddr < SHARED_MEMORY_VADDR_END)) {
-        var = *((const T*)&g_shared_mem[vaddr - SHARED_MEMORY_VADDR]);
+void InvalidateRegion(const VAddr addr, const u32 size) {
+    InvalidateRegion(addr, size, 0);
+}
 
-    // System memory
-    } else if ((vaddr >= SYSTEM_MEMORY_VADDR)  && (vaddr < SYSTEM_MEMORY_VADDR_END)) {
-        var = *((const T*)&g_system_mem[vaddr - SYSTEM_MEMORY_VADDR]);
+void InvalidateRegion(const VAddr addr, const u32 size, const PageWatch writer) {
+    InvalidateRegion(addr, size, 1 << static_cast<int>(writer));
+}
 
+template <typename T>
+static void ReadSpecial(T &var, const VAddr vaddr) {
     // Config memory
-    } else if ((vaddr >= CONFIG_MEMORY_VADDR)  && (vaddr < CONFIG_MEMORY_VADDR_END)) {
+    if ((vaddr >= CONFIG_MEMORY_VADDR)  && (vaddr < CONFIG_MEMORY_VADDR_END)) {
         ConfigMem::Read<T>(var, vaddr);
 
     // Shared page
     } else if ((vaddr >= SHARED_PAGE_VADDR)  && (vaddr < SHARED_PAGE_VADDR_END)) {
         SharedPage::Read<T>(var, vaddr);
 
-    // DSP memory
-    } else if ((vaddr >= DSP_MEMORY_VADDR)  && (vaddr < DSP_MEMORY_VADDR_END)) {
-        var = *((const T*)&g_dsp_mem[vaddr - DSP_MEMORY_VADDR]);
-
-    // VRAM
-    } else if ((vaddr >= VRAM_VADDR)  && (vaddr < VRAM_VADDR_END)) {
-        var = *((const T*)&g_vram[vaddr - VRAM_VADDR]);
+    // Hardware registers
+    } else if ((vaddr >= HARDWARE_IO_VADDR)  && (vaddr < HARDWARE_IO_VADDR_END)) {
+        HW::Read<T>(var, vaddr);
 
     } else {
         LOG_ERROR(HW_Memory, "unknown Read%lu @ 0x%08X", sizeof(var) * 8, vaddr);
@@ -101,86 +192,79 @@ inline void Read(T &var, const VAddr vaddr) {
 }
 
 template <typename T>
-inline void Write(const VAddr vaddr, const T data) {
-
-    // Kernel memory command buffer
-    if (vaddr >= KERNEL_MEMORY_VADDR && vaddr < KERNEL_MEMORY_VADDR_END) {
-        *(T*)&g_kernel_mem[vaddr - KERNEL_MEMORY_VADDR] = data;
-
-    // ExeFS:/.code is loaded here
-    } else if ((vaddr >= EXEFS_CODE_VADDR)  && (vaddr < EXEFS_CODE_VADDR_END)) {
-        *(T*)&g_exefs_code[vaddr - EXEFS_CODE_VADDR] = data;
-
-    // FCRAM - linear heap
-    } else if ((vaddr >= HEAP_LINEAR_VADDR)  && (vaddr < HEAP_LINEAR_VADDR_END)) {
-        *(T*)&g_heap_linear[vaddr - HEAP_LINEAR_VADDR] = data;
-
-    // FCRAM - application heap
-    } else if ((vaddr >= HEAP_VADDR)  && (vaddr < HEAP_VADDR_END)) {
-        *(T*)&g_heap[vaddr - HEAP_VADDR] = data;
-
-    // Shared memory
-    } else if ((vaddr >= SHARED_MEMORY_VADDR)  && (vaddr < SHARED_MEMORY_VADDR_END)) {
-        *(T*)&g_shared_mem[vaddr - SHARED_MEMORY_VADDR] = data;
-
-    // System memory
-    } else if ((vaddr >= SYSTEM_MEMORY_VADDR)  && (vaddr < SYSTEM_MEMORY_VADDR_END)) {
-        *(T*)&g_system_mem[vaddr - SYSTEM_MEMORY_VADDR] = data;
-
-    // VRAM
-    } else if ((vaddr >= VRAM_VADDR)  && (vaddr < VRAM_VADDR_END)) {
-        *(T*)&g_vram[vaddr - VRAM_VADDR] = data;
-
-    // DSP memory
-    } else if ((vaddr >= DSP_MEMORY_VADDR)  && (vaddr < DSP_MEMORY_VADDR_END)) {
-        *(T*)&g_dsp_mem[vaddr - DSP_MEMORY_VADDR] = data;
+static void WriteSpecial(const VAddr vaddr, const T data) {
+    // Hardware registers
+    if ((vaddr >= HARDWARE_IO_VADDR)  && (vaddr < HARDWARE_IO_VADDR_END)) {
+        HW::Write<T>(vaddr, data);
 
     //} else if ((vaddr & 0xFFFF0000) == 0x1FF80000) {
     //    _assert_msg_(MEMMAP, false, "umimplemented write to Configuration Memory");
     //} else if ((vaddr & 0xFFFFF000) == 0x1FF81000) {
     //    _assert_msg_(MEMMAP, false, "umimplemented write to shared page");
 
-    // Error out...
     } else {
         LOG_ERROR(HW_Memory, "unknown Write%lu 0x%08X @ 0x%08X", sizeof(data) * 8, (u32)data, vaddr);
     }
 }
 
-u8 *GetPointer(const VAddr vaddr) {
-    // Kernel memory command buffer
-    if (vaddr >= KERNEL_MEMORY_VADDR && vaddr < KERNEL_MEMORY_VADDR_END) {
-        return g_kernel_mem + (vaddr - KERNEL_MEMORY_VADDR);
-
-    // ExeFS:/.code is loaded here
-    } else if ((vaddr >= EXEFS_CODE_VADDR)  && (vaddr < EXEFS_CODE_VADDR_END)) {
-        return g_exefs_code + (vaddr - EXEFS_CODE_VADDR);
+template <typename T>
+inline void Read(T &var, const VAddr vaddr) {
+    const u8* page_pointer = page_table.pointers[vaddr >> PAGE_BITS];
+    if (page_pointer) {
+        var = *reinterpret_cast<const T*>(page_pointer + (vaddr & PAGE_MASK));
+        return;
+    }
 
-    // FCRAM - linear heap
-    } else if ((vaddr >= HEAP_LINEAR_VADDR)  && (vaddr < HEAP_LINEAR_VADDR_END)) {
-        return g_heap_linear + (vaddr - HEAP_LINEAR_VADDR);
+    switch (page_table.attributes[vaddr >> PAGE_BITS]) {
+    case PageType::Special:
+        ReadSpecial<T>(var, vaddr);
+        break;
 
-    // FCRAM - application heap
-    } else if ((vaddr >= HEAP_VADDR)  && (vaddr < HEAP_VADDR_END)) {
-        return g_heap + (vaddr - HEAP_VADDR);
+    default:
+        LOG_ERROR(HW_Memory, "unmapped Read%lu @ 0x%08X", sizeof(var) * 8, vaddr);
+        break;
+    }
+}
 
-    // Shared memory
-    } else if ((vaddr >= SHARED_MEMORY_VADDR)  && (vaddr < SHARED_MEMORY_VADDR_END)) {
-        return g_shared_mem + (vaddr - SHARED_MEMORY_VADDR);
+template <typename T>
+inline void Write(const VAddr vaddr, const T data) {
+    u8* page_pointer = page_table.pointers[vaddr >> PAGE_BITS];
+    if (page_pointer) {
+        if (page_table.watches[vaddr >> PAGE_BITS])
+            OnWatchedPageWrite(vaddr);
 
-    // System memory
-    } else if ((vaddr >= SYSTEM_MEMORY_VADDR)  && (vaddr < SYSTEM_MEMORY_VADDR_END)) {
-        return g_system_mem + (vaddr - SYSTEM_MEMORY_VADDR);
+        *reinterpret_cast<T*>(page_pointer + (vaddr & PAGE_MASK)) = data;
+        return;
+    }
 
-    // VRAM
-    } else if ((vaddr >= VRAM_VADDR)  && (vaddr < VRAM_VADDR_END)) {
-        return g_vram + (vaddr - VRAM_VADDR);
+    switch (page_table.attributes[vaddr >> PAGE_BITS]) {
+    case PageType::Special:
+        WriteSpecial<T>(vaddr, data);
+        break;
 
-    } else {
-        LOG_ERROR(HW_Memory, "unknown GetPointer @ 0x%08x", vaddr);
-        return 0;
+    default:
+        LOG_ERROR(HW_Memory, "unmapped Write%lu 0x%08X @ 0x%08X", sizeof(data) * 8, (u32)data, vaddr);
+        break;
     }
 }
 
+u8 *GetPointer(const VAddr vaddr) {
+    u8* page_pointer = page_table.pointers[vaddr >> PAGE_BITS];
+    if (page_pointer)
+        return page_pointer + (vaddr & PAGE_MASK);
+
+    LOG_ERROR(HW_Memory, "unknown GetPointer @ 0x%08x", vaddr);
+    return nullptr;
+}
+
+u8* const* GetPageTablePointers() {
+    return page_table.pointers.data();
+}
+
+const std::atomic<u8>* GetPageWatches() {
+    return page_table.watches.data();
+}
+
 /**
  * Maps a block of memory on the heap
  * @param size Size of block in bytes
@@ -31,6 +31,15 @@ struct Values {
     // Core
     int gpu_refresh_rate;
     int frame_skip;
+    int translation_cache_size;
+    bool use_cpu_jit;
+    bool skip_idle_loops;
+    int vertex_cache_size;
+    int vertex_cache_policy;
+    int gpu_worker_threads;
+    bool use_gpu_thread;
+    bool use_shader_jit;
+    bool use_simd_rasterizer;
 
     // Data Storage
     bool use_virtual_sd;
@@ -37,10 +37,11 @@ void RunLoopUntil(u64 global_cycles) {
 }
 
 void Shutdown() {
+    // The GPU thread executes video core code, so it has to be stopped first
+    HW::Shutdown();
     VideoCore::Shutdown();
     HLE::Shutdown();
     Kernel::Shutdown();
-    HW::Shutdown();
     Memory::Shutdown();
     CoreTiming::Shutdown();
     Core::Shutdown();
@@ -73,24 +73,29 @@ private:
     float24 pos;
 };
 
-static void InitScreenCoordinates(OutputVertex& vtx)
-{
-    struct {
-        float24 halfsize_x;
-        float24 offset_x;
-        float24 halfsize_y;
-        float24 offset_y;
-        float24 zscale;
-        float24 offset_z;
-    } viewport;
+struct Viewport {
+    float24 halfsize_x;
+    float24 offset_x;
+    float24 halfsize_y;
+    float24 offset_y;
+    float24 zscale;
+    float24 offset_z;
+};
 
+static Viewport GetViewport()
+{
+    Viewport viewport;
     viewport.halfsize_x = float24::FromRawFloat24(registers.viewport_size_x);
     viewport.halfsize_y = float24::FromRawFloat24(registers.viewport_size_y);
     viewport.offset_x   = float24::FromFloat32(static_cast<float>(registers.viewport_corner.x));
     viewport.offset_y   = float24::FromFloat32(static_cast<float>(registers.viewport_corner.y));
     viewport.zscale     = float24::FromRawFloat24(registers.viewport_depth_range);
     viewport.offset_z   = float24::FromRawFloat24(registers.viewport_depth_far_plane);
+    return viewport;
+}
 
+static void InitScreenCoordinates(const Viewport& viewport, OutputVertex& vtx)
+{
     float24 inv_w = float24::FromFloat32(1.f) / vtx.pos.w;
     vtx.color *= inv_w;
     vtx.tc0 *= inv_w;
@@ -104,7 +109,7 @@ static void InitScreenCoordinates(OutputVertex& vtx)
     vtx.screenpos[2] = viewport.offset_z - vtx.pos.z * inv_w * viewport.zscale;
 }
 
-void ProcessTriangle(OutputVertex &v0, OutputVertex &v1, OutputVertex &v2) {
+void ProcessTriangle(const Rasterizer::DrawState& state, OutputVertex &v0, OutputVertex &v1, OutputVertex &v2) {
     using boost::container::static_vector;
 
     // Clipping a planar n-gon against a plane will remove at least 1 vertex and introduces 2 at
@@ -150,15 +155,16 @@ void ProcessTriangle(OutputVertex &v0, OutputVertex &v1, OutputVertex &v2) {
             return;
     }
 
-    InitScreenCoordinates((*output_list)[0]);
-    InitScreenCoordinates((*output_list)[1]);
+    const Viewport viewport = GetViewport();
+    InitScreenCoordinates(viewport, (*output_list)[0]);
+    InitScreenCoordinates(viewport, (*output_list)[1]);
 
     for (size_t i = 0; i < output_list->size() - 2; i ++) {
         OutputVertex& vtx0 = (*output_list)[0];
         OutputVertex& vtx1 = (*output_list)[i+1];
         OutputVertex& vtx2 = (*output_list)[i+2];
 
-        InitScreenCoordinates(vtx2);
+        InitScreenCoordinates(viewport, vtx2);
 
         LOG_TRACE(Render_Software,
                   "Triangle %lu/%lu at position (%.3f, %.3f, %.3f, %.3f), "
@@ -172,7 +178,7 @@ void ProcessTriangle(OutputVertex &v0, OutputVertex &v1, OutputVertex &v2) {
                   vtx1.screenpos.x.ToFloat32(), vtx1.screenpos.y.ToFloat32(), vtx1.screenpos.z.ToFloat32(),
                   vtx2.screenpos.x.ToFloat32(), vtx2.screenpos.y.ToFloat32(), vtx2.screenpos.z.ToFloat32());
 
-        Rasterizer::ProcessTriangle(vtx0, vtx1, vtx2);
+        Rasterizer::ProcessTriangle(state, vtx0, vtx1, vtx2);
     }
 }
 
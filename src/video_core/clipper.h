@@ -10,11 +10,16 @@ namespace VertexShader {
     struct OutputVertex;
 }
 
+namespace Rasterizer {
+    struct DrawState;
+}
+
 namespace Clipper {
 
 using VertexShader::OutputVertex;
 
-void ProcessTriangle(OutputVertex& v0, OutputVertex& v1, OutputVertex& v2);
+/// Clips the triangle against the view volume and rasterizes the resulting triangles
+void ProcessTriangle(const Rasterizer::DrawState& state, OutputVertex& v0, OutputVertex& v1, OutputVertex& v2);
 
 } // namespace
 
@@ -2,16 +2,29 @@
 // Licensed under GPLv2 or any later version
 // Refer to the license.txt file included.
 
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "common/make_unique.h"
+#include "common/thread_pool.h"
+
 #include "clipper.h"
 #include "command_processor.h"
 #include "math.h"
 #include "pica.h"
 #include "primitive_assembly.h"
+#include "rasterizer.h"
+#include "vertex_cache.h"
 #include "vertex_shader.h"
 #include "core/hle/service/gsp_gpu.h"
 #include "core/hw/gpu.h"
+#include "core/settings.h"
 
 #include "debug_utils/debug_utils.h"
+#include "debug_utils/pica_capture.h"
 
 namespace Pica {
 
@@ -27,6 +40,124 @@ static u32 uniform_write_buffer[4];
 static u32 vs_binary_write_offset = 0;
 static u32 vs_swizzle_write_offset = 0;
 
+// Maps vertex indices of indexed draws to the slot of their already processed vertex, reset at the
+// start of each draw
+static VertexCache<u32> vertex_cache;
+
+// Vertex cache statistics accumulated over all indexed draws
+static VertexCacheStats vertex_cache_stats;
+
+// Number of vertices loaded and shaded by a single worker thread task
+static const unsigned VERTEX_BATCH_SIZE = 64;
+
+// Worker threads used to load and shade vertices, created on the first draw
+static std::unique_ptr<Common::ThreadPool> vertex_thread_pool;
+static int vertex_thread_pool_setting = -1;
+
+// Unique vertices of the current draw, in order of their first use. Reused between draws to avoid
+// reallocating them.
+static std::vector<u32> draw_vertex_ids;
+static std::vector<u32> draw_vertex_slots;
+static std::vector<VertexShader::OutputVertex> draw_outputs;
+static std::vector<DebugUtils::GeometryDumper::Vertex> draw_dumped_vertices;
+
+/// Attribute sources of the current draw, shared read-only by all vertex loading threads
+struct AttributeSetup {
+    u32 base_address;
+    int num_attributes;
+
+    u32 sources[16];
+    u32 strides[16];
+    u32 formats[16];
+    u32 elements[16];
+    u32 element_sizes[16];
+};
+
+/**
+ * Loads the input attributes of a vertex from memory and runs the vertex shader on them.
+ * @param setup Attribute sources of the current draw
+ * @param vertex Index of the vertex in the attribute arrays
+ * @param output Shaded vertex
+ * @param dumped_vertex Untransformed position of the vertex for the geometry dumper
+ */
+static void ProcessVertex(const AttributeSetup& setup, u32 vertex, VertexShader::OutputVertex& output,
+                          DebugUtils::GeometryDumper::Vertex& dumped_vertex) {
+    // Initialize data for the current vertex
+    VertexShader::InputVertex input;
+
+    // Load a debugging token to check whether this gets loaded by the running
+    // application or not.
+    static const float24 debug_token = float24::FromRawFloat24(0x00abcdef);
+    input.attr[0].w = debug_token;
+
+    for (int i = 0; i < setup.num_attributes; ++i) {
+        for (unsigned int comp = 0; comp < setup.elements[i]; ++comp) {
+            const u8* srcdata = Memory::GetPointer(PAddrToVAddr(setup.sources[i] + setup.strides[i] * vertex + comp * setup.element_sizes[i]));
+
+            // TODO(neobrain): Ocarina of Time 3D has GetNumTotalAttributes return 8,
+            // yet only provides 2 valid source data addresses. Need to figure out
+            // what's wrong there, until then we just continue when address lookup fails
+            if (srcdata == nullptr)
+                continue;
+
+            const float srcval = (setup.formats[i] == 0) ? *(s8*)srcdata :
+                                 (setup.formats[i] == 1) ? *(u8*)srcdata :
+                                 (setup.formats[i] == 2) ? *(s16*)srcdata :
+                                                           *(float*)srcdata;
+            input.attr[i][comp] = float24::FromFloat32(srcval);
+            LOG_TRACE(HW_GPU, "Loaded component %x of attribute %x for vertex %x from 0x%08x + 0x%08lx + 0x%04lx: %f",
+                      comp, i, vertex,
+                      setup.base_address,
+                      setup.sources[i] - setup.base_address,
+                      setup.strides[i] * vertex + comp * setup.element_sizes[i],
+                      input.attr[i][comp].ToFloat32());
+        }
+    }
+
+    // HACK: Some games do not initialize the vertex position's w component. This leads
+    //       to critical issues since it messes up perspective division. As a
+    //       workaround, we force the fourth component to 1.0 if we find this to be the
+    //       case.
+    //       To do this, we additionally have to assume that the first input attribute
+    //       is the vertex position, since there's no information about this other than
+    //       the empiric observation that this is usually the case.
+    if (input.attr[0].w == debug_token)
+        input.attr[0].w = float24::FromFloat32(1.0);
+
+    if (g_debug_context)
+        g_debug_context->OnEvent(DebugContext::Event::VertexLoaded, (void*)&input);
+
+    // NOTE: When dumping geometry, we simply assume that the first input attribute
+    //       corresponds to the position for now.
+    dumped_vertex = {
+        input.attr[0][0].ToFloat32(), input.attr[0][1].ToFloat32(), input.attr[0][2].ToFloat32()
+    };
+
+    // Send to vertex shader
+    output = VertexShader::RunShader(input, setup.num_attributes);
+}
+
+/// Returns the worker pool for vertex processing, or nullptr if vertices are processed serially
+static Common::ThreadPool* GetVertexThreadPool() {
+    const int num_threads = Settings::values.gpu_worker_threads;
+    if (num_threads != vertex_thread_pool_setting) {
+        vertex_thread_pool.reset();
+        vertex_thread_pool_setting = num_threads;
+
+        const unsigned pool_size = (num_threads > 0) ? num_threads : Common::ThreadPool::HardwareConcurrency();
+        if (pool_size > 1)
+            vertex_thread_pool = Common::make_unique<Common::ThreadPool>(pool_size);
+    }
+    return vertex_thread_pool.get();
+}
+
+/// Returns true if the register is used for drawing triangles rather than for processing vertices
+static bool IsRasterizerRegister(u32 id) {
+    // Texturing, texture environment, output merger and framebuffer configuration
+    return id >= PICA_REG_INDEX(texture0) - 1 &&
+           id < PICA_REG_INDEX(framebuffer) + sizeof(Regs::framebuffer) / sizeof(u32);
+}
+
 static inline void WritePicaReg(u32 id, u32 value, u32 mask) {
 
     if (id >= registers.NumIds())
@@ -36,6 +167,10 @@ static inline void WritePicaReg(u32 id, u32 value, u32 mask) {
     if (GPU::g_skip_frame && id != PICA_REG_INDEX(trigger_irq))
         return;
 
+    // Queued triangles need to be drawn with the state they were submitted with
+    if (IsRasterizerRegister(id) && ((registers[id] ^ value) & mask))
+        Rasterizer::Flush();
+
     // TODO: Figure out how register masking acts on e.g. vs_uniform_setup.set_value
     u32 old_value = registers[id];
     registers[id] = (old_value & ~mask) | (value & mask);
@@ -44,10 +179,12 @@ static inline void WritePicaReg(u32 id, u32 value, u32 mask) {
         g_debug_context->OnEvent(DebugContext::Event::CommandLoaded, reinterpret_cast<void*>(&id));
 
     DebugUtils::OnPicaRegWrite(id, registers[id]);
+    DebugUtils::CapturePicaRegWrite(id, value, mask);
 
     switch(id) {
         // Trigger IRQ
         case PICA_REG_INDEX(trigger_irq):
+            Rasterizer::Flush();
             GSP_GPU::SignalInterrupt(GSP_GPU::InterruptId::P3D);
             return;
 
@@ -61,30 +198,27 @@ static inline void WritePicaReg(u32 id, u32 value, u32 mask) {
                 g_debug_context->OnEvent(DebugContext::Event::IncomingPrimitiveBatch, nullptr);
 
             const auto& attribute_config = registers.vertex_attributes;
-            const u32 base_address = attribute_config.GetPhysicalBaseAddress();
 
             // Information about internal vertex attributes
-            u32 vertex_attribute_sources[16];
-            std::fill(vertex_attribute_sources, &vertex_attribute_sources[16], 0xdeadbeef);
-            u32 vertex_attribute_strides[16];
-            u32 vertex_attribute_formats[16];
-            u32 vertex_attribute_elements[16];
-            u32 vertex_attribute_element_size[16];
+            AttributeSetup setup;
+            setup.base_address = attribute_config.GetPhysicalBaseAddress();
+            setup.num_attributes = attribute_config.GetNumTotalAttributes();
+            std::fill(setup.sources, &setup.sources[16], 0xdeadbeef);
 
             // Setup attribute data from loaders
             for (int loader = 0; loader < 12; ++loader) {
                 const auto& loader_config = attribute_config.attribute_loaders[loader];
 
-                u32 load_address = base_address + loader_config.data_offset;
+                u32 load_address = setup.base_address + loader_config.data_offset;
 
                 // TODO: What happens if a loader overwrites a previous one's data?
                 for (unsigned component = 0; component < loader_config.component_count; ++component) {
                     u32 attribute_index = loader_config.GetComponent(component);
-                    vertex_attribute_sources[attribute_index] = load_address;
-                    vertex_attribute_strides[attribute_index] = static_cast<u32>(loader_config.byte_count);
-                    vertex_attribute_formats[attribute_index] = static_cast<u32>(attribute_config.GetFormat(attribute_index));
-                    vertex_attribute_elements[attribute_index] = attribute_config.GetNumElements(attribute_index);
-                    vertex_attribute_element_size[attribute_index] = attribute_config.GetElementSizeInBytes(attribute_index);
+                    setup.sources[attribute_index] = load_address;
+                    setup.strides[attribute_index] = static_cast<u32>(loader_config.byte_count);
+                    setup.formats[attribute_index] = static_cast<u32>(attribute_config.GetFormat(attribute_index));
+                    setup.elements[attribute_index] = attribute_config.GetNumElements(attribute_index);
+                    setup.element_sizes[attribute_index] = attribute_config.GetElementSizeInBytes(attribute_index);
                     load_address += attribute_config.GetStride(attribute_index);
                 }
             }
@@ -93,89 +227,108 @@ static inline void WritePicaReg(u32 id, u32 value, u32 mask) {
             bool is_indexed = (id == PICA_REG_INDEX(trigger_draw_indexed));
 
             const auto& index_info = registers.index_array;
-            const u8* index_address_8 = Memory::GetPointer(PAddrToVAddr(base_address + index_info.offset));
+            const u8* index_address_8 = Memory::GetPointer(PAddrToVAddr(setup.base_address + index_info.offset));
             const u16* index_address_16 = (u16*)index_address_8;
             bool index_u16 = index_info.format != 0;
 
-            DebugUtils::GeometryDumper geometry_dumper;
-            PrimitiveAssembler<VertexShader::OutputVertex> clipper_primitive_assembler(registers.triangle_topology.Value());
-            PrimitiveAssembler<DebugUtils::GeometryDumper::Vertex> dumping_primitive_assembler(registers.triangle_topology.Value());
+            // The debugger expects a VertexLoaded event for every single vertex, so don't skip any
+            // while it's attached
+            const bool use_vertex_cache = is_indexed && !g_debug_context;
+            if (use_vertex_cache) {
+                vertex_cache.Reset(std::max(Settings::values.vertex_cache_size, 0),
+                                   static_cast<VertexCache<u32>::Policy>(Settings::values.vertex_cache_policy));
+            }
 
-            for (unsigned int index = 0; index < registers.num_vertices; ++index)
-            {
+            // Assign each index to the slot of a unique vertex, so that vertices shared through
+            // the vertex cache are only loaded and shaded once
+            const unsigned num_vertices = registers.num_vertices;
+            draw_vertex_ids.clear();
+            draw_vertex_slots.resize(num_vertices);
+            for (unsigned int index = 0; index < num_vertices; ++index) {
                 unsigned int vertex = is_indexed ? (index_u16 ? index_address_16[index] : index_address_8[index]) : index;
 
-                if (is_indexed) {
-                    // TODO: Implement some sort of vertex cache!
+                const u32* cached_slot = use_vertex_cache ? vertex_cache.Lookup(vertex) : nullptr;
+                if (cached_slot != nullptr) {
+                    draw_vertex_slots[index] = *cached_slot;
+                    continue;
+                }
+
+                const u32 slot = static_cast<u32>(draw_vertex_ids.size());
+                draw_vertex_ids.push_back(vertex);
+                draw_vertex_slots[index] = slot;
+                if (use_vertex_cache)
+                    vertex_cache.Insert(vertex, slot);
+            }
+
+            VertexShader::Setup();
+
+            const unsigned num_unique_vertices = static_cast<unsigned>(draw_vertex_ids.size());
+            draw_outputs.resize(num_unique_vertices);
+            draw_dumped_vertices.resize(num_unique_vertices);
+
+            // Split vertex processing into batches for the worker threads. Debug events have to be
+            // raised on the thread executing GPU commands, so the debugger forces serial processing.
+            Common::ThreadPool* thread_pool = g_debug_context ? nullptr : GetVertexThreadPool();
+            std::vector<std::future<void>> batches;
+            if (thread_pool != nullptr && num_unique_vertices > VERTEX_BATCH_SIZE) {
+                for (unsigned first = 0; first < num_unique_vertices; first += VERTEX_BATCH_SIZE) {
+                    const unsigned last = std::min(first + VERTEX_BATCH_SIZE, num_unique_vertices);
+                    batches.push_back(thread_pool->Push([&setup, first, last] {
+                        for (unsigned slot = first; slot < last; ++slot)
+                            ProcessVertex(setup, draw_vertex_ids[slot], draw_outputs[slot], draw_dumped_vertices[slot]);
+                    }));
                 }
+            }
+
+            // Register state doesn't change during the draw, so resolve what the rasterizer needs once
+            const Rasterizer::DrawState draw_state = Rasterizer::GetDrawState();
+
+            DebugUtils::GeometryDumper geometry_dumper;
+            PrimitiveAssembler<VertexShader::OutputVertex> clipper_primitive_assembler(registers.triangle_topology.Value());
+            PrimitiveAssembler<DebugUtils::GeometryDumper::Vertex> dumping_primitive_assembler(registers.triangle_topology.Value());
 
-                // Initialize data for the current vertex
-                VertexShader::InputVertex input;
-
-                // Load a debugging token to check whether this gets loaded by the running
-                // application or not.
-                static const float24 debug_token = float24::FromRawFloat24(0x00abcdef);
-                input.attr[0].w = debug_token;
-
-                for (int i = 0; i < attribute_config.GetNumTotalAttributes(); ++i) {
-                    for (unsigned int comp = 0; comp < vertex_attribute_elements[i]; ++comp) {
-                        const u8* srcdata = Memory::GetPointer(PAddrToVAddr(vertex_attribute_sources[i] + vertex_attribute_strides[i] * vertex + comp * vertex_attribute_element_size[i]));
-
-                        // TODO(neobrain): Ocarina of Time 3D has GetNumTotalAttributes return 8,
-                        // yet only provides 2 valid source data addresses. Need to figure out
-                        // what's wrong there, until then we just continue when address lookup fails
-                        if (srcdata == nullptr)
-                            continue;
-
-                        const float srcval = (vertex_attribute_formats[i] == 0) ? *(s8*)srcdata :
-                                             (vertex_attribute_formats[i] == 1) ? *(u8*)srcdata :
-                                             (vertex_attribute_formats[i] == 2) ? *(s16*)srcdata :
-                                                                                  *(float*)srcdata;
-                        input.attr[i][comp] = float24::FromFloat32(srcval);
-                        LOG_TRACE(HW_GPU, "Loaded component %x of attribute %x for vertex %x (index %x) from 0x%08x + 0x%08lx + 0x%04lx: %f",
-                                  comp, i, vertex, index,
-                                  attribute_config.GetPhysicalBaseAddress(),
-                                  vertex_attribute_sources[i] - base_address,
-                                  vertex_attribute_strides[i] * vertex + comp * vertex_attribute_element_size[i],
-                                  input.attr[i][comp].ToFloat32());
+            // Assemble primitives in index order. Slots are numbered by first use, so each index
+            // refers either to an already processed vertex or to the next one.
+            unsigned num_processed_vertices = 0;
+            for (unsigned int index = 0; index < num_vertices; ++index) {
+                const u32 slot = draw_vertex_slots[index];
+
+                if (slot == num_processed_vertices) {
+                    if (batches.empty()) {
+                        ProcessVertex(setup, draw_vertex_ids[slot], draw_outputs[slot], draw_dumped_vertices[slot]);
+                        ++num_processed_vertices;
+                    } else {
+                        // Wait for the batch containing the vertex, which also covers the
+                        // vertices following it
+                        const unsigned batch = slot / VERTEX_BATCH_SIZE;
+                        batches[batch].get();
+                        num_processed_vertices = std::min((batch + 1) * VERTEX_BATCH_SIZE, num_unique_vertices);
                     }
                 }
 
-                // HACK: Some games do not initialize the vertex position's w component. This leads
-                //       to critical issues since it messes up perspective division. As a
-                //       workaround, we force the fourth component to 1.0 if we find this to be the
-                //       case.
-                //       To do this, we additionally have to assume that the first input attribute
-                //       is the vertex position, since there's no information about this other than
-                //       the empiric observation that this is usually the case.
-                if (input.attr[0].w == debug_token)
-                    input.attr[0].w = float24::FromFloat32(1.0);
-
-                if (g_debug_context)
-                    g_debug_context->OnEvent(DebugContext::Event::VertexLoaded, (void*)&input);
-
-                // NOTE: When dumping geometry, we simply assume that the first input attribute
-                //       corresponds to the position for now.
-                DebugUtils::GeometryDumper::Vertex dumped_vertex = {
-                    input.attr[0][0].ToFloat32(), input.attr[0][1].ToFloat32(), input.attr[0][2].ToFloat32()
-                };
                 using namespace std::placeholders;
+                DebugUtils::GeometryDumper::Vertex dumped_vertex = draw_dumped_vertices[slot];
                 dumping_primitive_assembler.SubmitVertex(dumped_vertex,
                                                          std::bind(&DebugUtils::GeometryDumper::AddTriangle,
                                                                    &geometry_dumper, _1, _2, _3));
 
-                // Send to vertex shader
-                VertexShader::OutputVertex output = VertexShader::RunShader(input, attribute_config.GetNumTotalAttributes());
-
-                if (is_indexed) {
-                    // TODO: Add processed vertex to vertex cache!
-                }
-
                 // Send to triangle clipper
-                clipper_primitive_assembler.SubmitVertex(output, Clipper::ProcessTriangle);
+                VertexShader::OutputVertex output = draw_outputs[slot];
+                clipper_primitive_assembler.SubmitVertex(output,
+                                                         std::bind(&Clipper::ProcessTriangle,
+                                                                   std::cref(draw_state), _1, _2, _3));
             }
             geometry_dumper.Dump();
 
+            if (use_vertex_cache) {
+                const VertexCacheStats& stats = vertex_cache.GetStats();
+                vertex_cache_stats.hits += stats.hits;
+                vertex_cache_stats.misses += stats.misses;
+                LOG_TRACE(HW_GPU, "Vertex cache: %llu hits, %llu misses for %u indices",
+                          (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+                          num_vertices);
+            }
+
             if (g_debug_context)
                 g_debug_context->OnEvent(DebugContext::Event::FinishedPrimitiveBatch, nullptr);
 
@@ -326,6 +479,15 @@ static std::ptrdiff_t ExecuteCommandBlock(const u32* first_command_word) {
     return read_pointer - first_command_word;
 }
 
+void Shutdown() {
+    vertex_thread_pool.reset();
+    vertex_thread_pool_setting = -1;
+}
+
+const VertexCacheStats& GetVertexCacheStats() {
+    return vertex_cache_stats;
+}
+
 void ProcessCommandList(const u32* list, u32 size) {
     u32* read_pointer = (u32*)list;
     u32 list_length = size / sizeof(u32);
@@ -333,6 +495,10 @@ void ProcessCommandList(const u32* list, u32 size) {
     while (read_pointer < list + list_length) {
         read_pointer += ExecuteCommandBlock(read_pointer);
     }
+
+    // Command lists are the only way to submit triangles, so anything accessing the framebuffer
+    // afterwards sees the final result
+    Rasterizer::Flush();
 }
 
 } // namespace
@@ -8,6 +8,7 @@
 #include "common/common_types.h"
 
 #include "pica.h"
+#include "vertex_cache.h"
 
 namespace Pica {
 
@@ -37,6 +38,12 @@ static_assert(sizeof(CommandHeader) == sizeof(u32), "CommandHeader has incorrect
 
 void ProcessCommandList(const u32* list, u32 size);
 
+/// Stops the worker threads used for vertex processing
+void Shutdown();
+
+/// Returns the post-transform vertex cache hit/miss counters accumulated over all indexed draws
+const VertexCacheStats& GetVertexCacheStats();
+
 } // namespace
 
 } // namespace
@@ -0,0 +1,299 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common/file_util.h"
+#include "common/hash.h"
+#include "common/log.h"
+
+#include "core/mem_map.h"
+
+#include "video_core/pica.h"
+#include "video_core/texture_cache.h"
+#include "video_core/vertex_shader.h"
+
+#include "pica_capture.h"
+
+namespace Pica {
+
+namespace DebugUtils {
+
+static_assert(sizeof(Regs) == sizeof(PicaCapture::InitialState::registers), "Capture register state has invalid size");
+
+// Captures are only written from the thread executing GPU commands, and frames are only ended
+// while no commands are executing, so none of this state is locked
+static FileUtil::IOFile capture_file;
+static bool is_capturing = false;
+static std::string pending_filename;
+static int remaining_frames = 0;
+
+// Hash of the memory contents last stored for each (address, size) range
+static std::unordered_map<u64, u64> stored_hashes;
+
+// Framebuffers whose initial contents have been stored. Framebuffers are written by the GPU
+// itself afterwards, so they are only stored on first use.
+static std::unordered_set<PAddr> stored_framebuffers;
+
+static void WritePacket(PicaCapture::PacketType type, u32 arg0, u32 arg1, u32 arg2, u32 arg3,
+                        const u8* data = nullptr, u32 size = 0) {
+    const u32 header[5] = { static_cast<u32>(type), arg0, arg1, arg2, arg3 };
+    capture_file.WriteArray(header, 5);
+    if (size != 0)
+        capture_file.WriteBytes(data, size);
+}
+
+/// Stores the given memory range unless it is unchanged since it was last stored
+static void StoreMemory(PAddr address, u32 size) {
+    if (size == 0)
+        return;
+
+    // Memory is only contiguous within a region, so check that the whole range lies in one
+    const u8* data = Memory::GetPointer(PAddrToVAddr(address));
+    const u8* last = Memory::GetPointer(PAddrToVAddr(address + size - 1));
+    if (data == nullptr || last != data + size - 1) {
+        LOG_WARNING(HW_GPU, "Not capturing invalid memory range 0x%08x-0x%08x", address, address + size);
+        return;
+    }
+
+    const u64 key = (static_cast<u64>(address) << 32) | size;
+    const u64 hash = GetMurmurHash3(data, static_cast<int>(size), 0);
+    auto it = stored_hashes.find(key);
+    if (it != stored_hashes.end() && it->second == hash)
+        return;
+
+    stored_hashes[key] = hash;
+    WritePacket(PicaCapture::PacketType::MemoryUpdate, address, size, 0, 0, data, size);
+}
+
+/// Stores the memory read by the draw about to be triggered
+static void StoreDrawMemory(bool is_indexed) {
+    const auto& attribute_config = registers.vertex_attributes;
+    const u32 base_address = attribute_config.GetPhysicalBaseAddress();
+    const u32 num_vertices = registers.num_vertices;
+    if (num_vertices == 0)
+        return;
+
+    // Only the range of vertices referenced by the draw needs to be stored
+    u32 min_vertex = 0;
+    u32 max_vertex = num_vertices - 1;
+    if (is_indexed) {
+        const auto& index_info = registers.index_array;
+        const PAddr index_address = base_address + index_info.offset;
+        const bool index_u16 = index_info.format != 0;
+        StoreMemory(index_address, num_vertices * (index_u16 ? 2 : 1));
+
+        const u8* index_address_8 = Memory::GetPointer(PAddrToVAddr(index_address));
+        const u16* index_address_16 = reinterpret_cast<const u16*>(index_address_8);
+        if (index_address_8 == nullptr)
+            return;
+
+        min_vertex = ~0u;
+        max_vertex = 0;
+        for (unsigned index = 0; index < num_vertices; ++index) {
+            const u32 vertex = index_u16 ? index_address_16[index] : index_address_8[index];
+            min_vertex = std::min(min_vertex, vertex);
+            max_vertex = std::max(max_vertex, vertex);
+        }
+    }
+
+    for (int loader = 0; loader < 12; ++loader) {
+        const auto& loader_config = attribute_config.attribute_loaders[loader];
+        if (loader_config.component_count == 0)
+            continue;
+
+        u32 vertex_size = 0;
+        for (unsigned component = 0; component < loader_config.component_count; ++component)
+            vertex_size += attribute_config.GetStride(loader_config.GetComponent(component));
+
+        const u32 stride = static_cast<u32>(loader_config.byte_count);
+        StoreMemory(base_address + loader_config.data_offset + min_vertex * stride,
+                    (max_vertex - min_vertex) * stride + vertex_size);
+    }
+
+    for (const auto& texture : registers.GetTextures()) {
+        if (!texture.enabled || texture.config.address == 0)
+            continue;
+
+        StoreMemory(texture.config.GetPhysicalAddress(),
+                    TextureCache::GetEncodedSize(texture.config.width, texture.config.height, texture.format));
+    }
+
+    // Four bytes per pixel are enough for any color or depth format
+    const auto& framebuffer = registers.framebuffer;
+    const u32 framebuffer_size = framebuffer.GetWidth() * framebuffer.GetHeight() * 4;
+    for (PAddr address : { framebuffer.GetColorBufferPhysicalAddress(), framebuffer.GetDepthBufferPhysicalAddress() }) {
+        if (stored_framebuffers.insert(address).second)
+            StoreMemory(address, framebuffer_size);
+    }
+}
+
+static void WriteInitialState() {
+    PicaCapture::InitialState state;
+
+    for (unsigned i = 0; i < state.registers.size(); ++i)
+        state.registers[i] = registers[i];
+
+    state.shader_binary = VertexShader::GetShaderBinary();
+    state.swizzle_patterns = VertexShader::GetSwizzlePatterns();
+
+    for (unsigned i = 0; i < 96; ++i) {
+        for (unsigned comp = 0; comp < 4; ++comp)
+            state.float_uniforms[i * 4 + comp] = VertexShader::GetFloatUniform(i)[comp].ToFloat32();
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+        for (unsigned comp = 0; comp < 4; ++comp)
+            state.int_uniforms[i * 4 + comp] = VertexShader::GetIntUniform(i)[comp];
+    }
+    for (unsigned i = 0; i < 16; ++i)
+        state.bool_uniforms[i] = VertexShader::GetBoolUniform(i);
+
+    const PicaCapture::Header header = { PicaCapture::MAGIC, PicaCapture::VERSION };
+    capture_file.WriteArray(&header, 1);
+    capture_file.WriteArray(state.registers.data(), state.registers.size());
+    capture_file.WriteArray(state.shader_binary.data(), state.shader_binary.size());
+    capture_file.WriteArray(state.swizzle_patterns.data(), state.swizzle_patterns.size());
+    capture_file.WriteArray(state.float_uniforms.data(), state.float_uniforms.size());
+    capture_file.WriteArray(state.int_uniforms.data(), state.int_uniforms.size());
+    capture_file.WriteArray(state.bool_uniforms.data(), state.bool_uniforms.size());
+}
+
+void StartPicaCapture(const std::string& filename, int num_frames) {
+    if (IsPicaCapturing()) {
+        LOG_WARNING(HW_GPU, "StartPicaCapture called even though a capture is already running!");
+        return;
+    }
+
+    pending_filename = filename;
+    remaining_frames = std::max(num_frames, 1);
+}
+
+bool IsPicaCapturing() {
+    return is_capturing || !pending_filename.empty();
+}
+
+void FinishPicaCapture() {
+    pending_filename.clear();
+    if (!is_capturing)
+        return;
+
+    is_capturing = false;
+    stored_hashes.clear();
+    stored_framebuffers.clear();
+
+    if (!capture_file.IsGood())
+        LOG_ERROR(HW_GPU, "Failed to write PICA capture");
+    capture_file.Close();
+    LOG_INFO(HW_GPU, "Finished PICA capture");
+}
+
+void CapturePicaRegWrite(u32 id, u32 value, u32 mask) {
+    if (!is_capturing)
+        return;
+
+    // Memory is stored before the draw trigger, so that it is in place when the draw is replayed
+    if (id == PICA_REG_INDEX(trigger_draw) || id == PICA_REG_INDEX(trigger_draw_indexed))
+        StoreDrawMemory(id == PICA_REG_INDEX(trigger_draw_indexed));
+
+    WritePacket(PicaCapture::PacketType::RegisterWrite, id, value, mask, 0);
+}
+
+void CaptureMemoryFill(const GPU::Regs::MemoryFillConfig& config) {
+    if (!is_capturing)
+        return;
+
+    WritePacket(PicaCapture::PacketType::MemoryFill, config.address_start, config.address_end,
+                config.value_32bit, config.control);
+}
+
+void CaptureFrameEnd() {
+    if (is_capturing) {
+        WritePacket(PicaCapture::PacketType::FrameEnd, 0, 0, 0, 0);
+        if (--remaining_frames == 0)
+            FinishPicaCapture();
+        return;
+    }
+
+    if (pending_filename.empty())
+        return;
+
+    // Captures start at a frame boundary, so that replays cover whole frames
+    if (!capture_file.Open(pending_filename, "wb")) {
+        LOG_ERROR(HW_GPU, "Failed to open PICA capture file %s", pending_filename.c_str());
+        pending_filename.clear();
+        return;
+    }
+
+    LOG_INFO(HW_GPU, "Capturing %d frames of PICA commands to %s", remaining_frames, pending_filename.c_str());
+    pending_filename.clear();
+    is_capturing = true;
+    WriteInitialState();
+}
+
+bool LoadPicaCapture(const std::string& filename, PicaCapture& capture) {
+    FileUtil::IOFile file(filename, "rb");
+    if (!file.IsOpen()) {
+        LOG_ERROR(HW_GPU, "Failed to open PICA capture file %s", filename.c_str());
+        return false;
+    }
+
+    PicaCapture::Header header;
+    if (file.ReadArray(&header, 1) != 1 || header.magic != PicaCapture::MAGIC) {
+        LOG_ERROR(HW_GPU, "%s is not a PICA capture file", filename.c_str());
+        return false;
+    }
+    if (header.version != PicaCapture::VERSION) {
+        LOG_ERROR(HW_GPU, "Unsupported PICA capture version %u", header.version);
+        return false;
+    }
+
+    auto& state = capture.initial_state;
+    if (file.ReadArray(state.registers.data(), state.registers.size()) != state.registers.size() ||
+        file.ReadArray(state.shader_binary.data(), state.shader_binary.size()) != state.shader_binary.size() ||
+        file.ReadArray(state.swizzle_patterns.data(), state.swizzle_patterns.size()) != state.swizzle_patterns.size() ||
+        file.ReadArray(state.float_uniforms.data(), state.float_uniforms.size()) != state.float_uniforms.size() ||
+        file.ReadArray(state.int_uniforms.data(), state.int_uniforms.size()) != state.int_uniforms.size() ||
+        file.ReadArray(state.bool_uniforms.data(), state.bool_uniforms.size()) != state.bool_uniforms.size()) {
+        LOG_ERROR(HW_GPU, "PICA capture %s is truncated", filename.c_str());
+        return false;
+    }
+
+    capture.packets.clear();
+    u32 packet_header[5];
+    while (file.ReadArray(packet_header, 5) == 5) {
+        PicaCapture::Packet packet;
+        packet.type = static_cast<PicaCapture::PacketType>(packet_header[0]);
+        std::copy(&packet_header[1], &packet_header[5], packet.args);
+
+        switch (packet.type) {
+        case PicaCapture::PacketType::MemoryUpdate:
+            packet.data.resize(packet.args[1]);
+            if (file.ReadBytes(packet.data.data(), packet.data.size()) != packet.data.size()) {
+                LOG_ERROR(HW_GPU, "PICA capture %s is truncated", filename.c_str());
+                return false;
+            }
+            break;
+
+        case PicaCapture::PacketType::RegisterWrite:
+        case PicaCapture::PacketType::MemoryFill:
+        case PicaCapture::PacketType::FrameEnd:
+            break;
+
+        default:
+            LOG_ERROR(HW_GPU, "Unknown packet type %u in PICA capture %s", packet_header[0], filename.c_str());
+            return false;
+        }
+
+        capture.packets.push_back(std::move(packet));
+    }
+
+    return true;
+}
+
+} // namespace
+
+} // namespace
@@ -0,0 +1,96 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "common/common_types.h"
+
+#include "core/hw/gpu.h"
+
+namespace Pica {
+
+namespace DebugUtils {
+
+/**
+ * Capture of the PICA command stream over a range of frames, which can be replayed without
+ * emulating the CPU or the kernel.
+ *
+ * A capture file starts with a header and the GPU state at the beginning of the first frame,
+ * followed by a stream of packets. Register writes are stored as written by the command lists.
+ * Guest memory read by draws (vertex and index buffers, textures, and the initial framebuffer
+ * contents) is stored right before the draw whenever its contents changed since they were last
+ * stored. Shader binaries and uniforms are uploaded through registers, so they are covered by the
+ * register writes after the initial state. All values are stored in host byte order.
+ */
+struct PicaCapture {
+    static const u32 MAGIC = 0x50414350; // "PCAP"
+    static const u32 VERSION = 2;
+
+    struct Header {
+        u32 magic;
+        u32 version;
+    };
+
+    /// GPU state at the start of the capture
+    struct InitialState {
+        std::array<u32, 0x300> registers;
+        std::array<u32, 1024> shader_binary;
+        std::array<u32, 1024> swizzle_patterns;
+        std::array<float, 96 * 4> float_uniforms;
+        std::array<u8, 4 * 4> int_uniforms;
+        std::array<u8, 16> bool_uniforms;
+    };
+
+    enum class PacketType : u32 {
+        RegisterWrite = 0, ///< id, value, mask
+        MemoryUpdate  = 1, ///< physical address, size and the new memory contents
+        MemoryFill    = 2, ///< memory fill registers: start and end address, value, control
+        FrameEnd      = 3, ///< no payload
+    };
+
+    struct Packet {
+        PacketType type;
+        u32 args[4];
+        std::vector<u8> data; ///< Memory contents of MemoryUpdate packets
+    };
+
+    InitialState initial_state;
+    std::vector<Packet> packets;
+};
+
+/**
+ * Starts capturing the command stream to a file at the next frame boundary.
+ * @param filename File to write the capture to
+ * @param num_frames Number of frames to capture, after which the file is closed
+ */
+void StartPicaCapture(const std::string& filename, int num_frames);
+
+/// Returns true if a capture has been started and hasn't finished yet
+bool IsPicaCapturing();
+
+/// Stops capturing and closes the capture file
+void FinishPicaCapture();
+
+/// Records a register write, along with the memory read by draws triggered by it
+void CapturePicaRegWrite(u32 id, u32 value, u32 mask);
+
+/// Records a GPU memory fill
+void CaptureMemoryFill(const GPU::Regs::MemoryFillConfig& config);
+
+/// Marks the end of a frame, to be called on each VBlank
+void CaptureFrameEnd();
+
+/**
+ * Reads a capture file written by StartPicaCapture
+ * @return True on success
+ */
+bool LoadPicaCapture(const std::string& filename, PicaCapture& capture);
+
+} // namespace
+
+} // namespace
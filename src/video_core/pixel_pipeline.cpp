@@ -0,0 +1,590 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include "common/common.h"
+#include "common/hash.h"
+#include "common/make_unique.h"
+
+#include "pica.h"
+#include "pixel_pipeline.h"
+
+namespace Pica {
+
+namespace PixelPipeline {
+
+using Source = Regs::TevStageConfig::Source;
+using ColorModifier = Regs::TevStageConfig::ColorModifier;
+using AlphaModifier = Regs::TevStageConfig::AlphaModifier;
+using Operation = Regs::TevStageConfig::Operation;
+using CompareFunc = decltype(Regs::output_merger)::CompareFunc;
+using BlendParams = decltype(Regs::output_merger.alpha_blending);
+
+typedef void (*TevStageFunction)(const TevStage& stage, TevSlots& slots);
+typedef bool (*AlphaTestFunction)(u8 alpha, u8 ref);
+
+// Number of cached pipelines after which the cache starts over, so that games cycling through
+// constant colors don't use up unbounded amounts of memory
+static const size_t MAX_CACHED_PIPELINES = 4096;
+
+static std::unordered_map<u64, std::unique_ptr<Pipeline>> pipelines;
+
+// Most recently used pipeline, checked first since consecutive draws usually share their state
+static const Pipeline* current_pipeline = nullptr;
+
+/// Returns the number of inputs the given operation reads
+static inline int NumOperands(Operation op) {
+    switch (op) {
+    case Operation::Replace:
+        return 1;
+
+    case Operation::Modulate:
+    case Operation::Add:
+    case Operation::Subtract:
+        return 2;
+
+    case Operation::Lerp:
+        return 3;
+
+    default:
+        return 0;
+    }
+}
+
+template <Operation op>
+static inline u8 Combine(u8 a, u8 b, u8 c) {
+    switch (op) {
+    case Operation::Replace:
+        return a;
+
+    case Operation::Modulate:
+        return a * b / 255;
+
+    case Operation::Add:
+        return std::min(255, a + b);
+
+    case Operation::Lerp:
+        return (a * c + b * (255 - c)) / 255;
+
+    case Operation::Subtract:
+        return std::max(0, (int)a - (int)b);
+
+    default:
+        // Unsupported operations, reported when compiling the pipeline
+        return 0;
+    }
+}
+
+template <Operation color_op, Operation alpha_op>
+static void RunTevStage(const TevStage& stage, TevSlots& slots) {
+    std::memcpy(slots[SlotConstant], stage.constant, sizeof(stage.constant));
+
+    u8 color[3][3] = {};
+    for (int i = 0; i < NumOperands(color_op); ++i) {
+        const auto& input = stage.color_inputs[i];
+        const u8* value = slots[input.slot];
+        for (int component = 0; component < 3; ++component)
+            color[i][component] = value[input.components[component]] ^ input.invert;
+    }
+
+    u8 alpha[3] = {};
+    for (int i = 0; i < NumOperands(alpha_op); ++i) {
+        const auto& input = stage.alpha_inputs[i];
+        alpha[i] = slots[input.slot][input.component] ^ input.invert;
+    }
+
+    // NOTE: All inputs have been read at this point, so the alpha combiner sees the color output
+    //       of the previous stage rather than of this one.
+    u8* output = slots[SlotPrevious];
+    for (int component = 0; component < 3; ++component)
+        output[component] = Combine<color_op>(color[0][component], color[1][component], color[2][component]);
+    output[3] = Combine<alpha_op>(alpha[0], alpha[1], alpha[2]);
+}
+
+template <Operation color_op>
+static TevStageFunction GetTevStageFunction(Operation alpha_op) {
+    switch (alpha_op) {
+    case Operation::Replace:   return &RunTevStage<color_op, Operation::Replace>;
+    case Operation::Modulate:  return &RunTevStage<color_op, Operation::Modulate>;
+    case Operation::Add:       return &RunTevStage<color_op, Operation::Add>;
+    case Operation::Lerp:      return &RunTevStage<color_op, Operation::Lerp>;
+    case Operation::Subtract:  return &RunTevStage<color_op, Operation::Subtract>;
+    default:                   return &RunTevStage<color_op, Operation::AddSigned>;
+    }
+}
+
+static TevStageFunction GetTevStageFunction(Operation color_op, Operation alpha_op) {
+    switch (color_op) {
+    case Operation::Replace:   return GetTevStageFunction<Operation::Replace>(alpha_op);
+    case Operation::Modulate:  return GetTevStageFunction<Operation::Modulate>(alpha_op);
+    case Operation::Add:       return GetTevStageFunction<Operation::Add>(alpha_op);
+    case Operation::Lerp:      return GetTevStageFunction<Operation::Lerp>(alpha_op);
+    case Operation::Subtract:  return GetTevStageFunction<Operation::Subtract>(alpha_op);
+    default:                   return GetTevStageFunction<Operation::AddSigned>(alpha_op);
+    }
+}
+
+static u8 GetTevSlot(Source source) {
+    switch (source) {
+    case Source::PrimaryColor:
+        return SlotPrimaryColor;
+
+    case Source::Texture0:
+        return SlotTexture0;
+
+    case Source::Texture1:
+        return SlotTexture1;
+
+    case Source::Texture2:
+        return SlotTexture2;
+
+    case Source::Constant:
+        return SlotConstant;
+
+    case Source::Previous:
+        return SlotPrevious;
+
+    default:
+        LOG_ERROR(HW_GPU, "Unknown color combiner source %d\n", (int)source);
+        _dbg_assert_(HW_GPU, 0);
+        return SlotZero;
+    }
+}
+
+static Operation GetOperation(Operation op, const char* combiner) {
+    switch (op) {
+    case Operation::Replace:
+    case Operation::Modulate:
+    case Operation::Add:
+    case Operation::Lerp:
+    case Operation::Subtract:
+        return op;
+
+    default:
+        LOG_ERROR(HW_GPU, "Unknown %s combiner operation %d\n", combiner, (int)op);
+        _dbg_assert_(HW_GPU, 0);
+        return Operation::AddSigned;
+    }
+}
+
+static TevStage CompileTevStage(const Regs::TevStageConfig& config) {
+    TevStage stage;
+
+    const Operation color_op = GetOperation(config.color_op, "color");
+    const Operation alpha_op = GetOperation(config.alpha_op, "alpha");
+    stage.run = GetTevStageFunction(color_op, alpha_op);
+
+    stage.constant[0] = config.const_r;
+    stage.constant[1] = config.const_g;
+    stage.constant[2] = config.const_b;
+    stage.constant[3] = config.const_a;
+
+    const Source color_sources[3] = { config.color_source1, config.color_source2, config.color_source3 };
+    const ColorModifier color_modifiers[3] = { config.color_modifier1, config.color_modifier2, config.color_modifier3 };
+    for (int i = 0; i < 3; ++i) {
+        auto& input = stage.color_inputs[i];
+        input.slot = GetTevSlot(color_sources[i]);
+
+        // Modifiers select either the RGB components or a single broadcast component, and
+        // optionally invert the result
+        const u32 modifier = static_cast<u32>(color_modifiers[i]);
+        input.invert = (modifier & 1) ? 0xFF : 0;
+        switch (static_cast<ColorModifier>(modifier & ~1)) {
+        case ColorModifier::SourceColor:
+            input.components[0] = 0;
+            input.components[1] = 1;
+            input.components[2] = 2;
+            break;
+
+        case ColorModifier::SourceAlpha:
+            std::fill_n(input.components, 3, 3);
+            break;
+
+        case ColorModifier::SourceRed:
+            std::fill_n(input.components, 3, 0);
+            break;
+
+        case ColorModifier::SourceGreen:
+            std::fill_n(input.components, 3, 1);
+            break;
+
+        case ColorModifier::SourceBlue:
+            std::fill_n(input.components, 3, 2);
+            break;
+
+        default:
+            LOG_ERROR(HW_GPU, "Unknown color modifier %d\n", modifier);
+            input.slot = SlotZero;
+            input.invert = 0;
+            std::fill_n(input.components, 3, 0);
+            break;
+        }
+    }
+
+    const Source alpha_sources[3] = { config.alpha_source1, config.alpha_source2, config.alpha_source3 };
+    const AlphaModifier alpha_modifiers[3] = { config.alpha_modifier1, config.alpha_modifier2, config.alpha_modifier3 };
+    for (int i = 0; i < 3; ++i) {
+        // Alpha modifiers are numbered alpha, red, green, blue, each followed by its inversion
+        static const u8 components[4] = { 3, 0, 1, 2 };
+        const u32 modifier = static_cast<u32>(alpha_modifiers[i]);
+
+        auto& input = stage.alpha_inputs[i];
+        input.slot = GetTevSlot(alpha_sources[i]);
+        input.component = components[modifier >> 1];
+        input.invert = (modifier & 1) ? 0xFF : 0;
+    }
+
+    return stage;
+}
+
+/// Returns true if the stage passes on the output of the previous stage unmodified
+static bool IsPassThrough(const Regs::TevStageConfig& config, const TevStage& stage) {
+    const auto& color = stage.color_inputs[0];
+    const auto& alpha = stage.alpha_inputs[0];
+    return config.color_op == Operation::Replace && color.slot == SlotPrevious && color.invert == 0 &&
+           color.components[0] == 0 && color.components[1] == 1 && color.components[2] == 2 &&
+           config.alpha_op == Operation::Replace && alpha.slot == SlotPrevious && alpha.invert == 0 &&
+           alpha.component == 3;
+}
+
+static void CompileTevStages(const std::array<Regs::TevStageConfig, 6>& configs, Pipeline& pipeline) {
+    std::array<TevStage, 6> stages;
+    bool keep[6] = {};
+
+    // Walk the stages backwards, keeping track of which components of the previous stage's output
+    // are read by later stages. Stages which don't contribute to the final color are dropped.
+    bool needs_color = true;
+    bool needs_alpha = true;
+    for (int i = 5; i >= 0; --i) {
+        stages[i] = CompileTevStage(configs[i]);
+        if (!needs_color && !needs_alpha)
+            continue;
+
+        if (IsPassThrough(configs[i], stages[i]))
+            continue;
+
+        keep[i] = true;
+        needs_color = false;
+        needs_alpha = false;
+
+        const TevStage& stage = stages[i];
+        for (int input = 0; input < NumOperands(configs[i].color_op); ++input) {
+            if (stage.color_inputs[input].slot != SlotPrevious)
+                continue;
+            for (u8 component : stage.color_inputs[input].components) {
+                needs_color |= (component < 3);
+                needs_alpha |= (component == 3);
+            }
+        }
+        for (int input = 0; input < NumOperands(configs[i].alpha_op); ++input) {
+            if (stage.alpha_inputs[input].slot != SlotPrevious)
+                continue;
+            needs_color |= (stage.alpha_inputs[input].component < 3);
+            needs_alpha |= (stage.alpha_inputs[input].component == 3);
+        }
+    }
+
+    pipeline.num_stages = 0;
+    std::fill_n(pipeline.uses_texture, 3, false);
+    for (int i = 0; i < 6; ++i) {
+        if (!keep[i])
+            continue;
+
+        const TevStage& stage = stages[i];
+        for (int input = 0; input < NumOperands(configs[i].color_op); ++input) {
+            const u8 slot = stage.color_inputs[input].slot;
+            if (slot >= SlotTexture0 && slot <= SlotTexture2)
+                pipeline.uses_texture[slot - SlotTexture0] = true;
+        }
+        for (int input = 0; input < NumOperands(configs[i].alpha_op); ++input) {
+            const u8 slot = stage.alpha_inputs[input].slot;
+            if (slot >= SlotTexture0 && slot <= SlotTexture2)
+                pipeline.uses_texture[slot - SlotTexture0] = true;
+        }
+
+        pipeline.stages[pipeline.num_stages++] = stage;
+    }
+}
+
+Math::Vec4<u8> Pipeline::CombineTextures(const Math::Vec4<u8>& primary_color,
+                                         const Math::Vec4<u8> texture_color[3]) const {
+    TevSlots slots;
+
+    auto Store = [&](TevSlot slot, const Math::Vec4<u8>& value) {
+        slots[slot][0] = value.r();
+        slots[slot][1] = value.g();
+        slots[slot][2] = value.b();
+        slots[slot][3] = value.a();
+    };
+    Store(SlotPrimaryColor, primary_color);
+    Store(SlotTexture0, texture_color[0]);
+    Store(SlotTexture1, texture_color[1]);
+    Store(SlotTexture2, texture_color[2]);
+    std::memset(slots[SlotPrevious], 0, sizeof(slots[SlotPrevious]));
+    std::memset(slots[SlotZero], 0, sizeof(slots[SlotZero]));
+
+    for (unsigned i = 0; i < num_stages; ++i)
+        stages[i].run(stages[i], slots);
+
+    const u8* output = slots[SlotPrevious];
+    return { output[0], output[1], output[2], output[3] };
+}
+
+template <CompareFunc func>
+static bool AlphaTest(u8 alpha, u8 ref) {
+    switch (func) {
+    case CompareFunc::Never:
+        return false;
+
+    case CompareFunc::Always:
+        return true;
+
+    case CompareFunc::Equal:
+        return alpha == ref;
+
+    case CompareFunc::NotEqual:
+        return alpha != ref;
+
+    case CompareFunc::LessThan:
+        return alpha < ref;
+
+    case CompareFunc::LessThanOrEqual:
+        return alpha <= ref;
+
+    case CompareFunc::GreaterThan:
+        return alpha > ref;
+
+    case CompareFunc::GreaterThanOrEqual:
+    default:
+        return alpha >= ref;
+    }
+}
+
+static AlphaTestFunction GetAlphaTestFunction(CompareFunc func) {
+    switch (func) {
+    case CompareFunc::Never:               return &AlphaTest<CompareFunc::Never>;
+    case CompareFunc::Always:              return &AlphaTest<CompareFunc::Always>;
+    case CompareFunc::Equal:               return &AlphaTest<CompareFunc::Equal>;
+    case CompareFunc::NotEqual:            return &AlphaTest<CompareFunc::NotEqual>;
+    case CompareFunc::LessThan:            return &AlphaTest<CompareFunc::LessThan>;
+    case CompareFunc::LessThanOrEqual:     return &AlphaTest<CompareFunc::LessThanOrEqual>;
+    case CompareFunc::GreaterThan:         return &AlphaTest<CompareFunc::GreaterThan>;
+    case CompareFunc::GreaterThanOrEqual:
+    default:                        return &AlphaTest<CompareFunc::GreaterThanOrEqual>;
+    }
+}
+
+template <bool replace>
+static Math::Vec4<u8> Blend(const Pipeline& pipeline, const Math::Vec4<u8>& source, const Math::Vec4<u8>& dest) {
+    Math::Vec4<u8> blended = source;
+
+    if (!replace) {
+        const u8 slots[NumBlendSlots][4] = {
+            { 0, 0, 0, 0 },
+            { source.r(), source.g(), source.b(), source.a() },
+            { dest.r(), dest.g(), dest.b(), dest.a() },
+            { pipeline.blend_const[0], pipeline.blend_const[1], pipeline.blend_const[2], pipeline.blend_const[3] }
+        };
+
+        int result[4];
+        for (int i = 0; i < 4; ++i) {
+            const BlendFactor& src = pipeline.source_factor;
+            const BlendFactor& dst = pipeline.dest_factor;
+            const u8 src_factor = slots[src.slots[i]][src.components[i]] ^ src.invert[i];
+            const u8 dst_factor = slots[dst.slots[i]][dst.components[i]] ^ dst.invert[i];
+            result[i] = (slots[BlendSlotSource][i] * src_factor + slots[BlendSlotDest][i] * dst_factor) / 255;
+        }
+
+        // NOTE: Only the color channels are clamped, the alpha channel wraps around
+        blended = {
+            (u8)std::min(255, result[0]),
+            (u8)std::min(255, result[1]),
+            (u8)std::min(255, result[2]),
+            (u8)result[3]
+        };
+    }
+
+    return {
+        pipeline.write_mask[0] ? blended.r() : dest.r(),
+        pipeline.write_mask[1] ? blended.g() : dest.g(),
+        pipeline.write_mask[2] ? blended.b() : dest.b(),
+        pipeline.write_mask[3] ? blended.a() : dest.a()
+    };
+}
+
+static Math::Vec4<u8> BlendUnsupported(const Pipeline& pipeline, const Math::Vec4<u8>& source, const Math::Vec4<u8>& dest) {
+    // The configuration has been reported when compiling the pipeline
+    exit(0);
+}
+
+/**
+ * Sets up the given channels of a blend factor.
+ * @return false if the factor is not supported for these channels
+ */
+static bool CompileBlendFactor(BlendParams::BlendFactor factor, int first_channel, int num_channels,
+                               BlendFactor& result) {
+    // Base value of each blend factor, or BlendSlotZero with component 0xFF if unsupported
+    struct FactorSetup {
+        u8 slot;
+        u8 component;  ///< 0xFF to use the component of the channel
+    };
+    static const FactorSetup setups[] = {
+        { BlendSlotZero,     0 },       // Zero
+        { BlendSlotZero,     0 },       // One
+        { BlendSlotSource,   0xFF },    // SourceColor
+        { BlendSlotSource,   0xFF },    // OneMinusSourceColor
+        { BlendSlotDest,     0xFF },    // DestColor
+        { BlendSlotDest,     0xFF },    // OneMinusDestColor
+        { BlendSlotSource,   3 },       // SourceAlpha
+        { BlendSlotSource,   3 },       // OneMinusSourceAlpha
+        { BlendSlotDest,     3 },       // DestAlpha
+        { BlendSlotDest,     3 },       // OneMinusDestAlpha
+        { BlendSlotConstant, 0xFF },    // ConstantColor
+        { BlendSlotConstant, 0xFF },    // OneMinusConstantColor
+        { BlendSlotConstant, 3 },       // ConstantAlpha
+        { BlendSlotConstant, 3 },       // OneMinusConstantAlpha
+    };
+
+    if (factor >= ARRAY_SIZE(setups))
+        return false;
+
+    // Alpha factors can't be based on color values
+    const FactorSetup& setup = setups[factor];
+    if (first_channel == 3 && setup.component == 0xFF)
+        return false;
+
+    for (int channel = first_channel; channel < first_channel + num_channels; ++channel) {
+        result.slots[channel] = setup.slot;
+        result.components[channel] = (setup.component == 0xFF) ? channel : setup.component;
+
+        // Factors are listed as pairs of a value and its inversion, starting with Zero and One
+        result.invert[channel] = (factor & 1) ? 0xFF : 0;
+    }
+    return true;
+}
+
+static void CompileBlending(const Regs& regs, Pipeline& pipeline) {
+    const auto& output_merger = regs.output_merger;
+    const auto& params = output_merger.alpha_blending;
+
+    pipeline.blend_const[0] = output_merger.blend_const.r;
+    pipeline.blend_const[1] = output_merger.blend_const.g;
+    pipeline.blend_const[2] = output_merger.blend_const.b;
+    pipeline.blend_const[3] = output_merger.blend_const.a;
+    pipeline.write_mask[0] = output_merger.red_enable != 0;
+    pipeline.write_mask[1] = output_merger.green_enable != 0;
+    pipeline.write_mask[2] = output_merger.blue_enable != 0;
+    pipeline.write_mask[3] = output_merger.alpha_enable != 0;
+
+    pipeline.blend = &BlendUnsupported;
+    pipeline.reads_dest = true;
+
+    if (!output_merger.alphablend_enable) {
+        LOG_CRITICAL(HW_GPU, "logic op: %x", output_merger.logic_op.op.Value());
+        return;
+    }
+
+    if (!CompileBlendFactor(params.factor_source_rgb, 0, 3, pipeline.source_factor)) {
+        LOG_CRITICAL(HW_GPU, "Unknown color blend factor %x", params.factor_source_rgb.Value());
+        return;
+    }
+
+    if (!CompileBlendFactor(params.factor_dest_rgb, 0, 3, pipeline.dest_factor)) {
+        LOG_CRITICAL(HW_GPU, "Unknown color blend factor %x", params.factor_dest_rgb.Value());
+        return;
+    }
+
+    if (!CompileBlendFactor(params.factor_source_a, 3, 1, pipeline.source_factor)) {
+        LOG_CRITICAL(HW_GPU, "Unknown alpha blend factor %x", params.factor_source_a.Value());
+        return;
+    }
+
+    if (!CompileBlendFactor(params.factor_dest_a, 3, 1, pipeline.dest_factor)) {
+        LOG_CRITICAL(HW_GPU, "Unknown alpha blend factor %x", params.factor_dest_a.Value());
+        return;
+    }
+
+    if (params.blend_equation_rgb != params.Add) {
+        LOG_CRITICAL(HW_GPU, "Unknown RGB blend equation %x", params.blend_equation_rgb.Value());
+        return;
+    }
+
+    // Blending with source factor one and destination factor zero just passes on the combiner
+    // output, in which case the framebuffer only needs to be read for masked channels
+    const bool replace = params.factor_source_rgb == params.One && params.factor_source_a == params.One &&
+                         params.factor_dest_rgb == params.Zero && params.factor_dest_a == params.Zero;
+    if (replace) {
+        pipeline.blend = &Blend<true>;
+        pipeline.reads_dest = !std::all_of(pipeline.write_mask, pipeline.write_mask + 4, [](bool b) { return b; });
+    } else {
+        pipeline.blend = &Blend<false>;
+    }
+}
+
+/// Gathers the register words the pipeline of the current draw depends on
+static std::array<u32, Pipeline::CONFIG_SIZE> GetConfig() {
+    std::array<u32, Pipeline::CONFIG_SIZE> config;
+
+    const auto tev_stages = registers.GetTevStages();
+    for (unsigned i = 0; i < tev_stages.size(); ++i)
+        std::memcpy(&config[i * 4], &tev_stages[i], 4 * sizeof(u32));
+
+    // Blending, alpha test and color write mask
+    static const u32 output_merger_words[] = { 0, 1, 2, 3, 4, 7 };
+    for (unsigned i = 0; i < ARRAY_SIZE(output_merger_words); ++i)
+        config[24 + i] = registers[PICA_REG_INDEX(output_merger) + output_merger_words[i]];
+
+    return config;
+}
+
+static std::unique_ptr<Pipeline> Compile(const std::array<u32, Pipeline::CONFIG_SIZE>& config) {
+    auto pipeline = Common::make_unique<Pipeline>();
+    pipeline->config = config;
+
+    CompileTevStages(registers.GetTevStages(), *pipeline);
+
+    const auto& alpha_test = registers.output_merger.alpha_test;
+    pipeline->alpha_test = alpha_test.enable ? GetAlphaTestFunction(alpha_test.func) : &AlphaTest<CompareFunc::Always>;
+    pipeline->alpha_ref = alpha_test.ref;
+
+    CompileBlending(registers, *pipeline);
+
+    LOG_DEBUG(HW_GPU, "Compiled pixel pipeline with %u active texture environment stages", pipeline->num_stages);
+    return pipeline;
+}
+
+const Pipeline& GetPipeline() {
+    const auto config = GetConfig();
+    if (current_pipeline != nullptr && current_pipeline->config == config)
+        return *current_pipeline;
+
+    const u64 key = GetMurmurHash3(reinterpret_cast<const u8*>(config.data()),
+                                   static_cast<int>(config.size() * sizeof(u32)), 0);
+    auto& pipeline = pipelines[key];
+    if (pipeline == nullptr || pipeline->config != config) {
+        if (pipelines.size() > MAX_CACHED_PIPELINES) {
+            ClearCache();
+            return GetPipeline();
+        }
+
+        pipeline = Compile(config);
+    }
+
+    current_pipeline = pipeline.get();
+    return *current_pipeline;
+}
+
+void ClearCache() {
+    pipelines.clear();
+    current_pipeline = nullptr;
+}
+
+} // namespace
+
+} // namespace
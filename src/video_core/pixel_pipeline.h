@@ -0,0 +1,131 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <array>
+
+#include "common/common_types.h"
+
+#include "math.h"
+
+namespace Pica {
+
+namespace PixelPipeline {
+
+/// Values a texture environment stage can read from, and the output of the previous stage
+enum TevSlot {
+    SlotPrimaryColor,
+    SlotTexture0,
+    SlotTexture1,
+    SlotTexture2,
+    SlotConstant,
+    SlotPrevious,
+    SlotZero,        ///< Stands in for unknown sources and modifiers
+
+    NumTevSlots
+};
+
+/// Color components of all TEV slots while a pixel is being shaded
+typedef u8 TevSlots[NumTevSlots][4];
+
+/// A single texture environment stage, reduced to the inputs its operations actually use
+struct TevStage {
+    void (*run)(const TevStage& stage, TevSlots& slots);
+
+    u8 constant[4];
+
+    /// Color combiner inputs: components picked from a slot, xor'ed with 0xFF when inverted
+    struct {
+        u8 slot;
+        u8 components[3];
+        u8 invert;
+    } color_inputs[3];
+
+    /// Alpha combiner inputs, analogously
+    struct {
+        u8 slot;
+        u8 component;
+        u8 invert;
+    } alpha_inputs[3];
+};
+
+/// Values a blend factor can be derived from
+enum BlendSlot {
+    BlendSlotZero,
+    BlendSlotSource,
+    BlendSlotDest,
+    BlendSlotConstant,
+
+    NumBlendSlots
+};
+
+/// Blend factor for each of the RGBA channels, derived like TEV stage inputs
+struct BlendFactor {
+    u8 slots[4];
+    u8 components[4];
+    u8 invert[4];
+};
+
+/**
+ * Texture environment, alpha test and blending configuration compiled into a sequence of
+ * specialized stage functions, so that per-pixel work only covers the operations which are
+ * actually configured.
+ */
+struct Pipeline {
+    /// Number of register words the pipeline is specialized for
+    static const size_t CONFIG_SIZE = 6 * 4 + 6;
+
+    /// The register words this pipeline has been compiled from
+    std::array<u32, CONFIG_SIZE> config;
+
+    /// Stages whose output contributes to the final color, in order
+    std::array<TevStage, 6> stages;
+    unsigned num_stages;
+
+    /// Whether the color of each texture unit is read by any of the stages
+    bool uses_texture[3];
+
+    bool (*alpha_test)(u8 alpha, u8 ref);
+    u8 alpha_ref;
+
+    /// Whether Blend needs the current framebuffer color
+    bool reads_dest;
+
+    Math::Vec4<u8> (*blend)(const Pipeline& pipeline, const Math::Vec4<u8>& source, const Math::Vec4<u8>& dest);
+    BlendFactor source_factor;
+    BlendFactor dest_factor;
+    u8 blend_const[4];
+    bool write_mask[4];
+
+    /// Runs the texture environment on the given inputs
+    Math::Vec4<u8> CombineTextures(const Math::Vec4<u8>& primary_color, const Math::Vec4<u8> texture_color[3]) const;
+
+    /// Returns true if a pixel with the given combiner output passes the alpha test
+    bool TestAlpha(u8 alpha) const {
+        return alpha_test(alpha, alpha_ref);
+    }
+
+    /**
+     * Blends the combiner output with the framebuffer color and applies the color write mask.
+     * @param dest Framebuffer color, ignored unless reads_dest is set
+     */
+    Math::Vec4<u8> Blend(const Math::Vec4<u8>& source, const Math::Vec4<u8>& dest) const {
+        return blend(*this, source, dest);
+    }
+};
+
+/**
+ * Looks up the pipeline for the current register state, compiling it if the configuration hasn't
+ * been used before. Must be called from the thread writing the registers; the returned pipeline
+ * may be used from any thread until the next call.
+ */
+const Pipeline& GetPipeline();
+
+/// Drops every compiled pipeline
+void ClearCache();
+
+} // namespace
+
+} // namespace
@@ -3,11 +3,26 @@
 // Refer to the license.txt file included.
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <vector>
 
 #include "common/common_types.h"
+#include "common/make_unique.h"
+#include "common/thread_pool.h"
+
+#include "core/mem_map.h"
+#include "core/settings.h"
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
 
 #include "math.h"
 #include "pica.h"
+#include "pixel_pipeline.h"
 #include "rasterizer.h"
 #include "vertex_shader.h"
 
@@ -17,42 +32,27 @@ namespace Pica {
 
 namespace Rasterizer {
 
-static void DrawPixel(int x, int y, const Math::Vec4<u8>& color) {
-    const PAddr addr = registers.framebuffer.GetColorBufferPhysicalAddress();
-    u32* color_buffer = reinterpret_cast<u32*>(Memory::GetPointer(PAddrToVAddr(addr)));
+static void DrawPixel(const DrawState& state, int x, int y, const Math::Vec4<u8>& color) {
     u32 value = (color.a() << 24) | (color.r() << 16) | (color.g() << 8) | color.b();
-
-    // Assuming RGBA8 format until actual framebuffer format handling is implemented
-    *(color_buffer + x + y * registers.framebuffer.GetWidth()) = value;
+    state.color_buffer[x + y * state.width] = value;
 }
 
-static const Math::Vec4<u8> GetPixel(int x, int y) {
-    const PAddr addr = registers.framebuffer.GetColorBufferPhysicalAddress();
-    u32* color_buffer_u32 = reinterpret_cast<u32*>(Memory::GetPointer(PAddrToVAddr(addr)));
-
-    u32 value = *(color_buffer_u32 + x + y * registers.framebuffer.GetWidth());
+static const Math::Vec4<u8> GetPixel(const DrawState& state, int x, int y) {
+    u32 value = state.color_buffer[x + y * state.width];
     Math::Vec4<u8> ret;
     ret.a() = value >> 24;
     ret.r() = (value >> 16) & 0xFF;
     ret.g() = (value >> 8) & 0xFF;
     ret.b() = value & 0xFF;
     return ret;
- }
-
-static u32 GetDepth(int x, int y) {
-    const PAddr addr = registers.framebuffer.GetDepthBufferPhysicalAddress();
-    u16* depth_buffer = reinterpret_cast<u16*>(Memory::GetPointer(PAddrToVAddr(addr)));
-
-    // Assuming 16-bit depth buffer format until actual format handling is implemented
-    return *(depth_buffer + x + y * registers.framebuffer.GetWidth());
 }
 
-static void SetDepth(int x, int y, u16 value) {
-    const PAddr addr = registers.framebuffer.GetDepthBufferPhysicalAddress();
-    u16* depth_buffer = reinterpret_cast<u16*>(Memory::GetPointer(PAddrToVAddr(addr)));
+static u32 GetDepth(const DrawState& state, int x, int y) {
+    return state.depth_buffer[x + y * state.width];
+}
 
-    // Assuming 16-bit depth buffer format until actual format handling is implemented
-    *(depth_buffer + x + y * registers.framebuffer.GetWidth()) = value;
+static void SetDepth(const DrawState& state, int x, int y, u16 value) {
+    state.depth_buffer[x + y * state.width] = value;
 }
 
 // NOTE: Assuming that rasterizer coordinates are 12.4 fixed-point values
@@ -90,9 +90,130 @@ static int SignedArea (const Math::Vec2<Fix12P4>& vtx1,
     return Math::Cross(vec1, vec2).z;
 };
 
-void ProcessTriangle(const VertexShader::OutputVertex& v0,
-                     const VertexShader::OutputVertex& v1,
-                     const VertexShader::OutputVertex& v2)
+/**
+ * Tests the depth of a pixel against the depth buffer. Since the tested depth only depends on the
+ * pixel position, this is done before any shading work; only the depth write has to wait for the
+ * alpha test.
+ */
+static bool TestDepth(const DrawState& state, int x, int y, u16 z) {
+    u16 ref_z = GetDepth(state, x, y);
+
+    switch (state.depth_test_func) {
+    case DrawState::CompareFunc::Never:
+        return false;
+
+    case DrawState::CompareFunc::Always:
+        return true;
+
+    case DrawState::CompareFunc::Equal:
+        return z == ref_z;
+
+    case DrawState::CompareFunc::NotEqual:
+        return z != ref_z;
+
+    case DrawState::CompareFunc::LessThan:
+        return z < ref_z;
+
+    case DrawState::CompareFunc::LessThanOrEqual:
+        return z <= ref_z;
+
+    case DrawState::CompareFunc::GreaterThan:
+        return z > ref_z;
+
+    case DrawState::CompareFunc::GreaterThanOrEqual:
+        return z >= ref_z;
+    }
+
+    return false;
+}
+
+/**
+ * Runs the texturing, texture environment and output merger stages for a single pixel which
+ * passed the depth test.
+ * @param x,y Pixel position in the framebuffer
+ * @param primary_color Interpolated vertex color
+ * @param uv Interpolated texture coordinates
+ * @param z Interpolated depth, only used if depth testing is enabled
+ */
+static void ShadePixel(const DrawState& state, int x, int y, const Math::Vec4<u8>& primary_color,
+                       const Math::Vec2<float24> uv[3], u16 z)
+{
+    const PixelPipeline::Pipeline& pipeline = *state.pipeline;
+
+    Math::Vec4<u8> texture_color[3]{};
+    for (int i = 0; i < 3; ++i) {
+        const auto& unit = state.textures[i];
+        if (unit.texture == nullptr)
+            continue;
+
+        const auto& texture = *unit.texture;
+        int s = (int)(uv[i].u() * float24::FromFloat32(static_cast<float>(texture.width))).ToFloat32();
+        int t = (int)(uv[i].v() * float24::FromFloat32(static_cast<float>(texture.height))).ToFloat32();
+        auto GetWrappedTexCoord = [](Regs::TextureConfig::WrapMode mode, int val, unsigned size) {
+            switch (mode) {
+                case Regs::TextureConfig::ClampToEdge:
+                    val = std::max(val, 0);
+                    val = std::min(val, (int)size - 1);
+                    return val;
+
+                case Regs::TextureConfig::Repeat:
+                    return (int)(((unsigned)val) % size);
+
+                default:
+                    LOG_ERROR(HW_GPU, "Unknown texture coordinate wrapping mode %x\n", (int)mode);
+                    _dbg_assert_(HW_GPU, 0);
+                    return 0;
+            }
+        };
+        s = GetWrappedTexCoord(unit.wrap_s, s, texture.width);
+        t = texture.height - 1 - GetWrappedTexCoord(unit.wrap_t, t, texture.height);
+
+        texture_color[i] = texture.Lookup(s, t);
+    }
+
+    // Texture environment - consists of 6 stages of color and alpha combining.
+    //
+    // Color combiners take three input color values from some source (e.g. interpolated
+    // vertex color, texture color, previous stage, etc), perform some very simple
+    // operations on each of them (e.g. inversion) and then calculate the output color
+    // with some basic arithmetic. Alpha combiners can be configured separately but work
+    // analogously.
+    const Math::Vec4<u8> combiner_output = pipeline.CombineTextures(primary_color, texture_color);
+
+    if (!pipeline.TestAlpha(combiner_output.a()))
+        return;
+
+    // TODO: Does depth indeed only get written even if depth testing is enabled?
+    if (state.depth_test_enable && state.depth_write_enable)
+        SetDepth(state, x, y, z);
+
+    const Math::Vec4<u8> dest = pipeline.reads_dest ? GetPixel(state, x, y) : Math::Vec4<u8>{};
+    DrawPixel(state, x, y, pipeline.Blend(combiner_output, dest));
+}
+
+/// Triangle which passed culling, along with the setup data shared by all of its pixels
+struct Triangle {
+    VertexShader::OutputVertex v0, v1, v2;
+
+    // vertex positions in rasterizer coordinates
+    Math::Vec3<Fix12P4> vtxpos[3];
+
+    // fill rule biases of the barycentric coordinates
+    int bias0, bias1, bias2;
+
+    // bounding box in rasterizer coordinates, clamped to the framebuffer
+    u16 min_x, min_y, max_x, max_y;
+};
+
+/**
+ * Calculates the screen space setup of a triangle.
+ * @return false if the triangle has been culled
+ */
+static bool SetupTriangle(const DrawState& state,
+                          const VertexShader::OutputVertex& v0,
+                          const VertexShader::OutputVertex& v1,
+                          const VertexShader::OutputVertex& v2,
+                          Triangle& triangle)
 {
     // vertex positions in rasterizer coordinates
     auto FloatToFix = [](float24 flt) {
@@ -102,20 +223,21 @@ void ProcessTriangle(const VertexShader::OutputVertex& v0,
                                              return Math::Vec3<Fix12P4>{FloatToFix(vec.x), FloatToFix(vec.y), FloatToFix(vec.z)};
                                          };
 
-    Math::Vec3<Fix12P4> vtxpos[3]{ ScreenToRasterizerCoordinates(v0.screenpos),
-                                   ScreenToRasterizerCoordinates(v1.screenpos),
-                                   ScreenToRasterizerCoordinates(v2.screenpos) };
+    Math::Vec3<Fix12P4>* vtxpos = triangle.vtxpos;
+    vtxpos[0] = ScreenToRasterizerCoordinates(v0.screenpos);
+    vtxpos[1] = ScreenToRasterizerCoordinates(v1.screenpos);
+    vtxpos[2] = ScreenToRasterizerCoordinates(v2.screenpos);
 
-    if (registers.cull_mode == Regs::CullMode::KeepClockWise) {
+    if (state.cull_mode == Regs::CullMode::KeepClockWise) {
         // Reverse vertex order and use the CCW code path.
         std::swap(vtxpos[1], vtxpos[2]);
     }
 
-    if (registers.cull_mode != Regs::CullMode::KeepAll) {
+    if (state.cull_mode != Regs::CullMode::KeepAll) {
         // Cull away triangles which are wound clockwise.
         // TODO: A check for degenerate triangles ("== 0") should be considered for CullMode::KeepAll
         if (SignedArea(vtxpos[0].xy(), vtxpos[1].xy(), vtxpos[2].xy()) <= 0)
-            return;
+            return false;
     }
 
     // TODO: Proper scissor rect test!
@@ -129,6 +251,13 @@ void ProcessTriangle(const VertexShader::OutputVertex& v0,
     max_x = ((max_x + Fix12P4::FracMask()) & Fix12P4::IntMask());
     max_y = ((max_y + Fix12P4::FracMask()) & Fix12P4::IntMask());
 
+    // Pixels outside of the framebuffer would otherwise be written to the neighboring rows, or
+    // past the end of the buffer
+    triangle.min_x = min_x;
+    triangle.min_y = min_y;
+    triangle.max_x = std::min<u16>(max_x, state.width << 4);
+    triangle.max_y = std::min<u16>(max_y, state.height << 4);
+
     // Triangle filling rules: Pixels on the right-sided edge or on flat bottom edges are not
     // drawn. Pixels on any other triangle border are drawn. This is implemented with three bias
     // values which are added to the barycentric coordinates w0, w1 and w2, respectively.
@@ -146,507 +275,738 @@ void ProcessTriangle(const VertexShader::OutputVertex& v0,
             return (int)vtx.x < (int)line1.x + ((int)line2.x - (int)line1.x) * ((int)vtx.y - (int)line1.y) / ((int)line2.y - (int)line1.y);
         }
     };
-    int bias0 = IsRightSideOrFlatBottomEdge(vtxpos[0].xy(), vtxpos[1].xy(), vtxpos[2].xy()) ? -1 : 0;
-    int bias1 = IsRightSideOrFlatBottomEdge(vtxpos[1].xy(), vtxpos[2].xy(), vtxpos[0].xy()) ? -1 : 0;
-    int bias2 = IsRightSideOrFlatBottomEdge(vtxpos[2].xy(), vtxpos[0].xy(), vtxpos[1].xy()) ? -1 : 0;
+    triangle.bias0 = IsRightSideOrFlatBottomEdge(vtxpos[0].xy(), vtxpos[1].xy(), vtxpos[2].xy()) ? -1 : 0;
+    triangle.bias1 = IsRightSideOrFlatBottomEdge(vtxpos[1].xy(), vtxpos[2].xy(), vtxpos[0].xy()) ? -1 : 0;
+    triangle.bias2 = IsRightSideOrFlatBottomEdge(vtxpos[2].xy(), vtxpos[0].xy(), vtxpos[1].xy()) ? -1 : 0;
+
+    triangle.v0 = v0;
+    triangle.v1 = v1;
+    triangle.v2 = v2;
+    return true;
+}
 
-    auto w_inverse = Math::MakeVec(v0.pos.w, v1.pos.w, v2.pos.w);
+// Edge length of the pixel blocks which are tested against the triangle edges and the depth
+// bounds as a whole, in pixels
+static const int BLOCK_SIZE = 8;
 
-    auto textures = registers.GetTextures();
-    auto tev_stages = registers.GetTevStages();
+// Triangles whose clipped bounding box covers fewer pixels are drawn by the scalar loop even
+// when the SSE rasterizer is enabled
+static const u32 MIN_SSE_TRIANGLE_AREA = 64;
 
-    // TODO: Not sure if looping through x first might be faster
-    for (u16 y = min_y; y < max_y; y += 0x10) {
-        for (u16 x = min_x; x < max_x; x += 0x10) {
+/// Range of the values in a block of the depth buffer
+struct DepthBounds {
+    u16 min;
+    u16 max;
+};
 
-            // Calculate the barycentric coordinates w0, w1 and w2
-            int w0 = bias0 + SignedArea(vtxpos[1].xy(), vtxpos[2].xy(), {x, y});
-            int w1 = bias1 + SignedArea(vtxpos[2].xy(), vtxpos[0].xy(), {x, y});
-            int w2 = bias2 + SignedArea(vtxpos[0].xy(), vtxpos[1].xy(), {x, y});
-            int wsum = w0 + w1 + w2;
+// Depth bounds of each BLOCK_SIZE x BLOCK_SIZE block of the depth buffer, stored row by row. Only
+// DrawTriangleSSE keeps them up to date with its depth writes; any other write to the depth
+// buffer invalidates them.
+static std::vector<DepthBounds> depth_bounds;
+static const u16* depth_bounds_buffer = nullptr;
+static u32 depth_bounds_width = 0;
+static u32 depth_bounds_height = 0;
+static bool depth_bounds_valid = false;
+
+/// Recomputes the depth bounds of the block whose top-left pixel is at the given position
+static void UpdateDepthBounds(const DrawState& state, u32 x, u32 y) {
+    const u32 end_x = std::min(x + BLOCK_SIZE, state.width);
+    const u32 end_y = std::min(y + BLOCK_SIZE, state.height);
+
+    DepthBounds bounds = { 0xFFFF, 0 };
+    for (u32 pixel_y = y; pixel_y < end_y; ++pixel_y) {
+        const u16* row = &state.depth_buffer[pixel_y * state.width];
+        for (u32 pixel_x = x; pixel_x < end_x; ++pixel_x) {
+            bounds.min = std::min(bounds.min, row[pixel_x]);
+            bounds.max = std::max(bounds.max, row[pixel_x]);
+        }
+    }
 
-            // If current pixel is not covered by the current primitive
-            if (w0 < 0 || w1 < 0 || w2 < 0)
-                continue;
+    const u32 blocks_per_row = (state.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    depth_bounds[x / BLOCK_SIZE + (y / BLOCK_SIZE) * blocks_per_row] = bounds;
+}
 
-            auto baricentric_coordinates = Math::MakeVec(float24::FromFloat32(static_cast<float>(w0)),
-                                                float24::FromFloat32(static_cast<float>(w1)),
-                                                float24::FromFloat32(static_cast<float>(w2)));
-            float24 interpolated_w_inverse = float24::FromFloat32(1.0f) / Math::Dot(w_inverse, baricentric_coordinates);
+/**
+ * Widens the depth bounds of the block containing the given pixel to include a depth written to
+ * it. The bounds may then be wider than the depths in the block, which only makes them less
+ * effective at rejecting blocks.
+ */
+static void ExpandDepthBounds(const DrawState& state, u32 x, u32 y, u16 z) {
+    const u32 blocks_per_row = (state.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    DepthBounds& bounds = depth_bounds[x / BLOCK_SIZE + (y / BLOCK_SIZE) * blocks_per_row];
+    bounds.min = std::min(bounds.min, z);
+    bounds.max = std::max(bounds.max, z);
+}
 
-            // Perspective correct attribute interpolation:
-            // Attribute values cannot be calculated by simple linear interpolation since
-            // they are not linear in screen space. For example, when interpolating a
-            // texture coordinate across two vertices, something simple like
-            //     u = (u0*w0 + u1*w1)/(w0+w1)
-            // will not work. However, the attribute value divided by the
-            // clipspace w-coordinate (u/w) and and the inverse w-coordinate (1/w) are linear
-            // in screenspace. Hence, we can linearly interpolate these two independently and
-            // calculate the interpolated attribute by dividing the results.
-            // I.e.
-            //     u_over_w   = ((u0/v0.pos.w)*w0 + (u1/v1.pos.w)*w1)/(w0+w1)
-            //     one_over_w = (( 1/v0.pos.w)*w0 + ( 1/v1.pos.w)*w1)/(w0+w1)
-            //     u = u_over_w / one_over_w
-            //
-            // The generalization to three vertices is straightforward in baricentric coordinates.
-            auto GetInterpolatedAttribute = [&](float24 attr0, float24 attr1, float24 attr2) {
-                auto attr_over_w = Math::MakeVec(attr0, attr1, attr2);
-                float24 interpolated_attr_over_w = Math::Dot(attr_over_w, baricentric_coordinates);
-                return interpolated_attr_over_w * interpolated_w_inverse;
-            };
+/**
+ * Returns true if no pixel of a block can pass the depth test
+ * @param z_min,z_max Range of the depth of the pixels drawn to the block
+ */
+static bool IsOccluded(DrawState::CompareFunc func, float z_min, float z_max, const DepthBounds& bounds) {
+    switch (func) {
+    case DrawState::CompareFunc::Never:
+        return true;
 
-            Math::Vec4<u8> primary_color{
-                (u8)(GetInterpolatedAttribute(v0.color.r(), v1.color.r(), v2.color.r()).ToFloat32() * 255),
-                (u8)(GetInterpolatedAttribute(v0.color.g(), v1.color.g(), v2.color.g()).ToFloat32() * 255),
-                (u8)(GetInterpolatedAttribute(v0.color.b(), v1.color.b(), v2.color.b()).ToFloat32() * 255),
-                (u8)(GetInterpolatedAttribute(v0.color.a(), v1.color.a(), v2.color.a()).ToFloat32() * 255)
-            };
+    case DrawState::CompareFunc::LessThan:
+        return z_min >= bounds.max;
 
-            Math::Vec2<float24> uv[3];
-            uv[0].u() = GetInterpolatedAttribute(v0.tc0.u(), v1.tc0.u(), v2.tc0.u());
-            uv[0].v() = GetInterpolatedAttribute(v0.tc0.v(), v1.tc0.v(), v2.tc0.v());
-            uv[1].u() = GetInterpolatedAttribute(v0.tc1.u(), v1.tc1.u(), v2.tc1.u());
-            uv[1].v() = GetInterpolatedAttribute(v0.tc1.v(), v1.tc1.v(), v2.tc1.v());
-            uv[2].u() = GetInterpolatedAttribute(v0.tc2.u(), v1.tc2.u(), v2.tc2.u());
-            uv[2].v() = GetInterpolatedAttribute(v0.tc2.v(), v1.tc2.v(), v2.tc2.v());
+    case DrawState::CompareFunc::LessThanOrEqual:
+        return z_min > bounds.max;
 
-            Math::Vec4<u8> texture_color[3]{};
-            for (int i = 0; i < 3; ++i) {
-                const auto& texture = textures[i];
-                if (!texture.enabled)
-                    continue;
+    case DrawState::CompareFunc::GreaterThan:
+        return z_max <= bounds.min;
 
-                _dbg_assert_(HW_GPU, 0 != texture.config.address);
+    case DrawState::CompareFunc::GreaterThanOrEqual:
+        return z_max < bounds.min;
 
-                int s = (int)(uv[i].u() * float24::FromFloat32(static_cast<float>(texture.config.width))).ToFloat32();
-                int t = (int)(uv[i].v() * float24::FromFloat32(static_cast<float>(texture.config.height))).ToFloat32();
-                auto GetWrappedTexCoord = [](Regs::TextureConfig::WrapMode mode, int val, unsigned size) {
-                    switch (mode) {
-                        case Regs::TextureConfig::ClampToEdge:
-                            val = std::max(val, 0);
-                            val = std::min(val, (int)size - 1);
-                            return val;
+    default:
+        return false;
+    }
+}
 
-                        case Regs::TextureConfig::Repeat:
-                            return (int)(((unsigned)val) % size);
+static void OnDepthBufferWrite(VAddr page_address) {
+    depth_bounds_valid = false;
+}
 
-                        default:
-                            LOG_ERROR(HW_GPU, "Unknown texture coordinate wrapping mode %x\n", (int)mode);
-                            _dbg_assert_(HW_GPU, 0);
-                            return 0;
-                    }
-                };
-                s = GetWrappedTexCoord(texture.config.wrap_s, s, texture.config.width);
-                t = texture.config.height - 1 - GetWrappedTexCoord(texture.config.wrap_t, t, texture.config.height);
+/**
+ * Makes sure the depth bounds match the contents of the depth buffer before triangles are drawn
+ * with the given state. Must be called from the thread executing GPU commands.
+ */
+static void PrepareDepthBounds(const DrawState& state) {
+    static bool handler_registered = false;
+    if (!handler_registered) {
+        Memory::RegisterWriteHandler(Memory::PageWatch::DepthBuffer, OnDepthBufferWrite);
+        handler_registered = true;
+    }
 
-                u8* texture_data = Memory::GetPointer(PAddrToVAddr(texture.config.GetPhysicalAddress()));
-                auto info = DebugUtils::TextureInfo::FromPicaRegister(texture.config, texture.format);
+    if (!state.depth_test_enable || state.depth_buffer == nullptr)
+        return;
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+    const bool updates_bounds = Settings::values.use_simd_rasterizer;
+#else
+    const bool updates_bounds = false;
+#endif
+    if (!updates_bounds) {
+        if (state.depth_write_enable)
+            depth_bounds_valid = false;
+        return;
+    }
 
-                texture_color[i] = DebugUtils::LookupTexture(texture_data, s, t, info);
-                DebugUtils::DumpTexture(texture.config, texture_data);
-            }
+    if (depth_bounds_valid && depth_bounds_buffer == state.depth_buffer &&
+        depth_bounds_width == state.width && depth_bounds_height == state.height)
+        return;
 
-            // Texture environment - consists of 6 stages of color and alpha combining.
-            //
-            // Color combiners take three input color values from some source (e.g. interpolated
-            // vertex color, texture color, previous stage, etc), perform some very simple
-            // operations on each of them (e.g. inversion) and then calculate the output color
-            // with some basic arithmetic. Alpha combiners can be configured separately but work
-            // analogously.
-            Math::Vec4<u8> combiner_output;
-            for (const auto& tev_stage : tev_stages) {
-                using Source = Regs::TevStageConfig::Source;
-                using ColorModifier = Regs::TevStageConfig::ColorModifier;
-                using AlphaModifier = Regs::TevStageConfig::AlphaModifier;
-                using Operation = Regs::TevStageConfig::Operation;
-
-                auto GetSource = [&](Source source) -> Math::Vec4<u8> {
-                    switch (source) {
-                    case Source::PrimaryColor:
-                        return primary_color;
-
-                    case Source::Texture0:
-                        return texture_color[0];
-
-                    case Source::Texture1:
-                        return texture_color[1];
-
-                    case Source::Texture2:
-                        return texture_color[2];
-
-                    case Source::Constant:
-                        return {tev_stage.const_r, tev_stage.const_g, tev_stage.const_b, tev_stage.const_a};
-
-                    case Source::Previous:
-                        return combiner_output;
-
-                    default:
-                        LOG_ERROR(HW_GPU, "Unknown color combiner source %d\n", (int)source);
-                        _dbg_assert_(HW_GPU, 0);
-                        return {};
-                    }
-                };
+    depth_bounds_buffer = state.depth_buffer;
+    depth_bounds_width = state.width;
+    depth_bounds_height = state.height;
+    depth_bounds.resize(((state.width + BLOCK_SIZE - 1) / BLOCK_SIZE) * ((state.height + BLOCK_SIZE - 1) / BLOCK_SIZE));
+    for (u32 y = 0; y < state.height; y += BLOCK_SIZE)
+        for (u32 x = 0; x < state.width; x += BLOCK_SIZE)
+            UpdateDepthBounds(state, x, y);
 
-                static auto GetColorModifier = [](ColorModifier factor, const Math::Vec4<u8>& values) -> Math::Vec3<u8> {
-                    switch (factor) {
-                    case ColorModifier::SourceColor:
-                        return values.rgb();
+    const VAddr start = PAddrToVAddr(registers.framebuffer.GetDepthBufferPhysicalAddress());
+    const u32 size = state.width * state.height * 2;
+    for (VAddr page = start & ~Memory::PAGE_MASK; page < start + size; page += Memory::PAGE_SIZE)
+        Memory::WatchPage(Memory::PageWatch::DepthBuffer, page);
 
-                    case ColorModifier::OneMinusSourceColor:
-                        return (Math::Vec3<u8>(255, 255, 255) - values.rgb()).Cast<u8>();
+    depth_bounds_valid = true;
+}
 
-                    case ColorModifier::SourceAlpha:
-                        return values.aaa();
+#if defined(__x86_64__) || defined(_M_AMD64)
 
-                    case ColorModifier::OneMinusSourceAlpha:
-                        return (Math::Vec3<u8>(255, 255, 255) - values.aaa()).Cast<u8>();
+namespace SSE {
 
-                    case ColorModifier::SourceRed:
-                        return values.rrr();
+/**
+ * Edge function of a triangle, i.e. SignedArea(vtx1, vtx2, {x, y}) plus a fill rule bias, which
+ * changes by a constant amount per pixel step in either direction
+ */
+struct EdgeFunction {
+    EdgeFunction(const Math::Vec2<Fix12P4>& vtx1, const Math::Vec2<Fix12P4>& vtx2, int bias)
+        : vtx1(vtx1), vtx2(vtx2), bias(bias),
+          step_x(-((int)vtx2.y - (int)vtx1.y) * 0x10), step_y(((int)vtx2.x - (int)vtx1.x) * 0x10) {}
 
-                    case ColorModifier::OneMinusSourceRed:
-                        return (Math::Vec3<u8>(255, 255, 255) - values.rrr()).Cast<u8>();
+    int Evaluate(u16 x, u16 y) const {
+        return bias + SignedArea(vtx1, vtx2, {x, y});
+    }
 
-                    case ColorModifier::SourceGreen:
-                        return values.ggg();
+    Math::Vec2<Fix12P4> vtx1, vtx2;
+    int bias;
+    int step_x; ///< Change of the function when moving one pixel to the right
+    int step_y; ///< Change of the function when moving one pixel down
+};
 
-                    case ColorModifier::OneMinusSourceGreen:
-                        return (Math::Vec3<u8>(255, 255, 255) - values.ggg()).Cast<u8>();
+/// Vertex attribute broadcast to all lanes
+struct Attribute {
+    Attribute(float24 attr0, float24 attr1, float24 attr2)
+        : attr0(_mm_set1_ps(attr0.ToFloat32())), attr1(_mm_set1_ps(attr1.ToFloat32())),
+          attr2(_mm_set1_ps(attr2.ToFloat32())) {}
 
-                    case ColorModifier::SourceBlue:
-                        return values.bbb();
+    /// Same operations in the same order as Math::Dot, so that results match the scalar path
+    __m128 Dot(__m128 w0, __m128 w1, __m128 w2) const {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(attr0, w0), _mm_mul_ps(attr1, w1)), _mm_mul_ps(attr2, w2));
+    }
 
-                    case ColorModifier::OneMinusSourceBlue:
-                        return (Math::Vec3<u8>(255, 255, 255) - values.bbb()).Cast<u8>();
-                    }
-                };
+    __m128 attr0, attr1, attr2;
+};
 
-                static auto GetAlphaModifier = [](AlphaModifier factor, const Math::Vec4<u8>& values) -> u8 {
-                    switch (factor) {
-                    case AlphaModifier::SourceAlpha:
-                        return values.a();
+} // namespace SSE
 
-                    case AlphaModifier::OneMinusSourceAlpha:
-                        return 255 - values.a();
+/**
+ * Draws the pixels of a triangle which lie within the given rectangle, producing the same results
+ * as the scalar loop in DrawTriangle. Edge functions are stepped incrementally, blocks of pixels
+ * which are entirely outside or inside of the triangle are detected from their corners, and the
+ * pixels of each 2x2 quad are set up at once. Blocks which are entirely occluded according to the
+ * depth bounds are skipped, and attributes are only interpolated for pixels passing the depth test.
+ */
+static void DrawTriangleSSE(const DrawState& state, const Triangle& triangle,
+                            u16 min_x, u16 min_y, u16 max_x, u16 max_y)
+{
+    const auto& v0 = triangle.v0;
+    const auto& v1 = triangle.v1;
+    const auto& v2 = triangle.v2;
+    const Math::Vec3<Fix12P4>* vtxpos = triangle.vtxpos;
+
+    const SSE::EdgeFunction edges[3] = {
+        { vtxpos[1].xy(), vtxpos[2].xy(), triangle.bias0 },
+        { vtxpos[2].xy(), vtxpos[0].xy(), triangle.bias1 },
+        { vtxpos[0].xy(), vtxpos[1].xy(), triangle.bias2 },
+    };
 
-                    case AlphaModifier::SourceRed:
-                        return values.r();
+    // Offsets of the edge functions of a 2x2 quad's pixels from its top-left pixel, and of the
+    // corners of a block from its top-left pixel
+    __m128i quad_offsets[3];
+    __m128i corner_offsets[3];
+    for (int i = 0; i < 3; ++i) {
+        const int step_x = edges[i].step_x;
+        const int step_y = edges[i].step_y;
+        quad_offsets[i] = _mm_setr_epi32(0, step_x, step_y, step_x + step_y);
+        const int far_x = step_x * (BLOCK_SIZE - 1);
+        const int far_y = step_y * (BLOCK_SIZE - 1);
+        corner_offsets[i] = _mm_setr_epi32(0, far_x, far_y, far_x + far_y);
+    }
 
-                    case AlphaModifier::OneMinusSourceRed:
-                        return 255 - values.r();
+    const SSE::Attribute w_inverse(v0.pos.w, v1.pos.w, v2.pos.w);
+    const SSE::Attribute colors[4] = {
+        { v0.color.r(), v1.color.r(), v2.color.r() },
+        { v0.color.g(), v1.color.g(), v2.color.g() },
+        { v0.color.b(), v1.color.b(), v2.color.b() },
+        { v0.color.a(), v1.color.a(), v2.color.a() },
+    };
+    const SSE::Attribute texcoords[3][2] = {
+        { { v0.tc0.u(), v1.tc0.u(), v2.tc0.u() }, { v0.tc0.v(), v1.tc0.v(), v2.tc0.v() } },
+        { { v0.tc1.u(), v1.tc1.u(), v2.tc1.u() }, { v0.tc1.v(), v1.tc1.v(), v2.tc1.v() } },
+        { { v0.tc2.u(), v1.tc2.u(), v2.tc2.u() }, { v0.tc2.v(), v1.tc2.v(), v2.tc2.v() } },
+    };
+    const SSE::Attribute depth(v0.screenpos[2], v1.screenpos[2], v2.screenpos[2]);
+    const bool depth_test_enable = state.depth_test_enable;
+
+    // The depth of each pixel lies between the depths of the vertices, and the depth within a
+    // block between the ones at its corners. One unit of slack covers rounding differences.
+    const bool use_depth_bounds = depth_test_enable && depth_bounds_valid &&
+                                  depth_bounds_buffer == state.depth_buffer;
+    const u32 blocks_per_row = (state.width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const float vertex_z[3] = {
+        -v0.screenpos[2].ToFloat32() * 65535.f,
+        -v1.screenpos[2].ToFloat32() * 65535.f,
+        -v2.screenpos[2].ToFloat32() * 65535.f,
+    };
+    const float triangle_min_z = std::min({ vertex_z[0], vertex_z[1], vertex_z[2] }) - 1.0f;
+    const float triangle_max_z = std::max({ vertex_z[0], vertex_z[1], vertex_z[2] }) + 1.0f;
+    const __m128 corner_depth_scale = _mm_set1_ps(-65535.0f / (edges[0].Evaluate(min_x, min_y) +
+                                                               edges[1].Evaluate(min_x, min_y) +
+                                                               edges[2].Evaluate(min_x, min_y)));
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 color_scale = _mm_set1_ps(255.0f);
+    const __m128 depth_scale = _mm_set1_ps(65535.0f);
+    const __m128 sign_bit = _mm_set1_ps(-0.0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    // Blocks are aligned to the depth bounds grid. Pixels to the left of or above the bounding box
+    // lie outside of the triangle, so starting the blocks there doesn't draw anything extra.
+    const int block_step = BLOCK_SIZE * 0x10;
+    for (int block_y = min_y & ~(block_step - 1); block_y < max_y; block_y += block_step) {
+        for (int block_x = min_x & ~(block_step - 1); block_x < max_x; block_x += block_step) {
+            __m128i block_w[3];
+            __m128 corner_w[3];
+            bool fully_covered = true;
+            bool outside = false;
+            for (int i = 0; i < 3; ++i) {
+                const int w = edges[i].Evaluate(block_x, block_y);
+                block_w[i] = _mm_set1_epi32(w);
+
+                const __m128i corners = _mm_add_epi32(block_w[i], corner_offsets[i]);
+                corner_w[i] = _mm_cvtepi32_ps(corners);
+                const int negative_corners = _mm_movemask_ps(_mm_castsi128_ps(corners));
+                if (negative_corners == 0xF) {
+                    outside = true;
+                    break;
+                }
+                if (negative_corners != 0)
+                    fully_covered = false;
+            }
+            if (outside)
+                continue;
 
-                    case AlphaModifier::SourceGreen:
-                        return values.g();
+            if (use_depth_bounds) {
+                MEMORY_ALIGNED16(float corner_z[4]);
+                _mm_store_ps(corner_z, _mm_mul_ps(depth.Dot(corner_w[0], corner_w[1], corner_w[2]), corner_depth_scale));
+                const float block_min_z = std::max(std::min({ corner_z[0], corner_z[1], corner_z[2], corner_z[3] }) - 1.0f, triangle_min_z);
+                const float block_max_z = std::min(std::max({ corner_z[0], corner_z[1], corner_z[2], corner_z[3] }) + 1.0f, triangle_max_z);
 
-                    case AlphaModifier::OneMinusSourceGreen:
-                        return 255 - values.g();
+                const u32 block_index = (block_x >> 4) / BLOCK_SIZE + ((block_y >> 4) / BLOCK_SIZE) * blocks_per_row;
+                if (IsOccluded(state.depth_test_func, block_min_z, block_max_z, depth_bounds[block_index]))
+                    continue;
+            }
 
-                    case AlphaModifier::SourceBlue:
-                        return values.b();
+            // Set if any pixel of the block passed the depth test, and thus may have written depth
+            bool passed_depth_test = false;
 
-                    case AlphaModifier::OneMinusSourceBlue:
-                        return 255 - values.b();
-                    }
-                };
-
-                static auto ColorCombine = [](Operation op, const Math::Vec3<u8> input[3]) -> Math::Vec3<u8> {
-                    switch (op) {
-                    case Operation::Replace:
-                        return input[0];
-
-                    case Operation::Modulate:
-                        return ((input[0] * input[1]) / 255).Cast<u8>();
-
-                    case Operation::Add:
-                    {
-                        auto result = input[0] + input[1];
-                        result.r() = std::min(255, result.r());
-                        result.g() = std::min(255, result.g());
-                        result.b() = std::min(255, result.b());
-                        return result.Cast<u8>();
-                    }
+            for (int quad_y = 0; quad_y < BLOCK_SIZE; quad_y += 2) {
+                const int y = block_y + quad_y * 0x10;
+                if (y >= max_y)
+                    break;
 
-                    case Operation::Lerp:
-                        return ((input[0] * input[2] + input[1] * (Math::MakeVec<u8>(255, 255, 255) - input[2]).Cast<u8>()) / 255).Cast<u8>();
+                for (int quad_x = 0; quad_x < BLOCK_SIZE; quad_x += 2) {
+                    const int x = block_x + quad_x * 0x10;
+                    if (x >= max_x)
+                        break;
 
-                    case Operation::Subtract:
-                    {
-                        auto result = input[0].Cast<int>() - input[1].Cast<int>();
-                        result.r() = std::max(0, result.r());
-                        result.g() = std::max(0, result.g());
-                        result.b() = std::max(0, result.b());
-                        return result.Cast<u8>();
+                    // Lanes are the top-left, top-right, bottom-left and bottom-right pixels
+                    unsigned mask = 0xF;
+                    if (x + 0x10 >= max_x)
+                        mask &= 0x5;
+                    if (y + 0x10 >= max_y)
+                        mask &= 0x3;
+
+                    __m128i w[3];
+                    for (int i = 0; i < 3; ++i) {
+                        const int offset = quad_x * edges[i].step_x + quad_y * edges[i].step_y;
+                        w[i] = _mm_add_epi32(_mm_add_epi32(block_w[i], _mm_set1_epi32(offset)), quad_offsets[i]);
                     }
 
-                    default:
-                        LOG_ERROR(HW_GPU, "Unknown color combiner operation %d\n", (int)op);
-                        _dbg_assert_(HW_GPU, 0);
-                        return {};
+                    if (!fully_covered) {
+                        const __m128i any_negative = _mm_or_si128(_mm_or_si128(w[0], w[1]), w[2]);
+                        mask &= ~_mm_movemask_ps(_mm_castsi128_ps(any_negative));
+                    }
+                    if (mask == 0)
+                        continue;
+
+                    const __m128 w0 = _mm_cvtepi32_ps(w[0]);
+                    const __m128 w1 = _mm_cvtepi32_ps(w[1]);
+                    const __m128 w2 = _mm_cvtepi32_ps(w[2]);
+
+                    MEMORY_ALIGNED16(s32 z_values[4]);
+                    if (depth_test_enable) {
+                        const __m128 wsum = _mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(w[0], w[1]), w[2]));
+                        const __m128 z = _mm_div_ps(_mm_mul_ps(_mm_xor_ps(depth.Dot(w0, w1, w2), sign_bit), depth_scale), wsum);
+                        _mm_store_si128((__m128i*)z_values, _mm_cvttps_epi32(z));
+
+                        for (int lane = 0; lane < 4; ++lane) {
+                            if ((mask & (1 << lane)) &&
+                                !TestDepth(state, (x >> 4) + (lane & 1), (y >> 4) + (lane >> 1), (u16)z_values[lane]))
+                                mask &= ~(1 << lane);
+                        }
+                        if (mask == 0)
+                            continue;
+                        passed_depth_test = true;
+                    } else {
+                        _mm_store_si128((__m128i*)z_values, zero);
                     }
-                };
-
-                static auto AlphaCombine = [](Operation op, const std::array<u8,3>& input) -> u8 {
-                    switch (op) {
-                    case Operation::Replace:
-                        return input[0];
-
-                    case Operation::Modulate:
-                        return input[0] * input[1] / 255;
 
-                    case Operation::Add:
-                        return std::min(255, input[0] + input[1]);
+                    const __m128 interpolated_w_inverse = _mm_div_ps(one, w_inverse.Dot(w0, w1, w2));
 
-                    case Operation::Lerp:
-                        return (input[0] * input[2] + input[1] * (255 - input[2])) / 255;
+                    // Color components are converted to u8 the same way a cast from float does
+                    MEMORY_ALIGNED16(s32 color_values[4][4]);
+                    for (int c = 0; c < 4; ++c) {
+                        const __m128 value = _mm_mul_ps(colors[c].Dot(w0, w1, w2), interpolated_w_inverse);
+                        _mm_store_si128((__m128i*)color_values[c], _mm_cvttps_epi32(_mm_mul_ps(value, color_scale)));
+                    }
 
-                    case Operation::Subtract:
-                        return std::max(0, (int)input[0] - (int)input[1]);
+                    MEMORY_ALIGNED16(float uv_values[3][2][4]);
+                    for (int t = 0; t < 3; ++t) {
+                        if (state.textures[t].texture == nullptr)
+                            continue;
+                        for (int c = 0; c < 2; ++c)
+                            _mm_store_ps(uv_values[t][c], _mm_mul_ps(texcoords[t][c].Dot(w0, w1, w2), interpolated_w_inverse));
+                    }
 
-                    default:
-                        LOG_ERROR(HW_GPU, "Unknown alpha combiner operation %d\n", (int)op);
-                        _dbg_assert_(HW_GPU, 0);
-                        return 0;
+                    for (int lane = 0; lane < 4; ++lane) {
+                        if (!(mask & (1 << lane)))
+                            continue;
+
+                        const Math::Vec4<u8> primary_color{
+                            (u8)color_values[0][lane], (u8)color_values[1][lane],
+                            (u8)color_values[2][lane], (u8)color_values[3][lane]
+                        };
+
+                        Math::Vec2<float24> uv[3];
+                        for (int t = 0; t < 3; ++t) {
+                            if (state.textures[t].texture == nullptr)
+                                continue;
+                            uv[t].u() = float24::FromFloat32(uv_values[t][0][lane]);
+                            uv[t].v() = float24::FromFloat32(uv_values[t][1][lane]);
+                        }
+
+                        ShadePixel(state, (x >> 4) + (lane & 1), (y >> 4) + (lane >> 1), primary_color, uv,
+                                   (u16)z_values[lane]);
                     }
-                };
-
-                // color combiner
-                // NOTE: Not sure if the alpha combiner might use the color output of the previous
-                //       stage as input. Hence, we currently don't directly write the result to
-                //       combiner_output.rgb(), but instead store it in a temporary variable until
-                //       alpha combining has been done.
-                Math::Vec3<u8> color_result[3] = {
-                    GetColorModifier(tev_stage.color_modifier1, GetSource(tev_stage.color_source1)),
-                    GetColorModifier(tev_stage.color_modifier2, GetSource(tev_stage.color_source2)),
-                    GetColorModifier(tev_stage.color_modifier3, GetSource(tev_stage.color_source3))
-                };
-                auto color_output = ColorCombine(tev_stage.color_op, color_result);
-
-                // alpha combiner
-                std::array<u8,3> alpha_result = {
-                    GetAlphaModifier(tev_stage.alpha_modifier1, GetSource(tev_stage.alpha_source1)),
-                    GetAlphaModifier(tev_stage.alpha_modifier2, GetSource(tev_stage.alpha_source2)),
-                    GetAlphaModifier(tev_stage.alpha_modifier3, GetSource(tev_stage.alpha_source3))
-                };
-                auto alpha_output = AlphaCombine(tev_stage.alpha_op, alpha_result);
-
-                combiner_output = Math::MakeVec(color_output, alpha_output);
+                }
             }
 
-            if (registers.output_merger.alpha_test.enable) {
-                bool pass = false;
-
-                switch (registers.output_merger.alpha_test.func) {
-                case registers.output_merger.Never:
-                    pass = false;
-                    break;
+            if (use_depth_bounds && state.depth_write_enable && passed_depth_test)
+                UpdateDepthBounds(state, block_x >> 4, block_y >> 4);
+        }
+    }
+}
 
-                case registers.output_merger.Always:
-                    pass = true;
-                    break;
+#endif // x86-64
 
-                case registers.output_merger.Equal:
-                    pass = combiner_output.a() == registers.output_merger.alpha_test.ref;
-                    break;
-
-                case registers.output_merger.NotEqual:
-                    pass = combiner_output.a() != registers.output_merger.alpha_test.ref;
-                    break;
+/**
+ * Draws the pixels of a triangle which lie within the given rectangle.
+ * Only reads the current register state and writes to the framebuffer, so that triangles can be
+ * drawn on any thread as long as no two threads draw to the same pixels.
+ * @param clip_min_x,clip_min_y,clip_max_x,clip_max_y Rectangle in rasterizer coordinates
+ */
+static void DrawTriangle(const DrawState& state, const Triangle& triangle,
+                         u16 clip_min_x, u16 clip_min_y, u16 clip_max_x, u16 clip_max_y)
+{
+    const u16 min_x = std::max(triangle.min_x, clip_min_x);
+    const u16 min_y = std::max(triangle.min_y, clip_min_y);
+    const u16 max_x = std::min(triangle.max_x, clip_max_x);
+    const u16 max_y = std::min(triangle.max_y, clip_max_y);
+    if (min_x >= max_x || min_y >= max_y)
+        return;
+
+#if defined(__x86_64__) || defined(_M_AMD64)
+    // Set if the scalar loop below needs to keep the depth bounds up to date
+    bool keep_depth_bounds = false;
+    if (Settings::values.use_simd_rasterizer) {
+        // Setting up the SSE loop costs more than it saves for tiny triangles
+        const u32 area = ((max_x - min_x) >> 4) * ((max_y - min_y) >> 4);
+        if (area >= MIN_SSE_TRIANGLE_AREA) {
+            DrawTriangleSSE(state, triangle, min_x, min_y, max_x, max_y);
+            return;
+        }
+        keep_depth_bounds = state.depth_test_enable && state.depth_write_enable && depth_bounds_valid &&
+                            depth_bounds_buffer == state.depth_buffer;
+    }
+#endif
 
-                case registers.output_merger.LessThan:
-                    pass = combiner_output.a() < registers.output_merger.alpha_test.ref;
-                    break;
+    const auto& v0 = triangle.v0;
+    const auto& v1 = triangle.v1;
+    const auto& v2 = triangle.v2;
+    const Math::Vec3<Fix12P4>* vtxpos = triangle.vtxpos;
+    const int bias0 = triangle.bias0;
+    const int bias1 = triangle.bias1;
+    const int bias2 = triangle.bias2;
 
-                case registers.output_merger.LessThanOrEqual:
-                    pass = combiner_output.a() <= registers.output_merger.alpha_test.ref;
-                    break;
+    auto w_inverse = Math::MakeVec(v0.pos.w, v1.pos.w, v2.pos.w);
 
-                case registers.output_merger.GreaterThan:
-                    pass = combiner_output.a() > registers.output_merger.alpha_test.ref;
-                    break;
+    // TODO: Not sure if looping through x first might be faster
+    for (u16 y = min_y; y < max_y; y += 0x10) {
+        for (u16 x = min_x; x < max_x; x += 0x10) {
 
-                case registers.output_merger.GreaterThanOrEqual:
-                    pass = combiner_output.a() >= registers.output_merger.alpha_test.ref;
-                    break;
-                }
+            // Calculate the barycentric coordinates w0, w1 and w2
+            int w0 = bias0 + SignedArea(vtxpos[1].xy(), vtxpos[2].xy(), {x, y});
+            int w1 = bias1 + SignedArea(vtxpos[2].xy(), vtxpos[0].xy(), {x, y});
+            int w2 = bias2 + SignedArea(vtxpos[0].xy(), vtxpos[1].xy(), {x, y});
+            int wsum = w0 + w1 + w2;
 
-                if (!pass)
-                    continue;
-            }
+            // If current pixel is not covered by the current primitive
+            if (w0 < 0 || w1 < 0 || w2 < 0)
+                continue;
 
-            // TODO: Does depth indeed only get written even if depth testing is enabled?
-            if (registers.output_merger.depth_test_enable) {
-                u16 z = (u16)(-(v0.screenpos[2].ToFloat32() * w0 +
+            u16 z = 0;
+            if (state.depth_test_enable) {
+                z = (u16)(-(v0.screenpos[2].ToFloat32() * w0 +
                             v1.screenpos[2].ToFloat32() * w1 +
                             v2.screenpos[2].ToFloat32() * w2) * 65535.f / wsum);
-                u16 ref_z = GetDepth(x >> 4, y >> 4);
-
-                bool pass = false;
-
-                switch (registers.output_merger.depth_test_func) {
-                case registers.output_merger.Never:
-                    pass = false;
-                    break;
-
-                case registers.output_merger.Always:
-                    pass = true;
-                    break;
-
-                case registers.output_merger.Equal:
-                    pass = z == ref_z;
-                    break;
-
-                case registers.output_merger.NotEqual:
-                    pass = z != ref_z;
-                    break;
+                if (!TestDepth(state, x >> 4, y >> 4, z))
+                    continue;
+#if defined(__x86_64__) || defined(_M_AMD64)
+                if (keep_depth_bounds)
+                    ExpandDepthBounds(state, x >> 4, y >> 4, z);
+#endif
+            }
 
-                case registers.output_merger.LessThan:
-                    pass = z < ref_z;
-                    break;
+            auto baricentric_coordinates = Math::MakeVec(float24::FromFloat32(static_cast<float>(w0)),
+                                                float24::FromFloat32(static_cast<float>(w1)),
+                                                float24::FromFloat32(static_cast<float>(w2)));
+            float24 interpolated_w_inverse = float24::FromFloat32(1.0f) / Math::Dot(w_inverse, baricentric_coordinates);
 
-                case registers.output_merger.LessThanOrEqual:
-                    pass = z <= ref_z;
-                    break;
+            // Perspective correct attribute interpolation:
+            // Attribute values cannot be calculated by simple linear interpolation since
+            // they are not linear in screen space. For example, when interpolating a
+            // texture coordinate across two vertices, something simple like
+            //     u = (u0*w0 + u1*w1)/(w0+w1)
+            // will not work. However, the attribute value divided by the
+            // clipspace w-coordinate (u/w) and and the inverse w-coordinate (1/w) are linear
+            // in screenspace. Hence, we can linearly interpolate these two independently and
+            // calculate the interpolated attribute by dividing the results.
+            // I.e.
+            //     u_over_w   = ((u0/v0.pos.w)*w0 + (u1/v1.pos.w)*w1)/(w0+w1)
+            //     one_over_w = (( 1/v0.pos.w)*w0 + ( 1/v1.pos.w)*w1)/(w0+w1)
+            //     u = u_over_w / one_over_w
+            //
+            // The generalization to three vertices is straightforward in baricentric coordinates.
+            auto GetInterpolatedAttribute = [&](float24 attr0, float24 attr1, float24 attr2) {
+                auto attr_over_w = Math::MakeVec(attr0, attr1, attr2);
+                float24 interpolated_attr_over_w = Math::Dot(attr_over_w, baricentric_coordinates);
+                return interpolated_attr_over_w * interpolated_w_inverse;
+            };
 
-                case registers.output_merger.GreaterThan:
-                    pass = z > ref_z;
-                    break;
+            Math::Vec4<u8> primary_color{
+                (u8)(GetInterpolatedAttribute(v0.color.r(), v1.color.r(), v2.color.r()).ToFloat32() * 255),
+                (u8)(GetInterpolatedAttribute(v0.color.g(), v1.color.g(), v2.color.g()).ToFloat32() * 255),
+                (u8)(GetInterpolatedAttribute(v0.color.b(), v1.color.b(), v2.color.b()).ToFloat32() * 255),
+                (u8)(GetInterpolatedAttribute(v0.color.a(), v1.color.a(), v2.color.a()).ToFloat32() * 255)
+            };
 
-                case registers.output_merger.GreaterThanOrEqual:
-                    pass = z >= ref_z;
-                    break;
-                }
+            Math::Vec2<float24> uv[3];
+            uv[0].u() = GetInterpolatedAttribute(v0.tc0.u(), v1.tc0.u(), v2.tc0.u());
+            uv[0].v() = GetInterpolatedAttribute(v0.tc0.v(), v1.tc0.v(), v2.tc0.v());
+            uv[1].u() = GetInterpolatedAttribute(v0.tc1.u(), v1.tc1.u(), v2.tc1.u());
+            uv[1].v() = GetInterpolatedAttribute(v0.tc1.v(), v1.tc1.v(), v2.tc1.v());
+            uv[2].u() = GetInterpolatedAttribute(v0.tc2.u(), v1.tc2.u(), v2.tc2.u());
+            uv[2].v() = GetInterpolatedAttribute(v0.tc2.v(), v1.tc2.v(), v2.tc2.v());
 
-                if (!pass)
-                    continue;
+            ShadePixel(state, x >> 4, y >> 4, primary_color, uv, z);
+        }
+    }
+}
 
-                if (registers.output_merger.depth_write_enable)
-                    SetDepth(x >> 4, y >> 4, z);
-            }
+// Edge length of the square screen tiles triangles are sorted into, in pixels
+static const unsigned TILE_SIZE = 32;
+
+// Number of queued triangles after which they get drawn regardless of state changes, so that
+// draws with huge numbers of triangles don't use up unbounded amounts of memory
+static const size_t MAX_QUEUED_TRIANGLES = 8192;
+
+// Worker threads used to draw tiles, created on the first flush
+static std::unique_ptr<Common::ThreadPool> thread_pool;
+static int thread_pool_setting = -1;
+
+// Triangles queued since the last flush, in submission order, and the draw state they share
+static std::vector<Triangle> queued_triangles;
+static DrawState queued_state;
+
+// Indices into queued_triangles for each tile touched by them, in submission order. Tiles are
+// stored row by row.
+static std::vector<std::vector<u32>> tile_bins;
+static unsigned num_tiles_x = 0;
+static unsigned num_tiles_y = 0;
+
+// Rows of the framebuffer drawn to since caches of guest memory were last notified about it.
+// Triangles are only drawn to the framebuffer given by the current registers, and changing them
+// flushes, so the rows always belong to that framebuffer.
+static u32 dirty_min_y = 0;
+static u32 dirty_max_y = 0;
+
+/// Adds the rows covered by a triangle's bounding box to the dirty rows of the framebuffer
+static void MarkFramebufferDirty(const DrawState& state, const Triangle& triangle) {
+    const u32 min_y = triangle.min_y >> 4;
+    const u32 max_y = std::min<u32>((triangle.max_y + 0xF) >> 4, state.height);
+    if (min_y >= max_y)
+        return;
+
+    if (dirty_min_y >= dirty_max_y) {
+        dirty_min_y = min_y;
+        dirty_max_y = max_y;
+    } else {
+        dirty_min_y = std::min(dirty_min_y, min_y);
+        dirty_max_y = std::max(dirty_max_y, max_y);
+    }
+}
 
-            auto dest = GetPixel(x >> 4, y >> 4);
+/// Notifies caches of guest memory, in particular the texture cache, about the drawn rows
+static void InvalidateFramebuffer() {
+    if (dirty_min_y >= dirty_max_y)
+        return;
 
-            if (registers.output_merger.alphablend_enable) {
-                auto params = registers.output_merger.alpha_blending;
+    const auto& framebuffer = registers.framebuffer;
+    const u32 width = framebuffer.GetWidth();
+    const u32 first_pixel = dirty_min_y * width;
+    const u32 num_pixels = (dirty_max_y - dirty_min_y) * width;
+    dirty_min_y = dirty_max_y = 0;
 
-                auto LookupFactorRGB = [&](decltype(params)::BlendFactor factor) -> Math::Vec3<u8> {
-                    switch (factor) {
-                    case params.Zero:
-                        return Math::Vec3<u8>(0, 0, 0);
+    Memory::InvalidateRegion(PAddrToVAddr(framebuffer.GetColorBufferPhysicalAddress()) + first_pixel * 4,
+                             num_pixels * 4);
 
-                    case params.One:
-                        return Math::Vec3<u8>(255, 255, 255);
+    // The rasterizer keeps the depth bounds up to date itself while drawing
+    Memory::InvalidateRegion(PAddrToVAddr(framebuffer.GetDepthBufferPhysicalAddress()) + first_pixel * 2,
+                             num_pixels * 2, Memory::PageWatch::DepthBuffer);
+}
 
-                    case params.SourceColor:
-                        return combiner_output.rgb();
+/// Returns the worker pool for drawing tiles, or nullptr if triangles are drawn immediately
+static Common::ThreadPool* GetThreadPool() {
+    const int num_threads = Settings::values.gpu_worker_threads;
+    if (num_threads != thread_pool_setting) {
+        Flush();
+        thread_pool.reset();
+        thread_pool_setting = num_threads;
+
+        // The thread executing GPU commands draws tiles as well, so it doesn't count towards the pool size
+        const unsigned num_drawing_threads = (num_threads > 0) ? num_threads : Common::ThreadPool::HardwareConcurrency();
+        if (num_drawing_threads > 1)
+            thread_pool = Common::make_unique<Common::ThreadPool>(num_drawing_threads - 1);
+    }
+    return thread_pool.get();
+}
 
-                    case params.OneMinusSourceColor:
-                        return Math::Vec3<u8>(255 - combiner_output.r(), 255 - combiner_output.g(), 255 - combiner_output.b());
+DrawState GetDrawState() {
+    DrawState state;
 
-                    case params.DestColor:
-                        return dest.rgb();
+    const auto& framebuffer = registers.framebuffer;
+    state.color_buffer = reinterpret_cast<u32*>(Memory::GetPointer(PAddrToVAddr(framebuffer.GetColorBufferPhysicalAddress())));
+    state.depth_buffer = reinterpret_cast<u16*>(Memory::GetPointer(PAddrToVAddr(framebuffer.GetDepthBufferPhysicalAddress())));
+    state.width = framebuffer.GetWidth();
+    state.height = framebuffer.GetHeight();
 
-                    case params.OneMinusDestColor:
-                        return Math::Vec3<u8>(255 - dest.r(), 255 - dest.g(), 255 - dest.b());
+    state.cull_mode = registers.cull_mode;
 
-                    case params.SourceAlpha:
-                        return Math::Vec3<u8>(combiner_output.a(), combiner_output.a(), combiner_output.a());
+    const auto& output_merger = registers.output_merger;
+    state.depth_test_enable = output_merger.depth_test_enable != 0;
+    state.depth_write_enable = output_merger.depth_write_enable != 0;
+    state.depth_test_func = output_merger.depth_test_func;
 
-                    case params.OneMinusSourceAlpha:
-                        return Math::Vec3<u8>(255 - combiner_output.a(), 255 - combiner_output.a(), 255 - combiner_output.a());
+    state.pipeline = &PixelPipeline::GetPipeline();
 
-                    case params.DestAlpha:
-                        return Math::Vec3<u8>(dest.a(), dest.a(), dest.a());
+    const auto textures = registers.GetTextures();
+    for (int i = 0; i < 3; ++i) {
+        auto& unit = state.textures[i];
+        unit.wrap_s = textures[i].config.wrap_s;
+        unit.wrap_t = textures[i].config.wrap_t;
+        if (textures[i].enabled && state.pipeline->uses_texture[i]) {
+            _dbg_assert_(HW_GPU, 0 != textures[i].config.address);
+            unit.texture = TextureCache::Get(textures[i].config, textures[i].format);
+        }
+    }
 
-                    case params.OneMinusDestAlpha:
-                        return Math::Vec3<u8>(255 - dest.a(), 255 - dest.a(), 255 - dest.a());
+    return state;
+}
 
-                    case params.ConstantColor:
-                        return Math::Vec3<u8>(registers.output_merger.blend_const.r, registers.output_merger.blend_const.g, registers.output_merger.blend_const.b);
+void ProcessTriangle(const DrawState& state,
+                     const VertexShader::OutputVertex& v0,
+                     const VertexShader::OutputVertex& v1,
+                     const VertexShader::OutputVertex& v2)
+{
+    // The debugger inspects the framebuffer after each primitive batch, so don't defer drawing
+    // while it's attached
+    if (g_debug_context || GetThreadPool() == nullptr) {
+        Flush();
+
+        Triangle triangle;
+        if (SetupTriangle(state, v0, v1, v2, triangle)) {
+            PrepareDepthBounds(state);
+            DrawTriangle(state, triangle, 0, 0, 0xFFFF, 0xFFFF);
+            MarkFramebufferDirty(state, triangle);
+        }
+        return;
+    }
 
-                    case params.OneMinusConstantColor:
-                        return Math::Vec3<u8>(255 - registers.output_merger.blend_const.r, 255 - registers.output_merger.blend_const.g, 255 - registers.output_merger.blend_const.b);
+    // Register changes flush the queue already, but texture memory may have been modified between
+    // draws using the same registers
+    if (!queued_triangles.empty()) {
+        for (int i = 0; i < 3; ++i) {
+            if (state.textures[i].texture != queued_state.textures[i].texture) {
+                Flush();
+                break;
+            }
+        }
+    }
 
-                    case params.ConstantAlpha:
-                        return Math::Vec3<u8>(registers.output_merger.blend_const.a, registers.output_merger.blend_const.a, registers.output_merger.blend_const.a);
+    if (queued_triangles.empty()) {
+        queued_state = state;
+        num_tiles_x = (state.width + TILE_SIZE - 1) / TILE_SIZE;
+        num_tiles_y = (state.height + TILE_SIZE - 1) / TILE_SIZE;
+        tile_bins.resize(num_tiles_x * num_tiles_y);
+    }
 
-                    case params.OneMinusConstantAlpha:
-                        return Math::Vec3<u8>(255 - registers.output_merger.blend_const.a, 255 - registers.output_merger.blend_const.a, 255 - registers.output_merger.blend_const.a);
+    queued_triangles.emplace_back();
+    Triangle& triangle = queued_triangles.back();
+    if (!SetupTriangle(state, v0, v1, v2, triangle)) {
+        queued_triangles.pop_back();
+        return;
+    }
 
-                    default:
-                        LOG_CRITICAL(HW_GPU, "Unknown color blend factor %x", factor);
-                        exit(0);
-                        break;
-                    }
-                };
+    // Empty bounding boxes, e.g. for triangles which are entirely outside of the framebuffer
+    if (triangle.min_x >= triangle.max_x || triangle.min_y >= triangle.max_y) {
+        queued_triangles.pop_back();
+        return;
+    }
 
-                auto LookupFactorA = [&](decltype(params)::BlendFactor factor) -> u8 {
-                    switch (factor) {
-                    case params.Zero:
-                        return 0;
+    MarkFramebufferDirty(state, triangle);
 
-                    case params.One:
-                        return 255;
+    const u32 index = static_cast<u32>(queued_triangles.size() - 1);
+    const unsigned first_tile_x = (triangle.min_x >> 4) / TILE_SIZE;
+    const unsigned first_tile_y = (triangle.min_y >> 4) / TILE_SIZE;
+    const unsigned last_tile_x = ((triangle.max_x >> 4) - 1) / TILE_SIZE;
+    const unsigned last_tile_y = ((triangle.max_y >> 4) - 1) / TILE_SIZE;
+    for (unsigned tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y)
+        for (unsigned tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x)
+            tile_bins[tile_x + tile_y * num_tiles_x].push_back(index);
 
-                    case params.SourceAlpha:
-                        return combiner_output.a();
+    if (queued_triangles.size() >= MAX_QUEUED_TRIANGLES)
+        Flush();
+}
 
-                    case params.OneMinusSourceAlpha:
-                        return 255 - combiner_output.a();
+/// Draws the queued triangles touching a tile in submission order
+static void DrawTile(unsigned tile) {
+    const u16 clip_min_x = static_cast<u16>((tile % num_tiles_x) * TILE_SIZE) << 4;
+    const u16 clip_min_y = static_cast<u16>((tile / num_tiles_x) * TILE_SIZE) << 4;
+    const u16 clip_max_x = clip_min_x + (TILE_SIZE << 4);
+    const u16 clip_max_y = clip_min_y + (TILE_SIZE << 4);
 
-                    case params.DestAlpha:
-                        return dest.a();
+    for (u32 index : tile_bins[tile])
+        DrawTriangle(queued_state, queued_triangles[index], clip_min_x, clip_min_y, clip_max_x, clip_max_y);
+}
 
-                    case params.OneMinusDestAlpha:
-                        return 255 - dest.a();
+void Flush() {
+    if (queued_triangles.empty()) {
+        // Triangles drawn immediately only mark the framebuffer dirty
+        InvalidateFramebuffer();
+        return;
+    }
 
-                    case params.ConstantAlpha:
-                        return registers.output_merger.blend_const.a;
+    // Each tile covers a distinct set of pixels, so tiles can be drawn in any order and in
+    // parallel. Threads grab the next undrawn tile until all of them are done.
+    PrepareDepthBounds(queued_state);
 
-                    case params.OneMinusConstantAlpha:
-                        return 255 - registers.output_merger.blend_const.a;
+    const unsigned num_tiles = num_tiles_x * num_tiles_y;
+    std::atomic<unsigned> next_tile(0);
+    auto draw_tiles = [num_tiles, &next_tile] {
+        for (unsigned tile = next_tile++; tile < num_tiles; tile = next_tile++)
+            DrawTile(tile);
+    };
 
-                    default:
-                        LOG_CRITICAL(HW_GPU, "Unknown alpha blend factor %x", factor);
-                        exit(0);
-                        break;
-                    }
-                };
-
-                auto srcfactor = Math::MakeVec(LookupFactorRGB(params.factor_source_rgb),
-                                               LookupFactorA(params.factor_source_a));
-                auto dstfactor = Math::MakeVec(LookupFactorRGB(params.factor_dest_rgb),
-                                               LookupFactorA(params.factor_dest_a));
-
-                switch (params.blend_equation_rgb) {
-                case params.Add:
-                {
-                    auto result = (combiner_output * srcfactor + dest * dstfactor) / 255;
-                    result.r() = std::min(255, result.r());
-                    result.g() = std::min(255, result.g());
-                    result.b() = std::min(255, result.b());
-                    combiner_output = result.Cast<u8>();
-                    break;
-                }
+    std::vector<std::future<void>> workers;
+    if (thread_pool != nullptr) {
+        for (unsigned i = 0; i < thread_pool->NumThreads(); ++i)
+            workers.push_back(thread_pool->Push(draw_tiles));
+    }
+    draw_tiles();
+    for (auto& worker : workers)
+        worker.get();
 
-                default:
-                    LOG_CRITICAL(HW_GPU, "Unknown RGB blend equation %x", params.blend_equation_rgb.Value());
-                    exit(0);
-                }
-            } else {
-                LOG_CRITICAL(HW_GPU, "logic op: %x", registers.output_merger.logic_op);
-                exit(0);
-            }
+    InvalidateFramebuffer();
 
-            const Math::Vec4<u8> result = {
-                registers.output_merger.red_enable   ? combiner_output.r() : dest.r(),
-                registers.output_merger.green_enable ? combiner_output.g() : dest.g(),
-                registers.output_merger.blue_enable  ? combiner_output.b() : dest.b(),
-                registers.output_merger.alpha_enable ? combiner_output.a() : dest.a()
-            };
+    // Release the textures referenced by the state
+    queued_state = DrawState();
+    queued_triangles.clear();
+    for (auto& bin : tile_bins)
+        bin.clear();
+}
 
-            DrawPixel(x >> 4, y >> 4, result);
-        }
-    }
+void Shutdown() {
+    Flush();
+    thread_pool.reset();
+    thread_pool_setting = -1;
+    PixelPipeline::ClearCache();
+    TextureCache::ClearCache();
+    depth_bounds.clear();
+    depth_bounds_valid = false;
 }
 
 } // namespace Rasterizer
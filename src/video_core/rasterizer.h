@@ -4,6 +4,15 @@
 
 #pragma once
 
+#include <array>
+#include <memory>
+
+#include "common/common_types.h"
+
+#include "pica.h"
+#include "pixel_pipeline.h"
+#include "texture_cache.h"
+
 namespace Pica {
 
 namespace VertexShader {
@@ -12,10 +21,63 @@ namespace VertexShader {
 
 namespace Rasterizer {
 
-void ProcessTriangle(const VertexShader::OutputVertex& v0,
+/**
+ * Register state used for drawing, resolved once per draw into the form used by the per-pixel
+ * code: framebuffer host pointers, decoded textures and the compiled pixel pipeline.
+ */
+struct DrawState {
+    // Assuming RGBA8 color and 16-bit depth buffers until actual format handling is implemented
+    u32* color_buffer;
+    u16* depth_buffer;
+
+    /// Framebuffer dimensions in pixels, the width also being the row stride of both buffers
+    u32 width;
+    u32 height;
+
+    Regs::CullMode cull_mode;
+
+    bool depth_test_enable;
+    bool depth_write_enable;
+    typedef decltype(Regs::output_merger)::CompareFunc CompareFunc;
+    CompareFunc depth_test_func;
+
+    struct TextureUnit {
+        /// Decoded texture, nullptr if the unit is disabled or not read by the pixel pipeline
+        std::shared_ptr<const TextureCache::CachedTexture> texture;
+        Regs::TextureConfig::WrapMode wrap_s;
+        Regs::TextureConfig::WrapMode wrap_t;
+    };
+    std::array<TextureUnit, 3> textures;
+
+    const PixelPipeline::Pipeline* pipeline;
+};
+
+/**
+ * Resolves the current register state for drawing. This is done once when a draw is triggered,
+ * the result being passed along with all of its triangles.
+ */
+DrawState GetDrawState();
+
+/**
+ * Submits a triangle for rasterization. When multiple GPU worker threads are enabled, triangles
+ * are only sorted into screen tiles here and drawn on the next call to Flush(). All triangles
+ * queued until then need to share the same draw state.
+ */
+void ProcessTriangle(const DrawState& state,
+                     const VertexShader::OutputVertex& v0,
                      const VertexShader::OutputVertex& v1,
                      const VertexShader::OutputVertex& v2);
 
+/**
+ * Draws all queued triangles and notifies caches of guest memory about the drawn pixels. Needs to
+ * be called before any register state used for drawing is changed, and before the framebuffer
+ * contents are accessed by anything else.
+ */
+void Flush();
+
+/// Draws all queued triangles and stops the worker threads used for rasterization
+void Shutdown();
+
 } // namespace Rasterizer
 
 } // namespace Pica
@@ -0,0 +1,174 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/emu_window.h"
+#include "common/file_util.h"
+#include "common/hash.h"
+#include "common/string_util.h"
+
+#include "core/mem_map.h"
+#include "core/hw/gpu_transfer.h"
+
+#include "video_core/color.h"
+#include "video_core/renderer_headless/renderer_headless.h"
+
+/// Decodes the pixel at the given address to 8-bit RGB
+static void DecodePixel(GPU::Regs::PixelFormat format, const u8* pixel, u8 rgb[3]) {
+    u16 value;
+    std::memcpy(&value, pixel, sizeof(value));
+
+    switch (format) {
+    case GPU::Regs::PixelFormat::RGBA8:
+        rgb[0] = pixel[3];
+        rgb[1] = pixel[2];
+        rgb[2] = pixel[1];
+        break;
+
+    case GPU::Regs::PixelFormat::RGB8:
+        rgb[0] = pixel[2];
+        rgb[1] = pixel[1];
+        rgb[2] = pixel[0];
+        break;
+
+    case GPU::Regs::PixelFormat::RGB565:
+        rgb[0] = Color::Convert5To8(value >> 11);
+        rgb[1] = Color::Convert6To8((value >> 5) & 0x3F);
+        rgb[2] = Color::Convert5To8(value & 0x1F);
+        break;
+
+    case GPU::Regs::PixelFormat::RGB5A1:
+        rgb[0] = Color::Convert5To8(value >> 11);
+        rgb[1] = Color::Convert5To8((value >> 6) & 0x1F);
+        rgb[2] = Color::Convert5To8((value >> 1) & 0x1F);
+        break;
+
+    case GPU::Regs::PixelFormat::RGBA4:
+        rgb[0] = Color::Convert4To8(value >> 12);
+        rgb[1] = Color::Convert4To8((value >> 8) & 0xF);
+        rgb[2] = Color::Convert4To8((value >> 4) & 0xF);
+        break;
+
+    default:
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        break;
+    }
+}
+
+/// RendererHeadless constructor
+RendererHeadless::RendererHeadless()
+    : render_window(nullptr), screens(), hashing(false), dump_interval(1) {
+}
+
+/// RendererHeadless destructor
+RendererHeadless::~RendererHeadless() {
+}
+
+/// Swap buffers (render frame)
+void RendererHeadless::SwapBuffers() {
+    for (int i : {0, 1}) {
+        LoadFramebuffer(GPU::g_regs.framebuffer_config[i], screens[i]);
+        if (hashing)
+            screens[i].hash = GetMurmurHash3(screens[i].data.data(), static_cast<int>(screens[i].data.size()), 0);
+    }
+    if (hashing)
+        frame_hashes.push_back({{ screens[0].hash, screens[1].hash }});
+
+    if (!dump_directory.empty() && m_current_frame % dump_interval == 0) {
+        DumpScreen(screens[0], Common::StringFromFormat("%s/frame%06d_top.ppm", dump_directory.c_str(), m_current_frame));
+        DumpScreen(screens[1], Common::StringFromFormat("%s/frame%06d_bottom.ppm", dump_directory.c_str(), m_current_frame));
+    }
+
+    m_current_frame++;
+
+    render_window->PollEvents();
+    render_window->SwapBuffers();
+}
+
+/**
+ * Copies the framebuffer currently read by the LCD into the screen
+ */
+void RendererHeadless::LoadFramebuffer(const GPU::Regs::FramebufferConfig& framebuffer, Screen& screen) {
+    const VAddr framebuffer_vaddr = Memory::PhysicalToVirtualAddress(
+        framebuffer.active_fb == 0 ? framebuffer.address_left1 : framebuffer.address_left2);
+
+    screen.width = framebuffer.width;
+    screen.height = framebuffer.height;
+    screen.stride = framebuffer.stride;
+    screen.format = framebuffer.color_format;
+
+    // Rows are never read past the framebuffer width, so a stride smaller than that is bogus
+    const u32 row_size = screen.width * GPU::BytesPerPixel(screen.format);
+    if (screen.stride < row_size) {
+        LOG_ERROR(Render_Headless, "Framebuffer stride 0x%x smaller than its rows (0x%x bytes)",
+                  screen.stride, row_size);
+        screen.stride = row_size;
+    }
+
+    const u8* framebuffer_data = Memory::GetPointer(framebuffer_vaddr);
+    if (framebuffer_data == nullptr) {
+        LOG_ERROR(Render_Headless, "Framebuffer at invalid address 0x%08x", framebuffer_vaddr);
+        screen.data.assign(screen.stride * screen.height, 0);
+        return;
+    }
+
+    screen.data.assign(framebuffer_data, framebuffer_data + screen.stride * screen.height);
+}
+
+/**
+ * Writes the screen, rotated the same way the LCD displays it, to a PPM image
+ */
+void RendererHeadless::DumpScreen(const Screen& screen, const std::string& filename) {
+    // Framebuffers are stored column-major, so their height is the width of the image
+    const u32 image_width = screen.height;
+    const u32 image_height = screen.width;
+    const u32 bytes_per_pixel = GPU::BytesPerPixel(screen.format);
+
+    std::string header = Common::StringFromFormat("P6\n%u %u\n255\n", image_width, image_height);
+    std::vector<u8> image(header.begin(), header.end());
+    image.resize(header.size() + image_width * image_height * 3);
+
+    u8* out = &image[header.size()];
+    for (u32 y = 0; y < image_height; ++y) {
+        for (u32 x = 0; x < image_width; ++x) {
+            const u8* pixel = &screen.data[x * screen.stride + (screen.width - 1 - y) * bytes_per_pixel];
+            DecodePixel(screen.format, pixel, out);
+            out += 3;
+        }
+    }
+
+    FileUtil::IOFile file(filename, "wb");
+    if (!file.IsOpen() || !file.WriteBytes(image.data(), image.size()))
+        LOG_ERROR(Render_Headless, "Failed to write frame dump %s", filename.c_str());
+}
+
+/**
+ * Writes both screens to the given directory every interval frames, as PPM images
+ */
+void RendererHeadless::SetFrameDump(const std::string& directory, int interval) {
+    dump_directory = directory;
+    dump_interval = std::max(interval, 1);
+
+    if (!dump_directory.empty() && !FileUtil::IsDirectory(dump_directory))
+        FileUtil::CreateFullPath(dump_directory + "/");
+}
+
+/**
+ * Set the emulator window to use for renderer
+ * @param window EmuWindow handle to emulator window to use for rendering
+ */
+void RendererHeadless::SetWindow(EmuWindow* window) {
+    render_window = window;
+}
+
+/// Initialize the renderer
+void RendererHeadless::Init() {
+    LOG_INFO(Render_Headless, "Presenting frames to memory");
+}
+
+/// Shutdown the renderer
+void RendererHeadless::ShutDown() {
+}
@@ -0,0 +1,90 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "common/common_types.h"
+
+#include "core/hw/gpu.h"
+
+#include "video_core/renderer_base.h"
+
+class EmuWindow;
+
+/**
+ * Renderer which doesn't need a graphics context: the framebuffers read by the LCDs are copied to
+ * memory on every frame, optionally hashed and written to disk.
+ */
+class RendererHeadless : public RendererBase {
+public:
+    /// Contents of a screen's framebuffer as presented in the last frame
+    struct Screen {
+        u32 width;
+        u32 height;
+        u32 stride;                     ///< Distance between two pixel rows, in bytes
+        GPU::Regs::PixelFormat format;
+        std::vector<u8> data;           ///< Framebuffer contents, in the framebuffer's format
+        u64 hash;                       ///< Hash of data, only calculated if hashing is enabled
+    };
+
+    RendererHeadless();
+    ~RendererHeadless() override;
+
+    /// Swap buffers (render frame)
+    void SwapBuffers() override;
+
+    /**
+     * Set the emulator window to use for renderer
+     * @param window EmuWindow handle to emulator window to use for rendering
+     */
+    void SetWindow(EmuWindow* window) override;
+
+    /// Initialize the renderer
+    void Init() override;
+
+    /// Shutdown the renderer
+    void ShutDown() override;
+
+    /// Enables calculating a hash of each screen on every frame
+    void SetHashing(bool enable) {
+        hashing = enable;
+    }
+
+    /**
+     * Writes both screens to the given directory every interval frames, as PPM images
+     * @param directory Output directory, an empty string disables dumping
+     * @param interval Number of frames between two dumps
+     */
+    void SetFrameDump(const std::string& directory, int interval);
+
+    /// Returns the top (0) and bottom (1) screens as presented in the last frame
+    const std::array<Screen, 2>& GetScreens() const {
+        return screens;
+    }
+
+    /// Returns the hashes of the top and bottom screens of every frame presented while hashing
+    const std::vector<std::array<u64, 2>>& GetFrameHashes() const {
+        return frame_hashes;
+    }
+
+private:
+    /// Copies the framebuffer currently read by the LCD into the screen
+    static void LoadFramebuffer(const GPU::Regs::FramebufferConfig& framebuffer, Screen& screen);
+
+    /// Writes the screen, rotated the same way the LCD displays it, to a PPM image
+    static void DumpScreen(const Screen& screen, const std::string& filename);
+
+    EmuWindow* render_window;           ///< Handle to render window
+
+    std::array<Screen, 2> screens;
+
+    bool hashing;
+    std::vector<std::array<u64, 2>> frame_hashes;
+    std::string dump_directory;
+    int dump_interval;
+};
@@ -0,0 +1,170 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <chrono>
+#include <unordered_map>
+
+#include "common/common.h"
+#include "common/hash.h"
+
+#include "core/mem_map.h"
+
+#include "debug_utils/debug_utils.h"
+#include "texture_cache.h"
+
+namespace Pica {
+
+namespace TextureCache {
+
+// Total size of the decoded textures after which the cache starts over
+static const size_t MAX_CACHED_BYTES = 64 * 1024 * 1024;
+
+struct Entry {
+    std::shared_ptr<const CachedTexture> texture;
+
+    /// Set when a page holding the texture has been written to since it was last validated
+    bool dirty;
+};
+
+static std::unordered_map<u64, Entry> entries;
+static size_t cached_bytes = 0;
+static Stats stats = {};
+
+u32 GetEncodedSize(int width, int height, Regs::TextureFormat format) {
+    switch (format) {
+    case Regs::TextureFormat::ETC1:
+        return width * height / 2;
+
+    case Regs::TextureFormat::ETC1A4:
+        return width * height;
+
+    default:
+        return Regs::NibblesPerPixel(format) * width * height / 2;
+    }
+}
+
+static u64 GetKey(PAddr address, int width, int height, Regs::TextureFormat format) {
+    // Texture dimensions are at most 1024 texels, so all parameters fit into the key exactly
+    return (static_cast<u64>(address) << 32) | (static_cast<u64>(width) << 20) |
+           (static_cast<u64>(height) << 8) | static_cast<u64>(format);
+}
+
+static void OnTexturePageWrite(VAddr page_address) {
+    const PAddr start = Memory::VirtualToPhysicalAddress(page_address);
+    const PAddr end = start + Memory::PAGE_SIZE;
+
+    ++stats.invalidations;
+    for (auto& entry : entries) {
+        const CachedTexture& texture = *entry.second.texture;
+        const PAddr texture_end = texture.address + GetEncodedSize(texture.width, texture.height, texture.format);
+        if (texture.address < end && start < texture_end)
+            entry.second.dirty = true;
+    }
+}
+
+/// Watches the pages holding the texture, so that writes to them mark it as dirty
+static void WatchTexture(const CachedTexture& texture, u32 size) {
+    const VAddr start = PAddrToVAddr(texture.address);
+    for (VAddr page = start & ~Memory::PAGE_MASK; page < start + size; page += Memory::PAGE_SIZE)
+        Memory::WatchPage(Memory::PageWatch::Texture, page);
+}
+
+static std::shared_ptr<const CachedTexture> Decode(const Regs::TextureConfig& config, Regs::TextureFormat format,
+                                                   const u8* data, u64 hash) {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    auto texture = std::make_shared<CachedTexture>();
+    texture->address = config.GetPhysicalAddress();
+    texture->width = config.width;
+    texture->height = config.height;
+    texture->format = format;
+    texture->hash = hash;
+    texture->texels.resize(texture->width * texture->height);
+
+    const auto info = DebugUtils::TextureInfo::FromPicaRegister(config, format);
+    for (int t = 0; t < texture->height; ++t)
+        for (int s = 0; s < texture->width; ++s)
+            texture->texels[s + t * texture->width] = DebugUtils::LookupTexture(data, s, t, info);
+
+    DebugUtils::DumpTexture(config, const_cast<u8*>(data));
+
+    const auto elapsed = std::chrono::steady_clock::now() - start_time;
+    stats.decode_time_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    ++stats.misses;
+
+    return texture;
+}
+
+std::shared_ptr<const CachedTexture> Get(const Regs::TextureConfig& config, Regs::TextureFormat format) {
+    static bool handler_registered = false;
+    if (!handler_registered) {
+        Memory::RegisterWriteHandler(Memory::PageWatch::Texture, OnTexturePageWrite);
+        handler_registered = true;
+    }
+
+    const PAddr address = config.GetPhysicalAddress();
+    const int width = config.width;
+    const int height = config.height;
+    const u64 key = GetKey(address, width, height, format);
+
+    auto it = entries.find(key);
+    if (it != entries.end() && !it->second.dirty) {
+        ++stats.hits;
+        return it->second.texture;
+    }
+
+    const u8* data = Memory::GetPointer(PAddrToVAddr(address));
+    if (data == nullptr) {
+        LOG_ERROR(HW_GPU, "Texture at invalid address 0x%08x", address);
+        return nullptr;
+    }
+
+    const u32 size = GetEncodedSize(width, height, format);
+    const u64 hash = GetMurmurHash3(data, static_cast<int>(size), 0);
+
+    if (it != entries.end()) {
+        // Writes to the same page as the texture, or writes of the data already present, don't
+        // require decoding it again
+        Entry& entry = it->second;
+        if (entry.texture->hash == hash) {
+            ++stats.hits;
+            ++stats.revalidations;
+        } else {
+            entry.texture = Decode(config, format, data, hash);
+        }
+
+        entry.dirty = false;
+        WatchTexture(*entry.texture, size);
+        return entry.texture;
+    }
+
+    const size_t decoded_bytes = width * height * sizeof(Math::Vec4<u8>);
+    if (cached_bytes + decoded_bytes > MAX_CACHED_BYTES)
+        ClearCache();
+
+    Entry& entry = entries[key];
+    entry.texture = Decode(config, format, data, hash);
+    entry.dirty = false;
+    cached_bytes += decoded_bytes;
+
+    WatchTexture(*entry.texture, size);
+    return entry.texture;
+}
+
+Stats GetStats() {
+    return stats;
+}
+
+void ResetStats() {
+    stats = {};
+}
+
+void ClearCache() {
+    entries.clear();
+    cached_bytes = 0;
+}
+
+} // namespace
+
+} // namespace
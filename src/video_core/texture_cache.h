@@ -0,0 +1,66 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common/common_types.h"
+
+#include "math.h"
+#include "pica.h"
+
+namespace Pica {
+
+namespace TextureCache {
+
+/// Texture decoded to linear RGBA8 texels
+struct CachedTexture {
+    PAddr address;
+    int width;
+    int height;
+    Regs::TextureFormat format;
+
+    /// Hash of the encoded data the texels have been decoded from
+    u64 hash;
+
+    /// Texels in row-major order, using the same coordinates as DebugUtils::LookupTexture
+    std::vector<Math::Vec4<u8>> texels;
+
+    const Math::Vec4<u8>& Lookup(int s, int t) const {
+        return texels[s + t * width];
+    }
+};
+
+struct Stats {
+    u64 hits;               ///< Lookups of textures which were decoded already
+    u64 revalidations;      ///< Hits on textures whose memory was written to without changing them
+    u64 misses;             ///< Lookups which required decoding the texture
+    u64 invalidations;      ///< Writes to pages holding cached textures
+    u64 decode_time_us;     ///< Total time spent decoding textures, in microseconds
+};
+
+/**
+ * Looks up the decoded texture for the given configuration, decoding it if it isn't cached yet or
+ * its memory has been modified since it was decoded. Must be called from the thread executing GPU
+ * commands; the returned texture stays valid as long as the pointer is held.
+ * @return The decoded texture, or nullptr if the texture address is invalid
+ */
+std::shared_ptr<const CachedTexture> Get(const Regs::TextureConfig& config, Regs::TextureFormat format);
+
+/// Returns the number of bytes the texture data takes up in guest memory
+u32 GetEncodedSize(int width, int height, Regs::TextureFormat format);
+
+/// Returns the counters accumulated since the last call to ResetStats
+Stats GetStats();
+
+void ResetStats();
+
+/// Drops every cached texture
+void ClearCache();
+
+} // namespace
+
+} // namespace
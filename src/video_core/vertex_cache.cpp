@@ -0,0 +1,87 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include "vertex_cache.h"
+
+namespace Pica {
+
+template<typename VertexType>
+void VertexCache<VertexType>::Reset(unsigned num_entries, Policy new_policy) {
+    // Fall back to the default policy for out-of-range configuration values
+    policy = (new_policy <= Policy::LRU) ? new_policy : Policy::DirectMapped;
+    entries.resize(num_entries);
+    for (auto& entry : entries)
+        entry.valid = false;
+
+    next_fifo_slot = 0;
+    use_counter = 0;
+    stats = VertexCacheStats();
+}
+
+template<typename VertexType>
+const VertexType* VertexCache<VertexType>::Lookup(u32 index) {
+    if (entries.empty())
+        return nullptr;
+
+    if (policy == Policy::DirectMapped) {
+        const Entry& entry = entries[index % entries.size()];
+        if (entry.valid && entry.index == index) {
+            ++stats.hits;
+            return &entry.vertex;
+        }
+    } else {
+        for (auto& entry : entries) {
+            if (entry.valid && entry.index == index) {
+                entry.last_use = ++use_counter;
+                ++stats.hits;
+                return &entry.vertex;
+            }
+        }
+    }
+
+    ++stats.misses;
+    return nullptr;
+}
+
+template<typename VertexType>
+void VertexCache<VertexType>::Insert(u32 index, const VertexType& vertex) {
+    if (entries.empty())
+        return;
+
+    Entry* slot = nullptr;
+    switch (policy) {
+    case Policy::DirectMapped:
+        slot = &entries[index % entries.size()];
+        break;
+
+    case Policy::FIFO:
+        slot = &entries[next_fifo_slot];
+        next_fifo_slot = (next_fifo_slot + 1) % entries.size();
+        break;
+
+    case Policy::LRU:
+        // Prefer empty slots, otherwise evict the entry that has been unused for the longest time
+        slot = &entries[0];
+        for (auto& entry : entries) {
+            if (!entry.valid) {
+                slot = &entry;
+                break;
+            }
+            if (entry.last_use < slot->last_use)
+                slot = &entry;
+        }
+        break;
+    }
+
+    slot->index = index;
+    slot->last_use = ++use_counter;
+    slot->valid = true;
+    slot->vertex = vertex;
+}
+
+// explicitly instantiate use cases
+template
+struct VertexCache<u32>;
+
+} // namespace
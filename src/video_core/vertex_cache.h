@@ -0,0 +1,66 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include <vector>
+
+#include "common/common_types.h"
+
+namespace Pica {
+
+struct VertexCacheStats {
+    u64 hits = 0;
+    u64 misses = 0;
+};
+
+/*
+ * Post-transform cache for indexed draws, mapping vertex indices to already processed vertices (or
+ * to the location they are stored at).
+ * The cache is meant to be reset at the start of every draw, since any register or uniform change
+ * between two draws may change the output of the vertex shader.
+ */
+template<typename VertexType>
+struct VertexCache {
+    enum class Policy {
+        DirectMapped = 0, ///< Each index has exactly one slot, determined by its low bits
+        FIFO         = 1, ///< Fully associative, the oldest inserted entry is replaced
+        LRU          = 2, ///< Fully associative, the least recently used entry is replaced
+    };
+
+    /*
+     * Drops all cached vertices and reconfigures the cache.
+     * @param num_entries Number of cached vertices, 0 disables the cache
+     * @param policy Replacement policy used once the cache is full
+     */
+    void Reset(unsigned num_entries, Policy policy);
+
+    /*
+     * Looks up the processed vertex for the given index.
+     * @return Pointer to the cached vertex, or nullptr on a miss
+     */
+    const VertexType* Lookup(u32 index);
+
+    /// Stores the processed vertex for the given index, evicting an entry if needed
+    void Insert(u32 index, const VertexType& vertex);
+
+    /// Hit/miss counters since the last Reset
+    const VertexCacheStats& GetStats() const { return stats; }
+
+private:
+    struct Entry {
+        u32 index;
+        u32 last_use; ///< Value of use_counter at the last access, only used for LRU
+        bool valid;
+        VertexType vertex;
+    };
+
+    Policy policy = Policy::DirectMapped;
+    std::vector<Entry> entries;
+    unsigned next_fifo_slot = 0;
+    u32 use_counter = 0;
+    VertexCacheStats stats;
+};
+
+} // namespace
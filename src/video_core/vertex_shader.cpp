@@ -9,12 +9,14 @@
 #include <common/file_util.h>
 
 #include <core/mem_map.h>
+#include <core/settings.h>
 
 #include <nihstro/shader_bytecode.h>
 
 
 #include "pica.h"
 #include "vertex_shader.h"
+#include "vertex_shader_jit_x64.h"
 #include "debug_utils/debug_utils.h"
 
 using nihstro::Instruction;
@@ -39,12 +41,36 @@ static struct {
 static std::array<u32, 1024> shader_memory;
 static std::array<u32, 1024> swizzle_data;
 
+// Set when the shader binary or swizzle patterns have been written since the last lookup of the
+// compiled program
+static bool program_changed = true;
+static u32 compiled_main_offset = 0;
+static const JitX64::CompiledShader* compiled_shader = nullptr;
+
 void SubmitShaderMemoryChange(u32 addr, u32 value) {
     shader_memory[addr] = value;
+    program_changed = true;
 }
 
 void SubmitSwizzleDataChange(u32 addr, u32 value) {
     swizzle_data[addr] = value;
+    program_changed = true;
+}
+
+void Setup() {
+#if defined(__x86_64__) || defined(_M_AMD64)
+    if (!Settings::values.use_shader_jit) {
+        compiled_shader = nullptr;
+        program_changed = true;
+        return;
+    }
+
+    if (program_changed || registers.vs_main_offset != compiled_main_offset) {
+        compiled_shader = JitX64::GetShader(registers.vs_main_offset);
+        compiled_main_offset = registers.vs_main_offset;
+        program_changed = false;
+    }
+#endif
 }
 
 Math::Vec4<float24>& GetFloatUniform(u32 index) {
@@ -71,11 +97,15 @@ struct VertexShaderState {
     u32* program_counter;
 
     const float24* input_register_table[16];
-    float24* output_register_table[7*4];
+    float24* output_register_table[8*4];
 
     Math::Vec4<float24> temporary_registers[16];
     bool conditional_code[2];
 
+    // Placeholder for invalid inputs and outputs. Kept per invocation since vertices may be
+    // shaded concurrently.
+    float24 dummy_vec4_float24[4];
+
     // Two Address registers and one loop counter
     // TODO: How many bits do these actually have?
     s32 address_registers[3];
@@ -89,7 +119,7 @@ struct VertexShaderState {
         u32 return_address;
     };
 
-    // TODO: Is there a maximal size for this?
+    // TODO: Is there a maximal size for this? Limited to MAX_CALL_DEPTH like in the shader JIT.
     std::stack<CallStackElement> call_stack;
 
     struct {
@@ -98,10 +128,23 @@ struct VertexShaderState {
     } debug;
 };
 
+/**
+ * Looks up the destination of each component of a register. Output components are looked up one
+ * by one, since the output vertex attributes they map to need not be contiguous.
+ */
+template<typename DestRegister>
+static void LookupDestRegister(VertexShaderState& state, const DestRegister& dest_reg, float24* dest[4]) {
+    for (int i = 0; i < 4; ++i) {
+        dest[i] = (dest_reg < 0x08) ? state.output_register_table[4*dest_reg.GetIndex() + i]
+                : (dest_reg < 0x10) ? &state.dummy_vec4_float24[i]
+                : (dest_reg < 0x20) ? &state.temporary_registers[dest_reg.GetIndex()][i]
+                : &state.dummy_vec4_float24[i];
+    }
+}
+
 static void ProcessShaderCode(VertexShaderState& state) {
 
-    // Placeholder for invalid inputs
-    static float24 dummy_vec4_float24[4];
+    float24* const dummy_vec4_float24 = state.dummy_vec4_float24;
 
     while (true) {
         if (!state.call_stack.empty()) {
@@ -119,6 +162,11 @@ static void ProcessShaderCode(VertexShaderState& state) {
         const SwizzlePattern& swizzle = *(SwizzlePattern*)&swizzle_data[instr.common.operand_desc_id];
 
         auto call = [&](VertexShaderState& state, u32 offset, u32 num_instructions, u32 return_offset) {
+            if (state.call_stack.size() >= MAX_CALL_DEPTH) {
+                LOG_ERROR(HW_GPU, "Vertex shader exceeded the maximum call depth");
+                exit_loop = true;
+                return;
+            }
             state.program_counter = &shader_memory[offset] - 1; // -1 to make sure when incrementing the PC we end up at the correct offset
             state.call_stack.push({ offset + num_instructions, return_offset });
         };
@@ -170,10 +218,10 @@ static void ProcessShaderCode(VertexShaderState& state) {
                 src1_[(int)swizzle.GetSelectorSrc1(3)],
             };
             if (negate_src1) {
-                src1[0] = src1[0] * float24::FromFloat32(-1);
-                src1[1] = src1[1] * float24::FromFloat32(-1);
-                src1[2] = src1[2] * float24::FromFloat32(-1);
-                src1[3] = src1[3] * float24::FromFloat32(-1);
+                src1[0] = -src1[0];
+                src1[1] = -src1[1];
+                src1[2] = -src1[2];
+                src1[3] = -src1[3];
             }
             float24 src2[4] = {
                 src2_[(int)swizzle.GetSelectorSrc2(0)],
@@ -182,16 +230,14 @@ static void ProcessShaderCode(VertexShaderState& state) {
                 src2_[(int)swizzle.GetSelectorSrc2(3)],
             };
             if (negate_src2) {
-                src2[0] = src2[0] * float24::FromFloat32(-1);
-                src2[1] = src2[1] * float24::FromFloat32(-1);
-                src2[2] = src2[2] * float24::FromFloat32(-1);
-                src2[3] = src2[3] * float24::FromFloat32(-1);
+                src2[0] = -src2[0];
+                src2[1] = -src2[1];
+                src2[2] = -src2[2];
+                src2[3] = -src2[3];
             }
 
-            float24* dest = (instr.common.dest < 0x08) ? state.output_register_table[4*instr.common.dest.GetIndex()]
-                        : (instr.common.dest < 0x10) ? dummy_vec4_float24
-                        : (instr.common.dest < 0x20) ? &state.temporary_registers[instr.common.dest.GetIndex()][0]
-                        : dummy_vec4_float24;
+            float24* dest[4];
+            LookupDestRegister(state, instr.common.dest, dest);
 
             state.debug.max_opdesc_id = std::max<u32>(state.debug.max_opdesc_id, 1+instr.common.operand_desc_id);
 
@@ -202,7 +248,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = src1[i] + src2[i];
+                    *dest[i] = src1[i] + src2[i];
                 }
 
                 break;
@@ -214,7 +260,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = src1[i] * src2[i];
+                    *dest[i] = src1[i] * src2[i];
                 }
 
                 break;
@@ -225,7 +271,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = std::max(src1[i], src2[i]);
+                    *dest[i] = std::max(src1[i], src2[i]);
                 }
                 break;
 
@@ -241,7 +287,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = dot;
+                    *dest[i] = dot;
                 }
                 break;
             }
@@ -255,7 +301,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
 
                     // TODO: Be stable against division by zero!
                     // TODO: I think this might be wrong... we should only use one component here
-                    dest[i] = float24::FromFloat32(1.0 / src1[i].ToFloat32());
+                    *dest[i] = float24::FromFloat32(1.0 / src1[i].ToFloat32());
                 }
 
                 break;
@@ -270,7 +316,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
 
                     // TODO: Be stable against division by zero!
                     // TODO: I think this might be wrong... we should only use one component here
-                    dest[i] = float24::FromFloat32(1.0 / sqrt(src1[i].ToFloat32()));
+                    *dest[i] = float24::FromFloat32(1.0 / sqrt(src1[i].ToFloat32()));
                 }
 
                 break;
@@ -295,7 +341,7 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = src1[i];
+                    *dest[i] = src1[i];
                 }
                 break;
             }
@@ -369,10 +415,10 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     src1_[(int)swizzle.GetSelectorSrc1(3)],
                 };
                 if (negate_src1) {
-                    src1[0] = src1[0] * float24::FromFloat32(-1);
-                    src1[1] = src1[1] * float24::FromFloat32(-1);
-                    src1[2] = src1[2] * float24::FromFloat32(-1);
-                    src1[3] = src1[3] * float24::FromFloat32(-1);
+                    src1[0] = -src1[0];
+                    src1[1] = -src1[1];
+                    src1[2] = -src1[2];
+                    src1[3] = -src1[3];
                 }
                 float24 src2[4] = {
                     src2_[(int)swizzle.GetSelectorSrc2(0)],
@@ -381,10 +427,10 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     src2_[(int)swizzle.GetSelectorSrc2(3)],
                 };
                 if (negate_src2) {
-                    src2[0] = src2[0] * float24::FromFloat32(-1);
-                    src2[1] = src2[1] * float24::FromFloat32(-1);
-                    src2[2] = src2[2] * float24::FromFloat32(-1);
-                    src2[3] = src2[3] * float24::FromFloat32(-1);
+                    src2[0] = -src2[0];
+                    src2[1] = -src2[1];
+                    src2[2] = -src2[2];
+                    src2[3] = -src2[3];
                 }
                 float24 src3[4] = {
                     src3_[(int)swizzle.GetSelectorSrc3(0)],
@@ -393,22 +439,20 @@ static void ProcessShaderCode(VertexShaderState& state) {
                     src3_[(int)swizzle.GetSelectorSrc3(3)],
                 };
                 if (negate_src3) {
-                    src3[0] = src3[0] * float24::FromFloat32(-1);
-                    src3[1] = src3[1] * float24::FromFloat32(-1);
-                    src3[2] = src3[2] * float24::FromFloat32(-1);
-                    src3[3] = src3[3] * float24::FromFloat32(-1);
+                    src3[0] = -src3[0];
+                    src3[1] = -src3[1];
+                    src3[2] = -src3[2];
+                    src3[3] = -src3[3];
                 }
 
-                float24* dest = (instr.mad.dest < 0x08) ? state.output_register_table[4*instr.mad.dest.GetIndex()]
-                            : (instr.mad.dest < 0x10) ? dummy_vec4_float24
-                            : (instr.mad.dest < 0x20) ? &state.temporary_registers[instr.mad.dest.GetIndex()][0]
-                            : dummy_vec4_float24;
+                float24* dest[4];
+                LookupDestRegister(state, instr.mad.dest, dest);
 
                 for (int i = 0; i < 4; ++i) {
                     if (!swizzle.DestComponentEnabled(i))
                         continue;
 
-                    dest[i] = src1[i] * src2[i] + src3[i];
+                    *dest[i] = src1[i] * src2[i] + src3[i];
                 }
             } else {
                 LOG_ERROR(HW_GPU, "Unhandled multiply-add instruction: 0x%02x (%s): 0x%08x",
@@ -542,11 +586,15 @@ OutputVertex RunShader(const InputVertex& input, int num_attributes) {
     state.program_counter = (u32*)main;
     state.debug.max_offset = 0;
     state.debug.max_opdesc_id = 0;
+    boost::fill(state.dummy_vec4_float24, float24::FromFloat32(0.0f));
 
     // Setup input register table
     const auto& attribute_register_map = registers.vs_input_register_map;
-    float24 dummy_register;
-    boost::fill(state.input_register_table, &dummy_register);
+    // Unmapped input registers read as zero. All four components are read, so this needs to be a
+    // full vector.
+    Math::Vec4<float24> dummy_register;
+    memset(&dummy_register, 0, sizeof(dummy_register));
+    boost::fill(state.input_register_table, &dummy_register.x);
     if(num_attributes > 0) state.input_register_table[attribute_register_map.attribute0_register] = &input.attr[0].x;
     if(num_attributes > 1) state.input_register_table[attribute_register_map.attribute1_register] = &input.attr[1].x;
     if(num_attributes > 2) state.input_register_table[attribute_register_map.attribute2_register] = &input.attr[2].x;
@@ -578,14 +626,48 @@ OutputVertex RunShader(const InputVertex& input, int num_attributes) {
             output_register_map.map_z, output_register_map.map_w
         };
 
+        // Semantics are 5 bits wide, so even unused ones like INVALID point into the output vertex
         for (int comp = 0; comp < 4; ++comp)
             state.output_register_table[4*i+comp] = ((float24*)&ret) + semantics[comp];
     }
 
+    // The last output register isn't mapped to any attribute
+    for (int comp = 0; comp < 4; ++comp)
+        state.output_register_table[4*7+comp] = &state.dummy_vec4_float24[comp];
+
     state.conditional_code[0] = false;
     state.conditional_code[1] = false;
 
-    ProcessShaderCode(state);
+    // Temporary and address registers are not initialized by the hardware either, but reading
+    // them before writing should at least not depend on leftover stack contents
+    memset(state.temporary_registers, 0, sizeof(state.temporary_registers));
+    memset(state.address_registers, 0, sizeof(state.address_registers));
+
+    if (compiled_shader != nullptr) {
+        JitX64::JitState jit_state;
+
+        for (int i = 0; i < 16; ++i)
+            memcpy(&jit_state.input_registers[i], state.input_register_table[i], sizeof(jit_state.input_registers[i]));
+
+        for (int i = 0; i < 7*4; ++i)
+            jit_state.output_registers[i] = state.output_register_table[i];
+        for (int comp = 0; comp < 4; ++comp)
+            jit_state.output_registers[4*7+comp] = &jit_state.dummy_register[comp];
+        memset(jit_state.temporary_registers, 0, sizeof(jit_state.temporary_registers));
+        memset(&jit_state.dummy_register, 0, sizeof(jit_state.dummy_register));
+
+        memset(jit_state.address_registers, 0, sizeof(jit_state.address_registers));
+        jit_state.conditional_code[0] = false;
+        jit_state.conditional_code[1] = false;
+
+        compiled_shader->entry(&jit_state);
+
+        state.debug.max_offset = compiled_shader->max_offset;
+        state.debug.max_opdesc_id = compiled_shader->max_opdesc_id;
+    } else {
+        ProcessShaderCode(state);
+    }
+
     DebugUtils::DumpShader(shader_memory.data(), state.debug.max_offset, swizzle_data.data(),
                            state.debug.max_opdesc_id, registers.vs_main_offset,
                            registers.vs_output_attributes);
@@ -15,6 +15,9 @@ namespace Pica {
 
 namespace VertexShader {
 
+/// Maximum nesting of CALL and IF blocks, deeper nesting ends the shader
+static const u32 MAX_CALL_DEPTH = 32;
+
 struct InputVertex {
     Math::Vec4<float24> attr[16];
 };
@@ -69,6 +72,13 @@ static_assert(sizeof(OutputVertex) == 32 * sizeof(float), "OutputVertex has inva
 void SubmitShaderMemoryChange(u32 addr, u32 value);
 void SubmitSwizzleDataChange(u32 addr, u32 value);
 
+/**
+ * Prepares the current shader program for the upcoming draw, compiling it to host code if the
+ * shader JIT is enabled. Needs to be called before RunShader whenever the program or its entry
+ * point may have changed.
+ */
+void Setup();
+
 OutputVertex RunShader(const InputVertex& input, int num_attributes);
 
 Math::Vec4<float24>& GetFloatUniform(u32 index);
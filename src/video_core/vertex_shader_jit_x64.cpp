@@ -0,0 +1,805 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <nihstro/shader_bytecode.h>
+
+#include "common/common.h"
+#include "common/hash.h"
+#include "common/make_unique.h"
+#include "common/memory_util.h"
+#include "common/x64_emitter.h"
+
+#include "vertex_shader.h"
+#include "vertex_shader_jit_x64.h"
+
+using nihstro::Instruction;
+using nihstro::RegisterType;
+using nihstro::SourceRegister;
+using nihstro::SwizzlePattern;
+
+namespace Pica {
+
+namespace VertexShader {
+
+namespace JitX64 {
+
+using namespace Gen;
+
+// Register holding the JitState pointer for the whole shader
+static const X64Reg STATE = RBX;
+// Register holding the address of the float uniforms
+static const X64Reg UNIFORMS = R12;
+// Register holding the address of the constants used by compiled code
+static const X64Reg CONSTANTS = R13;
+
+#ifdef _WIN32
+static const X64Reg ABI_PARAM1 = RCX;
+static const X64Reg ABI_PARAM2 = RDX;
+static const X64Reg ABI_PARAM3 = R8;
+#else
+static const X64Reg ABI_PARAM1 = RDI;
+static const X64Reg ABI_PARAM2 = RSI;
+static const X64Reg ABI_PARAM3 = RDX;
+#endif
+
+// Stack space reserved by the prologue. Together with the three pushed registers this keeps the
+// stack 16-byte aligned for helper calls and provides the Win64 shadow space.
+static const s32 STACK_RESERVE = 32;
+
+// Only XMM0-XMM5 are used, since the others are callee-saved on Win64
+static const X64Reg SRC1 = XMM1;
+static const X64Reg SRC2 = XMM2;
+static const X64Reg SRC3 = XMM3;
+static const X64Reg SCRATCH1 = XMM4;
+static const X64Reg SCRATCH2 = XMM5;
+
+static const u32 PROGRAM_SIZE = 1024;
+// Upper bound of the host code emitted for a single shader instruction, prologue or epilogue
+static const size_t MAX_INSTRUCTION_CODE_SIZE = 384;
+static const size_t CODE_SPACE_SIZE = 4 * 1024 * 1024;
+
+/// Constants loaded by compiled code relative to the CONSTANTS register, all 16-byte aligned
+struct Constants {
+    u32 sign_mask[4];
+    float one[4];
+    double one_double[2];
+    u32 component_masks[16][4]; ///< Lane i of entry m is set if bit i of m is set
+};
+
+static Constants MakeConstants() {
+    Constants constants;
+    for (int i = 0; i < 4; ++i) {
+        constants.sign_mask[i] = 0x80000000;
+        constants.one[i] = 1.0f;
+    }
+    constants.one_double[0] = constants.one_double[1] = 1.0;
+    for (u32 mask = 0; mask < 16; ++mask) {
+        for (int i = 0; i < 4; ++i)
+            constants.component_masks[mask][i] = ((mask >> i) & 1) ? 0xFFFFFFFF : 0;
+    }
+    return constants;
+}
+
+static const MEMORY_ALIGNED16(Constants constants) = MakeConstants();
+
+static s32 ConstantOffset(const void* constant) {
+    return static_cast<s32>(static_cast<const u8*>(constant) - reinterpret_cast<const u8*>(&constants));
+}
+
+static const s32 INPUT_OFFSET = static_cast<s32>(offsetof(JitState, input_registers));
+static const s32 TEMPORARY_OFFSET = static_cast<s32>(offsetof(JitState, temporary_registers));
+static const s32 DUMMY_OFFSET = static_cast<s32>(offsetof(JitState, dummy_register));
+static const s32 OUTPUT_OFFSET = static_cast<s32>(offsetof(JitState, output_registers));
+static const s32 ADDRESS_OFFSET = static_cast<s32>(offsetof(JitState, address_registers));
+static const s32 CONDITIONAL_CODE_OFFSET = static_cast<s32>(offsetof(JitState, conditional_code));
+static const s32 CALL_STACK_DEPTH_OFFSET = static_cast<s32>(offsetof(JitState, call_stack_depth));
+static const s32 CALL_STACK_OFFSET = static_cast<s32>(offsetof(JitState, call_stack));
+
+/// A compiled program along with the data its code refers to
+struct Program {
+    CompiledShader shader;
+    /// Host code of each reachable instruction, used to return from CALL and IF blocks
+    std::array<const u8*, PROGRAM_SIZE> labels;
+    /// Base registers of relatively addressed operands, passed to LookupRelativeSource
+    std::vector<std::unique_ptr<SourceRegister>> relative_sources;
+};
+
+static u8* code_space = nullptr;
+static u8* code_top = nullptr;
+
+static std::unordered_map<u64, std::unique_ptr<Program>> programs;
+
+void ClearCache() {
+    programs.clear();
+    code_top = code_space;
+}
+
+/// Called from compiled code to look up a source register offset by an address register
+static const float24* LookupRelativeSource(JitState* state, const SourceRegister* base, u32 address_register_index) {
+    const SourceRegister source_reg = *base + state->address_registers[address_register_index - 1];
+
+    switch (source_reg.GetRegisterType()) {
+    case RegisterType::Input:
+        return &state->input_registers[source_reg.GetIndex()].x;
+
+    case RegisterType::Temporary:
+        return &state->temporary_registers[source_reg.GetIndex()].x;
+
+    case RegisterType::FloatUniform:
+        return &GetFloatUniform(source_reg.GetIndex()).x;
+
+    default:
+        return &state->dummy_register.x;
+    }
+}
+
+/// Returns whether the interpreter implements the given instruction
+static bool IsSupported(const Instruction& instr) {
+    switch (instr.opcode.GetInfo().type) {
+    case Instruction::OpCodeType::Arithmetic:
+        // The interpreter aborts emulation for instructions with inverted sources
+        if (instr.opcode.GetInfo().subtype & Instruction::OpCodeInfo::SrcInversed)
+            return false;
+
+        switch (instr.opcode.EffectiveOpCode()) {
+        case Instruction::OpCode::ADD:
+        case Instruction::OpCode::MUL:
+        case Instruction::OpCode::MAX:
+        case Instruction::OpCode::DP3:
+        case Instruction::OpCode::DP4:
+        case Instruction::OpCode::RCP:
+        case Instruction::OpCode::RSQ:
+        case Instruction::OpCode::MOVA:
+        case Instruction::OpCode::MOV:
+        case Instruction::OpCode::CMP:
+            return true;
+        default:
+            return false;
+        }
+
+    case Instruction::OpCodeType::MultiplyAdd:
+        return instr.opcode.EffectiveOpCode() == Instruction::OpCode::MAD;
+
+    default:
+        switch (instr.opcode) {
+        case Instruction::OpCode::END:
+        case Instruction::OpCode::JMPC:
+        case Instruction::OpCode::JMPU:
+        case Instruction::OpCode::CALL:
+        case Instruction::OpCode::CALLU:
+        case Instruction::OpCode::CALLC:
+        case Instruction::OpCode::NOP:
+        case Instruction::OpCode::IFU:
+        case Instruction::OpCode::IFC:
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+/**
+ * Control flow of a program, determined ahead of compilation. Compiled code mirrors the
+ * interpreter's call stack: CALL and IF push the offset at which the block ends along with the one
+ * to continue at, and every instruction at which some block ends checks the top of the stack.
+ */
+struct ControlFlow {
+    std::set<u32> reachable;        ///< Offsets of all instructions that may be executed
+    std::set<u32> block_ends;       ///< Offsets at which CALL or IF blocks may return
+    u32 max_opdesc_id = 0;
+};
+
+/**
+ * Finds all instructions reachable from the entry point
+ * @return false if the program has to be interpreted
+ */
+static bool AnalyzeControlFlow(const std::array<u32, 1024>& binary, u32 main_offset, ControlFlow& flow) {
+    std::vector<u32> pending = { main_offset };
+
+    while (!pending.empty()) {
+        const u32 offset = pending.back();
+        pending.pop_back();
+
+        // Running past the end of the shader memory is undefined in the interpreter
+        if (offset >= PROGRAM_SIZE)
+            return false;
+        if (!flow.reachable.insert(offset).second)
+            continue;
+
+        const Instruction& instr = *(const Instruction*)&binary[offset];
+        if (!IsSupported(instr)) {
+            LOG_DEBUG(HW_GPU, "Interpreting vertex shader due to instruction 0x%08x at 0x%03x",
+                      instr.hex, offset);
+            return false;
+        }
+
+        switch (instr.opcode.GetInfo().type) {
+        case Instruction::OpCodeType::Arithmetic:
+            flow.max_opdesc_id = std::max<u32>(flow.max_opdesc_id, 1 + instr.common.operand_desc_id);
+            pending.push_back(offset + 1);
+            break;
+
+        case Instruction::OpCodeType::MultiplyAdd:
+            flow.max_opdesc_id = std::max<u32>(flow.max_opdesc_id, 1 + instr.mad.operand_desc_id);
+            pending.push_back(offset + 1);
+            break;
+
+        default:
+        {
+            const u32 dest = instr.flow_control.dest_offset;
+            const u32 block_end = dest + instr.flow_control.num_instructions;
+
+            switch (instr.opcode) {
+            case Instruction::OpCode::END:
+                break;
+
+            case Instruction::OpCode::JMPC:
+            case Instruction::OpCode::JMPU:
+                pending.push_back(dest);
+                pending.push_back(offset + 1);
+                break;
+
+            case Instruction::OpCode::CALL:
+            case Instruction::OpCode::CALLU:
+            case Instruction::OpCode::CALLC:
+                flow.block_ends.insert(block_end);
+                pending.push_back(dest);
+                pending.push_back(offset + 1);
+                break;
+
+            case Instruction::OpCode::IFU:
+            case Instruction::OpCode::IFC:
+                flow.block_ends.insert(dest);
+                flow.block_ends.insert(block_end);
+                pending.push_back(offset + 1);
+                pending.push_back(dest);
+                pending.push_back(block_end);
+                break;
+
+            default:
+                pending.push_back(offset + 1);
+                break;
+            }
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+class ShaderCompiler {
+public:
+    ShaderCompiler(u8* code, Program& program, const std::array<u32, 1024>& binary,
+                   const std::array<u32, 1024>& swizzle_data)
+        : emit(code), program(program), binary(binary), swizzle_data(swizzle_data) {}
+
+    const u8* GetCodePtr() const {
+        return emit.GetCodePtr();
+    }
+
+    void Compile(const ControlFlow& flow, u32 main_offset) {
+        program.labels.fill(nullptr);
+
+        emit.PUSH(RBX);
+        emit.PUSH(Gen::R12);
+        emit.PUSH(Gen::R13);
+        emit.ALU64_RI(ALU_SUB, RSP, STACK_RESERVE);
+        emit.MOV64_RR(STATE, ABI_PARAM1);
+        emit.MOV64_RI(UNIFORMS, reinterpret_cast<u64>(&GetFloatUniform(0)));
+        emit.MOV64_RI(CONSTANTS, reinterpret_cast<u64>(&constants));
+        emit.MOV_MI(STATE, CALL_STACK_DEPTH_OFFSET, 0);
+        JumpTo(main_offset);
+
+        exit_label = emit.GetCodePtr();
+        emit.ALU64_RI(ALU_ADD, RSP, STACK_RESERVE);
+        emit.POP(Gen::R13);
+        emit.POP(Gen::R12);
+        emit.POP(RBX);
+        emit.RET();
+
+        // Instructions are emitted in ascending order, so falling through to the next instruction
+        // needs no jump: it is reachable whenever its predecessor doesn't end the program.
+        for (u32 offset : flow.reachable) {
+            program.labels[offset] = emit.GetCodePtr();
+            if (flow.block_ends.count(offset))
+                CompileBlockEndCheck(offset);
+            CompileInstruction(offset);
+
+            if (!flow.reachable.count(offset + 1))
+                emit.SetJumpTarget(emit.J(), exit_label);
+        }
+
+        for (const auto& jump : jumps)
+            emit.SetJumpTarget(jump.first, program.labels[jump.second]);
+    }
+
+private:
+    void JumpTo(u32 offset) {
+        jumps.emplace_back(emit.J(), offset);
+    }
+
+    /**
+     * Returns to the instruction following a CALL or IF block if the current one ends here. Only
+     * the innermost block is popped. The return goes through the label of the return address, so
+     * that the next block is checked there like in the interpreter, which tries again after
+     * returning.
+     */
+    void CompileBlockEndCheck(u32 offset) {
+        emit.MOV_RM(EAX, STATE, CALL_STACK_DEPTH_OFFSET);
+        emit.TEST_RR(EAX, EAX);
+        FixupBranch empty = emit.J_CC(CC_Z);
+
+        emit.SHIFT_RI(SHIFT_SHL, EAX, 3);
+        emit.ALU64_RR(ALU_ADD, RAX, STATE);
+        emit.ALU_MI(ALU_CMP, RAX, CALL_STACK_OFFSET - 8, offset);
+        FixupBranch other_block = emit.J_CC(CC_NE);
+
+        emit.ALU_MI(ALU_SUB, STATE, CALL_STACK_DEPTH_OFFSET, 1);
+        emit.MOV_RM(ECX, RAX, CALL_STACK_OFFSET - 8 + 4);
+        emit.SHIFT_RI(SHIFT_SHL, ECX, 3);
+        emit.MOV64_RI(RAX, reinterpret_cast<u64>(program.labels.data()));
+        emit.ALU64_RR(ALU_ADD, RAX, RCX);
+        emit.MOV64_RM(RAX, RAX, 0);
+        emit.JMP_R(RAX);
+
+        emit.SetJumpTarget(empty);
+        emit.SetJumpTarget(other_block);
+    }
+
+    /// Pushes a block onto the call stack and jumps to its first instruction
+    void CompileCall(u32 offset, u32 final_address, u32 return_address) {
+        emit.MOV_RM(EAX, STATE, CALL_STACK_DEPTH_OFFSET);
+        emit.ALU_RI(ALU_CMP, EAX, MAX_CALL_DEPTH);
+        emit.SetJumpTarget(emit.J_CC(CC_AE), exit_label);
+
+        emit.SHIFT_RI(SHIFT_SHL, EAX, 3);
+        emit.ALU64_RR(ALU_ADD, RAX, STATE);
+        emit.MOV_MI(RAX, CALL_STACK_OFFSET, final_address);
+        emit.MOV_MI(RAX, CALL_STACK_OFFSET + 4, return_address);
+        emit.ALU_MI(ALU_ADD, STATE, CALL_STACK_DEPTH_OFFSET, 1);
+        JumpTo(offset);
+    }
+
+    /**
+     * Evaluates the condition of a flow control instruction
+     * @return Branch taken when the condition is false
+     */
+    FixupBranch CompileCondition(const Instruction& instr) {
+        const auto& flow_control = instr.flow_control;
+
+        emit.MOVZX8_RM(EAX, STATE, CONDITIONAL_CODE_OFFSET);
+        if (!flow_control.refx)
+            emit.ALU_RI(ALU_XOR, EAX, 1);
+        emit.MOVZX8_RM(ECX, STATE, CONDITIONAL_CODE_OFFSET + 1);
+        if (!flow_control.refy)
+            emit.ALU_RI(ALU_XOR, ECX, 1);
+
+        switch (flow_control.op) {
+        case flow_control.Or:
+            emit.ALU_RR(ALU_OR, EAX, ECX);
+            break;
+
+        case flow_control.And:
+            emit.ALU_RR(ALU_AND, EAX, ECX);
+            break;
+
+        case flow_control.JustX:
+            break;
+
+        case flow_control.JustY:
+            emit.MOV_RR(EAX, ECX);
+            break;
+        }
+
+        emit.TEST_RR(EAX, EAX);
+        return emit.J_CC(CC_Z);
+    }
+
+    /// @return Branch taken when the boolean uniform is false
+    FixupBranch CompileBoolUniformCondition(const Instruction& instr) {
+        emit.MOV64_RI(RAX, reinterpret_cast<u64>(&GetBoolUniform(instr.flow_control.bool_uniform_id)));
+        emit.MOVZX8_RM(EAX, RAX, 0);
+        emit.TEST_RR(EAX, EAX);
+        return emit.J_CC(CC_Z);
+    }
+
+    /// Loads a source operand, swizzled and negated as given by the operand descriptor
+    void LoadSource(X64Reg dst, const SourceRegister& source_reg, u32 address_register_index,
+                    const SwizzlePattern::Selector selectors[4], bool negate) {
+        if (address_register_index != 0) {
+            program.relative_sources.push_back(Common::make_unique<SourceRegister>(source_reg));
+
+            emit.MOV64_RR(ABI_PARAM1, STATE);
+            emit.MOV64_RI(ABI_PARAM2, reinterpret_cast<u64>(program.relative_sources.back().get()));
+            emit.MOV_RI(ABI_PARAM3, address_register_index);
+            emit.MOV64_RI(RAX, reinterpret_cast<u64>(&LookupRelativeSource));
+            emit.CALL_R(RAX);
+            emit.MOVUPS_RM(dst, RAX, 0);
+        } else {
+            switch (source_reg.GetRegisterType()) {
+            case RegisterType::Input:
+                emit.MOVUPS_RM(dst, STATE, INPUT_OFFSET + source_reg.GetIndex() * 16);
+                break;
+
+            case RegisterType::Temporary:
+                emit.MOVUPS_RM(dst, STATE, TEMPORARY_OFFSET + source_reg.GetIndex() * 16);
+                break;
+
+            case RegisterType::FloatUniform:
+                emit.MOVUPS_RM(dst, UNIFORMS, source_reg.GetIndex() * 16);
+                break;
+
+            default:
+                emit.MOVUPS_RM(dst, STATE, DUMMY_OFFSET);
+                break;
+            }
+        }
+
+        u8 shuffle = 0;
+        for (int i = 0; i < 4; ++i)
+            shuffle |= static_cast<u8>(selectors[i]) << (2 * i);
+        if (shuffle != 0xE4)
+            emit.SHUFPS(dst, dst, shuffle);
+
+        // Negation flips the sign bit like in the interpreter, including the sign of NaNs
+        if (negate)
+            emit.XORPS_RM(dst, CONSTANTS, ConstantOffset(constants.sign_mask));
+    }
+
+    /// Extracts lane i of src to the lowest lane of SCRATCH1
+    void ExtractLane(X64Reg src, int lane) {
+        emit.MOVAPS_RR(SCRATCH1, src);
+        if (lane != 0)
+            emit.SHUFPS(SCRATCH1, SCRATCH1, static_cast<u8>(lane * 0x55));
+    }
+
+    /**
+     * Writes the enabled components of src to a destination register. Outputs are written
+     * component by component through their own pointers, since the output vertex attributes they
+     * map to need not be contiguous. Other registers are updated through a masked
+     * read-modify-write.
+     */
+    template<typename DestRegister>
+    void StoreDest(const DestRegister& dest, X64Reg src, u32 mask) {
+        if (mask == 0)
+            return;
+
+        if (dest < 0x08) {
+            for (int i = 0; i < 4; ++i) {
+                if (!(mask & (1 << i)))
+                    continue;
+                emit.MOV64_RM(RAX, STATE, OUTPUT_OFFSET + (dest.GetIndex() * 4 + i) * sizeof(float24*));
+                ExtractLane(src, i);
+                emit.MOVSS_MR(RAX, 0, SCRATCH1);
+            }
+            return;
+        }
+
+        const s32 offset = (dest < 0x10) ? DUMMY_OFFSET
+                         : (dest < 0x20) ? TEMPORARY_OFFSET + dest.GetIndex() * 16
+                         : DUMMY_OFFSET;
+
+        if (mask != 0xF) {
+            emit.ANDPS_RM(src, CONSTANTS, ConstantOffset(constants.component_masks[mask]));
+            emit.MOVUPS_RM(SCRATCH2, STATE, offset);
+            emit.ANDPS_RM(SCRATCH2, CONSTANTS, ConstantOffset(constants.component_masks[~mask & 0xF]));
+            emit.ORPS(src, SCRATCH2);
+        }
+        emit.MOVUPS_MR(STATE, offset, src);
+    }
+
+    static u32 DestMask(const SwizzlePattern& swizzle) {
+        u32 mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (swizzle.DestComponentEnabled(i))
+                mask |= 1 << i;
+        }
+        return mask;
+    }
+
+    void CompileArithmetic(const Instruction& instr) {
+        const SwizzlePattern& swizzle = *(const SwizzlePattern*)&swizzle_data[instr.common.operand_desc_id];
+        const u32 mask = DestMask(swizzle);
+
+        const SwizzlePattern::Selector selectors1[4] = {
+            swizzle.GetSelectorSrc1(0), swizzle.GetSelectorSrc1(1),
+            swizzle.GetSelectorSrc1(2), swizzle.GetSelectorSrc1(3),
+        };
+        const SwizzlePattern::Selector selectors2[4] = {
+            swizzle.GetSelectorSrc2(0), swizzle.GetSelectorSrc2(1),
+            swizzle.GetSelectorSrc2(2), swizzle.GetSelectorSrc2(3),
+        };
+
+        // The first source may call a helper, so it has to be loaded before anything else
+        LoadSource(SRC1, instr.common.GetSrc1(false), instr.common.address_register_index,
+                   selectors1, swizzle.negate_src1);
+        LoadSource(SRC2, instr.common.GetSrc2(false), 0, selectors2, swizzle.negate_src2);
+
+        switch (instr.opcode.EffectiveOpCode()) {
+        case Instruction::OpCode::ADD:
+            emit.ADDPS(SRC1, SRC2);
+            StoreDest(instr.common.dest, SRC1, mask);
+            break;
+
+        case Instruction::OpCode::MUL:
+            emit.MULPS(SRC1, SRC2);
+            StoreDest(instr.common.dest, SRC1, mask);
+            break;
+
+        case Instruction::OpCode::MAX:
+            // MAXPS returns its second operand unless the first one is greater, which matches
+            // std::max(src1, src2) for NaNs and signed zeros
+            emit.MAXPS(SRC2, SRC1);
+            StoreDest(instr.common.dest, SRC2, mask);
+            break;
+
+        case Instruction::OpCode::DP3:
+        case Instruction::OpCode::DP4:
+        {
+            // Sum up the products in the same order as the interpreter, starting from +0
+            const int num_components = (instr.opcode == Instruction::OpCode::DP3) ? 3 : 4;
+            emit.MULPS(SRC1, SRC2);
+            emit.XORPS(XMM0, XMM0);
+            for (int i = 0; i < num_components; ++i) {
+                ExtractLane(SRC1, i);
+                emit.ADDSS(XMM0, SCRATCH1);
+            }
+            emit.SHUFPS(XMM0, XMM0, 0);
+            StoreDest(instr.common.dest, XMM0, mask & ((1 << num_components) - 1));
+            break;
+        }
+
+        case Instruction::OpCode::RCP:
+            // The interpreter divides in double precision, which rounds to the same result
+            emit.MOVUPS_RM(XMM0, CONSTANTS, ConstantOffset(constants.one));
+            emit.DIVPS(XMM0, SRC1);
+            StoreDest(instr.common.dest, XMM0, mask);
+            break;
+
+        case Instruction::OpCode::RSQ:
+            // Computed in double precision like the interpreter, two components at a time
+            emit.MOVHLPS(SCRATCH1, SRC1);
+            emit.CVTPS2PD(SRC1, SRC1);
+            emit.CVTPS2PD(SCRATCH1, SCRATCH1);
+            emit.SQRTPD(SRC1, SRC1);
+            emit.SQRTPD(SCRATCH1, SCRATCH1);
+            emit.MOVUPS_RM(XMM0, CONSTANTS, ConstantOffset(constants.one_double));
+            emit.MOVAPS_RR(SCRATCH2, XMM0);
+            emit.DIVPD(XMM0, SRC1);
+            emit.DIVPD(SCRATCH2, SCRATCH1);
+            emit.CVTPD2PS(XMM0, XMM0);
+            emit.CVTPD2PS(SCRATCH2, SCRATCH2);
+            emit.MOVLHPS(XMM0, SCRATCH2);
+            StoreDest(instr.common.dest, XMM0, mask);
+            break;
+
+        case Instruction::OpCode::MOVA:
+            for (int i = 0; i < 2; ++i) {
+                if (!(mask & (1 << i)))
+                    continue;
+                ExtractLane(SRC1, i);
+                emit.CVTTSS2SI(EAX, SCRATCH1);
+                emit.MOV_MR(STATE, ADDRESS_OFFSET + i * 4, EAX);
+            }
+            break;
+
+        case Instruction::OpCode::MOV:
+            StoreDest(instr.common.dest, SRC1, mask);
+            break;
+
+        case Instruction::OpCode::CMP:
+            for (int i = 0; i < 2; ++i) {
+                auto compare_op = instr.common.compare_op;
+                auto op = (i == 0) ? compare_op.x.Value() : compare_op.y.Value();
+
+                // Greater-than comparisons are done as less-than with swapped operands
+                X64Reg lhs = SRC1, rhs = SRC2;
+                SSECompare predicate;
+                switch (op) {
+                case compare_op.Equal:        predicate = CMP_EQ; break;
+                case compare_op.NotEqual:     predicate = CMP_NEQ; break;
+                case compare_op.LessThan:     predicate = CMP_LT; break;
+                case compare_op.LessEqual:    predicate = CMP_LE; break;
+                case compare_op.GreaterThan:  predicate = CMP_LT; std::swap(lhs, rhs); break;
+                case compare_op.GreaterEqual: predicate = CMP_LE; std::swap(lhs, rhs); break;
+                default:
+                    LOG_ERROR(HW_GPU, "Unknown compare mode %x", static_cast<int>(op));
+                    continue;
+                }
+
+                emit.MOVAPS_RR(XMM0, lhs);
+                emit.CMPPS(XMM0, rhs, predicate);
+                emit.MOVMSKPS(EAX, XMM0);
+                emit.BT_RI(EAX, static_cast<u8>(i));
+                emit.SETcc_M(CC_C, STATE, CONDITIONAL_CODE_OFFSET + i);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void CompileMultiplyAdd(const Instruction& instr) {
+        const SwizzlePattern& swizzle = *(const SwizzlePattern*)&swizzle_data[instr.mad.operand_desc_id];
+
+        const SwizzlePattern::Selector selectors1[4] = {
+            swizzle.GetSelectorSrc1(0), swizzle.GetSelectorSrc1(1),
+            swizzle.GetSelectorSrc1(2), swizzle.GetSelectorSrc1(3),
+        };
+        const SwizzlePattern::Selector selectors2[4] = {
+            swizzle.GetSelectorSrc2(0), swizzle.GetSelectorSrc2(1),
+            swizzle.GetSelectorSrc2(2), swizzle.GetSelectorSrc2(3),
+        };
+        const SwizzlePattern::Selector selectors3[4] = {
+            swizzle.GetSelectorSrc3(0), swizzle.GetSelectorSrc3(1),
+            swizzle.GetSelectorSrc3(2), swizzle.GetSelectorSrc3(3),
+        };
+
+        LoadSource(SRC1, instr.mad.src1, 0, selectors1, swizzle.negate_src1);
+        LoadSource(SRC2, instr.mad.src2, 0, selectors2, swizzle.negate_src2);
+        LoadSource(SRC3, instr.mad.src3, 0, selectors3, swizzle.negate_src3);
+
+        emit.MULPS(SRC1, SRC2);
+        emit.ADDPS(SRC1, SRC3);
+        StoreDest(instr.mad.dest, SRC1, DestMask(swizzle));
+    }
+
+    void CompileFlowControl(const Instruction& instr, u32 offset) {
+        const u32 dest = instr.flow_control.dest_offset;
+        const u32 block_end = dest + instr.flow_control.num_instructions;
+
+        switch (instr.opcode) {
+        case Instruction::OpCode::END:
+            emit.SetJumpTarget(emit.J(), exit_label);
+            break;
+
+        case Instruction::OpCode::JMPC:
+        {
+            FixupBranch skip = CompileCondition(instr);
+            JumpTo(dest);
+            emit.SetJumpTarget(skip);
+            break;
+        }
+
+        case Instruction::OpCode::JMPU:
+        {
+            FixupBranch skip = CompileBoolUniformCondition(instr);
+            JumpTo(dest);
+            emit.SetJumpTarget(skip);
+            break;
+        }
+
+        case Instruction::OpCode::CALL:
+            CompileCall(dest, block_end, offset + 1);
+            break;
+
+        case Instruction::OpCode::CALLU:
+        {
+            FixupBranch skip = CompileBoolUniformCondition(instr);
+            CompileCall(dest, block_end, offset + 1);
+            emit.SetJumpTarget(skip);
+            break;
+        }
+
+        case Instruction::OpCode::CALLC:
+        {
+            FixupBranch skip = CompileCondition(instr);
+            CompileCall(dest, block_end, offset + 1);
+            emit.SetJumpTarget(skip);
+            break;
+        }
+
+        case Instruction::OpCode::IFU:
+        case Instruction::OpCode::IFC:
+        {
+            FixupBranch else_branch = (instr.opcode == Instruction::OpCode::IFU)
+                                      ? CompileBoolUniformCondition(instr) : CompileCondition(instr);
+            CompileCall(offset + 1, dest, block_end);
+            emit.SetJumpTarget(else_branch);
+            CompileCall(dest, block_end, block_end);
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    void CompileInstruction(u32 offset) {
+        const Instruction& instr = *(const Instruction*)&binary[offset];
+
+        switch (instr.opcode.GetInfo().type) {
+        case Instruction::OpCodeType::Arithmetic:
+            CompileArithmetic(instr);
+            break;
+
+        case Instruction::OpCodeType::MultiplyAdd:
+            CompileMultiplyAdd(instr);
+            break;
+
+        default:
+            CompileFlowControl(instr, offset);
+            break;
+        }
+    }
+
+    XEmitter emit;
+    Program& program;
+    const std::array<u32, 1024>& binary;
+    const std::array<u32, 1024>& swizzle_data;
+
+    const u8* exit_label = nullptr;
+    /// Jumps to instructions, resolved once all instructions have been emitted
+    std::vector<std::pair<FixupBranch, u32>> jumps;
+};
+
+static u64 GetProgramKey(const std::array<u32, 1024>& binary, const std::array<u32, 1024>& swizzle_data,
+                         u32 main_offset) {
+    const u64 binary_hash = GetMurmurHash3(reinterpret_cast<const u8*>(binary.data()),
+                                           static_cast<int>(binary.size() * sizeof(u32)), 0);
+    const u64 swizzle_hash = GetMurmurHash3(reinterpret_cast<const u8*>(swizzle_data.data()),
+                                            static_cast<int>(swizzle_data.size() * sizeof(u32)), 0);
+    return binary_hash ^ (swizzle_hash * 0x9E3779B97F4A7C15ULL) ^ main_offset;
+}
+
+const CompiledShader* GetShader(u32 main_offset) {
+    const auto& binary = GetShaderBinary();
+    const auto& swizzle_data = GetSwizzlePatterns();
+    const u64 key = GetProgramKey(binary, swizzle_data, main_offset);
+
+    auto it = programs.find(key);
+    if (it != programs.end())
+        return it->second ? &it->second->shader : nullptr;
+
+    ControlFlow flow;
+    if (!AnalyzeControlFlow(binary, main_offset, flow)) {
+        // Remember unsupported programs as well, so that they aren't analyzed on every draw
+        programs.emplace(key, nullptr);
+        return nullptr;
+    }
+
+    if (code_space == nullptr) {
+        code_space = static_cast<u8*>(AllocateExecutableMemory(CODE_SPACE_SIZE, false));
+        code_top = code_space;
+    }
+
+    // Start over with an empty cache when running out of code space. This is safe since compiled
+    // shaders are only run during draws, which have all finished by the time this is called.
+    const size_t code_size = (flow.reachable.size() + 2) * MAX_INSTRUCTION_CODE_SIZE;
+    if (static_cast<size_t>(code_top - code_space) + code_size > CODE_SPACE_SIZE)
+        ClearCache();
+
+    auto program = Common::make_unique<Program>();
+    ShaderCompiler compiler(code_top, *program, binary, swizzle_data);
+    compiler.Compile(flow, main_offset);
+
+    program->shader.entry = reinterpret_cast<void (*)(JitState*)>(code_top);
+    program->shader.max_offset = *flow.reachable.rbegin() + 1;
+    program->shader.max_opdesc_id = flow.max_opdesc_id;
+    code_top = const_cast<u8*>(compiler.GetCodePtr());
+
+    LOG_DEBUG(HW_GPU, "Compiled vertex shader with %u instructions to %u bytes",
+              static_cast<unsigned>(flow.reachable.size()),
+              static_cast<unsigned>(compiler.GetCodePtr() - reinterpret_cast<const u8*>(program->shader.entry)));
+
+    const CompiledShader* shader = &program->shader;
+    programs.emplace(key, std::move(program));
+    return shader;
+}
+
+} // namespace
+
+} // namespace
+
+} // namespace
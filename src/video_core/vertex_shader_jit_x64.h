@@ -0,0 +1,57 @@
+// Copyright 2015 Citra Emulator Project
+// Licensed under GPLv2 or any later version
+// Refer to the license.txt file included.
+
+#pragma once
+
+#include "common/common_types.h"
+
+#include "math.h"
+#include "pica.h"
+#include "vertex_shader.h"
+
+namespace Pica {
+
+namespace VertexShader {
+
+namespace JitX64 {
+
+/// Registers of a single shader invocation, as accessed by compiled code
+struct JitState {
+    Math::Vec4<float24> input_registers[16];
+    Math::Vec4<float24> temporary_registers[16];
+    Math::Vec4<float24> dummy_register;     ///< Placeholder for invalid operands
+    float24* output_registers[8 * 4];       ///< Destination of each output component
+    s32 address_registers[3];
+    u8 conditional_code[2];
+
+    u32 call_stack_depth;
+    struct {
+        u32 final_address;
+        u32 return_address;
+    } call_stack[MAX_CALL_DEPTH];
+};
+
+struct CompiledShader {
+    void (*entry)(JitState* state);
+    u32 max_offset;     ///< One past the highest compiled instruction offset
+    u32 max_opdesc_id;  ///< One past the highest swizzle pattern index used
+};
+
+/**
+ * Looks up the compiled code of the currently uploaded shader program, compiling it if no program
+ * with the same binary, swizzle data and entry point has been compiled before.
+ * @param main_offset Offset of the entry point in the shader binary
+ * @return The compiled shader, or nullptr if the program uses instructions the compiler does not
+ *         support and has to be interpreted
+ */
+const CompiledShader* GetShader(u32 main_offset);
+
+/// Drops every compiled shader
+void ClearCache();
+
+} // namespace
+
+} // namespace
+
+} // namespace
@@ -8,23 +8,30 @@
 
 #include "core/core.h"
 
+#include "video_core/command_processor.h"
+#include "video_core/rasterizer.h"
 #include "video_core/video_core.h"
 #include "video_core/renderer_base.h"
-#include "video_core/renderer_opengl/renderer_opengl.h"
+#include "video_core/renderer_headless/renderer_headless.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Video Core namespace
 
 namespace VideoCore {
 
+static RendererBase* CreateHeadlessRenderer() {
+    return new RendererHeadless();
+}
+
 EmuWindow*      g_emu_window    = nullptr;     ///< Frontend emulator window
+RendererBase*   (*g_create_renderer)() = CreateHeadlessRenderer;
 RendererBase*   g_renderer      = nullptr;     ///< Renderer plugin
 int             g_current_frame = 0;
 
 /// Initialize the video core
 void Init(EmuWindow* emu_window) {
     g_emu_window = emu_window;
-    g_renderer = new RendererOpenGL();
+    g_renderer = g_create_renderer();
     g_renderer->SetWindow(g_emu_window);
     g_renderer->Init();
 
@@ -35,6 +42,8 @@ void Init(EmuWindow* emu_window) {
 
 /// Shutdown the video core
 void Shutdown() {
+    Pica::CommandProcessor::Shutdown();
+    Pica::Rasterizer::Shutdown();
     delete g_renderer;
     LOG_DEBUG(Render, "shutdown OK");
 }
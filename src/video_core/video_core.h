@@ -29,6 +29,12 @@ static const int kScreenBottomHeight    = 240;  ///< 3DS bottom screen height
 //  Video core renderer
 // ---------------------
 
+/**
+ * Creates the renderer plugin during Init, set by the frontend. The OpenGL renderer lives in the
+ * separate video_core_opengl library, so that only frontends which draw with OpenGL depend on it.
+ * Defaults to the headless renderer.
+ */
+extern RendererBase* (*g_create_renderer)();
 extern RendererBase*   g_renderer;              ///< Renderer plugin
 extern int             g_current_frame;         ///< Current frame
 extern EmuWindow*      g_emu_window;            ///< Emu window